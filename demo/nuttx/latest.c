@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2020 xiaomi.
+ *
+ * Unpublished copyright. All rights reserved. This material contains
+ * proprietary information that should be used or copied only within
+ * xiaomi, except with written permission of xiaomi.
+ *
+ * @file:    latest.c
+ * @brief:   latest value publishing: conflation and the topic cache
+ *
+ * A sensor style publisher (NXIPC_PUB_CONFLATE | NXIPC_PUB_CACHE)
+ * publishes readings.  A subscriber that comes along later is handed
+ * the current reading just after it registers the topic, and a slow
+ * subscriber (NXIPC_SUB_CONFLATE) only sees the readings it has time
+ * for, always ending with the newest.
+ *
+ * Usage: latest [url]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../src/nuttx/nxipc.h"
+
+#define LATEST_READINGS 200
+
+typedef struct {
+    const char* name;
+    int count;
+    int last;
+    int delay_us;
+} latest_sub_t;
+
+static int latest_listener(const void* cookie, const void* topic, const size_t topic_len, const nxparcel* parcel)
+{
+    latest_sub_t* sub = (latest_sub_t*)cookie;
+
+    (void)topic;
+    (void)topic_len;
+
+    sub->count++;
+    sub->last = atoi((const char*)nxparcel_data(parcel));
+
+    if (sub->delay_us > 0) {
+        usleep(sub->delay_us);
+    }
+
+    return 0;
+}
+
+static void latest_publish(void* pub, int value)
+{
+    char buf[16];
+    nxparcel* parcel;
+
+    if (nxparcel_alloc(&parcel) == 0) {
+        snprintf(buf, sizeof(buf), "%d", value);
+        nxparcel_append(parcel, buf, strlen(buf) + 1);
+        nxipc_pub_topic_msg_zc(pub, "temp", 4, parcel);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* url = argc > 1 ? argv[1] : "latest";
+    latest_sub_t late = { "late", 0, -1, 0 };
+    latest_sub_t slow = { "slow", 0, -1, 2000 };
+    void* pub;
+    void* late_sub;
+    void* slow_sub;
+    int errors = 0;
+
+    pub = nxipc_pub_create_ex(url, NXIPC_PUB_CONFLATE | NXIPC_PUB_CACHE);
+
+    if (pub == NULL) {
+        fprintf(stderr, "publisher failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Published before anyone is listening. */
+    latest_publish(pub, 21);
+
+    late_sub = nxipc_sub_connect_ex(url, latest_listener, &late, NXIPC_SUB_CACHE);
+    nxipc_sub_register_topic(late_sub, "temp", 4);
+    usleep(100000);
+    printf("late subscriber: %d reading(s) on registering, last %d\n", late.count, late.last);
+
+    if (late.count != 1 || late.last != 21) {
+        errors++;
+    }
+
+    slow_sub = nxipc_sub_connect_ex(url, latest_listener, &slow, NXIPC_SUB_CONFLATE | NXIPC_SUB_CACHE);
+    nxipc_sub_register_topic(slow_sub, "temp", 4);
+    usleep(100000);
+
+    for (int i = 1; i <= LATEST_READINGS; i++) {
+        latest_publish(pub, i);
+    }
+
+    sleep(1);
+    printf("slow subscriber: %d of %d readings, last %d\n", slow.count, LATEST_READINGS + 1, slow.last);
+    printf("late subscriber: %d of %d readings, last %d\n", late.count, LATEST_READINGS + 1, late.last);
+
+    if (slow.last != LATEST_READINGS || slow.count >= LATEST_READINGS || late.last != LATEST_READINGS) {
+        errors++;
+    }
+
+    nxipc_sub_disconnect(slow_sub);
+    nxipc_sub_disconnect(late_sub);
+    nxipc_pub_release(pub);
+
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2020 xiaomi.
+ *
+ * Unpublished copyright. All rights reserved. This material contains
+ * proprietary information that should be used or copied only within
+ * xiaomi, except with written permission of xiaomi.
+ *
+ * @file:    marshal_bench.c
+ * @brief:   cost of marshalling a record with the append/read calls and cursors
+ *
+ * The record has 48 integer fields, a name, an array of samples and a
+ * nested header parcel, a shape typical of service requests.
+ *
+ * "append" writes it with nxparcel_append_u32 and friends, each of which
+ * checks for room and may grow the parcel.  Reading it back with
+ * nxparcel_read_u32 and friends trims the parcel as it goes, so it must
+ * be duplicated first to be read more than once, which is counted.
+ *
+ * "cursor" writes it with a writer, reserving room once, and reads it
+ * in place with a reader, checking for errors once per record.
+ *
+ * Both produce the same bytes, which is checked by reading each with
+ * the other.
+ *
+ * Usage: marshal_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../../src/nuttx/nxparcel.h"
+
+#define RECORD_FIELDS 48
+#define RECORD_SAMPLES 16
+
+typedef struct {
+    uint32_t hdr_id;
+    uint16_t hdr_flags;
+    uint64_t fields[RECORD_FIELDS];
+    char name[32];
+    uint32_t samples[RECORD_SAMPLES];
+    size_t nsamples;
+} record_t;
+
+static uint64_t microseconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec * 1000000) + (uint64_t)tv.tv_usec);
+}
+
+static void record_fill(record_t* rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->hdr_id = 0x12345678;
+    rec->hdr_flags = 0xa5;
+    snprintf(rec->name, sizeof(rec->name), "imu0/accel");
+
+    for (int i = 0; i < RECORD_FIELDS; i++) {
+        rec->fields[i] = (i % 3 == 0) ? (uint16_t)(i * 7) : (i % 3 == 1) ? (uint32_t)(i * 1000003) : (uint64_t)i << 40;
+    }
+
+    for (int i = 0; i < RECORD_SAMPLES; i++) {
+        rec->samples[i] = i * 31;
+    }
+
+    rec->nsamples = RECORD_SAMPLES;
+}
+
+static int record_equal(const record_t* a, const record_t* b)
+{
+    return a->hdr_id == b->hdr_id && a->hdr_flags == b->hdr_flags && memcmp(a->fields, b->fields, sizeof(a->fields)) == 0 && strcmp(a->name, b->name) == 0 && a->nsamples == b->nsamples && memcmp(a->samples, b->samples, a->nsamples * sizeof(uint32_t)) == 0;
+}
+
+/* The fields cycle through u16, u32 and u64. */
+
+static int append_record(nxparcel* parcel, nxparcel* hdr, const record_t* rec)
+{
+    size_t len = strlen(rec->name);
+    int ret = 0;
+
+    nxparcel_clear(hdr);
+    ret |= nxparcel_append_u32(hdr, rec->hdr_id);
+    ret |= nxparcel_append_u16(hdr, rec->hdr_flags);
+    ret |= nxparcel_append_u32(parcel, nxparcel_size(hdr));
+    ret |= nxparcel_append(parcel, nxparcel_data(hdr), nxparcel_size(hdr));
+
+    for (int i = 0; i < RECORD_FIELDS; i++) {
+        switch (i % 3) {
+        case 0:
+            ret |= nxparcel_append_u16(parcel, (uint16_t)rec->fields[i]);
+            break;
+        case 1:
+            ret |= nxparcel_append_u32(parcel, (uint32_t)rec->fields[i]);
+            break;
+        default:
+            ret |= nxparcel_append_u64(parcel, rec->fields[i]);
+            break;
+        }
+    }
+
+    ret |= nxparcel_append_u32(parcel, len);
+    ret |= nxparcel_append(parcel, rec->name, len);
+    ret |= nxparcel_append_u32(parcel, rec->nsamples);
+
+    for (size_t i = 0; i < rec->nsamples; i++) {
+        ret |= nxparcel_append_u32(parcel, rec->samples[i]);
+    }
+
+    return ret;
+}
+
+static int read_record(nxparcel* parcel, record_t* rec)
+{
+    uint32_t len;
+    uint32_t u32;
+    uint16_t u16;
+    int ret = 0;
+
+    ret |= nxparcel_read_u32(parcel, &len);
+    ret |= nxparcel_read_u32(parcel, &rec->hdr_id);
+    ret |= nxparcel_read_u16(parcel, &rec->hdr_flags);
+
+    for (int i = 0; i < RECORD_FIELDS && ret == 0; i++) {
+        switch (i % 3) {
+        case 0:
+            ret |= nxparcel_read_u16(parcel, &u16);
+            rec->fields[i] = u16;
+            break;
+        case 1:
+            ret |= nxparcel_read_u32(parcel, &u32);
+            rec->fields[i] = u32;
+            break;
+        default:
+            ret |= nxparcel_read_u64(parcel, &rec->fields[i]);
+            break;
+        }
+    }
+
+    ret |= nxparcel_read_u32(parcel, &len);
+
+    if (ret != 0 || len >= sizeof(rec->name) || (size_t)nxparcel_size(parcel) < len) {
+        return -1;
+    }
+
+    memcpy(rec->name, nxparcel_data(parcel), len);
+    rec->name[len] = '\0';
+    ret |= nxparcel_skip(parcel, len);
+    ret |= nxparcel_read_u32(parcel, &len);
+
+    if (ret != 0 || len > RECORD_SAMPLES) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        ret |= nxparcel_read_u32(parcel, &rec->samples[i]);
+    }
+
+    rec->nsamples = len;
+    return ret;
+}
+
+static int write_record(nxparcel* parcel, nxparcel* hdr, const record_t* rec)
+{
+    nxparcel_writer w;
+
+    nxparcel_clear(hdr);
+    nxparcel_writer_begin(&w, hdr);
+    nxparcel_write_u32(&w, rec->hdr_id);
+    nxparcel_write_u16(&w, rec->hdr_flags);
+
+    if (nxparcel_writer_commit(&w) != 0) {
+        return -1;
+    }
+
+    nxparcel_writer_begin(&w, parcel);
+    nxparcel_reserve(&w, 512);
+    nxparcel_write_parcel(&w, hdr);
+
+    for (int i = 0; i < RECORD_FIELDS; i++) {
+        switch (i % 3) {
+        case 0:
+            nxparcel_write_u16(&w, (uint16_t)rec->fields[i]);
+            break;
+        case 1:
+            nxparcel_write_u32(&w, (uint32_t)rec->fields[i]);
+            break;
+        default:
+            nxparcel_write_u64(&w, rec->fields[i]);
+            break;
+        }
+    }
+
+    nxparcel_write_string(&w, rec->name);
+    nxparcel_write_u32_array(&w, rec->samples, rec->nsamples);
+    return nxparcel_writer_commit(&w);
+}
+
+static int scan_record(const nxparcel* parcel, record_t* rec)
+{
+    nxparcel_reader r;
+    nxparcel_reader hdr;
+    const char* name;
+    size_t len;
+    uint32_t u32;
+    uint16_t u16;
+
+    nxparcel_reader_begin(&r, parcel);
+
+    if (nxparcel_read_parcel(&r, &hdr) != 0) {
+        return -1;
+    }
+
+    nxparcel_read_u32_at(&hdr, &rec->hdr_id);
+    nxparcel_read_u16_at(&hdr, &rec->hdr_flags);
+
+    for (int i = 0; i < RECORD_FIELDS; i++) {
+        switch (i % 3) {
+        case 0:
+            nxparcel_read_u16_at(&r, &u16);
+            rec->fields[i] = u16;
+            break;
+        case 1:
+            nxparcel_read_u32_at(&r, &u32);
+            rec->fields[i] = u32;
+            break;
+        default:
+            nxparcel_read_u64_at(&r, &rec->fields[i]);
+            break;
+        }
+    }
+
+    if (nxparcel_read_string(&r, &name, &len) != 0 || len >= sizeof(rec->name)) {
+        return -1;
+    }
+
+    memcpy(rec->name, name, len);
+    rec->name[len] = '\0';
+
+    if (nxparcel_read_u32_array(&r, rec->samples, RECORD_SAMPLES, &rec->nsamples) != 0) {
+        return -1;
+    }
+
+    return nxparcel_reader_error(&hdr) | nxparcel_reader_error(&r);
+}
+
+int main(int argc, char** argv)
+{
+    int iters = argc > 1 ? atoi(argv[1]) : 200000;
+    record_t rec;
+    record_t out;
+    nxparcel* parcel;
+    nxparcel* hdr;
+    nxparcel* copy;
+    uint64_t beg;
+    uint64_t t_append;
+    uint64_t t_read;
+    uint64_t t_write;
+    uint64_t t_scan;
+    size_t size;
+    int errors = 0;
+
+    record_fill(&rec);
+
+    if (nxparcel_alloc(&parcel) != 0 || nxparcel_alloc(&hdr) != 0) {
+        fprintf(stderr, "alloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Each API reads what the other wrote. */
+    memset(&out, 0, sizeof(out));
+    errors += write_record(parcel, hdr, &rec) != 0;
+    size = nxparcel_size(parcel);
+    errors += read_record(parcel, &out) != 0 || !record_equal(&rec, &out);
+
+    memset(&out, 0, sizeof(out));
+    nxparcel_clear(parcel);
+    errors += append_record(parcel, hdr, &rec) != 0;
+    errors += (size_t)nxparcel_size(parcel) != size;
+    errors += scan_record(parcel, &out) != 0 || !record_equal(&rec, &out);
+
+    beg = microseconds();
+
+    for (int i = 0; i < iters; i++) {
+        nxparcel_clear(parcel);
+        errors += append_record(parcel, hdr, &rec) != 0;
+    }
+
+    t_append = microseconds() - beg;
+    beg = microseconds();
+
+    for (int i = 0; i < iters; i++) {
+        if (nng_msg_dup(&copy, parcel) != 0) {
+            errors++;
+            continue;
+        }
+
+        errors += read_record(copy, &out) != 0;
+        nxparcel_free(copy);
+    }
+
+    t_read = microseconds() - beg;
+    beg = microseconds();
+
+    for (int i = 0; i < iters; i++) {
+        nxparcel_clear(parcel);
+        errors += write_record(parcel, hdr, &rec) != 0;
+    }
+
+    t_write = microseconds() - beg;
+    beg = microseconds();
+
+    for (int i = 0; i < iters; i++) {
+        errors += scan_record(parcel, &out) != 0;
+    }
+
+    t_scan = microseconds() - beg;
+    errors += !record_equal(&rec, &out);
+
+    printf("%lu byte record, %d iterations\n", (unsigned long)size, iters);
+    printf("append: encode %.1f ns, decode %.1f ns\n", t_append * 1000.0 / iters, t_read * 1000.0 / iters);
+    printf("cursor: encode %.1f ns, decode %.1f ns\n", t_write * 1000.0 / iters, t_scan * 1000.0 / iters);
+    printf("errors %d\n", errors);
+
+    nxparcel_free(hdr);
+    nxparcel_free(parcel);
+
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
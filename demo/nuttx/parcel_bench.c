@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2020 xiaomi.
+ *
+ * Unpublished copyright. All rights reserved. This material contains
+ * proprietary information that should be used or copied only within
+ * xiaomi, except with written permission of xiaomi.
+ *
+ * @file:    parcel_bench.c
+ * @brief:   cost of an echo transaction with copying and zero-copy parcels
+ *
+ * "copy" uses nxipc_client_transaction, and the server callback builds
+ * a new reply parcel from the request, which is how replies had to be
+ * made before; each leg of the round trip copies the payload.
+ *
+ * "zc" uses nxipc_client_transaction_zc, passing each reply back in as
+ * the next request, and the server callback replies with the request
+ * parcel itself.  nxipc makes no copies of the payload; REQ still
+ * holds a reference to each request for resending, so the inproc
+ * transport has to copy the request once on delivery.
+ *
+ * Usage: parcel_bench [iterations-scale]
+ */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "../../src/nuttx/nxipc.h"
+
+#define BENCH_OP_ECHO_COPY 1
+#define BENCH_OP_ECHO 2
+
+static uint64_t microseconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec * 1000000) + (uint64_t)tv.tv_usec);
+}
+
+static int bench_on_transaction(const void* cookie, const int code, const nxparcel* in, nxparcel** out)
+{
+    (void)cookie;
+
+    switch (code) {
+    case BENCH_OP_ECHO_COPY:
+        if (nxparcel_alloc(out) == 0) {
+            nxparcel_append(*out, nxparcel_data(in), nxparcel_size(in));
+        }
+
+        break;
+
+    case BENCH_OP_ECHO:
+        *out = (nxparcel*)in;
+        break;
+
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static void bench_copy(void* client, size_t size, int count)
+{
+    nxparcel* in;
+    nxparcel* out;
+    char* buf = calloc(1, size);
+    int errors = 0;
+    uint64_t beg;
+    uint64_t end;
+
+    nxparcel_alloc(&in);
+    nxparcel_alloc(&out);
+    nxparcel_append(in, buf, size);
+
+    beg = microseconds();
+
+    for (int i = 0; i < count; i++) {
+        nxparcel_clear(out);
+
+        if (nxipc_client_transaction(client, BENCH_OP_ECHO_COPY, in, out) != 0 ||
+            nxparcel_size(out) != (int)size) {
+            errors++;
+        }
+    }
+
+    end = microseconds();
+
+    fprintf(stdout, "%8lu %6s %12.2f %12.1f %8d\n", (unsigned long)size, "copy",
+            (double)(end - beg) / count,
+            (double)size * count / (double)(end - beg), errors);
+    nxparcel_free(in);
+    nxparcel_free(out);
+    free(buf);
+}
+
+static void bench_zc(void* client, size_t size, int count)
+{
+    nxparcel* parcel;
+    char* buf = calloc(1, size);
+    int errors = 0;
+    uint64_t beg;
+    uint64_t end;
+
+    nxparcel_alloc(&parcel);
+    nxparcel_append(parcel, buf, size);
+
+    beg = microseconds();
+
+    for (int i = 0; i < count; i++) {
+        if (nxipc_client_transaction_zc(client, BENCH_OP_ECHO, parcel, &parcel) != 0 ||
+            parcel == NULL || nxparcel_size(parcel) != (int)size) {
+            errors++;
+
+            if (parcel == NULL) {
+                nxparcel_alloc(&parcel);
+                nxparcel_append(parcel, buf, size);
+            }
+        }
+    }
+
+    end = microseconds();
+
+    fprintf(stdout, "%8lu %6s %12.2f %12.1f %8d\n", (unsigned long)size, "zc",
+            (double)(end - beg) / count,
+            (double)size * count / (double)(end - beg), errors);
+    nxparcel_free(parcel);
+    free(buf);
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = "parcel_bench";
+    const size_t sizes[] = { 64, 4096, 1024 * 1024 };
+    const int counts[] = { 20000, 20000, 500 };
+    int scale = 1;
+    void* server;
+    void* client;
+
+    if (argc > 1) {
+        scale = atoi(argv[1]);
+    }
+
+    if ((server = nxipc_server_create(name)) == NULL) {
+        fprintf(stderr, "server start failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    nxipc_server_set_transaction_cb(server, bench_on_transaction, NULL);
+
+    if ((client = nxipc_client_connect(name)) == NULL) {
+        fprintf(stderr, "client connect failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stdout, "%8s %6s %12s %12s %8s\n", "size", "mode", "us/trans", "MB/s", "errors");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_copy(client, sizes[i], counts[i] * scale);
+        bench_zc(client, sizes[i], counts[i] * scale);
+    }
+
+    nxipc_client_disconnect(client);
+    nxipc_server_release(server);
+    return 0;
+}
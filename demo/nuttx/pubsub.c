@@ -74,7 +74,7 @@ static void* pub_worker(void* arg)
 
 static int local_sub_listener(const void* thiz, const void* topic, const size_t topic_len, const nxparcel* parcel) {
     ps_sub_test_t* test = (ps_sub_test_t*)thiz;
-    fprintf(stderr, "%s.%s.listener.topic=%s, content=%s\n", __func__, test->name, (char*)topic, (char*)nxparcel_data(parcel));
+    fprintf(stderr, "%s.%s.listener.topic=%.*s, content=%s\n", __func__, test->name, (int)topic_len, (char*)topic, (char*)nxparcel_data(parcel));
 }
 
 int client(const char* url, const char* name)
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2020 xiaomi.
+ *
+ * Unpublished copyright. All rights reserved. This material contains
+ * proprietary information that should be used or copied only within
+ * xiaomi, except with written permission of xiaomi.
+ *
+ * @file:    reqrep_bench.c
+ * @brief:   transaction rate of one nxipc server against 1..64 clients
+ *
+ * Each client is a thread with its own connection, doing transactions
+ * back to back.  The server callback sleeps for a while to stand in for
+ * real work (I/O, a slow codec, ...), so with a pool of one worker the
+ * clients queue behind each other, and with a larger pool they should
+ * not, up to the number of threads nng has to run callbacks on.
+ *
+ * A second table keeps 1..64 asynchronous transactions in flight on a
+ * single connection instead, each completion starting the next.
+ *
+ * Usage: reqrep_bench <workers> [work-us] [ms-per-step] [-a]
+ *
+ * With -a, the op code used is bound to worker 0, which should bring
+ * the rate back down to that of a single worker.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "../../src/nuttx/nxipc.h"
+
+#define BENCH_CLIENTS_MAX 64
+#define BENCH_OP_WORK 1
+
+typedef struct {
+    pthread_t tid;
+    void* client;
+    volatile bool* stop;
+    uint64_t count;
+    uint64_t errors;
+} bench_client_t;
+
+typedef struct {
+    void* client;
+    nxparcel* in;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    bool stop;
+    int busy;
+    uint64_t count;
+    uint64_t errors;
+} bench_pipeline_t;
+
+static int g_work_us = 100;
+
+static uint64_t microseconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec * 1000000) + (uint64_t)tv.tv_usec);
+}
+
+static int bench_on_transaction(const void* cookie, const int code, const nxparcel* in, nxparcel** out)
+{
+    (void)cookie;
+    (void)code;
+
+    if (g_work_us > 0) {
+        usleep(g_work_us);
+    }
+
+    if (nxparcel_alloc(out) == 0) {
+        nxparcel_append(*out, nxparcel_data(in), nxparcel_size(in));
+    }
+
+    return 0;
+}
+
+static void* bench_client_worker(void* arg)
+{
+    bench_client_t* c = (bench_client_t*)arg;
+    nxparcel* in;
+    nxparcel* out;
+
+    nxparcel_alloc(&in);
+    nxparcel_alloc(&out);
+    nxparcel_append_u64(in, (uint64_t)(uintptr_t)c);
+
+    while (!*c->stop) {
+        nxparcel_clear(out);
+
+        if (nxipc_client_transaction(c->client, BENCH_OP_WORK, in, out) != 0 ||
+            nxparcel_size(out) != nxparcel_size(in)) {
+            c->errors++;
+        } else {
+            c->count++;
+        }
+    }
+
+    nxparcel_free(in);
+    nxparcel_free(out);
+    return NULL;
+}
+
+static void bench_step(const char* name, int nclients, int ms)
+{
+    bench_client_t clients[BENCH_CLIENTS_MAX];
+    volatile bool stop = false;
+    uint64_t total = 0;
+    uint64_t errors = 0;
+    uint64_t beg;
+    uint64_t end;
+
+    memset(clients, 0, sizeof(clients));
+
+    for (int i = 0; i < nclients; i++) {
+        clients[i].stop = &stop;
+
+        if ((clients[i].client = nxipc_client_connect(name)) == NULL) {
+            fprintf(stderr, "client connect failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    beg = microseconds();
+
+    for (int i = 0; i < nclients; i++) {
+        pthread_create(&clients[i].tid, NULL, bench_client_worker, &clients[i]);
+    }
+
+    usleep(ms * 1000);
+    stop = true;
+
+    for (int i = 0; i < nclients; i++) {
+        pthread_join(clients[i].tid, NULL);
+        total += clients[i].count;
+        errors += clients[i].errors;
+        nxipc_client_disconnect(clients[i].client);
+    }
+
+    end = microseconds();
+
+    fprintf(stdout, "%8d %14.0f %10llu\n", nclients,
+            (double)total * 1000000.0 / (double)(end - beg),
+            (unsigned long long)errors);
+}
+
+static void bench_pipeline_done(void* cookie, int ret, const nxparcel* out)
+{
+    bench_pipeline_t* p = (bench_pipeline_t*)cookie;
+    bool again;
+
+    pthread_mutex_lock(&p->mtx);
+
+    if (ret != 0 || out == NULL || nxparcel_size(out) != nxparcel_size(p->in)) {
+        p->errors++;
+    } else {
+        p->count++;
+    }
+
+    if (!(again = !p->stop)) {
+        p->busy--;
+        pthread_cond_broadcast(&p->cv);
+    }
+
+    pthread_mutex_unlock(&p->mtx);
+
+    if (again && nxipc_client_transaction_async(p->client, BENCH_OP_WORK, p->in, \
+                                                0, bench_pipeline_done, p, NULL) != 0) {
+        pthread_mutex_lock(&p->mtx);
+        p->errors++;
+        p->busy--;
+        pthread_cond_broadcast(&p->cv);
+        pthread_mutex_unlock(&p->mtx);
+    }
+}
+
+static void bench_pipeline_step(const char* name, int depth, int ms)
+{
+    bench_pipeline_t p;
+    uint64_t beg;
+    uint64_t end;
+
+    memset(&p, 0, sizeof(p));
+    pthread_mutex_init(&p.mtx, NULL);
+    pthread_cond_init(&p.cv, NULL);
+    nxparcel_alloc(&p.in);
+    nxparcel_append_u64(p.in, (uint64_t)depth);
+
+    if ((p.client = nxipc_client_connect(name)) == NULL) {
+        fprintf(stderr, "client connect failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    beg = microseconds();
+    pthread_mutex_lock(&p.mtx);
+
+    for (int i = 0; i < depth; i++) {
+        if (nxipc_client_transaction_async(p.client, BENCH_OP_WORK, p.in, 0, \
+                                           bench_pipeline_done, &p, NULL) == 0) {
+            p.busy++;
+        }
+    }
+
+    pthread_mutex_unlock(&p.mtx);
+    usleep(ms * 1000);
+    pthread_mutex_lock(&p.mtx);
+    p.stop = true;
+
+    while (p.busy > 0) {
+        pthread_cond_wait(&p.cv, &p.mtx);
+    }
+
+    pthread_mutex_unlock(&p.mtx);
+    end = microseconds();
+
+    nxipc_client_disconnect(p.client);
+    nxparcel_free(p.in);
+    pthread_cond_destroy(&p.cv);
+    pthread_mutex_destroy(&p.mtx);
+
+    fprintf(stdout, "%8d %14.0f %10llu\n", depth,
+            (double)p.count * 1000000.0 / (double)(end - beg),
+            (unsigned long long)p.errors);
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = "reqrep_bench";
+    void* server;
+    int workers;
+    int ms = 1000;
+    bool affinity = false;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <workers> [work-us] [ms-per-step] [-a]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    workers = atoi(argv[1]);
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0) {
+            affinity = true;
+        } else if (i == 2) {
+            g_work_us = atoi(argv[i]);
+        } else {
+            ms = atoi(argv[i]);
+        }
+    }
+
+    if ((server = nxipc_server_create_ex(name, workers)) == NULL) {
+        fprintf(stderr, "server start failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    nxipc_server_set_transaction_cb(server, bench_on_transaction, NULL);
+
+    if (affinity && nxipc_server_set_affinity(server, BENCH_OP_WORK, 0) != 0) {
+        fprintf(stderr, "set affinity failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stdout, "workers=%d work=%dus%s\n", workers, g_work_us,
+            affinity ? " (op bound to worker 0)" : "");
+    fprintf(stdout, "%8s %14s %10s\n", "clients", "trans/s", "errors");
+
+    for (int n = 1; n <= BENCH_CLIENTS_MAX; n *= 2) {
+        bench_step(name, n, ms);
+    }
+
+    fprintf(stdout, "one connection, pipelined\n");
+    fprintf(stdout, "%8s %14s %10s\n", "depth", "trans/s", "errors");
+
+    for (int n = 1; n <= BENCH_CLIENTS_MAX; n *= 2) {
+        bench_pipeline_step(name, n, ms);
+    }
+
+    nxipc_server_release(server);
+    return 0;
+}
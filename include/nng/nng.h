@@ -778,6 +778,14 @@ enum nng_flag_enum {
 #define NNG_OPT_RECVFD "recv-fd"
 #define NNG_OPT_SENDFD "send-fd"
 #define NNG_OPT_RECVTIMEO "recv-timeout"
+
+// NNG_OPT_RECVBUSYPOLL is how long, in microseconds, a synchronous receive
+// (nng_recvmsg or nng_recv) spins waiting for a message before it goes to
+// sleep.  This saves the time it takes to be woken up, at the cost of a
+// CPU, so it is only worth it for latency critical sockets on machines
+// with CPUs to spare; it has no effect with only one CPU.  Zero, the
+// default, disables it.  This is an int.
+#define NNG_OPT_RECVBUSYPOLL "recv-busy-poll"
 #define NNG_OPT_SENDTIMEO "send-timeout"
 #define NNG_OPT_LOCADDR "local-address"
 #define NNG_OPT_REMADDR "remote-address"
@@ -787,6 +795,21 @@ enum nng_flag_enum {
 #define NNG_OPT_RECONNMINT "reconnect-time-min"
 #define NNG_OPT_RECONNMAXT "reconnect-time-max"
 
+// NNG_OPT_SENDBATCH is the most data, in bytes, that a stream transport
+// (TCP or IPC) will gather up from small messages and send in a single
+// write.  Small messages are accepted at once, and those that arrive
+// while a write is in progress are sent together when it finishes.  A
+// send so accepted completes before its data is written, and is lost if
+// the connection fails first.  The default, zero, disables it.  This is
+// a size.
+#define NNG_OPT_SENDBATCH "send-batch-max"
+
+// NNG_OPT_SENDBATCHTIME is the longest that a stream transport will hold
+// a small message on an idle connection, waiting for more to send with it.
+// The default, zero, never waits, so batches only form behind a write
+// that is in progress.  This is a duration.
+#define NNG_OPT_SENDBATCHTIME "send-batch-time"
+
 // TLS options are only used when the underlying transport supports TLS.
 
 // NNG_OPT_TLS_CONFIG is a pointer to an nng_tls_config object.  Generally
@@ -855,6 +878,14 @@ enum nng_flag_enum {
 // state current). This is a boolean.
 #define NNG_OPT_TCP_KEEPALIVE "tcp-keepalive"
 
+// TCP busy poll has the kernel poll the network device for up to this
+// many microseconds when a read on the connection finds no data, rather
+// than waiting for an interrupt (SO_BUSY_POLL).  This trades CPU for
+// latency, much as NNG_OPT_RECVBUSYPOLL does.  It is only supported on
+// Linux, and may need privileges to raise above the system default.
+// This is an int.
+#define NNG_OPT_TCP_BUSYPOLL "tcp-busy-poll"
+
 // Local TCP port number.  This is used on a listener, and is intended
 // to be used after starting the listener in combination with a wildcard
 // (0) local port.  This determines the actual ephemeral port that was
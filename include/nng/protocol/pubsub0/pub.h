@@ -26,6 +26,11 @@ NNG_DECL int nng_pub0_open_raw(nng_socket *);
 #define nng_pub_open_raw nng_pub0_open_raw
 #endif
 
+// With conflation, a message whose header is the 32-bit length of its
+// topic replaces any message for that topic still queued for a
+// subscriber.  See nng_pub(7).
+#define NNG_OPT_PUB_CONFLATE "pub:conflate"
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,10 @@ NNG_DECL int nng_sub0_open_raw(nng_socket *);
 
 #define NNG_OPT_SUB_PREFNEW "sub:prefnew"
 
+// With conflation, a message replaces any queued one that matched the
+// same subscription.  See nng_sub(7).
+#define NNG_OPT_SUB_CONFLATE "sub:conflate"
+
 #ifdef __cplusplus
 }
 #endif
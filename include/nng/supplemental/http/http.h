@@ -468,6 +468,12 @@ NNG_DECL int nng_http_server_set_error_page(
 NNG_DECL int nng_http_server_set_error_file(
     nng_http_server *, uint16_t, const char *);
 
+// nng_http_server_set_cache sets the number of bytes of file content that
+// the server may keep in memory, for its file and directory handlers.
+// Files that have not changed are then served from memory.  The default
+// is zero, which disables the cache.
+NNG_DECL int nng_http_server_set_cache(nng_http_server *, size_t);
+
 // nng_http_server_res_error takes replaces the body of the response with
 // a custom error page previously set for the server, using the status
 // of the response.  The response must have the status set first using
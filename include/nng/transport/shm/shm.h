@@ -0,0 +1,30 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef NNG_TRANSPORT_SHM_SHM_H
+#define NNG_TRANSPORT_SHM_SHM_H
+
+#include <nng/nng.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// shm transport.  This is used for inter-process communication on
+// the same host computer, with the data carried in shared memory
+// rather than through the kernel.  Addresses are the same as for ipc,
+// e.g. shm:///tmp/mysocket, and name the socket used to connect.
+
+NNG_DECL int nng_shm_register(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NNG_TRANSPORT_SHM_SHM_H
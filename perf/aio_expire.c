@@ -0,0 +1,119 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// aio_expire - this measures the cost of arming and canceling aio
+// expirations when many timed operations are outstanding at once.  Each
+// aio is put to sleep with a distinct (pseudo-random) deadline well in the
+// future, so that nothing actually fires, and then all of them are
+// canceled.  With a sorted expiration list the cost per operation grows
+// with the number outstanding; with the timing wheel it should not.
+
+static void die(const char *, ...);
+static void do_aio_expire(int argc, char **argv);
+
+int
+main(int argc, char **argv)
+{
+	argc--;
+	argv++;
+
+	do_aio_expire(argc, argv);
+}
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+static void
+do_aio_expire(int argc, char **argv)
+{
+	nng_aio **aios;
+	int       count;
+	int       rv;
+	nng_time  beg;
+	nng_time  mid;
+	nng_time  end;
+	double    arm;
+	double    cancel;
+
+	if (argc != 1) {
+		die("Usage: aio_expire <count>");
+	}
+	count = parse_int(argv[0], "count");
+	if (count < 1) {
+		die("Need at least one aio");
+	}
+
+	if ((aios = calloc(sizeof(nng_aio *), (size_t) count)) == NULL) {
+		die("Out of memory");
+	}
+	for (int i = 0; i < count; i++) {
+		if ((rv = nng_aio_alloc(&aios[i], NULL, NULL)) != 0) {
+			die("nng_aio_alloc: %s", nng_strerror(rv));
+		}
+	}
+
+	srand(1);
+	beg = nng_clock();
+	for (int i = 0; i < count; i++) {
+		// Between one and two minutes out, in random order.
+		nng_sleep_aio(60000 + (rand() % 60000), aios[i]);
+	}
+	mid = nng_clock();
+	for (int i = 0; i < count; i++) {
+		nng_aio_cancel(aios[i]);
+	}
+	for (int i = 0; i < count; i++) {
+		nng_aio_wait(aios[i]);
+	}
+	end = nng_clock();
+
+	for (int i = 0; i < count; i++) {
+		nng_aio_free(aios[i]);
+	}
+	free(aios);
+
+	arm    = (double) (mid - beg) * 1000000.0 / count;
+	cancel = (double) (end - mid) * 1000000.0 / count;
+	printf("outstanding aios: %d\n", count);
+	printf("arm time: %.3f [ms] (%.1f [ns/op])\n", (double) (mid - beg),
+	    arm);
+	printf("cancel time: %.3f [ms] (%.1f [ns/op])\n",
+	    (double) (end - mid), cancel);
+}
@@ -0,0 +1,267 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/http/http.h>
+#include <nng/supplemental/util/platform.h>
+
+// http_file_thr - this measures how fast the HTTP server's file handler
+// sends a large file over loopback TCP, and how much anonymous (heap)
+// memory the process uses while doing so.  It serves a scratch file of
+// the given size, and fetches it the given number of times, each on a
+// new connection, with a client that throws the body away as it reads.
+// If a cache size is given, the server's file cache is enabled with it.
+//
+// Memory is only reported on Linux, where it is sampled from
+// /proc/self/status while the body is being received.
+
+#define FILE_NAME "http_file_thr.tmp"
+#define RECV_SIZE 65536
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+// anon_kb returns the anonymous memory in use, in kilobytes, or zero if
+// that cannot be determined.
+static long
+anon_kb(void)
+{
+	long kb = 0;
+#ifdef __linux__
+	FILE *f;
+	char  line[128];
+
+	if ((f = fopen("/proc/self/status", "r")) == NULL) {
+		return (0);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "RssAnon: %ld", &kb) == 1) {
+			break;
+		}
+	}
+	fclose(f);
+#endif
+	return (kb);
+}
+
+static void
+make_file(size_t size)
+{
+	FILE * f;
+	char   buf[4096];
+	size_t n;
+
+	for (n = 0; n < sizeof(buf); n++) {
+		buf[n] = (char) n;
+	}
+	if ((f = fopen(FILE_NAME, "wb")) == NULL) {
+		die("Cannot create %s", FILE_NAME);
+	}
+	while (size > 0) {
+		n = size < sizeof(buf) ? size : sizeof(buf);
+		if (fwrite(buf, 1, n, f) != n) {
+			die("Cannot write %s", FILE_NAME);
+		}
+		size -= n;
+	}
+	fclose(f);
+}
+
+static void
+xfer(nng_aio *aio, nng_stream *s, void *buf, size_t len, bool send)
+{
+	nng_iov iov;
+	int     rv;
+
+	iov.iov_buf = buf;
+	iov.iov_len = len;
+	nng_aio_set_iov(aio, 1, &iov);
+	if (send) {
+		nng_stream_send(s, aio);
+	} else {
+		nng_stream_recv(s, aio);
+	}
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		die("Transfer failed: %s", nng_strerror(rv));
+	}
+}
+
+// fetch gets the file once, returning the size of the body, and
+// updating the peak memory seen.
+static size_t
+fetch(nng_stream_dialer *d, nng_aio *aio, char *buf, long *peak)
+{
+	nng_stream *s;
+	char        req[] = "GET /file HTTP/1.1\r\nHost: localhost\r\n"
+	             "Connection: close\r\n\r\n";
+	size_t      have = 0;
+	size_t      clen = 0;
+	size_t      got;
+	size_t      sampled = 0;
+	char *      end;
+	char *      cl;
+	int         rv;
+
+	nng_stream_dialer_dial(d, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		die("Dial failed: %s", nng_strerror(rv));
+	}
+	s = nng_aio_get_output(aio, 0);
+
+	xfer(aio, s, req, strlen(req), true);
+
+	// Read until we have all the headers.
+	for (;;) {
+		xfer(aio, s, buf + have, RECV_SIZE - 1 - have, false);
+		have += nng_aio_count(aio);
+		buf[have] = '\0';
+		if ((end = strstr(buf, "\r\n\r\n")) != NULL) {
+			break;
+		}
+		if (have == RECV_SIZE - 1) {
+			die("Headers too large");
+		}
+	}
+	if (strncmp(buf, "HTTP/1.1 200", 12) != 0) {
+		die("Bad response: %.40s", buf);
+	}
+	if ((cl = strstr(buf, "Content-Length: ")) == NULL) {
+		die("Missing Content-Length");
+	}
+	clen = (size_t) strtoull(cl + 16, NULL, 10);
+	got  = have - (size_t) (end + 4 - buf);
+
+	while (got < clen) {
+		xfer(aio, s, buf, RECV_SIZE, false);
+		got += nng_aio_count(aio);
+		if (got - sampled >= 1024 * 1024) {
+			long kb = anon_kb();
+			if (kb > *peak) {
+				*peak = kb;
+			}
+			sampled = got;
+		}
+	}
+	nng_stream_free(s);
+	return (clen);
+}
+
+int
+main(int argc, char **argv)
+{
+	nng_http_server *  srv;
+	nng_http_handler * h;
+	nng_stream_dialer *d;
+	nng_url *          url;
+	nng_aio *          aio;
+	char *             buf;
+	char               addr[64];
+	size_t             size;
+	int                count;
+	int                cache = 0;
+	long               base;
+	long               peak = 0;
+	nng_time           beg;
+	double             dur;
+	int                rv;
+
+	if ((argc != 4) && (argc != 5)) {
+		die("Usage: http_file_thr <port> <file-MB> <count> "
+		    "[cache-MB]");
+	}
+	(void) snprintf(addr, sizeof(addr), "http://127.0.0.1:%d",
+	    parse_int(argv[1], "port"));
+	size  = (size_t) parse_int(argv[2], "file size") * 1024 * 1024;
+	count = parse_int(argv[3], "count");
+	if (argc == 5) {
+		cache = parse_int(argv[4], "cache size");
+	}
+	if ((size == 0) || (count < 1)) {
+		die("Need a non-empty file, fetched at least once");
+	}
+	make_file(size);
+
+	if (((rv = nng_url_parse(&url, addr)) != 0) ||
+	    ((rv = nng_http_server_hold(&srv, url)) != 0) ||
+	    ((rv = nng_http_handler_alloc_file(&h, "/file", FILE_NAME)) !=
+	        0) ||
+	    ((rv = nng_http_server_add_handler(srv, h)) != 0) ||
+	    ((rv = nng_http_server_set_cache(
+	          srv, (size_t) cache * 1024 * 1024)) != 0) ||
+	    ((rv = nng_http_server_start(srv)) != 0)) {
+		die("Server: %s", nng_strerror(rv));
+	}
+	(void) snprintf(addr, sizeof(addr), "tcp://127.0.0.1:%s", url->u_port);
+	if (((rv = nng_stream_dialer_alloc(&d, addr)) != 0) ||
+	    ((rv = nng_aio_alloc(&aio, NULL, NULL)) != 0)) {
+		die("Client: %s", nng_strerror(rv));
+	}
+	if ((buf = malloc(RECV_SIZE)) == NULL) {
+		die("Out of memory");
+	}
+
+	base = anon_kb();
+	beg  = nng_clock();
+	for (int i = 0; i < count; i++) {
+		if (fetch(d, aio, buf, &peak) != size) {
+			die("Short file");
+		}
+	}
+	dur = (nng_clock() - beg) / 1000.0;
+	if (dur <= 0) {
+		dur = 0.001;
+	}
+
+	printf("%-24s %10.1f MB/s\n", "throughput",
+	    ((double) size * count) / (1024.0 * 1024.0) / dur);
+	printf("%-24s %10.1f ms\n", "time per fetch", dur * 1000.0 / count);
+#ifdef __linux__
+	printf("%-24s %10ld kB\n", "peak extra heap", peak - base);
+#endif
+
+	free(buf);
+	nng_aio_free(aio);
+	nng_stream_dialer_free(d);
+	nng_http_server_release(srv);
+	nng_url_free(url);
+	remove(FILE_NAME);
+	return (0);
+}
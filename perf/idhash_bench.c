@@ -0,0 +1,298 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/nng_impl.h"
+
+// idhash_bench - this measures the ID hash used for request and survey
+// IDs, and for looking up dialers, listeners and protocol pipes.  (It
+// uses private symbols, so it is linked with the test library.)
+//
+//   reqrep    - allocate an ID, find it, and remove it, with a window
+//               of IDs outstanding, as REQ does for each request
+//   find      - find keys that are present, or absent
+//   mixed     - half finds, a quarter each inserts and removes
+//   grow      - insert keys until the table is large, reporting the
+//               slowest single insert, which includes any resizing
+//   shared    - reqrep on one table from several threads at once
+//
+// Times are per operation, where an operation is one call.
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+// A simple generator, so runs are repeatable.
+static uint64_t
+bench_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return (*state);
+}
+
+static nni_idhash *
+bench_hash(void)
+{
+	nni_idhash *h;
+	int         rv;
+
+	if ((rv = nni_idhash_init(&h)) != 0) {
+		die("nni_idhash_init: %s", nng_strerror(rv));
+	}
+	nni_idhash_set_limits(h, 0x80000000u, 0xffffffffu, 0x80000000u);
+	return (h);
+}
+
+static void
+report(const char *what, uint64_t beg, uint64_t ops)
+{
+	uint64_t end = nni_plat_clock_us();
+
+	printf("%-24s %10.1f ns/op\n", what,
+	    ((double) (end - beg) * 1000.0) / (double) ops);
+}
+
+static void
+reqrep(nni_idhash *h, int count, int window)
+{
+	uint32_t *ids;
+	void *    val;
+	int       rv;
+
+	if ((ids = calloc(sizeof(*ids), (size_t) window)) == NULL) {
+		die("Out of memory");
+	}
+	for (int i = 0; i < window; i++) {
+		if ((rv = nni_idhash_alloc32(h, &ids[i], h)) != 0) {
+			die("nni_idhash_alloc32: %s", nng_strerror(rv));
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		int n = i % window;
+		if ((nni_idhash_find(h, ids[n], &val) != 0) ||
+		    (nni_idhash_remove(h, ids[n]) != 0) ||
+		    (nni_idhash_alloc32(h, &ids[n], h) != 0)) {
+			die("reqrep failed");
+		}
+	}
+	for (int i = 0; i < window; i++) {
+		nni_idhash_remove(h, ids[i]);
+	}
+	free(ids);
+}
+
+static void
+bench_reqrep(int count, int window)
+{
+	nni_idhash *h = bench_hash();
+	char        what[32];
+	uint64_t    beg;
+
+	(void) snprintf(what, sizeof(what), "reqrep window %d", window);
+	beg = nni_plat_clock_us();
+	reqrep(h, count, window);
+	report(what, beg, (uint64_t) count * 3);
+	nni_idhash_fini(h);
+}
+
+static void
+bench_find(int count, int nkeys)
+{
+	nni_idhash *h     = bench_hash();
+	uint64_t    state = 1;
+	uint64_t    beg;
+	void *      val;
+	int         found = 0;
+
+	for (int i = 0; i < nkeys; i++) {
+		nni_idhash_insert(h, (uint64_t) i * 2, h);
+	}
+
+	beg = nni_plat_clock_us();
+	for (int i = 0; i < count; i++) {
+		uint64_t k = (bench_rand(&state) % (uint64_t) nkeys) * 2;
+		found += (nni_idhash_find(h, k, &val) == 0);
+	}
+	report("find hit", beg, (uint64_t) count);
+
+	beg = nni_plat_clock_us();
+	for (int i = 0; i < count; i++) {
+		uint64_t k = (bench_rand(&state) % (uint64_t) nkeys) * 2 + 1;
+		found += (nni_idhash_find(h, k, &val) == 0);
+	}
+	report("find miss", beg, (uint64_t) count);
+
+	if (found != count) {
+		die("find found %d of %d", found, count);
+	}
+	nni_idhash_fini(h);
+}
+
+static void
+bench_mixed(int count, int nkeys)
+{
+	nni_idhash *h     = bench_hash();
+	uint64_t    state = 2;
+	uint64_t    beg;
+	void *      val;
+
+	beg = nni_plat_clock_us();
+	for (int i = 0; i < count; i++) {
+		uint64_t r = bench_rand(&state);
+		uint64_t k = (r >> 2) % (uint64_t) nkeys;
+
+		switch (r & 3) {
+		case 0:
+			(void) nni_idhash_insert(h, k, h);
+			break;
+		case 1:
+			(void) nni_idhash_remove(h, k);
+			break;
+		default:
+			(void) nni_idhash_find(h, k, &val);
+			break;
+		}
+	}
+	report("mixed", beg, (uint64_t) count);
+	nni_idhash_fini(h);
+}
+
+static void
+bench_grow(int nkeys)
+{
+	nni_idhash *h = bench_hash();
+	uint64_t    beg;
+	uint64_t    worst = 0;
+
+	beg = nni_plat_clock_us();
+	for (int i = 0; i < nkeys; i++) {
+		uint64_t t = nni_plat_clock_us();
+		nni_idhash_insert(h, (uint64_t) i, h);
+		t = nni_plat_clock_us() - t;
+		if (t > worst) {
+			worst = t;
+		}
+	}
+	report("grow insert", beg, (uint64_t) nkeys);
+	printf("%-24s %10llu us\n", "grow slowest insert",
+	    (unsigned long long) worst);
+	nni_idhash_fini(h);
+}
+
+struct shared_arg {
+	nni_idhash *h;
+	int         count;
+	nni_thr     thr;
+};
+
+static void
+shared_worker(void *arg)
+{
+	struct shared_arg *sa = arg;
+
+	reqrep(sa->h, sa->count, 16);
+}
+
+static void
+bench_shared(int count, int nthreads)
+{
+	nni_idhash *       h = bench_hash();
+	struct shared_arg *args;
+	char               what[32];
+	uint64_t           beg;
+	int                rv;
+
+	if ((args = calloc(sizeof(*args), (size_t) nthreads)) == NULL) {
+		die("Out of memory");
+	}
+	for (int i = 0; i < nthreads; i++) {
+		args[i].h     = h;
+		args[i].count = count / nthreads;
+		rv = nni_thr_init(&args[i].thr, shared_worker, &args[i]);
+		if (rv != 0) {
+			die("nni_thr_init: %s", nng_strerror(rv));
+		}
+	}
+	beg = nni_plat_clock_us();
+	for (int i = 0; i < nthreads; i++) {
+		nni_thr_run(&args[i].thr);
+	}
+	for (int i = 0; i < nthreads; i++) {
+		nni_thr_fini(&args[i].thr);
+	}
+	(void) snprintf(what, sizeof(what), "shared %d threads", nthreads);
+	report(what, beg, (uint64_t) (count / nthreads) * nthreads * 3);
+
+	free(args);
+	nni_idhash_fini(h);
+}
+
+int
+main(int argc, char **argv)
+{
+	int count;
+	int maxthr;
+
+	if (argc != 3) {
+		die("Usage: idhash_bench <count> <max-threads>");
+	}
+	count  = parse_int(argv[1], "count");
+	maxthr = parse_int(argv[2], "#threads");
+	if ((count < 1) || (maxthr < 1)) {
+		die("Need at least one operation and thread");
+	}
+	if (nni_init() != 0) {
+		die("Cannot initialize");
+	}
+
+	bench_reqrep(count, 16);
+	bench_reqrep(count, 4096);
+	bench_find(count, 65536);
+	bench_mixed(count, 4096);
+	bench_grow(1000000);
+	for (int n = 1;; n = (n * 2 < maxthr) ? n * 2 : maxthr) {
+		bench_shared(count, n);
+		if (n == maxthr) {
+			break;
+		}
+	}
+
+	nni_fini();
+	return (0);
+}
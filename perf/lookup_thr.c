@@ -0,0 +1,223 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// lookup_thr - this measures how calls that look up a socket by its
+// handle scale with the number of threads making them.  Every public
+// socket call starts with such a lookup.  Each thread reads a socket
+// option in a loop, either on a socket of its own ("own"), or all on
+// the same socket ("shared").  The option read itself only touches the
+// socket, so in the "own" case any loss of scaling comes from state
+// shared between sockets.  (The "shared" case necessarily contends on
+// the socket's reference count.)
+//
+// The run is repeated with 1, 2, 4, ... threads up to the maximum.
+
+#if defined(NNG_HAVE_PAIR1)
+#include <nng/protocol/pair1/pair.h>
+
+#else
+
+static void die(const char *, ...);
+
+static int
+nng_pair1_open(nng_socket *arg)
+{
+	(void) arg;
+	die("Pair1 protocol not enabled in this build!");
+	return (NNG_ENOTSUP);
+}
+
+#endif // NNG_HAVE_PAIR1
+
+static void die(const char *, ...);
+static void do_lookup_thr(int argc, char **argv);
+
+int
+main(int argc, char **argv)
+{
+	argc--;
+	argv++;
+
+	do_lookup_thr(argc, argv);
+}
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+struct lookup_args {
+	int      count;
+	bool     start;
+	int      ready;
+	nng_mtx *mtx;
+	nng_cv * cv;
+};
+
+struct lookup_worker {
+	struct lookup_args *la;
+	nng_socket          sock;
+	nng_thread *        thr;
+};
+
+static void
+lookup_worker(void *arg)
+{
+	struct lookup_worker *lw = arg;
+	struct lookup_args *  la = lw->la;
+	nng_duration          d;
+	int                   rv;
+
+	nng_mtx_lock(la->mtx);
+	la->ready++;
+	nng_cv_wake(la->cv);
+	while (!la->start) {
+		nng_cv_wait(la->cv);
+	}
+	nng_mtx_unlock(la->mtx);
+
+	for (int i = 0; i < la->count; i++) {
+		rv = nng_getopt_ms(lw->sock, NNG_OPT_RECVTIMEO, &d);
+		if (rv != 0) {
+			die("nng_getopt_ms: %s", nng_strerror(rv));
+		}
+	}
+}
+
+static void
+lookup_run(struct lookup_args *la, struct lookup_worker *workers,
+    int nthreads, bool shared)
+{
+	nng_time beg;
+	nng_time end;
+	double   dur;
+	double   ops;
+	int      rv;
+
+	la->ready = 0;
+	la->start = false;
+	for (int i = 0; i < nthreads; i++) {
+		workers[i].la   = la;
+		workers[i].sock = shared ? workers[0].sock : workers[i].sock;
+		if ((rv = nng_thread_create(
+		         &workers[i].thr, lookup_worker, &workers[i])) != 0) {
+			die("Cannot create thread: %s", nng_strerror(rv));
+		}
+	}
+
+	nng_mtx_lock(la->mtx);
+	while (la->ready < nthreads) {
+		nng_cv_wait(la->cv);
+	}
+	la->start = true;
+	beg       = nng_clock();
+	nng_cv_wake(la->cv);
+	nng_mtx_unlock(la->mtx);
+
+	for (int i = 0; i < nthreads; i++) {
+		nng_thread_destroy(workers[i].thr);
+	}
+	end = nng_clock();
+
+	dur = (end - beg) / 1000.0;
+	if (dur <= 0) {
+		dur = 0.001;
+	}
+	ops = ((double) la->count * nthreads) / dur;
+
+	// The time per operation is as seen by each thread.
+	printf("%-8s %8d %14.f %12.1f\n", shared ? "shared" : "own",
+	    nthreads, ops, (dur * 1e9) / la->count);
+}
+
+static void
+do_lookup_thr(int argc, char **argv)
+{
+	struct lookup_args    la;
+	struct lookup_worker *workers;
+	nng_socket *          socks;
+	int                   maxthr;
+	int                   rv;
+
+	if (argc != 2) {
+		die("Usage: lookup_thr <count> <max-threads>");
+	}
+
+	memset(&la, 0, sizeof(la));
+	la.count = parse_int(argv[0], "count");
+	maxthr   = parse_int(argv[1], "#threads");
+	if (maxthr < 1) {
+		die("Need at least one thread");
+	}
+
+	if (((rv = nng_mtx_alloc(&la.mtx)) != 0) ||
+	    ((rv = nng_cv_alloc(&la.cv, la.mtx)) != 0)) {
+		die("Startup: %s", nng_strerror(rv));
+	}
+	if (((workers = calloc(sizeof(*workers), (size_t) maxthr)) == NULL) ||
+	    ((socks = calloc(sizeof(*socks), (size_t) maxthr)) == NULL)) {
+		die("Out of memory");
+	}
+	for (int i = 0; i < maxthr; i++) {
+		if ((rv = nng_pair1_open(&socks[i])) != 0) {
+			die("nng_pair1_open: %s", nng_strerror(rv));
+		}
+	}
+
+	printf("%-8s %8s %14s %12s\n", "mode", "threads", "ops/s", "ns/op");
+	for (int n = 1;; n = (n * 2 < maxthr) ? n * 2 : maxthr) {
+		for (int i = 0; i < n; i++) {
+			workers[i].sock = socks[i];
+		}
+		lookup_run(&la, workers, n, false);
+		lookup_run(&la, workers, n, true);
+		if (n == maxthr) {
+			break;
+		}
+	}
+
+	for (int i = 0; i < maxthr; i++) {
+		nng_close(socks[i]);
+	}
+	free(socks);
+	free(workers);
+	nng_cv_free(la.cv);
+	nng_mtx_free(la.mtx);
+}
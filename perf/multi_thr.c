@@ -0,0 +1,270 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// multi_thr - this measures aggregate throughput across many concurrent
+// connections in a single process.  Each connection is an independent
+// PAIR1 pair with its own sending and receiving thread, so the limiting
+// factor is how well the I/O backend (e.g. the pollq) scales across
+// cores, rather than any single socket.
+//
+// The URL must contain a single "%d", which is replaced with the
+// connection index, e.g. "tcp://127.0.0.1:40%03d" or "ipc:///tmp/thr.%d".
+
+#if defined(NNG_HAVE_PAIR1)
+#include <nng/protocol/pair1/pair.h>
+
+#else
+
+static void die(const char *, ...);
+
+static int
+nng_pair1_open(nng_socket *arg)
+{
+	(void) arg;
+	die("Pair1 protocol not enabled in this build!");
+	return (NNG_ENOTSUP);
+}
+
+#endif // NNG_HAVE_PAIR1
+
+static void die(const char *, ...);
+static void do_multi_thr(int argc, char **argv);
+
+int
+main(int argc, char **argv)
+{
+	argc--;
+	argv++;
+
+	do_multi_thr(argc, argv);
+}
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+struct multi_args {
+	size_t   msgsize;
+	int      count;
+	bool     start;
+	int      ready;
+	int      done;
+	nng_time beg;
+	nng_time end;
+	nng_mtx *mtx;
+	nng_cv * cv;
+};
+
+struct multi_conn {
+	struct multi_args *ma;
+	char               addr[128];
+	nng_socket         srv;
+	nng_socket         cli;
+	nng_thread *       sthr;
+	nng_thread *       cthr;
+};
+
+static void
+multi_wait_start(struct multi_args *ma)
+{
+	nng_mtx_lock(ma->mtx);
+	ma->ready++;
+	nng_cv_wake(ma->cv);
+	while (!ma->start) {
+		nng_cv_wait(ma->cv);
+	}
+	nng_mtx_unlock(ma->mtx);
+}
+
+static void
+multi_server(void *arg)
+{
+	struct multi_conn *mc = arg;
+	struct multi_args *ma = mc->ma;
+	nng_msg *          msg;
+	int                rv;
+
+	multi_wait_start(ma);
+
+	for (int i = 0; i < ma->count; i++) {
+		if ((rv = nng_recvmsg(mc->srv, &msg, 0)) != 0) {
+			die("nng_recvmsg: %s", nng_strerror(rv));
+		}
+		if (nng_msg_len(msg) != ma->msgsize) {
+			die("wrong message size: %lu != %lu",
+			    (unsigned long) nng_msg_len(msg),
+			    (unsigned long) ma->msgsize);
+		}
+		nng_msg_free(msg);
+	}
+
+	nng_mtx_lock(ma->mtx);
+	ma->done++;
+	ma->end = nng_clock();
+	nng_mtx_unlock(ma->mtx);
+}
+
+static void
+multi_client(void *arg)
+{
+	struct multi_conn *mc = arg;
+	struct multi_args *ma = mc->ma;
+	nng_msg *          msg;
+	int                rv;
+
+	multi_wait_start(ma);
+
+	for (int i = 0; i < ma->count; i++) {
+		if ((rv = nng_msg_alloc(&msg, ma->msgsize)) != 0) {
+			die("nng_msg_alloc: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_sendmsg(mc->cli, msg, 0)) != 0) {
+			die("nng_sendmsg: %s", nng_strerror(rv));
+		}
+	}
+}
+
+static void
+do_multi_thr(int argc, char **argv)
+{
+	struct multi_args  ma;
+	struct multi_conn *conns;
+	int                nconns;
+	int                rv;
+	double             dur;
+	double             msgpersec;
+
+	if (argc != 4) {
+		die("Usage: multi_thr <url-with-%%d> <msg-size> <count> "
+		    "<num-conns>");
+	}
+	if (strchr(argv[0], '%') == NULL) {
+		die("URL must contain %%d for the connection index");
+	}
+
+	memset(&ma, 0, sizeof(ma));
+	ma.msgsize = parse_int(argv[1], "message size");
+	ma.count   = parse_int(argv[2], "count");
+	nconns     = parse_int(argv[3], "#connections");
+	if (nconns < 1) {
+		die("Need at least one connection");
+	}
+
+	if (((rv = nng_mtx_alloc(&ma.mtx)) != 0) ||
+	    ((rv = nng_cv_alloc(&ma.cv, ma.mtx)) != 0)) {
+		die("Startup: %s", nng_strerror(rv));
+	}
+	if ((conns = calloc(sizeof(*conns), (size_t) nconns)) == NULL) {
+		die("Out of memory");
+	}
+
+	for (int i = 0; i < nconns; i++) {
+		struct multi_conn *mc = &conns[i];
+		mc->ma                = &ma;
+		(void) snprintf(mc->addr, sizeof(mc->addr), argv[0], i);
+
+		if (((rv = nng_pair1_open(&mc->srv)) != 0) ||
+		    ((rv = nng_pair1_open(&mc->cli)) != 0)) {
+			die("nng_pair1_open: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_setopt_int(mc->srv, NNG_OPT_RECVBUF, 128)) !=
+		    0) {
+			die("nng_setopt(nng_opt_recvbuf): %s",
+			    nng_strerror(rv));
+		}
+		if ((rv = nng_setopt_int(mc->cli, NNG_OPT_SENDBUF, 128)) !=
+		    0) {
+			die("nng_setopt(nng_opt_sendbuf): %s",
+			    nng_strerror(rv));
+		}
+		if ((rv = nng_listen(mc->srv, mc->addr, NULL, 0)) != 0) {
+			die("nng_listen %s: %s", mc->addr, nng_strerror(rv));
+		}
+		if ((rv = nng_dial(mc->cli, mc->addr, NULL, 0)) != 0) {
+			die("nng_dial %s: %s", mc->addr, nng_strerror(rv));
+		}
+	}
+
+	for (int i = 0; i < nconns; i++) {
+		if (((rv = nng_thread_create(
+		          &conns[i].sthr, multi_server, &conns[i])) != 0) ||
+		    ((rv = nng_thread_create(
+		          &conns[i].cthr, multi_client, &conns[i])) != 0)) {
+			die("Cannot create thread: %s", nng_strerror(rv));
+		}
+	}
+
+	nng_mtx_lock(ma.mtx);
+	while (ma.ready < nconns * 2) {
+		nng_cv_wait(ma.cv);
+	}
+	ma.start = true;
+	ma.beg   = nng_clock();
+	nng_cv_wake(ma.cv);
+	nng_mtx_unlock(ma.mtx);
+
+	for (int i = 0; i < nconns; i++) {
+		nng_thread_destroy(conns[i].cthr);
+		nng_thread_destroy(conns[i].sthr);
+	}
+	for (int i = 0; i < nconns; i++) {
+		nng_close(conns[i].cli);
+		nng_close(conns[i].srv);
+	}
+
+	dur = (ma.end - ma.beg) / 1000.0;
+	if (dur <= 0) {
+		dur = 0.001;
+	}
+	msgpersec = ((double) ma.count * nconns) / dur;
+
+	printf("connections: %d\n", nconns);
+	printf("total time: %.3f [s]\n", dur);
+	printf("message size: %d [B]\n", (int) ma.msgsize);
+	printf("message count: %d per connection\n", ma.count);
+	printf("throughput: %.f [msg/s]\n", msgpersec);
+	printf("throughput: %.3f [Mb/s]\n",
+	    (msgpersec * 8 * ma.msgsize) / (1024 * 1024));
+
+	free(conns);
+	nng_cv_free(ma.cv);
+	nng_mtx_free(ma.mtx);
+}
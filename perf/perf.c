@@ -96,6 +96,7 @@ enum options {
 	OPT_SURVEY0,
 	OPT_BUS0,
 	OPT_URL,
+	OPT_BUSYPOLL,
 };
 
 // These are not universally supported by the variants yet.
@@ -107,6 +108,7 @@ static nng_optspec opts[] = {
 	{ .o_name = "pubsub0", .o_val = OPT_PUBSUB0 },
 	{ .o_name = "pipeline0", .o_val = OPT_PIPELINE0 },
 	{ .o_name = "url", .o_val = OPT_URL, .o_arg = true },
+	{ .o_name = "busypoll", .o_val = OPT_BUSYPOLL, .o_arg = true },
 	{ .o_name = NULL, .o_val = 0 },
 };
 
@@ -121,6 +123,10 @@ static void do_local_thr(int argc, char **argv);
 static void do_inproc_thr(int argc, char **argv);
 static void do_inproc_lat(int argc, char **argv);
 static void die(const char *, ...);
+static int  parse_int(const char *, const char *);
+
+// Microseconds for receives to spin before sleeping (--busypoll).
+static int busypoll;
 
 // perf implements the same performance tests found in the standard
 // nanomsg & mangos performance tests.  As with mangos, the decision
@@ -242,14 +248,41 @@ parse_int(const char *arg, const char *what)
 	return ((int) val);
 }
 
+// parse_lat_opts handles the options understood by the latency tests
+// that run on their own, returning how many arguments were used.
+static int
+parse_lat_opts(int argc, char **argv)
+{
+	int   optidx = 0;
+	int   val;
+	char *arg;
+
+	while (nng_opts_parse(argc, argv, opts, &val, &arg, &optidx) == 0) {
+		switch (val) {
+		case OPT_BUSYPOLL:
+			busypoll = parse_int(arg, "busy poll time");
+			break;
+		default:
+			die("bad option");
+		}
+	}
+	return (optidx);
+}
+
 void
 do_local_lat(int argc, char **argv)
 {
 	long int msgsize;
 	long int trips;
+	int      n;
+
+	n = parse_lat_opts(argc, argv);
+	argc -= n;
+	argv += n;
 
 	if (argc != 3) {
-		die("Usage: local_lat <listen-addr> <msg-size> <roundtrips>");
+		die("Usage: local_lat [--busypoll <usec>] <listen-addr> "
+		    "<msg-size> <roundtrips>");
 	}
 
 	msgsize = parse_int(argv[1], "message size");
@@ -263,9 +296,15 @@ do_remote_lat(int argc, char **argv)
 {
 	int msgsize;
 	int trips;
+	int n;
+
+	n = parse_lat_opts(argc, argv);
+	argc -= n;
+	argv += n;
 
 	if (argc != 3) {
-		die("Usage: remote_lat <connect-to> <msg-size> <roundtrips>");
+		die("Usage: remote_lat [--busypoll <usec>] <connect-to> "
+		    "<msg-size> <roundtrips>");
 	}
 
 	msgsize = parse_int(argv[1], "message size");
@@ -358,6 +397,9 @@ do_inproc_lat(int argc, char **argv)
 		case OPT_URL:
 			addr = arg;
 			break;
+		case OPT_BUSYPOLL:
+			busypoll = parse_int(arg, "busy poll time");
+			break;
 		default:
 			die("bad option");
 		}
@@ -449,6 +491,21 @@ do_inproc_thr(int argc, char **argv)
 	nng_thread_destroy(thr);
 }
 
+static void
+set_busypoll(nng_socket s)
+{
+	int rv;
+
+	if (busypoll == 0) {
+		return;
+	}
+	if ((rv = nng_setopt_int(s, NNG_OPT_RECVBUSYPOLL, busypoll)) != 0) {
+		die("nng_setopt(nng_opt_recvbusypoll): %s", nng_strerror(rv));
+	}
+	// Only TCP has this, and it is fine if it is not there.
+	(void) nng_setopt_int(s, NNG_OPT_TCP_BUSYPOLL, busypoll);
+}
+
 void
 latency_client(const char *addr, size_t msgsize, int trips)
 {
@@ -465,6 +522,7 @@ latency_client(const char *addr, size_t msgsize, int trips)
 
 	// XXX: set no delay
 	// XXX: other options (TLS in the future?, Linger?)
+	set_busypoll(s);
 
 	if ((rv = nng_dial(s, addr, NULL, 0)) != 0) {
 		die("nng_dial: %s", nng_strerror(rv));
@@ -513,6 +571,7 @@ latency_server(const char *addr, size_t msgsize, int trips)
 
 	// XXX: set no delay
 	// XXX: other options (TLS in the future?, Linger?)
+	set_busypoll(s);
 
 	if ((rv = nng_listen(s, addr, NULL, 0)) != 0) {
 		die("nng_listen: %s", nng_strerror(rv));
@@ -0,0 +1,201 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// pub_fanout - this measures the cost of a single publish as the number of
+// subscribers grows.  A PUB socket listens on the given address (IPC by
+// default), and that many SUB sockets connect to it.  Messages are
+// published in bursts, and after each burst we wait for the last
+// subscriber to receive it, so that nothing is dropped.  The result is the
+// CPU time (all threads) and the wall clock time per publish, along with
+// the same divided by the number of subscribers.
+
+#if defined(NNG_HAVE_PUB0) && defined(NNG_HAVE_SUB0)
+#include <nng/protocol/pubsub0/pub.h>
+#include <nng/protocol/pubsub0/sub.h>
+
+#else
+
+static void die(const char *, ...);
+
+static int
+nng_pub0_open(nng_socket *arg)
+{
+	(void) arg;
+	die("Pub protocol not enabled in this build!");
+	return (NNG_ENOTSUP);
+}
+
+static int
+nng_sub0_open(nng_socket *arg)
+{
+	(void) arg;
+	die("Sub protocol not enabled in this build!");
+	return (NNG_ENOTSUP);
+}
+
+#endif // NNG_HAVE_PUB0 && NNG_HAVE_SUB0
+
+#define BURST 32
+
+static void die(const char *, ...);
+static void do_pub_fanout(int argc, char **argv);
+
+int
+main(int argc, char **argv)
+{
+	argc--;
+	argv++;
+
+	do_pub_fanout(argc, argv);
+}
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+static void
+pub_fanout_run(const char *url, int nsubs, int count, size_t size)
+{
+	nng_socket  pub;
+	nng_socket *subs;
+	nng_msg *   msg;
+	int         rv;
+	nng_time    beg;
+	nng_time    end;
+	clock_t     cbeg;
+	clock_t     cend;
+	double      cpu;
+	double      wall;
+
+	if ((subs = calloc((size_t) nsubs, sizeof(nng_socket))) == NULL) {
+		die("Out of memory");
+	}
+	if ((rv = nng_pub0_open(&pub)) != 0) {
+		die("Cannot open pub: %s", nng_strerror(rv));
+	}
+	// Large enough that the bursts never drop anything.
+	if ((rv = nng_setopt_int(pub, NNG_OPT_SENDBUF, BURST * 4)) != 0) {
+		die("nng_setopt(nng_opt_sendbuf): %s", nng_strerror(rv));
+	}
+	if ((rv = nng_listen(pub, url, NULL, 0)) != 0) {
+		die("nng_listen(%s): %s", url, nng_strerror(rv));
+	}
+	for (int i = 0; i < nsubs; i++) {
+		if (((rv = nng_sub0_open(&subs[i])) != 0) ||
+		    ((rv = nng_setopt(subs[i], NNG_OPT_SUB_SUBSCRIBE, "", 0)) !=
+		        0) ||
+		    ((rv = nng_setopt_int(subs[i], NNG_OPT_RECVBUF, BURST)) !=
+		        0) ||
+		    ((rv = nng_setopt_ms(subs[i], NNG_OPT_RECVTIMEO, 10000)) !=
+		        0) ||
+		    ((rv = nng_dial(subs[i], url, NULL, 0)) != 0)) {
+			die("Cannot set up subscriber: %s", nng_strerror(rv));
+		}
+	}
+	nng_msleep(200 + nsubs); // let all the pipes come up
+
+	beg  = nng_clock();
+	cbeg = clock();
+	for (int i = 0; i < count; i += BURST) {
+		for (int j = 0; j < BURST; j++) {
+			if ((rv = nng_msg_alloc(&msg, size)) != 0) {
+				die("nng_msg_alloc: %s", nng_strerror(rv));
+			}
+			if ((rv = nng_sendmsg(pub, msg, 0)) != 0) {
+				die("nng_sendmsg: %s", nng_strerror(rv));
+			}
+		}
+		// Drain every subscriber before the next burst.
+		for (int k = 0; k < nsubs; k++) {
+			for (int j = 0; j < BURST; j++) {
+				if ((rv = nng_recvmsg(subs[k], &msg, 0)) != 0) {
+					die("nng_recvmsg: %s",
+					    nng_strerror(rv));
+				}
+				nng_msg_free(msg);
+			}
+		}
+	}
+	cend = clock();
+	end  = nng_clock();
+
+	for (int i = 0; i < nsubs; i++) {
+		nng_close(subs[i]);
+	}
+	nng_close(pub);
+	free(subs);
+
+	count = ((count + BURST - 1) / BURST) * BURST;
+	cpu   = (double) (cend - cbeg) * 1000000.0 / CLOCKS_PER_SEC / count;
+	wall  = (double) (end - beg) * 1000.0 / count;
+	printf("%8d %14.1f %14.1f %14.3f %14.3f\n", nsubs, cpu, wall,
+	    cpu / nsubs, wall / nsubs);
+}
+
+static void
+do_pub_fanout(int argc, char **argv)
+{
+	const char *url     = "ipc:///tmp/pub_fanout.ipc";
+	int         maxsubs = 1000;
+	int         size;
+	int         count;
+
+	if ((argc < 2) || (argc > 4)) {
+		die("Usage: pub_fanout <msg-size> <count> [<max-subs> [<url>]]");
+	}
+	size  = parse_int(argv[0], "message size");
+	count = parse_int(argv[1], "count");
+	if (argc > 2) {
+		maxsubs = parse_int(argv[2], "max subscribers");
+	}
+	if (argc > 3) {
+		url = argv[3];
+	}
+	if ((count < 1) || (maxsubs < 1)) {
+		die("Need at least one message and one subscriber");
+	}
+
+	printf("%8s %14s %14s %14s %14s\n", "subs", "cpu-us/pub",
+	    "wall-us/pub", "cpu-us/sub", "wall-us/sub");
+	for (int nsubs = 1; nsubs <= maxsubs; nsubs *= 10) {
+		pub_fanout_run(url, nsubs, count, (size_t) size);
+	}
+}
@@ -0,0 +1,178 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// sub_match - this measures the cost of subscription matching in the SUB
+// protocol as the number of subscriptions grows.  For each subscription
+// count (1, 10, 100, ... up to the maximum) a SUB socket subscribes to
+// that many distinct topics, and a PUB socket connected over inproc sends
+// messages on randomly chosen topics among them, one at a time.  If the
+// matching cost does not depend on the number of subscriptions, the time
+// per message should stay flat.
+
+#if defined(NNG_HAVE_PUB0) && defined(NNG_HAVE_SUB0)
+#include <nng/protocol/pubsub0/pub.h>
+#include <nng/protocol/pubsub0/sub.h>
+
+#else
+
+static void die(const char *, ...);
+
+static int
+nng_pub0_open(nng_socket *arg)
+{
+	(void) arg;
+	die("Pub protocol not enabled in this build!");
+	return (NNG_ENOTSUP);
+}
+
+static int
+nng_sub0_open(nng_socket *arg)
+{
+	(void) arg;
+	die("Sub protocol not enabled in this build!");
+	return (NNG_ENOTSUP);
+}
+
+#endif // NNG_HAVE_PUB0 && NNG_HAVE_SUB0
+
+static void die(const char *, ...);
+static void do_sub_match(int argc, char **argv);
+
+int
+main(int argc, char **argv)
+{
+	argc--;
+	argv++;
+
+	do_sub_match(argc, argv);
+}
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+static void
+sub_match_run(int nsubs, int count)
+{
+	nng_socket pub;
+	nng_socket sub;
+	nng_msg *  msg;
+	char       topic[32];
+	char       addr[64];
+	int        rv;
+	nng_time   beg;
+	nng_time   end;
+	double     subtime;
+
+	if (((rv = nng_pub0_open(&pub)) != 0) ||
+	    ((rv = nng_sub0_open(&sub)) != 0)) {
+		die("Cannot open sockets: %s", nng_strerror(rv));
+	}
+	if ((rv = nng_setopt_ms(sub, NNG_OPT_RECVTIMEO, 5000)) != 0) {
+		die("nng_setopt(nng_opt_recvtimeo): %s", nng_strerror(rv));
+	}
+
+	beg = nng_clock();
+	for (int i = 0; i < nsubs; i++) {
+		(void) snprintf(topic, sizeof(topic), "md.%07d.", i);
+		if ((rv = nng_setopt(sub, NNG_OPT_SUB_SUBSCRIBE, topic,
+		         strlen(topic))) != 0) {
+			die("nng_setopt(nng_opt_sub_subscribe): %s",
+			    nng_strerror(rv));
+		}
+	}
+	subtime = (double) (nng_clock() - beg);
+
+	(void) snprintf(addr, sizeof(addr), "inproc://sub_match_%d", nsubs);
+	if (((rv = nng_listen(sub, addr, NULL, 0)) != 0) ||
+	    ((rv = nng_dial(pub, addr, NULL, 0)) != 0)) {
+		die("Cannot connect %s: %s", addr, nng_strerror(rv));
+	}
+	nng_msleep(100); // let the pipe come up
+
+	beg = nng_clock();
+	for (int i = 0; i < count; i++) {
+		(void) snprintf(
+		    topic, sizeof(topic), "md.%07d.px", rand() % nsubs);
+		if (((rv = nng_msg_alloc(&msg, 0)) != 0) ||
+		    ((rv = nng_msg_append(msg, topic, strlen(topic))) != 0)) {
+			die("nng_msg_alloc: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_sendmsg(pub, msg, 0)) != 0) {
+			die("nng_sendmsg: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_recvmsg(sub, &msg, 0)) != 0) {
+			die("nng_recvmsg: %s", nng_strerror(rv));
+		}
+		nng_msg_free(msg);
+	}
+	end = nng_clock();
+
+	nng_close(pub);
+	nng_close(sub);
+
+	printf("%10d %14.1f %14.3f\n", nsubs,
+	    (double) (end - beg) * 1000000.0 / count,
+	    subtime * 1000.0 / nsubs);
+}
+
+static void
+do_sub_match(int argc, char **argv)
+{
+	int count;
+	int maxsubs = 100000;
+
+	if ((argc < 1) || (argc > 2)) {
+		die("Usage: sub_match <count> [<max-subs>]");
+	}
+	count = parse_int(argv[0], "count");
+	if (argc > 1) {
+		maxsubs = parse_int(argv[1], "max subscriptions");
+	}
+	if ((count < 1) || (maxsubs < 1)) {
+		die("Need at least one message and one subscription");
+	}
+
+	srand(1);
+	printf("%10s %14s %14s\n", "subs", "ns/msg", "us/subscribe");
+	for (int nsubs = 1; nsubs <= maxsubs; nsubs *= 10) {
+		sub_match_run(nsubs, count);
+	}
+}
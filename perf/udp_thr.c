@@ -0,0 +1,275 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/nng_impl.h"
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// udp_thr - this measures the datagram rate of the platform UDP layer
+// over loopback.  One UDP port keeps a window of receives posted, and
+// another keeps a window of sends in flight to it, each aio resubmitting
+// itself from its completion callback.  The deeper the window, the more
+// datagrams the platform can move per system call (where it has batch
+// calls like recvmmsg and sendmmsg).  UDP is lossy, so both the send and
+// receive rates are reported; datagrams dropped by the kernel (usually
+// for lack of socket buffer space) show up as the difference.
+
+static void die(const char *, ...);
+static void do_udp_thr(int argc, char **argv);
+
+int
+main(int argc, char **argv)
+{
+	argc--;
+	argv++;
+
+	do_udp_thr(argc, argv);
+}
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+typedef struct {
+	nni_plat_udp *udp;
+	nng_aio *     aio;
+	nng_sockaddr  sa;
+	nng_mtx *     mtx;
+	nng_cv *      cv;
+	int *         left;  // operations left to start
+	int *         count; // operations completed
+	int *         busy;  // operations outstanding
+	bool          send;
+	char          buf[65536];
+} udp_op;
+
+static void
+udp_op_start(udp_op *op)
+{
+	if (op->send) {
+		nni_plat_udp_send(op->udp, op->aio);
+	} else {
+		nni_plat_udp_recv(op->udp, op->aio);
+	}
+}
+
+static void
+udp_op_cb(void *arg)
+{
+	udp_op *op = arg;
+	bool    again;
+
+	nng_mtx_lock(op->mtx);
+	if (nng_aio_result(op->aio) == 0) {
+		(*op->count)++;
+	}
+	if ((again = ((nng_aio_result(op->aio) == 0) && (*op->left > 0)))) {
+		(*op->left)--;
+	} else {
+		(*op->busy)--;
+		nng_cv_wake(op->cv);
+	}
+	nng_mtx_unlock(op->mtx);
+	if (again) {
+		udp_op_start(op);
+	}
+}
+
+static udp_op *
+udp_ops_alloc(nni_plat_udp *udp, int window, size_t size, nng_sockaddr *to,
+    nng_mtx *mtx, nng_cv *cv, int *left, int *count, int *busy)
+{
+	udp_op *ops;
+
+	if ((ops = calloc(window, sizeof(udp_op))) == NULL) {
+		die("Out of memory");
+	}
+	for (int i = 0; i < window; i++) {
+		udp_op *op = &ops[i];
+		nng_iov iov;
+		int     rv;
+
+		if ((rv = nng_aio_alloc(&op->aio, udp_op_cb, op)) != 0) {
+			die("nng_aio_alloc: %s", nng_strerror(rv));
+		}
+		op->udp     = udp;
+		op->mtx     = mtx;
+		op->cv      = cv;
+		op->left    = left;
+		op->count   = count;
+		op->busy    = busy;
+		op->send    = (to != NULL);
+		iov.iov_buf = op->buf;
+		iov.iov_len = op->send ? size : sizeof(op->buf);
+		if (op->send) {
+			op->sa = *to;
+		}
+		memset(op->buf, 'x', iov.iov_len);
+		nng_aio_set_iov(op->aio, 1, &iov);
+		nng_aio_set_input(op->aio, 0, &op->sa);
+	}
+	return (ops);
+}
+
+static void
+do_udp_thr(int argc, char **argv)
+{
+	nni_plat_udp *rx;
+	nni_plat_udp *tx;
+	nng_sockaddr  rxsa;
+	nng_sockaddr  txsa;
+	nng_mtx *     mtx;
+	nng_cv *      cv;
+	udp_op *      rops;
+	udp_op *      sops;
+	int           size;
+	int           count;
+	int           window = 64;
+	int           sleft;
+	int           rleft;
+	int           sent  = 0;
+	int           recvd = 0;
+	int           sbusy;
+	int           rbusy;
+	int           last;
+	int           rv;
+	nng_time      beg;
+	nng_time      send_end;
+	nng_time      end;
+
+	if ((argc < 2) || (argc > 3)) {
+		die("Usage: udp_thr <msg-size> <count> [<window>]");
+	}
+	size  = parse_int(argv[0], "message size");
+	count = parse_int(argv[1], "count");
+	if (argc > 2) {
+		window = parse_int(argv[2], "window");
+	}
+	if ((size < 1) || (size > 65000) || (count < 1) || (window < 1)) {
+		die("Invalid size, count or window");
+	}
+	if (window > count) {
+		window = count;
+	}
+
+	if ((rv = nni_init()) != 0) {
+		die("nni_init: %s", nng_strerror(rv));
+	}
+	memset(&rxsa, 0, sizeof(rxsa));
+	rxsa.s_in.sa_family = NNG_AF_INET;
+	NNI_PUT32((uint8_t *) &rxsa.s_in.sa_addr, 0x7f000001); // 127.0.0.1
+	txsa = rxsa;
+	if (((rv = nni_plat_udp_open(&rx, &rxsa)) != 0) ||
+	    ((rv = nni_plat_udp_open(&tx, &txsa)) != 0) ||
+	    ((rv = nni_plat_udp_sockname(rx, &rxsa)) != 0)) {
+		die("Cannot open UDP: %s", nng_strerror(rv));
+	}
+	if (((rv = nng_mtx_alloc(&mtx)) != 0) ||
+	    ((rv = nng_cv_alloc(&cv, mtx)) != 0)) {
+		die("Cannot allocate: %s", nng_strerror(rv));
+	}
+
+	sleft = count - window;
+	rleft = count - window;
+	sbusy = window;
+	rbusy = window;
+	rops = udp_ops_alloc(rx, window, 0, NULL, mtx, cv, &rleft, &recvd,
+	    &rbusy);
+	sops = udp_ops_alloc(tx, window, (size_t) size, &rxsa, mtx, cv,
+	    &sleft, &sent, &sbusy);
+
+	for (int i = 0; i < window; i++) {
+		udp_op_start(&rops[i]);
+	}
+	nng_msleep(10);
+
+	beg = nng_clock();
+	for (int i = 0; i < window; i++) {
+		udp_op_start(&sops[i]);
+	}
+
+	// Wait for the sends to finish, then for the receives to either
+	// finish or stop arriving.
+	nng_mtx_lock(mtx);
+	while (sbusy > 0) {
+		nng_cv_wait(cv);
+	}
+	send_end = nng_clock();
+	last     = recvd;
+	while (rbusy > 0) {
+		int was = recvd;
+		(void) nng_cv_until(cv, nng_clock() + 100);
+		if ((recvd == was) && (was == last)) {
+			break;
+		}
+		last = recvd;
+	}
+	end = nng_clock();
+	nng_mtx_unlock(mtx);
+	if (rbusy > 0) {
+		// Anything still waiting was for a dropped datagram.
+		end -= 100;
+	}
+
+	for (int i = 0; i < window; i++) {
+		nng_aio_stop(rops[i].aio);
+		nng_aio_stop(sops[i].aio);
+		nng_aio_free(rops[i].aio);
+		nng_aio_free(sops[i].aio);
+	}
+	free(rops);
+	free(sops);
+	nni_plat_udp_close(rx);
+	nni_plat_udp_close(tx);
+	nng_cv_free(cv);
+	nng_mtx_free(mtx);
+
+	if (send_end == beg) {
+		send_end++;
+	}
+	if (end <= beg) {
+		end = beg + 1;
+	}
+	printf("message size: %d [B]\n", size);
+	printf("window: %d\n", window);
+	printf("sent: %d (%.0f [dgram/s])\n", sent,
+	    (double) sent * 1000.0 / (double) (send_end - beg));
+	printf("received: %d (%.0f [dgram/s])\n", recvd,
+	    (double) recvd * 1000.0 / (double) (end - beg));
+	printf("dropped: %d\n", count - recvd);
+}
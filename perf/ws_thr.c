@@ -0,0 +1,207 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// ws_thr - this measures websocket throughput over loopback at a range of
+// message sizes, sending each message as a single frame.  The dialing
+// side is the websocket client, so it masks every frame it sends, and the
+// listening side unmasks them; for large frames that masking is a large
+// part of the per-byte cost.
+
+#if defined(NNG_HAVE_PAIR1)
+#include <nng/protocol/pair1/pair.h>
+
+#else
+
+static void die(const char *, ...);
+
+static int
+nng_pair1_open(nng_socket *arg)
+{
+	(void) arg;
+	die("Pair protocol not enabled in this build!");
+	return (NNG_ENOTSUP);
+}
+
+#endif // NNG_HAVE_PAIR1
+
+static void die(const char *, ...);
+static void do_ws_thr(int argc, char **argv);
+
+int
+main(int argc, char **argv)
+{
+	argc--;
+	argv++;
+
+	do_ws_thr(argc, argv);
+}
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long  val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	// Must be a positive number less than around a billion.
+	if ((val < 0) || (val > 1000000000) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+typedef struct {
+	nng_socket s;
+	size_t     size;
+	int        count;
+} ws_sender;
+
+static void
+ws_send_thr(void *arg)
+{
+	ws_sender *ss = arg;
+	nng_msg *  msg;
+	int        rv;
+
+	for (int i = 0; i < ss->count; i++) {
+		if ((rv = nng_msg_alloc(&msg, ss->size)) != 0) {
+			die("nng_msg_alloc: %s", nng_strerror(rv));
+		}
+		memset(nng_msg_body(msg), i, ss->size);
+		if ((rv = nng_sendmsg(ss->s, msg, 0)) != 0) {
+			die("nng_sendmsg: %s", nng_strerror(rv));
+		}
+	}
+}
+
+static void
+ws_thr_run(size_t size, int count)
+{
+	nng_socket   srv;
+	ws_sender    ss;
+	nng_listener l;
+	nng_dialer   d;
+	nng_thread * thr;
+	nng_msg *    msg;
+	char         addr[64];
+	int          rv;
+	int          port;
+	nng_sockaddr sa;
+	nng_time     beg;
+	nng_time     end;
+	double       msec;
+
+	if (((rv = nng_pair1_open(&srv)) != 0) ||
+	    ((rv = nng_pair1_open(&ss.s)) != 0)) {
+		die("Cannot open sockets: %s", nng_strerror(rv));
+	}
+	if (((rv = nng_setopt_size(srv, NNG_OPT_RECVMAXSZ, 0)) != 0) ||
+	    ((rv = nng_setopt_ms(srv, NNG_OPT_RECVTIMEO, 10000)) != 0)) {
+		die("nng_setopt: %s", nng_strerror(rv));
+	}
+
+	if (((rv = nng_listener_create(&l, srv, "ws://127.0.0.1:0/thr")) !=
+	        0) ||
+	    ((rv = nng_listener_setopt_size(l, NNG_OPT_WS_RECVMAXFRAME, 0)) !=
+	        0) ||
+	    ((rv = nng_listener_start(l, 0)) != 0) ||
+	    ((rv = nng_listener_getopt_sockaddr(l, NNG_OPT_LOCADDR, &sa)) !=
+	        0)) {
+		die("Cannot listen: %s", nng_strerror(rv));
+	}
+	port = ((sa.s_in.sa_port & 0xff) << 8) | (sa.s_in.sa_port >> 8);
+	(void) snprintf(addr, sizeof(addr), "ws://127.0.0.1:%d/thr", port);
+	if (((rv = nng_dialer_create(&d, ss.s, addr)) != 0) ||
+	    ((rv = nng_dialer_setopt_size(d, NNG_OPT_WS_SENDMAXFRAME, 0)) !=
+	        0) ||
+	    ((rv = nng_dialer_start(d, 0)) != 0)) {
+		die("Cannot dial %s: %s", addr, nng_strerror(rv));
+	}
+
+	// The first message just gets everything connected and warm.
+	ss.size  = size;
+	ss.count = count + 1;
+	if ((rv = nng_thread_create(&thr, ws_send_thr, &ss)) != 0) {
+		die("nng_thread_create: %s", nng_strerror(rv));
+	}
+	if ((rv = nng_recvmsg(srv, &msg, 0)) != 0) {
+		die("nng_recvmsg: %s", nng_strerror(rv));
+	}
+	nng_msg_free(msg);
+
+	beg = nng_clock();
+	for (int i = 0; i < count; i++) {
+		if ((rv = nng_recvmsg(srv, &msg, 0)) != 0) {
+			die("nng_recvmsg: %s", nng_strerror(rv));
+		}
+		if (nng_msg_len(msg) != size) {
+			die("Received wrong size message");
+		}
+		nng_msg_free(msg);
+	}
+	end = nng_clock();
+	nng_thread_destroy(thr);
+
+	nng_close(ss.s);
+	nng_close(srv);
+
+	msec = (double) (end - beg);
+	if (msec < 1) {
+		msec = 1;
+	}
+	printf("%10zu %10d %14.1f\n", size, count,
+	    (double) size * count / (msec * 1000.0));
+}
+
+static void
+do_ws_thr(int argc, char **argv)
+{
+	size_t sizes[] = { 64, 1024, 16384, 65536, 1U << 20, 4U << 20 };
+	size_t total;
+
+	if (argc != 1) {
+		die("Usage: ws_thr <megabytes-per-size>");
+	}
+	total = (size_t) parse_int(argv[0], "megabytes") << 20;
+	if (total == 0) {
+		die("Need at least one megabyte");
+	}
+
+	printf("%10s %10s %14s\n", "msg-size", "count", "MB/s");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size_t count = total / sizes[i];
+		if (count < 1) {
+			count = 1;
+		} else if (count > 100000) {
+			count = 100000;
+		}
+		ws_thr_run(sizes[i], (int) count);
+	}
+}
@@ -11,13 +11,62 @@
 #include "core/nng_impl.h"
 #include <string.h>
 
+// NNG_AIO_EXPIRE_RESOLUTION is the granularity, in milliseconds, of
+// aio expirations.  Deadlines are rounded up to a multiple of this, so
+// an aio never expires early, but may expire up to this much late.
+// Coarser values let the expiration thread wake less often.
+#ifndef NNG_AIO_EXPIRE_RESOLUTION
+#define NNG_AIO_EXPIRE_RESOLUTION 1
+#endif
+
+// Expiration timing wheel.  There are NNI_AIO_WHEEL_LEVELS levels, each
+// having NNI_AIO_WHEEL_SLOTS slots.  A slot at level N covers a span of
+// (NNI_AIO_WHEEL_SLOTS ^ N) ticks.  Deadlines too far out for the wheel
+// are kept on an unsorted overflow list.
+#define NNI_AIO_WHEEL_BITS 6
+#define NNI_AIO_WHEEL_SLOTS (1U << NNI_AIO_WHEEL_BITS)
+#define NNI_AIO_WHEEL_MASK ((uint64_t) NNI_AIO_WHEEL_SLOTS - 1)
+#define NNI_AIO_WHEEL_LEVELS 4
+#define NNI_AIO_WHEEL_NEVER ((uint64_t) -1)
+
+typedef struct nni_aio_wheel {
+	nni_list slots[NNI_AIO_WHEEL_LEVELS][NNI_AIO_WHEEL_SLOTS];
+	uint64_t busy[NNI_AIO_WHEEL_LEVELS]; // hint of non-empty slots
+	nni_list overflow;                   // beyond the end of the wheel
+	nni_list expired;                    // due, waiting to be canceled
+	uint64_t tick;                       // next tick to process
+	uint64_t wake;                       // tick the thread sleeps until
+} nni_aio_wheel;
+
 static nni_mtx nni_aio_lk;
 // These are used for expiration.
-static nni_cv   nni_aio_expire_cv;
-static int      nni_aio_expire_run;
-static nni_thr  nni_aio_expire_thr;
-static nni_list nni_aio_expire_aios;
-static nni_aio *nni_aio_expire_aio;
+static nni_cv        nni_aio_expire_cv;
+static int           nni_aio_expire_run;
+static nni_thr       nni_aio_expire_thr;
+static nni_aio_wheel nni_aio_expire_wheel;
+static nni_aio *     nni_aio_expire_aio;
+static nni_plat_tls  nni_aio_inline_tls; // depth of nested completions
+static bool          nni_aio_inline_ok;
+
+// Synchronous operations (nng_sendmsg and nng_recvmsg) borrow their aio
+// from a cache kept by each thread, rather than allocating one (with its
+// lock and condition variable) on every call.  Threads beyond this many
+// just allocate, which bounds what is kept for threads that exit without
+// telling us.
+#ifndef NNG_AIO_SYNC_MAX_CACHES
+#define NNG_AIO_SYNC_MAX_CACHES 256
+#endif
+
+typedef struct {
+	nni_list_node node;
+	nni_aio       aio;
+	bool          busy;
+} nni_aio_cache;
+
+static nni_list     nni_aio_caches;
+static int          nni_aio_ncaches;
+static nni_plat_tls nni_aio_cache_tls;
+static bool         nni_aio_cache_ok;
 
 // Design notes.
 //
@@ -34,9 +83,17 @@ static nni_aio *nni_aio_expire_aio;
 // not call finish more than once though.
 //
 // A single lock, nni_aio_lk, is used to protect the flags on the AIO,
-// as well as the expire list on the AIOs.  We will not permit an AIO
+// as well as the expiration wheel.  We will not permit an AIO
 // to be marked done if an expiration is outstanding.
 //
+// Expirations are kept in a hierarchical timing wheel, so that adding
+// and removing a deadline are constant time operations, no matter how
+// many aios are outstanding.  An aio is linked (by a_expire_node) on
+// exactly one of a wheel slot, the overflow list, or the expired list,
+// so removing it is always just a matter of unlinking the node.  The
+// busy bitmaps are only hints; a stale bit simply causes the expiration
+// thread to look at an empty slot, at which point the bit is cleared.
+//
 // In order to synchronize with the expiration, we record the aio as
 // expiring, and wait for that record to be cleared (or at least not
 // equal to the aio) before destroying it.
@@ -134,6 +191,77 @@ nni_aio_free(nni_aio *aio)
 	}
 }
 
+// nni_aio_cache_fini is run when a thread with a cache exits.
+static void
+nni_aio_cache_fini(void *arg)
+{
+	nni_aio_cache *cache = arg;
+
+	nni_mtx_lock(&nni_aio_lk);
+	if (!nni_aio_cache_ok) {
+		// Already torn down (and the cache freed) by sys_fini.
+		nni_mtx_unlock(&nni_aio_lk);
+		return;
+	}
+	nni_list_remove(&nni_aio_caches, cache);
+	nni_aio_ncaches--;
+	nni_mtx_unlock(&nni_aio_lk);
+
+	nni_aio_fini(&cache->aio);
+	NNI_FREE_STRUCT(cache);
+}
+
+static nni_aio_cache *
+nni_aio_cache_get(void)
+{
+	nni_aio_cache *cache;
+
+	if ((cache = nni_plat_tls_get(&nni_aio_cache_tls)) != NULL) {
+		return (cache);
+	}
+	nni_mtx_lock(&nni_aio_lk);
+	if ((nni_aio_ncaches < NNG_AIO_SYNC_MAX_CACHES) &&
+	    ((cache = NNI_ALLOC_STRUCT(cache)) != NULL)) {
+		nni_aio_init(&cache->aio, NULL, NULL);
+		nni_list_append(&nni_aio_caches, cache);
+		nni_aio_ncaches++;
+		nni_plat_tls_set(&nni_aio_cache_tls, cache);
+	}
+	nni_mtx_unlock(&nni_aio_lk);
+	return (cache);
+}
+
+int
+nni_aio_sync_alloc(nni_aio **aiop)
+{
+	nni_aio_cache *cache;
+
+	// The cached aio might already be in use further up this thread's
+	// stack, from a callback, in which case we just allocate.
+	if (((cache = nni_aio_cache_get()) != NULL) && (!cache->busy)) {
+		cache->busy = true;
+		*aiop       = &cache->aio;
+		return (0);
+	}
+	return (nni_aio_alloc(aiop, NULL, NULL));
+}
+
+void
+nni_aio_sync_free(nni_aio *aio)
+{
+	nni_aio_cache *cache = nni_plat_tls_get(&nni_aio_cache_tls);
+
+	if ((cache == NULL) || (aio != &cache->aio)) {
+		nni_aio_free(aio);
+		return;
+	}
+	// The operation is complete, so all that is left to do is to put
+	// back what the next caller will not set for itself.
+	aio->a_msg     = NULL;
+	aio->a_timeout = NNG_DURATION_INFINITE;
+	cache->busy    = false;
+}
+
 int
 nni_aio_set_iov(nni_aio *aio, unsigned niov, const nni_iov *iov)
 {
@@ -290,6 +418,14 @@ nni_aio_wait(nni_aio *aio)
 	nni_task_wait(&aio->a_task);
 }
 
+void
+nni_aio_wait_spin(nni_aio *aio, int usec)
+{
+	if (!nni_task_spin(&aio->a_task, usec)) {
+		nni_task_wait(&aio->a_task);
+	}
+}
+
 int
 nni_aio_begin(nni_aio *aio)
 {
@@ -381,9 +517,47 @@ nni_aio_abort(nni_aio *aio, int rv)
 
 // I/O provider related functions.
 
+// How a finished aio's callback is to be run.
+#define NNI_AIO_DISPATCH 0 // on the taskq
+#define NNI_AIO_SYNCH 1    // on this thread, always
+#define NNI_AIO_INLINE 2   // on this thread, if the consumer allows it
+
+// The per thread inline state is the nesting depth, shifted left one
+// bit, with the low bit set while running an inline completion (or
+// anything nested within one).
+#define NNI_AIO_INLINE_ACTIVE 1
+
+// nni_aio_exec runs the callback on this thread, keeping count of how
+// deeply such runs are nested, and falls back to the taskq when they are
+// too deep.  Only inline completions honor the limit, since the
+// synchronous ones have always been promised to run in place -- except
+// within an inline completion, where a synchronous one is held to the
+// same rules.  Otherwise a transport callback run by the poller could
+// finish a protocol aio synchronously, and that one a user's, which
+// would put user code on the poller thread.
+static void
+nni_aio_exec(nni_aio *aio, int how)
+{
+	intptr_t state = (intptr_t) nni_plat_tls_get(&nni_aio_inline_tls);
+	intptr_t depth = state >> 1;
+	intptr_t inl   = state & NNI_AIO_INLINE_ACTIVE;
+
+	if (how == NNI_AIO_INLINE) {
+		inl = NNI_AIO_INLINE_ACTIVE;
+	}
+	if ((inl != 0) &&
+	    ((!aio->a_inline) || (depth >= NNG_AIO_INLINE_DEPTH))) {
+		nni_task_dispatch(&aio->a_task);
+		return;
+	}
+	nni_plat_tls_set(
+	    &nni_aio_inline_tls, (void *) (((depth + 1) << 1) | inl));
+	nni_task_exec(&aio->a_task);
+	nni_plat_tls_set(&nni_aio_inline_tls, (void *) state);
+}
+
 static void
-nni_aio_finish_impl(
-    nni_aio *aio, int rv, size_t count, nni_msg *msg, bool synch)
+nni_aio_finish_impl(nni_aio *aio, int rv, size_t count, nni_msg *msg, int how)
 {
 	nni_mtx_lock(&nni_aio_lk);
 
@@ -401,36 +575,92 @@ nni_aio_finish_impl(
 	aio->a_sleep  = false;
 	nni_mtx_unlock(&nni_aio_lk);
 
-	if (synch) {
-		nni_task_exec(&aio->a_task);
-	} else {
+	if (how == NNI_AIO_DISPATCH) {
 		nni_task_dispatch(&aio->a_task);
+	} else {
+		nni_aio_exec(aio, how);
 	}
 }
 
 void
 nni_aio_finish(nni_aio *aio, int result, size_t count)
 {
-	nni_aio_finish_impl(aio, result, count, NULL, false);
+	nni_aio_finish_impl(aio, result, count, NULL, NNI_AIO_DISPATCH);
 }
 
 void
 nni_aio_finish_synch(nni_aio *aio, int result, size_t count)
 {
-	nni_aio_finish_impl(aio, result, count, NULL, true);
+	nni_aio_finish_impl(aio, result, count, NULL, NNI_AIO_SYNCH);
+}
+
+void
+nni_aio_finish_inline(nni_aio *aio, int result, size_t count)
+{
+	nni_aio_finish_impl(aio, result, count, NULL, NNI_AIO_INLINE);
 }
 
 void
 nni_aio_finish_error(nni_aio *aio, int result)
 {
-	nni_aio_finish_impl(aio, result, 0, NULL, false);
+	nni_aio_finish_impl(aio, result, 0, NULL, NNI_AIO_DISPATCH);
 }
 
 void
 nni_aio_finish_msg(nni_aio *aio, nni_msg *msg)
 {
 	NNI_ASSERT(msg != NULL);
-	nni_aio_finish_impl(aio, 0, nni_msg_len(msg), msg, false);
+	nni_aio_finish_impl(aio, 0, nni_msg_len(msg), msg, NNI_AIO_DISPATCH);
+}
+
+void
+nni_aio_set_inline(nni_aio *aio, bool inl)
+{
+	aio->a_inline = inl;
+}
+
+bool
+nni_aio_inline_active(void)
+{
+	intptr_t state = (intptr_t) nni_plat_tls_get(&nni_aio_inline_tls);
+
+	return ((state & NNI_AIO_INLINE_ACTIVE) != 0);
+}
+
+void
+nni_aio_completions_init(nni_aio_completions *clp)
+{
+	*clp = NULL;
+}
+
+void
+nni_aio_completions_add(
+    nni_aio_completions *clp, nni_aio *aio, int result, size_t count)
+{
+	NNI_ASSERT(!nni_aio_list_active(aio));
+	aio->a_result    = result;
+	aio->a_count     = count;
+	aio->a_done_next = *clp;
+	*clp             = aio;
+}
+
+void
+nni_aio_completions_run(nni_aio_completions *clp)
+{
+	nni_aio *aio;
+	nni_aio *list = NULL;
+
+	// The list was built backwards; put it back in order of completion.
+	while ((aio = *clp) != NULL) {
+		*clp             = aio->a_done_next;
+		aio->a_done_next = list;
+		list             = aio;
+	}
+	while ((aio = list) != NULL) {
+		list             = aio->a_done_next;
+		aio->a_done_next = NULL;
+		nni_aio_finish_inline(aio, aio->a_result, aio->a_count);
+	}
 }
 
 void
@@ -458,25 +688,169 @@ nni_aio_list_active(nni_aio *aio)
 	return (nni_list_node_active(&aio->a_prov_node));
 }
 
+static uint64_t
+nni_aio_expire_tick(nni_time when)
+{
+	// Round up, so that we never expire early.
+	return ((when + NNG_AIO_EXPIRE_RESOLUTION - 1) /
+	    NNG_AIO_EXPIRE_RESOLUTION);
+}
+
 static void
-nni_aio_expire_add(nni_aio *aio)
+nni_aio_wheel_place(nni_aio_wheel *w, nni_aio *aio)
 {
-	nni_list *list = &nni_aio_expire_aios;
-	nni_aio * naio;
+	uint64_t tick = nni_aio_expire_tick(aio->a_expire);
+	uint64_t delta;
 
-	// This is a reverse walk of the list.  We're more likely to find
-	// a match at the end of the list.
-	for (naio = nni_list_last(list); naio != NULL;
-	     naio = nni_list_prev(list, naio)) {
-		if (aio->a_expire >= naio->a_expire) {
-			nni_list_insert_after(list, aio, naio);
+	if (tick < w->tick) {
+		// Already due.
+		nni_list_append(&w->expired, aio);
+		return;
+	}
+	delta = tick - w->tick;
+	for (unsigned lvl = 0; lvl < NNI_AIO_WHEEL_LEVELS; lvl++) {
+		unsigned shift = NNI_AIO_WHEEL_BITS * (lvl + 1);
+		if (delta < ((uint64_t) 1 << shift)) {
+			unsigned slot = (unsigned) ((tick >>
+			                    (shift - NNI_AIO_WHEEL_BITS)) &
+			    NNI_AIO_WHEEL_MASK);
+			nni_list_append(&w->slots[lvl][slot], aio);
+			w->busy[lvl] |= (uint64_t) 1 << slot;
+			return;
+		}
+	}
+	nni_list_append(&w->overflow, aio);
+}
+
+// nni_aio_wheel_cascade moves everything in the list back into the wheel,
+// which is positioned at a boundary, so that each entry lands in a finer
+// grained slot (or the expired list).
+static void
+nni_aio_wheel_cascade(nni_aio_wheel *w, nni_list *list)
+{
+	nni_aio *aio;
+
+	while ((aio = nni_list_first(list)) != NULL) {
+		nni_list_remove(list, aio);
+		nni_aio_wheel_place(w, aio);
+	}
+}
+
+// nni_aio_wheel_next returns the next tick at which something interesting
+// happens, either an expiration in level 0, or a cascade of a non-empty
+// slot in one of the higher levels.
+static uint64_t
+nni_aio_wheel_next(nni_aio_wheel *w)
+{
+	uint64_t next = NNI_AIO_WHEEL_NEVER;
+	uint64_t tick = w->tick;
+
+	for (unsigned lvl = 0; lvl < NNI_AIO_WHEEL_LEVELS; lvl++) {
+		unsigned shift = NNI_AIO_WHEEL_BITS * lvl;
+		uint64_t blk   = tick >> shift;
+		unsigned d;
+
+		if (w->busy[lvl] == 0) {
+			continue;
+		}
+		// The slot for the current block at higher levels has
+		// already been cascaded, unless we are sitting right on
+		// its boundary.
+		d = ((lvl == 0) || ((blk << shift) == tick)) ? 0 : 1;
+		for (; d <= NNI_AIO_WHEEL_SLOTS; d++) {
+			uint64_t b    = blk + d;
+			unsigned slot = (unsigned) (b & NNI_AIO_WHEEL_MASK);
+			if ((w->busy[lvl] & ((uint64_t) 1 << slot)) == 0) {
+				continue;
+			}
+			if (nni_list_empty(&w->slots[lvl][slot])) {
+				// Everything here was removed already.
+				w->busy[lvl] &= ~((uint64_t) 1 << slot);
+				continue;
+			}
+			if ((b << shift) < next) {
+				next = b << shift;
+			}
 			break;
 		}
 	}
-	if (naio == NULL) {
-		// This has the shortest time, so insert at the start.
-		nni_list_prepend(list, aio);
-		// And, as we are the latest, kick the thing.
+	if (!nni_list_empty(&w->overflow)) {
+		unsigned shift = NNI_AIO_WHEEL_BITS * NNI_AIO_WHEEL_LEVELS;
+		uint64_t when  = ((tick >> shift) + 1) << shift;
+		if (when < next) {
+			next = when;
+		}
+	}
+	return (next);
+}
+
+// nni_aio_wheel_advance processes every tick up to and including now,
+// moving expired aios onto the expired list.
+static void
+nni_aio_wheel_advance(nni_aio_wheel *w, uint64_t now)
+{
+	while (w->tick <= now) {
+		uint64_t tick = w->tick;
+		unsigned slot = (unsigned) (tick & NNI_AIO_WHEEL_MASK);
+		uint64_t rest;
+
+		// On a boundary, cascade the coarser slots that are now
+		// current, starting with the coarsest.
+		for (unsigned lvl = NNI_AIO_WHEEL_LEVELS; lvl > 0; lvl--) {
+			unsigned shift = NNI_AIO_WHEEL_BITS * lvl;
+			unsigned hs;
+			if ((tick & (((uint64_t) 1 << shift) - 1)) != 0) {
+				continue;
+			}
+			if (lvl == NNI_AIO_WHEEL_LEVELS) {
+				nni_aio_wheel_cascade(w, &w->overflow);
+				continue;
+			}
+			hs = (unsigned) ((tick >> shift) & NNI_AIO_WHEEL_MASK);
+			w->busy[lvl] &= ~((uint64_t) 1 << hs);
+			nni_aio_wheel_cascade(w, &w->slots[lvl][hs]);
+		}
+
+		if (w->busy[0] & ((uint64_t) 1 << slot)) {
+			nni_list *list = &w->slots[0][slot];
+			nni_aio * aio;
+			w->busy[0] &= ~((uint64_t) 1 << slot);
+			while ((aio = nni_list_first(list)) != NULL) {
+				nni_list_remove(list, aio);
+				nni_list_append(&w->expired, aio);
+			}
+		}
+
+		w->tick = tick + 1;
+
+		// If there is nothing else left in this round of level 0,
+		// skip directly ahead to the next interesting tick.
+		rest = 0;
+		if (slot != NNI_AIO_WHEEL_MASK) {
+			rest = w->busy[0] >> (slot + 1);
+		}
+		if (rest == 0) {
+			uint64_t next = nni_aio_wheel_next(w);
+			if (next > now) {
+				w->tick = now + 1;
+				break;
+			}
+			if (next > w->tick) {
+				w->tick = next;
+			}
+		}
+	}
+}
+
+static void
+nni_aio_expire_add(nni_aio *aio)
+{
+	nni_aio_wheel *w = &nni_aio_expire_wheel;
+
+	nni_aio_wheel_place(w, aio);
+
+	// Kick the expiration thread if it plans to sleep past us.
+	if (nni_aio_expire_tick(aio->a_expire) < w->wake) {
 		nni_cv_wake(&nni_aio_expire_cv);
 	}
 }
@@ -484,42 +858,43 @@ nni_aio_expire_add(nni_aio *aio)
 static void
 nni_aio_expire_loop(void *unused)
 {
-	nni_list *aios = &nni_aio_expire_aios;
+	nni_aio_wheel *w = &nni_aio_expire_wheel;
 
 	NNI_ARG_UNUSED(unused);
 
+	nni_mtx_lock(&nni_aio_lk);
 	for (;;) {
 		nni_aio_cancelfn fn;
-		nni_time         now;
 		nni_aio *        aio;
+		uint64_t         next;
 		int              rv;
 
-		now = nni_clock();
-
-		nni_mtx_lock(&nni_aio_lk);
-
-		if ((aio = nni_list_first(aios)) == NULL) {
-
-			if (nni_aio_expire_run == 0) {
-				nni_mtx_unlock(&nni_aio_lk);
-				return;
+		nni_aio_wheel_advance(
+		    w, nni_clock() / NNG_AIO_EXPIRE_RESOLUTION);
+
+		if ((aio = nni_list_first(&w->expired)) == NULL) {
+
+			next = nni_aio_wheel_next(w);
+			if (next == NNI_AIO_WHEEL_NEVER) {
+				if (nni_aio_expire_run == 0) {
+					break;
+				}
+				w->wake = NNI_AIO_WHEEL_NEVER;
+				nni_cv_wait(&nni_aio_expire_cv);
+			} else {
+				w->wake = next;
+				nni_cv_until(&nni_aio_expire_cv,
+				    next * NNG_AIO_EXPIRE_RESOLUTION);
 			}
-
-			nni_cv_wait(&nni_aio_expire_cv);
-			nni_mtx_unlock(&nni_aio_lk);
-			continue;
-		}
-
-		if (now < aio->a_expire) {
-			// Unexpired; the list is ordered, so we just wait.
-			nni_cv_until(&nni_aio_expire_cv, aio->a_expire);
-			nni_mtx_unlock(&nni_aio_lk);
+			// We are awake, and will look at the wheel again
+			// before sleeping, so nobody needs to kick us.
+			w->wake = 0;
 			continue;
 		}
 
 		// This aio's time has come.  Expire it, canceling any
 		// outstanding I/O.
-		nni_list_remove(aios, aio);
+		nni_list_remove(&w->expired, aio);
 		rv = aio->a_expire_ok ? 0 : NNG_ETIMEDOUT;
 
 		if ((fn = aio->a_cancel_fn) != NULL) {
@@ -541,8 +916,8 @@ nni_aio_expire_loop(void *unused)
 			nni_aio_expire_aio = NULL;
 			nni_cv_wake(&nni_aio_expire_cv);
 		}
-		nni_mtx_unlock(&nni_aio_lk);
 	}
+	nni_mtx_unlock(&nni_aio_lk);
 }
 
 void *
@@ -671,22 +1046,64 @@ nni_aio_sys_fini(void)
 		nni_mtx_unlock(mtx);
 	}
 
+	if (nni_aio_cache_ok) {
+		nni_aio_cache *cache;
+
+		nni_mtx_lock(mtx);
+		nni_aio_cache_ok = false;
+		nni_mtx_unlock(mtx);
+		while ((cache = nni_list_first(&nni_aio_caches)) != NULL) {
+			nni_list_remove(&nni_aio_caches, cache);
+			nni_aio_fini(&cache->aio);
+			NNI_FREE_STRUCT(cache);
+		}
+		nni_aio_ncaches = 0;
+		nni_plat_tls_fini(&nni_aio_cache_tls);
+	}
+
 	nni_thr_fini(thr);
 	nni_cv_fini(cv);
 	nni_mtx_fini(mtx);
+	if (nni_aio_inline_ok) {
+		nni_plat_tls_fini(&nni_aio_inline_tls);
+		nni_aio_inline_ok = false;
+	}
 }
 
 int
 nni_aio_sys_init(void)
 {
-	int      rv;
-	nni_mtx *mtx = &nni_aio_lk;
-	nni_cv * cv  = &nni_aio_expire_cv;
-	nni_thr *thr = &nni_aio_expire_thr;
-
-	NNI_LIST_INIT(&nni_aio_expire_aios, nni_aio, a_expire_node);
+	int            rv;
+	nni_mtx *      mtx = &nni_aio_lk;
+	nni_cv *       cv  = &nni_aio_expire_cv;
+	nni_thr *      thr = &nni_aio_expire_thr;
+	nni_aio_wheel *w   = &nni_aio_expire_wheel;
+
+	for (unsigned lvl = 0; lvl < NNI_AIO_WHEEL_LEVELS; lvl++) {
+		for (unsigned i = 0; i < NNI_AIO_WHEEL_SLOTS; i++) {
+			NNI_LIST_INIT(
+			    &w->slots[lvl][i], nni_aio, a_expire_node);
+		}
+		w->busy[lvl] = 0;
+	}
+	NNI_LIST_INIT(&w->overflow, nni_aio, a_expire_node);
+	NNI_LIST_INIT(&w->expired, nni_aio, a_expire_node);
+	w->tick = nni_clock() / NNG_AIO_EXPIRE_RESOLUTION;
+	w->wake = 0;
 	nni_mtx_init(mtx);
 	nni_cv_init(cv, mtx);
+	if ((rv = nni_plat_tls_init(&nni_aio_inline_tls, NULL)) != 0) {
+		nni_aio_sys_fini();
+		return (rv);
+	}
+	nni_aio_inline_ok = true;
+	NNI_LIST_INIT(&nni_aio_caches, nni_aio_cache, node);
+	if ((rv = nni_plat_tls_init(
+	         &nni_aio_cache_tls, nni_aio_cache_fini)) != 0) {
+		nni_aio_sys_fini();
+		return (rv);
+	}
+	nni_aio_cache_ok = true;
 #ifdef __NuttX__
 	thr->name = "nngaio";
 #endif
@@ -40,6 +40,14 @@ extern int nni_aio_alloc(nni_aio **, nni_cb, void *arg);
 // with nni_aio_allocate.
 extern void nni_aio_free(nni_aio *aio);
 
+// nni_aio_sync_alloc provides an aio, with no callback, for an operation
+// that the caller will wait for.  It is normally borrowed from a cache
+// kept by the calling thread, so that synchronous operations need not
+// allocate anything.  It must be returned, by the same thread and once
+// the operation is complete, with nni_aio_sync_free.
+extern int  nni_aio_sync_alloc(nni_aio **);
+extern void nni_aio_sync_free(nni_aio *);
+
 // nni_aio_stop cancels any unfinished I/O, running completion callbacks,
 // but also prevents any new operations from starting (nni_aio_start will
 // return NNG_ESTATE).  This should be called before nni_aio_free().  The
@@ -106,6 +114,11 @@ extern size_t nni_aio_count(nni_aio *);
 // lieu of a callback to build synchronous constructs on top of AIOs.
 extern void nni_aio_wait(nni_aio *);
 
+// nni_aio_wait_spin is nni_aio_wait, but first spins for up to the
+// given number of microseconds, for callers that would rather burn a
+// CPU than sleep and be woken up.  See nni_task_spin.
+extern void nni_aio_wait_spin(nni_aio *, int);
+
 // nni_aio_list_init creates a list suitable for use by providers using
 // the a_prov_node member of the aio.  These operations are not locked,
 // but they do have some extra checks -- remove is idempotent for example,
@@ -120,11 +133,55 @@ extern void nni_aio_finish(nni_aio *, int, size_t);
 // nni_aio_finish_synch is to be called when a synchronous completion is
 // desired.  It is very important that the caller not hold any locks when
 // calling this, but it is useful for chaining completions to minimize
-// context switch overhead during completions.
+// context switch overhead during completions.  Within a callback run by
+// nni_aio_finish_inline, it behaves like nni_aio_finish_inline, so that
+// an inline chain never reaches a consumer that did not allow it.
 extern void nni_aio_finish_synch(nni_aio *, int, size_t);
 extern void nni_aio_finish_error(nni_aio *, int);
 extern void nni_aio_finish_msg(nni_aio *, nni_msg *);
 
+// NNG_AIO_INLINE_DEPTH is the number of completions that may be run
+// nested on a single thread by nni_aio_finish_inline (and by
+// nni_aio_finish_synch) before further ones are sent to the taskq.
+// This bounds the stack used by chains of completions that start new
+// operations which complete right away.
+#ifndef NNG_AIO_INLINE_DEPTH
+#define NNG_AIO_INLINE_DEPTH 4
+#endif
+
+// nni_aio_set_inline is called by the consumer to say that its callback
+// may be run directly by the thread completing the operation, rather than
+// by the taskq.  Such a callback must not block, and must not take any
+// lock that a provider might hold while finishing an operation; in
+// practice it should only take its own locks, and start further
+// operations.  This is meant for transport and protocol internals,
+// never for user supplied callbacks.
+extern void nni_aio_set_inline(nni_aio *, bool);
+
+// nni_aio_finish_inline is nni_aio_finish, but runs the callback on the
+// calling thread when the consumer has allowed that with
+// nni_aio_set_inline, and the thread is not already nested too deeply.
+// Otherwise the callback is dispatched as usual.  As with
+// nni_aio_finish_synch the caller must not hold any locks, which in
+// practice limits this to the top of a poller or taskq thread.
+extern void nni_aio_finish_inline(nni_aio *, int, size_t);
+
+// nni_aio_inline_active returns true if the calling thread is running a
+// callback started by nni_aio_finish_inline, directly or nested.  This
+// is for assertions and tests.
+extern bool nni_aio_inline_active(void);
+
+// nni_aio_completions is a list of operations finished by a provider
+// while holding its own lock, to be completed once the lock is dropped,
+// with nni_aio_finish_inline.  The provider must have removed each aio
+// from its own lists, so that a racing cancellation finds nothing to do.
+typedef nni_aio *nni_aio_completions;
+
+extern void nni_aio_completions_init(nni_aio_completions *);
+extern void nni_aio_completions_add(
+    nni_aio_completions *, nni_aio *, int, size_t);
+extern void nni_aio_completions_run(nni_aio_completions *);
+
 // nni_aio_abort is used to abort an operation.  Any pending I/O or
 // timeouts are canceled if possible, and the callback will be returned
 // with the indicated result (NNG_ECLOSED or NNG_ECANCELED is recommended.)
@@ -187,6 +244,7 @@ struct nng_aio {
 	bool         a_stop;      // Shutting down (no new operations)
 	bool         a_sleep;     // Sleeping with no action
 	bool         a_expire_ok; // Expire from sleep is ok
+	bool         a_inline;    // Callback may run on the finishing thread
 	nni_task     a_task;
 
 	// Read/write operations.
@@ -211,6 +269,7 @@ struct nng_aio {
 	void *           a_cancel_arg;
 	nni_list_node    a_prov_node;     // Linkage on provider list.
 	void *           a_prov_extra[4]; // Extra data used by provider
+	nni_aio *        a_done_next;     // Linkage on nni_aio_completions
 
 	// Socket address.  This turns out to be very useful, as we wind up
 	// needing socket addresses for numerous connection related routines.
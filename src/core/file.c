@@ -22,6 +22,13 @@ nni_file_get(const char *name, void **datap, size_t *szp)
 	return (nni_plat_file_get(name, datap, szp));
 }
 
+int
+nni_file_info(
+    const char *name, uint64_t *sizep, uint64_t *mtimep, uint64_t *idp)
+{
+	return (nni_plat_file_info(name, sizep, mtimep, idp));
+}
+
 int
 nni_file_delete(const char *name)
 {
@@ -130,6 +137,41 @@ nni_file_basename(const char *path)
 	return (nni_plat_file_basename(path));
 }
 
+struct nni_file_handle {
+	nni_plat_fh fh;
+};
+
+int
+nni_file_open(const char *name, nni_file_handle **hp, uint64_t *sizep)
+{
+	nni_file_handle *h;
+	int              rv;
+
+	if ((h = NNI_ALLOC_STRUCT(h)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_plat_file_open(name, &h->fh, sizep)) != 0) {
+		NNI_FREE_STRUCT(h);
+		return (rv);
+	}
+	*hp = h;
+	return (0);
+}
+
+int
+nni_file_pread(
+    nni_file_handle *h, void *buf, size_t len, uint64_t off, size_t *np)
+{
+	return (nni_plat_file_pread(&h->fh, buf, len, off, np));
+}
+
+void
+nni_file_close(nni_file_handle *h)
+{
+	nni_plat_file_close(&h->fh);
+	NNI_FREE_STRUCT(h);
+}
+
 struct nni_file_lockh {
 	nni_plat_flock lk;
 };
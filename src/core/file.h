@@ -37,6 +37,22 @@ extern int nni_file_put(const char *, const void *, size_t);
 // using the supplied size when no longer needed.
 extern int nni_file_get(const char *, void **, size_t *);
 
+// nni_file_open opens the named file for reading piecewise, with
+// nni_file_pread, rather than all at once.  The size is returned.
+// NNG_ENOTSUP means the file is not a regular file, and should be read
+// with nni_file_get.  The handle is released with nni_file_close.
+typedef struct nni_file_handle nni_file_handle;
+
+extern int  nni_file_open(const char *, nni_file_handle **, uint64_t *);
+extern int  nni_file_pread(
+    nni_file_handle *, void *, size_t, uint64_t, size_t *);
+extern void nni_file_close(nni_file_handle *);
+
+// nni_file_info returns the size, modification time (nanoseconds since the
+// Unix epoch) and file number (inode) of a regular file.  Other kinds of
+// file give NNG_ENOTSUP.
+extern int nni_file_info(const char *, uint64_t *, uint64_t *, uint64_t *);
+
 // nni_file_delete deletes the named file.
 extern int nni_file_delete(const char *);
 
@@ -0,0 +1,306 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+// The low NNI_HANDLE_IDX_BITS of an ID select the slot, which limits
+// the number of live handles in a table to about a quarter million.
+// The rest of the 31 bits are the generation.  Slot 0 is never used,
+// so that no ID is zero.
+#define NNI_HANDLE_IDX_BITS 18
+#define NNI_HANDLE_IDX_MASK ((1u << NNI_HANDLE_IDX_BITS) - 1)
+#define NNI_HANDLE_GEN_MASK (0x7fffffffu >> NNI_HANDLE_IDX_BITS)
+
+// Chunk 0 holds the first 256 slots, and each chunk after that doubles
+// the size of the table.
+#define NNI_HANDLE_CHUNK_BITS 8
+#define NNI_HANDLE_NCHUNKS (NNI_HANDLE_IDX_BITS - NNI_HANDLE_CHUNK_BITS + 1)
+
+// Freed slots are not reused until there are more than this many, or
+// a quarter of the table, whichever is larger.  A slot's generation
+// only wraps after it has been reused 8192 times, so an ID cannot come
+// back until at least (NNI_HANDLE_REUSE + 1) * 8192 (about 8 million)
+// handles have been allocated, and longer as the table grows.
+#define NNI_HANDLE_REUSE 1024
+
+// Each slot gets its own cache line, so that threads working on
+// different handles do not slow each other down.
+#define NNI_HANDLE_SLOT_SIZE 64
+
+// The slot word holds the ID in the upper half, then the closed flag,
+// then the reference count.
+#define NNI_HANDLE_CLOSED (1ull << 31)
+#define NNI_HANDLE_REFS (NNI_HANDLE_CLOSED - 1)
+
+typedef struct {
+	nni_atomic_u64 s_word;
+	void *         s_obj;
+	uint32_t       s_next; // next free slot, protected by table lock
+	uint32_t       s_gen;  // generation for next use, ditto
+} nni_handle_slot;
+
+struct nni_handles {
+	nni_mtx        t_mtx;
+	nni_atomic_u64 t_chunks[NNI_HANDLE_NCHUNKS];
+	uint32_t       t_next;  // next slot never yet used
+	uint32_t       t_first; // oldest free slot
+	uint32_t       t_last;  // newest free slot
+	uint32_t       t_nfree;
+	bool           t_random;
+};
+
+static size_t
+handle_chunk_size(int k)
+{
+	return ((size_t) 1 << (k == 0 ? NNI_HANDLE_CHUNK_BITS
+	                              : (k + NNI_HANDLE_CHUNK_BITS - 1)));
+}
+
+static int
+handle_chunk(uint32_t idx)
+{
+	int k = 0;
+	while ((idx >> (k + NNI_HANDLE_CHUNK_BITS)) != 0) {
+		k++;
+	}
+	return (k);
+}
+
+static nni_handle_slot *
+handle_slot(nni_handles *t, uint32_t idx)
+{
+	int      k;
+	uint8_t *chunk;
+
+	k     = handle_chunk(idx);
+	chunk = (uint8_t *) (uintptr_t) nni_atomic_get64(&t->t_chunks[k]);
+	if (chunk == NULL) {
+		return (NULL);
+	}
+	if (k != 0) {
+		idx -= (uint32_t) handle_chunk_size(k);
+	}
+	return ((nni_handle_slot *) (chunk + idx * NNI_HANDLE_SLOT_SIZE));
+}
+
+// handle_find returns the slot for an ID that the caller knows to be
+// allocated, i.e. one it holds a reference on.
+static nni_handle_slot *
+handle_find(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s = handle_slot(t, id & NNI_HANDLE_IDX_MASK);
+	NNI_ASSERT(s != NULL);
+	NNI_ASSERT((nni_atomic_get64(&s->s_word) >> 32) == id);
+	return (s);
+}
+
+int
+nni_handles_init(nni_handles **tp, bool random)
+{
+	nni_handles *t;
+
+	NNI_ASSERT(sizeof(nni_handle_slot) <= NNI_HANDLE_SLOT_SIZE);
+	if ((t = NNI_ALLOC_STRUCT(t)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	nni_mtx_init(&t->t_mtx);
+	for (int k = 0; k < NNI_HANDLE_NCHUNKS; k++) {
+		nni_atomic_init64(&t->t_chunks[k]);
+	}
+	t->t_next   = 1;
+	t->t_random = random;
+	*tp         = t;
+	return (0);
+}
+
+void
+nni_handles_fini(nni_handles *t)
+{
+	for (int k = 0; k < NNI_HANDLE_NCHUNKS; k++) {
+		void *chunk;
+
+		chunk = (void *) (uintptr_t) nni_atomic_get64(&t->t_chunks[k]);
+		if (chunk != NULL) {
+			nni_free(chunk,
+			    handle_chunk_size(k) * NNI_HANDLE_SLOT_SIZE);
+		}
+	}
+	nni_mtx_fini(&t->t_mtx);
+	NNI_FREE_STRUCT(t);
+}
+
+int
+nni_handle_alloc(nni_handles *t, uint32_t *idp, void *obj, unsigned refs)
+{
+	nni_handle_slot *s;
+	uint32_t         idx;
+	uint32_t         id;
+	uint32_t         reuse;
+
+	nni_mtx_lock(&t->t_mtx);
+	reuse = t->t_next / 4;
+	if (reuse < NNI_HANDLE_REUSE) {
+		reuse = NNI_HANDLE_REUSE;
+	}
+	if ((t->t_nfree > reuse) ||
+	    ((t->t_nfree > 0) && (t->t_next > NNI_HANDLE_IDX_MASK))) {
+		idx        = t->t_first;
+		s          = handle_slot(t, idx);
+		t->t_first = s->s_next;
+		t->t_nfree--;
+	} else if (t->t_next <= NNI_HANDLE_IDX_MASK) {
+		int k;
+
+		idx = t->t_next;
+		k   = handle_chunk(idx);
+		if (nni_atomic_get64(&t->t_chunks[k]) == 0) {
+			void * chunk;
+			size_t sz;
+
+			sz = handle_chunk_size(k) * NNI_HANDLE_SLOT_SIZE;
+			if ((chunk = nni_zalloc(sz)) == NULL) {
+				nni_mtx_unlock(&t->t_mtx);
+				return (NNG_ENOMEM);
+			}
+			nni_atomic_set64(&t->t_chunks[k], (uintptr_t) chunk);
+		}
+		s = handle_slot(t, idx);
+		nni_atomic_init64(&s->s_word);
+		if (t->t_random) {
+			s->s_gen = nni_random() & NNI_HANDLE_GEN_MASK;
+		}
+		t->t_next++;
+	} else {
+		nni_mtx_unlock(&t->t_mtx);
+		return (NNG_ENOMEM);
+	}
+
+	id       = (s->s_gen << NNI_HANDLE_IDX_BITS) | idx;
+	s->s_obj = obj;
+	nni_atomic_set64(&s->s_word,
+	    ((uint64_t) id << 32) | NNI_HANDLE_CLOSED |
+	        (refs & NNI_HANDLE_REFS));
+	nni_mtx_unlock(&t->t_mtx);
+
+	*idp = id;
+	return (0);
+}
+
+void
+nni_handle_publish(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s = handle_find(t, id);
+	uint64_t         w;
+
+	do {
+		w = nni_atomic_get64(&s->s_word);
+	} while (!nni_atomic_cas64(&s->s_word, w, w & ~NNI_HANDLE_CLOSED));
+}
+
+void
+nni_handle_free(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s;
+	uint32_t         idx = id & NNI_HANDLE_IDX_MASK;
+
+	nni_mtx_lock(&t->t_mtx);
+	s = handle_find(t, id);
+	nni_atomic_set64(&s->s_word, 0);
+	s->s_obj  = NULL;
+	s->s_gen  = (s->s_gen + 1) & NNI_HANDLE_GEN_MASK;
+	s->s_next = 0;
+	if (t->t_nfree == 0) {
+		t->t_first = idx;
+	} else {
+		handle_slot(t, t->t_last)->s_next = idx;
+	}
+	t->t_last = idx;
+	t->t_nfree++;
+	nni_mtx_unlock(&t->t_mtx);
+}
+
+int
+nni_handle_hold(nni_handles *t, uint32_t id, void **objp)
+{
+	nni_handle_slot *s;
+	uint64_t         w;
+
+	if ((id & NNI_HANDLE_IDX_MASK) == 0) {
+		return (NNG_ENOENT);
+	}
+	if ((s = handle_slot(t, id & NNI_HANDLE_IDX_MASK)) == NULL) {
+		return (NNG_ENOENT);
+	}
+	do {
+		w = nni_atomic_get64(&s->s_word);
+		if (((w >> 32) != id) || ((w & NNI_HANDLE_CLOSED) != 0)) {
+			return (NNG_ENOENT);
+		}
+	} while (!nni_atomic_cas64(&s->s_word, w, w + 1));
+
+	// The object cannot change while we hold the reference.
+	if (objp != NULL) {
+		*objp = s->s_obj;
+	}
+	return (0);
+}
+
+bool
+nni_handle_rele_fast(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s = handle_find(t, id);
+	uint64_t         w;
+
+	do {
+		w = nni_atomic_get64(&s->s_word);
+		if ((w & NNI_HANDLE_CLOSED) != 0) {
+			return (false);
+		}
+		NNI_ASSERT((w & NNI_HANDLE_REFS) != 0);
+	} while (!nni_atomic_cas64(&s->s_word, w, w - 1));
+	return (true);
+}
+
+unsigned
+nni_handle_rele(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s = handle_find(t, id);
+	uint64_t         w;
+
+	w = nni_atomic_dec64_nv(&s->s_word);
+	return ((unsigned) (w & NNI_HANDLE_REFS));
+}
+
+unsigned
+nni_handle_close(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s = handle_find(t, id);
+	uint64_t         w;
+
+	do {
+		w = nni_atomic_get64(&s->s_word);
+	} while (!nni_atomic_cas64(&s->s_word, w, w | NNI_HANDLE_CLOSED));
+	return ((unsigned) (w & NNI_HANDLE_REFS));
+}
+
+unsigned
+nni_handle_refs(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s = handle_find(t, id);
+
+	return ((unsigned) (nni_atomic_get64(&s->s_word) & NNI_HANDLE_REFS));
+}
+
+bool
+nni_handle_closed(nni_handles *t, uint32_t id)
+{
+	nni_handle_slot *s = handle_find(t, id);
+
+	return ((nni_atomic_get64(&s->s_word) & NNI_HANDLE_CLOSED) != 0);
+}
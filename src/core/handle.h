@@ -0,0 +1,69 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_HANDLE_H
+#define CORE_HANDLE_H
+
+#include "core/defs.h"
+
+// Handle tables give out the 32-bit IDs that applications use for
+// sockets, contexts and pipes, and look them up again on every call.
+// Lookups are the common case, so they take no lock at all: each
+// handle is a slot holding a single atomic word that combines the ID,
+// a closed flag, and the reference count, and a lookup is just a load
+// and a compare-and-swap on that word.  Slots live in chunks that are
+// never freed until the table is, so a lookup with a stale or bogus ID
+// is always safe.  The low bits of an ID select the slot, and the high
+// bits are a generation that changes each time the slot is reused.
+//
+// Allocation and freeing take the table lock.  Freed slots are queued,
+// and are only reused after a number of others have been freed, so
+// that an ID is not handed out again soon after it was closed.
+//
+// Once a handle is closed, no new references can be obtained, and
+// nni_handle_rele_fast refuses to drop references, so that the owner
+// can drop them (nni_handle_rele) under whatever lock it uses to wait
+// for the last one to go.
+
+typedef struct nni_handles nni_handles;
+
+// nni_handles_init creates a table.  If random is true, the IDs
+// handed out are not predictable.
+extern int  nni_handles_init(nni_handles **, bool);
+extern void nni_handles_fini(nni_handles *);
+
+// nni_handle_alloc reserves an ID for the object, with the given
+// number of references.  The handle starts closed, so it cannot be
+// found until nni_handle_publish is called.
+extern int  nni_handle_alloc(nni_handles *, uint32_t *, void *, unsigned);
+extern void nni_handle_publish(nni_handles *, uint32_t);
+
+// nni_handle_free releases the ID.  The caller must be sure that no
+// references other than its own remain.
+extern void nni_handle_free(nni_handles *, uint32_t);
+
+// nni_handle_hold obtains a reference to an open handle, returning the
+// object, or NNG_ENOENT if there is no such handle or it is closed.
+extern int nni_handle_hold(nni_handles *, uint32_t, void **);
+
+// nni_handle_rele_fast drops a reference, unless the handle is closed,
+// in which case it does nothing and returns false.
+extern bool nni_handle_rele_fast(nni_handles *, uint32_t);
+
+// nni_handle_rele drops a reference, returning the number remaining.
+extern unsigned nni_handle_rele(nni_handles *, uint32_t);
+
+// nni_handle_close marks the handle closed, returning the number of
+// references held at that moment.  It is idempotent.
+extern unsigned nni_handle_close(nni_handles *, uint32_t);
+
+extern unsigned nni_handle_refs(nni_handles *, uint32_t);
+extern bool     nni_handle_closed(nni_handles *, uint32_t);
+
+#endif // CORE_HANDLE_H
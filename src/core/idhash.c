@@ -1,5 +1,5 @@
 //
-// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
 // Copyright 2018 Capitar IT Group BV <info@capitar.com>
 //
 // This software is supplied under the terms of the MIT License, a
@@ -12,340 +12,469 @@
 
 #include <string.h>
 
+// Slots are probed a group at a time.  Each slot has a control byte,
+// which is either EMPTY, DELETED, or (for a full slot) seven bits of
+// the key's hash.  The control bytes for a group are loaded into a
+// single 64-bit word, and compared all at once, so a lookup normally
+// checks one group and compares exactly one key.
+#define NNI_IDHASH_GROUP 8
+#define NNI_IDHASH_EMPTY 0x80u
+#define NNI_IDHASH_DELETED 0xfeu
+
+#define NNI_IDHASH_LSBS 0x0101010101010101ull
+#define NNI_IDHASH_MSBS 0x8080808080808080ull
+
+// The table is split into shards by hash, each with its own lock, so
+// that threads working on different keys rarely contend.
+#define NNI_IDHASH_SHARD_BITS 3
+#define NNI_IDHASH_SHARDS (1u << NNI_IDHASH_SHARD_BITS)
+
+// When a shard is resized, the old slots are moved over a few groups
+// at a time by subsequent updates, rather than all at once.
+#define NNI_IDHASH_DRAIN 4
+
 struct nni_idhash_entry {
 	uint64_t ihe_key;
 	void *   ihe_val;
-	uint32_t ihe_skips;
 };
 
+typedef struct {
+	uint8_t *         it_ctrl;
+	nni_idhash_entry *it_ents;
+	size_t            it_cap;   // slots, a power of two (or zero)
+	size_t            it_count; // full slots
+	size_t            it_used;  // full and deleted slots
+} nni_idhash_table;
+
+typedef struct {
+	nni_mtx          is_mtx;
+	nni_idhash_table is_cur;
+	nni_idhash_table is_old;   // being drained into is_cur
+	size_t           is_drain; // next group of is_old to drain
+} nni_idhash_shard;
+
 struct nni_idhash {
-	size_t            ih_cap;
-	size_t            ih_count;
-	size_t            ih_load;
-	size_t            ih_minload; // considers placeholders
-	size_t            ih_maxload;
-	uint64_t          ih_minval;
-	uint64_t          ih_maxval;
-	uint64_t          ih_dynval;
-	nni_idhash_entry *ih_entries;
-	nni_mtx           ih_mtx;
+	nni_idhash_shard ih_shards[NNI_IDHASH_SHARDS];
+	nni_atomic_u64   ih_dynval;
+	uint64_t         ih_minval;
+	uint64_t         ih_maxval;
 };
 
-int
-nni_idhash_init(nni_idhash **hp)
+// IDs are often consecutive, and a multiply spreads them well enough
+// (folding the top half in first, so that keys differing only there
+// do not collide).  The top bits pick the shard, the bottom seven are
+// stored in the control byte, and the rest pick the group.
+static uint64_t
+idhash_hash(uint64_t key)
 {
-	nni_idhash *h;
+	key = (key ^ (key >> 32)) * 0x9e3779b97f4a7c15ull;
+	return (key ^ (key >> 32));
+}
 
-	if ((h = NNI_ALLOC_STRUCT(h)) == NULL) {
-		return (NNG_ENOMEM);
-	}
-	nni_mtx_init(&h->ih_mtx);
-	h->ih_entries = NULL;
-	h->ih_count   = 0;
-	h->ih_load    = 0;
-	h->ih_cap     = 0;
-	h->ih_maxload = 0;
-	h->ih_minload = 0; // never shrink below this
-	h->ih_minval  = 0;
-	h->ih_maxval  = 0xffffffff;
-	h->ih_dynval  = 0;
-	*hp           = h;
-	return (0);
+#define NNI_IDHASH_SHARD(h) ((h) >> (64 - NNI_IDHASH_SHARD_BITS))
+#define NNI_IDHASH_TAG(h) ((uint8_t)((h) & 0x7fu))
+
+// Compilers turn this into a single load on little-endian machines.
+static uint64_t
+idhash_group(const uint8_t *c)
+{
+	return (((uint64_t) c[0]) | ((uint64_t) c[1] << 8) |
+	    ((uint64_t) c[2] << 16) | ((uint64_t) c[3] << 24) |
+	    ((uint64_t) c[4] << 32) | ((uint64_t) c[5] << 40) |
+	    ((uint64_t) c[6] << 48) | ((uint64_t) c[7] << 56));
 }
 
-void
-nni_idhash_fini(nni_idhash *h)
+// The match functions return the high bit of each matching byte.
+// Matching the tag may rarely report a false positive, which the
+// key comparison takes care of.
+static uint64_t
+idhash_match_tag(uint64_t g, uint8_t tag)
 {
-	if (h != NULL) {
-		if (h->ih_entries != NULL) {
-			NNI_FREE_STRUCTS(h->ih_entries, h->ih_cap);
-			h->ih_entries = NULL;
-			h->ih_cap = h->ih_count = 0;
-			h->ih_load = h->ih_minload = h->ih_maxload = 0;
-		}
-		nni_mtx_fini(&h->ih_mtx);
-		NNI_FREE_STRUCT(h);
+	uint64_t x = g ^ (NNI_IDHASH_LSBS * tag);
+	return ((x - NNI_IDHASH_LSBS) & ~x & NNI_IDHASH_MSBS);
+}
+
+static uint64_t
+idhash_match_empty(uint64_t g)
+{
+	return (g & ~(g << 6) & NNI_IDHASH_MSBS);
+}
+
+static uint64_t
+idhash_match_free(uint64_t g)
+{
+	return (g & NNI_IDHASH_MSBS);
+}
+
+// idhash_first returns the slot within the group of the first match.
+static size_t
+idhash_first(uint64_t m)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return ((size_t) __builtin_ctzll(m) / 8);
+#else
+	size_t i = 0;
+	while ((m & 0x80u) == 0) {
+		m >>= 8;
+		i++;
 	}
+	return (i);
+#endif
 }
 
-void
-nni_idhash_set_limits(
-    nni_idhash *h, uint64_t minval, uint64_t maxval, uint64_t start)
+static int
+idhash_table_init(nni_idhash_table *t, size_t cap)
 {
-	if (start < minval) {
-		start = minval;
+	if ((t->it_ctrl = nni_alloc(cap)) == NULL) {
+		return (NNG_ENOMEM);
 	}
-	if (start > maxval) {
-		start = maxval;
+	if ((t->it_ents = NNI_ALLOC_STRUCTS(t->it_ents, cap)) == NULL) {
+		nni_free(t->it_ctrl, cap);
+		return (NNG_ENOMEM);
 	}
-
-	nni_mtx_lock(&h->ih_mtx);
-	h->ih_minval = minval;
-	h->ih_maxval = maxval;
-	h->ih_dynval = start;
-	NNI_ASSERT(minval < maxval);
-	NNI_ASSERT(start >= minval);
-	NNI_ASSERT(start <= maxval);
-	nni_mtx_unlock(&h->ih_mtx);
+	memset(t->it_ctrl, NNI_IDHASH_EMPTY, cap);
+	t->it_cap   = cap;
+	t->it_count = 0;
+	t->it_used  = 0;
+	return (0);
 }
 
-// Inspired by Python dict implementation.  This probe will visit every
-// cell.  We always hash consecutively assigned IDs.
-#define NNI_IDHASH_NEXTPROBE(h, j) ((((j) *5) + 1) & (h->ih_cap - 1))
-#define NNI_IDHASH_INDEX(h, j) ((j) & (h->ih_cap - 1))
+static void
+idhash_table_fini(nni_idhash_table *t)
+{
+	if (t->it_cap != 0) {
+		nni_free(t->it_ctrl, t->it_cap);
+		NNI_FREE_STRUCTS(t->it_ents, t->it_cap);
+	}
+	memset(t, 0, sizeof(*t));
+}
 
-static size_t
-nni_hash_find_index(nni_idhash *h, uint64_t id)
+// Groups are probed in triangular order, which visits each group once.
+// This is the hot path, so it is worth asking for it to be inlined.
+static inline size_t
+idhash_table_find(nni_idhash_table *t, uint64_t key, uint64_t h)
 {
-	size_t index;
-	size_t start;
-	if (h->ih_count == 0) {
+	size_t  mask;
+	size_t  grp;
+	uint8_t tag = NNI_IDHASH_TAG(h);
+
+	if (t->it_count == 0) {
 		return ((size_t) -1);
 	}
-
-	index = NNI_IDHASH_INDEX(h, id);
-	start = index;
-	for (;;) {
-		// The value of ihe_key is only valid if ihe_val is not NULL.
-		if ((h->ih_entries[index].ihe_key == id) &&
-		    (h->ih_entries[index].ihe_val != NULL)) {
-			return (index);
+	mask = t->it_cap / NNI_IDHASH_GROUP - 1;
+	grp  = (size_t)(h >> 7) & mask;
+	for (size_t i = 1;; i++) {
+		size_t   base = grp * NNI_IDHASH_GROUP;
+		uint64_t g    = idhash_group(&t->it_ctrl[base]);
+		uint64_t m;
+
+		for (m = idhash_match_tag(g, tag); m != 0; m &= m - 1) {
+			size_t slot = base + idhash_first(m);
+			if (t->it_ents[slot].ihe_key == key) {
+				return (slot);
+			}
 		}
-		if (h->ih_entries[index].ihe_skips == 0) {
+		if ((idhash_match_empty(g) != 0) || (i > mask)) {
 			return ((size_t) -1);
 		}
-		index = NNI_IDHASH_NEXTPROBE(h, index);
+		grp = (grp + i) & mask;
+	}
+}
 
-		if (index == start) {
-			break;
+// idhash_table_put stores a key known not to be present.  There must
+// be room for it.
+static void
+idhash_table_put(nni_idhash_table *t, uint64_t key, void *val, uint64_t h)
+{
+	size_t mask = t->it_cap / NNI_IDHASH_GROUP - 1;
+	size_t grp  = (size_t)(h >> 7) & mask;
+
+	for (size_t i = 1;; i++) {
+		size_t   base = grp * NNI_IDHASH_GROUP;
+		uint64_t m;
+
+		m = idhash_match_free(idhash_group(&t->it_ctrl[base]));
+		if (m != 0) {
+			size_t slot = base + idhash_first(m);
+			if (t->it_ctrl[slot] == NNI_IDHASH_EMPTY) {
+				t->it_used++;
+			}
+			t->it_ctrl[slot]         = NNI_IDHASH_TAG(h);
+			t->it_ents[slot].ihe_key = key;
+			t->it_ents[slot].ihe_val = val;
+			t->it_count++;
+			return;
 		}
+		NNI_ASSERT(i <= mask);
+		grp = (grp + i) & mask;
 	}
-
-	return ((size_t) -1);
 }
 
-static int
-nni_hash_find(nni_idhash *h, uint64_t id, void **valp)
+// A slot can only be made empty again if its group already has an
+// empty slot; otherwise some probe may have continued past it.
+static void
+idhash_table_erase(nni_idhash_table *t, size_t slot)
 {
-	size_t index;
-	if ((index = nni_hash_find_index(h, id)) == (size_t) -1) {
-		return (NNG_ENOENT);
+	size_t base = slot & ~(size_t)(NNI_IDHASH_GROUP - 1);
+
+	if (idhash_match_empty(idhash_group(&t->it_ctrl[base])) != 0) {
+		t->it_ctrl[slot] = NNI_IDHASH_EMPTY;
+		t->it_used--;
+	} else {
+		t->it_ctrl[slot] = NNI_IDHASH_DELETED;
 	}
-	*valp = h->ih_entries[index].ihe_val;
-	return (0);
+	t->it_count--;
 }
 
-int
-nni_idhash_find(nni_idhash *h, uint64_t id, void **valp)
+// idhash_drain moves some of the old table over.  The moved slots are
+// marked deleted, so that probes in the old table still work.
+static void
+idhash_drain(nni_idhash_shard *s, size_t ngroups)
 {
-	int rv;
+	nni_idhash_table *old = &s->is_old;
 
-	nni_mtx_lock(&h->ih_mtx);
-	rv = nni_hash_find(h, id, valp);
-	nni_mtx_unlock(&h->ih_mtx);
-	return (rv);
+	while ((ngroups-- > 0) && (old->it_count > 0)) {
+		size_t base = s->is_drain * NNI_IDHASH_GROUP;
+
+		for (size_t i = base; i < base + NNI_IDHASH_GROUP; i++) {
+			nni_idhash_entry *e = &old->it_ents[i];
+
+			if ((old->it_ctrl[i] & NNI_IDHASH_EMPTY) != 0) {
+				continue;
+			}
+			idhash_table_put(&s->is_cur, e->ihe_key, e->ihe_val,
+			    idhash_hash(e->ihe_key));
+			old->it_ctrl[i] = NNI_IDHASH_DELETED;
+			old->it_count--;
+		}
+		s->is_drain++;
+	}
+	if ((old->it_cap != 0) && (old->it_count == 0)) {
+		idhash_table_fini(old);
+	}
 }
 
+// idhash_resize starts moving the shard to a table sized to be half
+// full once everything is moved.  The old table must be fully drained
+// first, which normally happened long ago.
 static int
-nni_hash_resize(nni_idhash *h)
+idhash_resize(nni_idhash_shard *s)
 {
-	size_t            newsize;
-	size_t            oldsize;
-	nni_idhash_entry *newents;
-	nni_idhash_entry *oldents;
-	uint32_t          i;
-
-	if ((h->ih_load < h->ih_maxload) && (h->ih_load >= h->ih_minload)) {
-		// No resize needed.
-		return (0);
-	}
+	nni_idhash_table t;
+	size_t           count;
+	size_t           cap;
+	int              rv;
 
-	oldsize = h->ih_cap;
+	idhash_drain(s, (size_t) -1);
 
-	newsize = 8;
-	while (newsize < (h->ih_count * 2)) {
-		newsize *= 2;
+	count = s->is_cur.it_count + 1;
+	cap   = NNI_IDHASH_GROUP;
+	while (cap < count * 2) {
+		cap *= 2;
 	}
-	if (newsize == oldsize) {
-		// Same size.
-		return (0);
+	if ((rv = idhash_table_init(&t, cap)) != 0) {
+		return (rv);
+	}
+	s->is_old   = s->is_cur;
+	s->is_cur   = t;
+	s->is_drain = 0;
+	if (s->is_old.it_cap != 0) {
+		idhash_drain(s, NNI_IDHASH_DRAIN);
 	}
+	return (0);
+}
 
-	oldents = h->ih_entries;
-	newents = NNI_ALLOC_STRUCTS(newents, newsize);
-	if (newents == NULL) {
-		return (NNG_ENOMEM);
+static nni_idhash_entry *
+idhash_shard_find(nni_idhash_shard *s, uint64_t id, uint64_t h)
+{
+	size_t slot;
+
+	if ((slot = idhash_table_find(&s->is_cur, id, h)) != (size_t) -1) {
+		return (&s->is_cur.it_ents[slot]);
 	}
+	if ((s->is_old.it_cap != 0) &&
+	    ((slot = idhash_table_find(&s->is_old, id, h)) != (size_t) -1)) {
+		return (&s->is_old.it_ents[slot]);
+	}
+	return (NULL);
+}
 
-	h->ih_entries = newents;
-	h->ih_cap     = newsize;
-	if (newsize > 8) {
-		h->ih_minload = newsize / 8;
-		h->ih_maxload = newsize * 2 / 3;
-	} else {
-		h->ih_minload = 0;
-		h->ih_maxload = 5;
+static int
+idhash_shard_insert(nni_idhash_shard *s, uint64_t id, void *val, uint64_t h)
+{
+	nni_idhash_table *t = &s->is_cur;
+	nni_idhash_entry *e;
+	int               rv;
+
+	// If it already exists, just overwrite the old value.
+	if ((e = idhash_shard_find(s, id, h)) != NULL) {
+		e->ihe_val = val;
+		return (0);
 	}
-	for (i = 0; i < oldsize; i++) {
-		size_t index;
-		if (oldents[i].ihe_val == NULL) {
-			continue;
-		}
-		index = oldents[i].ihe_key & (newsize - 1);
-		for (;;) {
-			// Increment the load unconditionally.  It counts
-			// once for every item stored, plus once for each
-			// hashing operation we use to store the item (i.e.
-			// one for the item, plus once for each rehash.)
-			h->ih_load++;
-			if (newents[index].ihe_val == NULL) {
-				// As we are hitting this entry for the first
-				// time, it won't have any skips.
-				NNI_ASSERT(newents[index].ihe_skips == 0);
-				newents[index].ihe_val = oldents[i].ihe_val;
-				newents[index].ihe_key = oldents[i].ihe_key;
-				break;
-			}
-			newents[index].ihe_skips++;
-			index = NNI_IDHASH_NEXTPROBE(h, index);
+
+	// Keep at least one slot in eight free, so probes stay short.
+	if (t->it_used + 1 > t->it_cap - t->it_cap / 8) {
+		if ((rv = idhash_resize(s)) != 0) {
+			return (rv);
 		}
+	} else if (s->is_old.it_cap != 0) {
+		idhash_drain(s, NNI_IDHASH_DRAIN);
 	}
-	if (oldsize != 0) {
-		NNI_FREE_STRUCTS(oldents, oldsize);
-	}
+	idhash_table_put(t, id, val, h);
 	return (0);
 }
 
 int
-nni_idhash_remove(nni_idhash *h, uint64_t id)
+nni_idhash_init(nni_idhash **hp)
 {
-	size_t            index;
-	size_t            srch;
-	nni_idhash_entry *ent;
+	nni_idhash *h;
 
-	nni_mtx_lock(&h->ih_mtx);
-	if ((index = nni_hash_find_index(h, id)) == (size_t) -1) {
-		nni_mtx_unlock(&h->ih_mtx);
-		return (NNG_ENOENT);
+	if ((h = NNI_ALLOC_STRUCT(h)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	for (unsigned i = 0; i < NNI_IDHASH_SHARDS; i++) {
+		nni_mtx_init(&h->ih_shards[i].is_mtx);
 	}
+	nni_atomic_init64(&h->ih_dynval);
+	h->ih_minval = 0;
+	h->ih_maxval = 0xffffffff;
+	*hp          = h;
+	return (0);
+}
 
-	// Now we have found the index where the object exists.  We are going
-	// to restart the search, until the index matches, to decrement the
-	// skips counter.
-	srch = (int) NNI_IDHASH_INDEX(h, id);
-
-	for (;;) {
-		// The load was increased once each hashing operation we used
-		// to place the the item.  Decrement it accordingly.
-		h->ih_load--;
-		ent = &h->ih_entries[srch];
-		if (srch == index) {
-			ent->ihe_val = NULL;
-			ent->ihe_key = (uint64_t) -1; // garbage key
-			break;
+void
+nni_idhash_fini(nni_idhash *h)
+{
+	if (h != NULL) {
+		for (unsigned i = 0; i < NNI_IDHASH_SHARDS; i++) {
+			nni_idhash_shard *s = &h->ih_shards[i];
+			idhash_table_fini(&s->is_cur);
+			idhash_table_fini(&s->is_old);
+			nni_mtx_fini(&s->is_mtx);
 		}
-		NNI_ASSERT(ent->ihe_skips > 0);
-		ent->ihe_skips--;
-		srch = NNI_IDHASH_NEXTPROBE(h, srch);
+		NNI_FREE_STRUCT(h);
 	}
+}
 
-	h->ih_count--;
-
-	// Shrink -- but it's ok if we can't.
-	(void) nni_hash_resize(h);
-
-	nni_mtx_unlock(&h->ih_mtx);
+void
+nni_idhash_set_limits(
+    nni_idhash *h, uint64_t minval, uint64_t maxval, uint64_t start)
+{
+	if (start < minval) {
+		start = minval;
+	}
+	if (start > maxval) {
+		start = maxval;
+	}
 
-	return (0);
+	NNI_ASSERT(minval < maxval);
+	h->ih_minval = minval;
+	h->ih_maxval = maxval;
+	nni_atomic_set64(&h->ih_dynval, start);
 }
 
-static int
-nni_hash_insert(nni_idhash *h, uint64_t id, void *val)
+int
+nni_idhash_find(nni_idhash *h, uint64_t id, void **valp)
 {
-	size_t            index;
-	nni_idhash_entry *ent;
-
-	// Try to resize -- if we don't need to, this will be a no-op.
-	if (nni_hash_resize(h) != 0) {
-		return (NNG_ENOMEM);
+	uint64_t          hv = idhash_hash(id);
+	nni_idhash_shard *s  = &h->ih_shards[NNI_IDHASH_SHARD(hv)];
+	nni_idhash_entry *e;
+	int               rv = NNG_ENOENT;
+
+	nni_mtx_lock(&s->is_mtx);
+	if ((e = idhash_shard_find(s, id, hv)) != NULL) {
+		*valp = e->ihe_val;
+		rv    = 0;
 	}
+	nni_mtx_unlock(&s->is_mtx);
+	return (rv);
+}
 
-	// If it already exists, just overwrite the old value.
-	if ((index = nni_hash_find_index(h, id)) != (size_t) -1) {
-		ent          = &h->ih_entries[index];
-		ent->ihe_val = val;
-		return (0);
+int
+nni_idhash_remove(nni_idhash *h, uint64_t id)
+{
+	uint64_t          hv = idhash_hash(id);
+	nni_idhash_shard *s  = &h->ih_shards[NNI_IDHASH_SHARD(hv)];
+	nni_idhash_table *t  = &s->is_cur;
+	size_t            slot;
+
+	nni_mtx_lock(&s->is_mtx);
+	if ((slot = idhash_table_find(t, id, hv)) != (size_t) -1) {
+		idhash_table_erase(t, slot);
+	} else if ((s->is_old.it_cap != 0) &&
+	    ((slot = idhash_table_find(&s->is_old, id, hv)) != (size_t) -1)) {
+		idhash_table_erase(&s->is_old, slot);
+	} else {
+		nni_mtx_unlock(&s->is_mtx);
+		return (NNG_ENOENT);
 	}
 
-	index = NNI_IDHASH_INDEX(h, id);
-	for (;;) {
-		ent = &h->ih_entries[index];
-
-		// Increment the load count.  We do this each time time we
-		// rehash.  This may overcount items that collide on the
-		// same rehashing, but this should just cause a table to
-		// grow sooner, which is probably a good thing.
-		h->ih_load++;
-		if (ent->ihe_val == NULL) {
-			h->ih_count++;
-			ent->ihe_key = id;
-			ent->ihe_val = val;
-			return (0);
-		}
-		// Record the skip count.  This being non-zero informs
-		// that a rehash will be necessary.  Without this we
-		// would need to scan the entire hash for the match.
-		ent->ihe_skips++;
-		index = NNI_IDHASH_NEXTPROBE(h, index);
+	// Shrink -- but it's ok if we can't.
+	if (s->is_old.it_cap != 0) {
+		idhash_drain(s, NNI_IDHASH_DRAIN);
+	} else if ((t->it_cap > NNI_IDHASH_GROUP) &&
+	    (t->it_count < t->it_cap / 8)) {
+		(void) idhash_resize(s);
 	}
+	nni_mtx_unlock(&s->is_mtx);
+	return (0);
 }
 
 int
 nni_idhash_insert(nni_idhash *h, uint64_t id, void *val)
 {
-	int rv;
+	uint64_t          hv = idhash_hash(id);
+	nni_idhash_shard *s  = &h->ih_shards[NNI_IDHASH_SHARD(hv)];
+	int               rv;
 
-	nni_mtx_lock(&h->ih_mtx);
-	rv = nni_hash_insert(h, id, val);
-	nni_mtx_unlock(&h->ih_mtx);
+	nni_mtx_lock(&s->is_mtx);
+	rv = idhash_shard_insert(s, id, val, hv);
+	nni_mtx_unlock(&s->is_mtx);
 	return (rv);
 }
 
-int
-nni_idhash_alloc(nni_idhash *h, uint64_t *idp, void *val)
+// idhash_next returns the next dynamic value, wrapping at the limits.
+static uint64_t
+idhash_next(nni_idhash *h)
 {
 	uint64_t id;
-	int      rv;
-	nni_mtx_lock(&h->ih_mtx);
+	uint64_t next;
 
-	NNI_ASSERT(val != NULL);
-
-	if (h->ih_count > (h->ih_maxval - h->ih_minval)) {
-		// Really more like ENOSPC.. the table is filled to max.
-		nni_mtx_unlock(&h->ih_mtx);
+	do {
+		id   = nni_atomic_get64(&h->ih_dynval);
+		next = (id >= h->ih_maxval) ? h->ih_minval : id + 1;
+	} while (!nni_atomic_cas64(&h->ih_dynval, id, next));
+	return (id);
+}
 
-		return (NNG_ENOMEM);
-	}
+int
+nni_idhash_alloc(nni_idhash *h, uint64_t *idp, void *val)
+{
+	NNI_ASSERT(val != NULL);
 
-	for (;;) {
-		id = h->ih_dynval;
-		h->ih_dynval++;
-		if (h->ih_dynval > h->ih_maxval) {
-			h->ih_dynval = h->ih_minval;
+	// There is no global count to check, as that would be shared by
+	// every thread.  Instead, if every value in the range is found to
+	// be in use, the table is full.
+	for (uint64_t tries = 0; tries <= h->ih_maxval - h->ih_minval;
+	     tries++) {
+		uint64_t          id = idhash_next(h);
+		uint64_t          hv = idhash_hash(id);
+		nni_idhash_shard *s  = &h->ih_shards[NNI_IDHASH_SHARD(hv)];
+		int               rv;
+
+		nni_mtx_lock(&s->is_mtx);
+		if (idhash_shard_find(s, id, hv) != NULL) {
+			nni_mtx_unlock(&s->is_mtx);
+			continue;
 		}
-
-		if (nni_hash_find_index(h, id) == (size_t) -1) {
-			break;
+		if ((rv = idhash_shard_insert(s, id, val, hv)) == 0) {
+			*idp = id;
 		}
+		nni_mtx_unlock(&s->is_mtx);
+		return (rv);
 	}
-
-	rv = nni_hash_insert(h, id, val);
-	if (rv == 0) {
-		*idp = id;
-	}
-	nni_mtx_unlock(&h->ih_mtx);
-
-	return (rv);
+	// Really more like ENOSPC.. the table is filled to max.
+	return (NNG_ENOMEM);
 }
 
 int
@@ -368,5 +497,14 @@ nni_idhash_alloc32(nni_idhash *h, uint32_t *idp, void *val)
 size_t
 nni_idhash_count(nni_idhash *h)
 {
-	return (h->ih_count);
+	size_t count = 0;
+
+	for (unsigned i = 0; i < NNI_IDHASH_SHARDS; i++) {
+		nni_idhash_shard *s = &h->ih_shards[i];
+
+		nni_mtx_lock(&s->is_mtx);
+		count += s->is_cur.it_count + s->is_old.it_count;
+		nni_mtx_unlock(&s->is_mtx);
+	}
+	return (count);
 }
@@ -31,6 +31,7 @@ nni_init_helper(void)
 	nni_inited = true;
 
 	if (((rv = nni_stat_sys_init()) != 0) ||
+	    ((rv = nni_msgpool_sys_init()) != 0) ||
 	    ((rv = nni_taskq_sys_init()) != 0) ||
 	    ((rv = nni_reap_sys_init()) != 0) ||
 	    ((rv = nni_timer_sys_init()) != 0) ||
@@ -85,6 +86,7 @@ nni_fini(void)
 	nni_timer_sys_fini();
 	nni_taskq_sys_fini();
 	nni_reap_sys_fini(); // must be before timer and aio (expire)
+	nni_msgpool_sys_fini();
 	nni_stat_sys_fini();
 
 	nni_mtx_fini(&nni_init_mtx);
@@ -119,6 +119,26 @@ nni_lmq_getq(nni_lmq *lmq, nng_msg **msgp)
 	return (0);
 }
 
+// nni_lmq_replace puts msg in the place of the first queued message that
+// match accepts, handing back the one it replaced.  The queue is left
+// alone, and NNG_ENOENT returned, if no queued message matches.
+int
+nni_lmq_replace(nni_lmq *lmq, nng_msg *msg,
+    bool (*match)(nng_msg *, void *), void *arg, nng_msg **oldp)
+{
+	for (size_t i = 0; i < lmq->lmq_len; i++) {
+		nng_msg **slot;
+
+		slot = &lmq->lmq_msgs[(lmq->lmq_get + i) & lmq->lmq_mask];
+		if (match(*slot, arg)) {
+			*oldp = *slot;
+			*slot = msg;
+			return (0);
+		}
+	}
+	return (NNG_ENOENT);
+}
+
 int
 nni_lmq_resize(nni_lmq *lmq, size_t cap)
 {
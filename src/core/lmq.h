@@ -33,6 +33,8 @@ extern size_t nni_lmq_cap(nni_lmq *);
 extern int    nni_lmq_putq(nni_lmq *, nng_msg *);
 extern int    nni_lmq_getq(nni_lmq *, nng_msg **);
 extern int    nni_lmq_resize(nni_lmq *, size_t);
+extern int    nni_lmq_replace(
+       nni_lmq *, nng_msg *, bool (*)(nng_msg *, void *), void *, nng_msg **);
 extern bool   nni_lmq_full(nni_lmq *);
 extern bool   nni_lmq_empty(nni_lmq *);
 
@@ -29,6 +29,8 @@ struct nng_msg {
 	nni_chunk      m_body;
 	uint32_t       m_pipe; // set on receive
 	nni_atomic_int m_refcnt;
+	uint8_t *      m_frame;     // encoded wire frame, see frame_prep
+	size_t         m_frame_len; // body length when frame was encoded
 };
 
 #if 0
@@ -95,6 +97,7 @@ static int
 nni_chunk_grow(nni_chunk *ch, size_t newsz, size_t headwanted)
 {
 	uint8_t *newbuf;
+	size_t   cap;
 
 	// We assume that if the pointer is a valid pointer, and inside
 	// the backing store, then the entire data length fits.  In this
@@ -128,17 +131,18 @@ nni_chunk_grow(nni_chunk *ch, size_t newsz, size_t headwanted)
 			newsz = ch->ch_cap - headroom;
 		}
 
-		if ((newbuf = nni_zalloc(newsz + headwanted)) == NULL) {
+		cap = newsz + headwanted;
+		if ((newbuf = nni_msgpool_alloc(&cap)) == NULL) {
 			return (NNG_ENOMEM);
 		}
 		// Copy all the data, but not header or trailer.
 		if (ch->ch_len > 0) {
 			memcpy(newbuf + headwanted, ch->ch_ptr, ch->ch_len);
 		}
-		nni_free(ch->ch_buf, ch->ch_cap);
+		nni_msgpool_free(ch->ch_buf, ch->ch_cap);
 		ch->ch_buf = newbuf;
 		ch->ch_ptr = newbuf + headwanted;
-		ch->ch_cap = newsz + headwanted;
+		ch->ch_cap = cap;
 		return (0);
 	}
 
@@ -146,11 +150,12 @@ nni_chunk_grow(nni_chunk *ch, size_t newsz, size_t headwanted)
 	// the backing store.  In this case, we just check against the
 	// allocated capacity and grow, or don't grow.
 	if ((newsz + headwanted) >= ch->ch_cap) {
-		if ((newbuf = nni_zalloc(newsz + headwanted)) == NULL) {
+		cap = newsz + headwanted;
+		if ((newbuf = nni_msgpool_alloc(&cap)) == NULL) {
 			return (NNG_ENOMEM);
 		}
-		nni_free(ch->ch_buf, ch->ch_cap);
-		ch->ch_cap = newsz + headwanted;
+		nni_msgpool_free(ch->ch_buf, ch->ch_cap);
+		ch->ch_cap = cap;
 		ch->ch_buf = newbuf;
 	}
 
@@ -162,7 +167,7 @@ static void
 nni_chunk_free(nni_chunk *ch)
 {
 	if ((ch->ch_cap != 0) && (ch->ch_buf != NULL)) {
-		nni_free(ch->ch_buf, ch->ch_cap);
+		nni_msgpool_free(ch->ch_buf, ch->ch_cap);
 	}
 	ch->ch_ptr = NULL;
 	ch->ch_buf = NULL;
@@ -209,10 +214,12 @@ nni_chunk_trim(nni_chunk *ch, size_t len)
 static int
 nni_chunk_dup(nni_chunk *dst, const nni_chunk *src)
 {
-	if ((dst->ch_buf = nni_zalloc(src->ch_cap)) == NULL) {
+	size_t cap = src->ch_cap;
+
+	if ((dst->ch_buf = nni_msgpool_alloc(&cap)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	dst->ch_cap = src->ch_cap;
+	dst->ch_cap = cap;
 	dst->ch_len = src->ch_len;
 	dst->ch_ptr = dst->ch_buf + (src->ch_ptr - src->ch_buf);
 	if (dst->ch_len > 0) {
@@ -272,8 +279,11 @@ nni_chunk_insert(nni_chunk *ch, const void *data, size_t len)
 		// There is already enough room at the beginning.
 		ch->ch_ptr -= len;
 	} else if ((ch->ch_len + len) <= ch->ch_cap) {
-		// We had enough capacity, just shuffle data down.
-		memmove(ch->ch_ptr + len, ch->ch_ptr, ch->ch_len);
+		// We had enough capacity, just shuffle data down.  There
+		// may be some headroom already, but not enough, so move
+		// from the start of the buffer, not from where we are.
+		memmove(ch->ch_buf + len, ch->ch_ptr, ch->ch_len);
+		ch->ch_ptr = ch->ch_buf;
 	} else if ((rv = nni_chunk_grow(ch, 0, len)) == 0) {
 		// We grew the chunk, so adjust.
 		ch->ch_ptr -= len;
@@ -306,6 +316,12 @@ nni_msg_clone(nni_msg *m)
 	nni_atomic_inc(&m->m_refcnt);
 }
 
+void
+nni_msg_clone_n(nni_msg *m, int n)
+{
+	nni_atomic_add(&m->m_refcnt, n);
+}
+
 // This returns either the original message or a new message on success.
 // If it fails, then NULL is returned.  Either way the original message
 // has its reference count dropped (and freed if zero).
@@ -363,13 +379,34 @@ nni_msg_pull_up(nni_msg *m)
 	return (m);
 }
 
+// Message structures come from the message pool as well.  Unlike the
+// body, which is about to be overwritten, the structure must start out
+// zeroed.
+static nni_msg *
+nni_msg_struct_alloc(void)
+{
+	nni_msg *m;
+	size_t   sz = sizeof(*m);
+
+	if ((m = nni_msgpool_alloc(&sz)) != NULL) {
+		memset(m, 0, sizeof(*m));
+	}
+	return (m);
+}
+
+static void
+nni_msg_struct_free(nni_msg *m)
+{
+	nni_msgpool_free(m, sizeof(*m));
+}
+
 int
 nni_msg_alloc(nni_msg **mp, size_t sz)
 {
 	nni_msg *m;
 	int      rv;
 
-	if ((m = NNI_ALLOC_STRUCT(m)) == NULL) {
+	if ((m = nni_msg_struct_alloc()) == NULL) {
 		return (NNG_ENOMEM);
 	}
 
@@ -384,7 +421,7 @@ nni_msg_alloc(nni_msg **mp, size_t sz)
 		rv = nni_chunk_grow(&m->m_body, sz, 0);
 	}
 	if (rv != 0) {
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
 		return (rv);
 	}
 	if (nni_chunk_append(&m->m_body, NULL, sz) != 0) {
@@ -405,7 +442,7 @@ nni_msg_dup(nni_msg **dup, const nni_msg *src)
 	nni_msg *m;
 	int      rv;
 
-	if ((m = NNI_ALLOC_STRUCT(m)) == NULL) {
+	if ((m = nni_msg_struct_alloc()) == NULL) {
 		return (NNG_ENOMEM);
 	}
 
@@ -413,7 +450,7 @@ nni_msg_dup(nni_msg **dup, const nni_msg *src)
 	m->m_header_len = src->m_header_len;
 
 	if ((rv = nni_chunk_dup(&m->m_body, &src->m_body)) != 0) {
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
 		return (rv);
 	}
 
@@ -430,7 +467,7 @@ nni_msg_free(nni_msg *m)
 {
 	if ((m != NULL) && (nni_atomic_dec_nv(&m->m_refcnt) == 0)) {
 		nni_chunk_free(&m->m_body);
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
 	}
 }
 
@@ -483,6 +520,9 @@ nni_msg_append(nni_msg *m, const void *data, size_t len)
 int
 nni_msg_insert(nni_msg *m, const void *data, size_t len)
 {
+	// This is the only body operation that can scribble over the
+	// headroom where an encoded frame prefix lives, so give it up.
+	m->m_frame = NULL;
 	return (nni_chunk_insert(&m->m_body, data, len));
 }
 
@@ -587,6 +627,44 @@ nni_msg_header_clear(nni_msg *m)
 	m->m_header_len = 0;
 }
 
+void
+nni_msg_frame_prep(nni_msg *m)
+{
+	nni_chunk *ch = &m->m_body;
+	uint8_t *  prefix;
+
+	m->m_frame = NULL;
+	if ((m->m_header_len != 0) || (nni_atomic_get(&m->m_refcnt) != 1)) {
+		return;
+	}
+	// Making room would copy the whole body, which costs more than
+	// each pipe framing the message itself.
+	if ((size_t) (ch->ch_ptr - ch->ch_buf) < NNI_MSG_FRAME_PREFIX) {
+		return;
+	}
+	prefix    = ch->ch_ptr - NNI_MSG_FRAME_PREFIX;
+	prefix[0] = 1; // IPC message type
+	NNI_PUT64(prefix + 1, (uint64_t) ch->ch_len);
+	m->m_frame     = prefix;
+	m->m_frame_len = ch->ch_len;
+}
+
+uint8_t *
+nni_msg_frame(nni_msg *m, size_t *lenp)
+{
+	const nni_chunk *ch = &m->m_body;
+
+	// The frame is only good if nothing has changed since it was
+	// encoded.  (Insert clears it outright, as it may overwrite it.)
+	if ((m->m_frame == NULL) || (m->m_header_len != 0) ||
+	    (m->m_frame + NNI_MSG_FRAME_PREFIX != ch->ch_ptr) ||
+	    (m->m_frame_len != ch->ch_len)) {
+		return (NULL);
+	}
+	*lenp = ch->ch_len + NNI_MSG_FRAME_PREFIX;
+	return (m->m_frame);
+}
+
 void
 nni_msg_set_pipe(nni_msg *m, uint32_t pid)
 {
@@ -46,6 +46,9 @@ extern uint32_t nni_msg_get_pipe(const nni_msg *);
 // Failure to do so will likely result in corruption.
 extern void     nni_msg_clone(nni_msg *);
 extern nni_msg *nni_msg_unique(nni_msg *);
+// nni_msg_clone_n adds n references at once.  This is for fan-out, where
+// the same message is handed to many consumers.
+extern void     nni_msg_clone_n(nni_msg *, int);
 // nni_msg_pull_up ensures that the message is unique, and that any
 // header present is "pulled up" into the message body.  If the function
 // cannot do this for any reason (out of space in the body), then NULL
@@ -53,4 +56,24 @@ extern nni_msg *nni_msg_unique(nni_msg *);
 // original message in that case (same semantics as realloc).
 extern nni_msg *nni_msg_pull_up(nni_msg *);
 
+// The stream transports (TCP, TLS, IPC) send each message preceded by its
+// length as a 64-bit big-endian value, and IPC also puts a one byte
+// message type (1) in front of that.  A message that is going to be sent
+// on many pipes at once, as PUB does, can have this prefix encoded just
+// once, in the headroom in front of the body.  Every pipe then sends the
+// same contiguous, immutable frame instead of building its own.
+#define NNI_MSG_FRAME_PREFIX 9
+
+// nni_msg_frame_prep encodes the frame prefix.  This must be done while
+// the caller still holds the only reference, before the message is shared.
+// It only uses headroom that is already there, and does nothing for
+// messages without enough, or with a header; the transports simply frame
+// such messages themselves.
+extern void nni_msg_frame_prep(nni_msg *);
+
+// nni_msg_frame returns the encoded frame (type byte, length, and body)
+// and its full length, or NULL if there is no frame, or if the message has
+// been modified since it was encoded.  TCP and TLS skip the type byte.
+extern uint8_t *nni_msg_frame(nni_msg *, size_t *);
+
 #endif // CORE_SOCKET_H
@@ -0,0 +1,373 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "core/nng_impl.h"
+
+#ifdef NNG_ENABLE_MSG_POOL
+
+// Size classes are powers of two, from 64 bytes up to 64 KiB.  Larger
+// requests go straight to the system allocator; at those sizes the cost
+// of moving the data dwarfs that of allocating it anyway.
+#define NNI_MSGPOOL_MIN_SHIFT 6
+#define NNI_MSGPOOL_NCLASS 11
+#define NNI_MSGPOOL_MAX_SIZE \
+	((size_t) 1 << (NNI_MSGPOOL_MIN_SHIFT + NNI_MSGPOOL_NCLASS - 1))
+
+// Each thread caches up to this many bytes of each size class (but no
+// fewer than 4 blocks, and no more than 256).  When a cache overflows or
+// runs dry, half of that is exchanged with the shared depot, which holds
+// up to eight times as much again.
+#ifndef NNG_MSG_POOL_CACHE_BYTES
+#define NNG_MSG_POOL_CACHE_BYTES (256 * 1024)
+#endif
+
+// Threads beyond this many work directly against the depot.  This bounds
+// the memory held by caches of threads that exited without telling us.
+#ifndef NNG_MSG_POOL_MAX_CACHES
+#define NNG_MSG_POOL_MAX_CACHES 64
+#endif
+
+// Hits on the per-thread cache are counted locally, and only folded into
+// the statistic this often, to keep the fast path free of shared writes.
+#define NNI_MSGPOOL_HIT_BATCH 64
+
+typedef struct nni_msgpool_blk nni_msgpool_blk;
+struct nni_msgpool_blk {
+	nni_msgpool_blk *next;
+};
+
+typedef struct {
+	nni_msgpool_blk *head;
+	unsigned         count;
+} nni_msgpool_list;
+
+typedef struct {
+	nni_list_node    node;
+	nni_msgpool_list lists[NNI_MSGPOOL_NCLASS];
+	uint64_t         hits;
+} nni_msgpool_cache;
+
+static nni_mtx          nni_msgpool_lk;
+static nni_msgpool_list nni_msgpool_depot[NNI_MSGPOOL_NCLASS];
+static unsigned         nni_msgpool_limit[NNI_MSGPOOL_NCLASS];
+static nni_list         nni_msgpool_caches;
+static int              nni_msgpool_ncaches;
+static nni_plat_tls     nni_msgpool_tls;
+static nni_atomic_bool  nni_msgpool_inited;
+static nni_stat_item    nni_msgpool_stats;
+static nni_stat_item    nni_msgpool_hits;
+static nni_stat_item    nni_msgpool_misses;
+
+static unsigned
+nni_msgpool_class(size_t sz)
+{
+	unsigned c = 0;
+
+	while (((size_t) 1 << (NNI_MSGPOOL_MIN_SHIFT + c)) < sz) {
+		c++;
+	}
+	return (c);
+}
+
+static void *
+nni_msgpool_pop(nni_msgpool_list *list)
+{
+	nni_msgpool_blk *blk;
+
+	if ((blk = list->head) != NULL) {
+		list->head = blk->next;
+		list->count--;
+	}
+	return (blk);
+}
+
+static void
+nni_msgpool_push(nni_msgpool_list *list, void *ptr)
+{
+	nni_msgpool_blk *blk = ptr;
+
+	blk->next  = list->head;
+	list->head = blk;
+	list->count++;
+}
+
+static void
+nni_msgpool_move(nni_msgpool_list *dst, nni_msgpool_list *src, unsigned n)
+{
+	void *blk;
+
+	while ((n > 0) && ((blk = nni_msgpool_pop(src)) != NULL)) {
+		nni_msgpool_push(dst, blk);
+		n--;
+	}
+}
+
+static unsigned
+nni_msgpool_room(nni_msgpool_list *depot, unsigned c)
+{
+	unsigned max = nni_msgpool_limit[c] * 8;
+
+	return (depot->count < max ? max - depot->count : 0);
+}
+
+// nni_msgpool_cache_fini is run when a thread with a cache exits.
+static void
+nni_msgpool_cache_fini(void *arg)
+{
+	nni_msgpool_cache *cache = arg;
+	void *             blk;
+
+	nni_mtx_lock(&nni_msgpool_lk);
+	if (!nni_atomic_get_bool(&nni_msgpool_inited)) {
+		// Already torn down (and the cache freed) by sys_fini.
+		nni_mtx_unlock(&nni_msgpool_lk);
+		return;
+	}
+	for (unsigned c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+		nni_msgpool_list *depot = &nni_msgpool_depot[c];
+		nni_msgpool_move(depot, &cache->lists[c],
+		    nni_msgpool_room(depot, c));
+		while ((blk = nni_msgpool_pop(&cache->lists[c])) != NULL) {
+			nni_free(blk, (size_t) 1 << (NNI_MSGPOOL_MIN_SHIFT + c));
+		}
+	}
+	nni_list_remove(&nni_msgpool_caches, cache);
+	nni_msgpool_ncaches--;
+	nni_mtx_unlock(&nni_msgpool_lk);
+
+	nni_stat_inc_atomic(&nni_msgpool_hits, cache->hits);
+	NNI_FREE_STRUCT(cache);
+}
+
+static nni_msgpool_cache *
+nni_msgpool_cache_get(void)
+{
+	nni_msgpool_cache *cache;
+
+	if ((cache = nni_plat_tls_get(&nni_msgpool_tls)) != NULL) {
+		return (cache);
+	}
+	nni_mtx_lock(&nni_msgpool_lk);
+	if ((nni_msgpool_ncaches < NNG_MSG_POOL_MAX_CACHES) &&
+	    ((cache = NNI_ALLOC_STRUCT(cache)) != NULL)) {
+		nni_list_append(&nni_msgpool_caches, cache);
+		nni_msgpool_ncaches++;
+		nni_plat_tls_set(&nni_msgpool_tls, cache);
+	}
+	nni_mtx_unlock(&nni_msgpool_lk);
+	return (cache);
+}
+
+void *
+nni_msgpool_alloc(size_t *szp)
+{
+	nni_msgpool_cache *cache;
+	void *             blk;
+	unsigned           c;
+
+	if (*szp > NNI_MSGPOOL_MAX_SIZE) {
+		return (nni_alloc(*szp));
+	}
+	// Always round up, even if we are not initialized yet, so that
+	// the block can be recycled no matter when it is freed.
+	c    = nni_msgpool_class(*szp);
+	*szp = (size_t) 1 << (NNI_MSGPOOL_MIN_SHIFT + c);
+	if (!nni_atomic_get_bool(&nni_msgpool_inited)) {
+		return (nni_alloc(*szp));
+	}
+
+	cache = nni_msgpool_cache_get();
+	if ((cache != NULL) &&
+	    ((blk = nni_msgpool_pop(&cache->lists[c])) != NULL)) {
+		if (++cache->hits >= NNI_MSGPOOL_HIT_BATCH) {
+			nni_stat_inc_atomic(&nni_msgpool_hits, cache->hits);
+			cache->hits = 0;
+		}
+		return (blk);
+	}
+
+	nni_mtx_lock(&nni_msgpool_lk);
+	if (cache != NULL) {
+		nni_msgpool_move(&cache->lists[c], &nni_msgpool_depot[c],
+		    nni_msgpool_limit[c] / 2);
+		blk = nni_msgpool_pop(&cache->lists[c]);
+	} else {
+		blk = nni_msgpool_pop(&nni_msgpool_depot[c]);
+	}
+	nni_mtx_unlock(&nni_msgpool_lk);
+
+	if (blk != NULL) {
+		nni_stat_inc_atomic(&nni_msgpool_hits, 1);
+		return (blk);
+	}
+	nni_stat_inc_atomic(&nni_msgpool_misses, 1);
+	return (nni_alloc(*szp));
+}
+
+void
+nni_msgpool_free(void *ptr, size_t sz)
+{
+	nni_msgpool_cache *cache;
+	nni_msgpool_list * depot;
+	unsigned           c;
+	unsigned           n;
+
+	if (ptr == NULL) {
+		return;
+	}
+	if (sz > NNI_MSGPOOL_MAX_SIZE) {
+		nni_free(ptr, sz);
+		return;
+	}
+	c  = nni_msgpool_class(sz);
+	sz = (size_t) 1 << (NNI_MSGPOOL_MIN_SHIFT + c);
+	if (!nni_atomic_get_bool(&nni_msgpool_inited)) {
+		nni_free(ptr, sz);
+		return;
+	}
+
+	cache = nni_msgpool_cache_get();
+	if ((cache != NULL) &&
+	    (cache->lists[c].count < nni_msgpool_limit[c])) {
+		nni_msgpool_push(&cache->lists[c], ptr);
+		return;
+	}
+
+	depot = &nni_msgpool_depot[c];
+	nni_mtx_lock(&nni_msgpool_lk);
+	if (cache != NULL) {
+		n = nni_msgpool_limit[c] / 2;
+		if (n > nni_msgpool_room(depot, c)) {
+			n = nni_msgpool_room(depot, c);
+		}
+		nni_msgpool_move(depot, &cache->lists[c], n);
+	}
+	if ((cache != NULL) &&
+	    (cache->lists[c].count < nni_msgpool_limit[c])) {
+		nni_msgpool_push(&cache->lists[c], ptr);
+		ptr = NULL;
+	} else if (nni_msgpool_room(depot, c) > 0) {
+		nni_msgpool_push(depot, ptr);
+		ptr = NULL;
+	}
+	nni_mtx_unlock(&nni_msgpool_lk);
+
+	if (ptr != NULL) {
+		nni_free(ptr, sz);
+	}
+}
+
+int
+nni_msgpool_sys_init(void)
+{
+	int rv;
+
+	nni_mtx_init(&nni_msgpool_lk);
+	NNI_LIST_INIT(&nni_msgpool_caches, nni_msgpool_cache, node);
+	nni_msgpool_ncaches = 0;
+	for (unsigned c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+		unsigned n;
+		n = NNG_MSG_POOL_CACHE_BYTES >> (NNI_MSGPOOL_MIN_SHIFT + c);
+		if (n < 4) {
+			n = 4;
+		} else if (n > 256) {
+			n = 256;
+		}
+		nni_msgpool_limit[c] = n;
+	}
+	if ((rv = nni_plat_tls_init(
+	         &nni_msgpool_tls, nni_msgpool_cache_fini)) != 0) {
+		nni_mtx_fini(&nni_msgpool_lk);
+		return (rv);
+	}
+
+	// These may still be linked from a previous nni_init, so start over.
+	memset(&nni_msgpool_stats, 0, sizeof(nni_msgpool_stats));
+	memset(&nni_msgpool_hits, 0, sizeof(nni_msgpool_hits));
+	memset(&nni_msgpool_misses, 0, sizeof(nni_msgpool_misses));
+	nni_stat_init_scope(
+	    &nni_msgpool_stats, "msgpool", "message pool statistics");
+	nni_stat_init_atomic(
+	    &nni_msgpool_hits, "hits", "allocations satisfied by the pool");
+	nni_stat_add(&nni_msgpool_stats, &nni_msgpool_hits);
+	nni_stat_init_atomic(
+	    &nni_msgpool_misses, "misses", "allocations from the system");
+	nni_stat_add(&nni_msgpool_stats, &nni_msgpool_misses);
+	nni_stat_register(&nni_msgpool_stats);
+
+	nni_atomic_set_bool(&nni_msgpool_inited, true);
+	return (0);
+}
+
+void
+nni_msgpool_sys_fini(void)
+{
+	nni_msgpool_cache *cache;
+	void *             blk;
+
+	if (!nni_atomic_get_bool(&nni_msgpool_inited)) {
+		return;
+	}
+	nni_stat_unregister(&nni_msgpool_stats);
+
+	nni_mtx_lock(&nni_msgpool_lk);
+	nni_atomic_set_bool(&nni_msgpool_inited, false);
+	for (unsigned c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+		size_t sz = (size_t) 1 << (NNI_MSGPOOL_MIN_SHIFT + c);
+		while ((blk = nni_msgpool_pop(&nni_msgpool_depot[c])) !=
+		    NULL) {
+			nni_free(blk, sz);
+		}
+	}
+	while ((cache = nni_list_first(&nni_msgpool_caches)) != NULL) {
+		nni_list_remove(&nni_msgpool_caches, cache);
+		for (unsigned c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+			size_t sz = (size_t) 1 << (NNI_MSGPOOL_MIN_SHIFT + c);
+			while ((blk = nni_msgpool_pop(&cache->lists[c])) !=
+			    NULL) {
+				nni_free(blk, sz);
+			}
+		}
+		NNI_FREE_STRUCT(cache);
+	}
+	nni_msgpool_ncaches = 0;
+	nni_mtx_unlock(&nni_msgpool_lk);
+
+	nni_plat_tls_fini(&nni_msgpool_tls);
+	nni_mtx_fini(&nni_msgpool_lk);
+}
+
+#else // NNG_ENABLE_MSG_POOL
+
+void *
+nni_msgpool_alloc(size_t *szp)
+{
+	return (nni_alloc(*szp));
+}
+
+void
+nni_msgpool_free(void *ptr, size_t sz)
+{
+	nni_free(ptr, sz);
+}
+
+int
+nni_msgpool_sys_init(void)
+{
+	return (0);
+}
+
+void
+nni_msgpool_sys_fini(void)
+{
+}
+
+#endif // NNG_ENABLE_MSG_POOL
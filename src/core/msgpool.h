@@ -0,0 +1,36 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_MSGPOOL_H
+#define CORE_MSGPOOL_H
+
+#include "core/defs.h"
+
+// The message pool supplies the memory for message structures and their
+// body buffers.  Requests are rounded up to a power of two size class,
+// and freed blocks are kept on per-thread caches (backed by a shared
+// depot) for reuse, which avoids the system allocator on the hot paths.
+// Memory from the pool is not zeroed.  If NNG_ENABLE_MSG_POOL is not
+// defined, these just call nni_alloc and nni_free.
+
+// nni_msgpool_alloc allocates at least *szp bytes, and updates *szp to
+// the size actually allocated.  Callers can (and should) make use of any
+// extra space.
+extern void *nni_msgpool_alloc(size_t *szp);
+
+// nni_msgpool_free returns memory obtained from nni_msgpool_alloc.  The
+// size may be either the one originally requested, or the one returned.
+// This may be called from any thread, even before nni_init or after
+// nni_fini.
+extern void nni_msgpool_free(void *, size_t);
+
+extern int  nni_msgpool_sys_init(void);
+extern void nni_msgpool_sys_fini(void);
+
+#endif // CORE_MSGPOOL_H
@@ -14,16 +14,34 @@
 // but as we have access to the internals, we have made some fundamental
 // differences and improvements.  For example, these can grow, and either
 // side can close, and they may be closed more than once.
+//
+// Most queues have one thread putting and one getting at a time, so
+// when nobody is waiting, the queue is neither empty nor full, and
+// there are no pollables, a put or get just moves the message through
+// the ring without taking mq_lock.  The producer only advances mq_put,
+// and the consumer only advances mq_get, so that is safe as long as
+// there is at most one of each at a time, which mq_putting and
+// mq_getting arrange; a second one takes the lock instead.
+//
+// Everything else happens under mq_lock.  Taking it (nni_msgq_lock)
+// first sets mq_slow, which turns the fast paths away, and waits for
+// any already on them to finish, so that the holder of the lock has the
+// ring to itself.  On the way out (nni_msgq_unlock), mq_slow is only
+// cleared if there is no reason left to take the lock: so as long as
+// someone waits for the queue to become readable or writable, every put
+// and get goes through the lock and sees them.
 
 struct nni_msgq {
-	nni_mtx   mq_lock;
-	int       mq_cap;
-	int       mq_alloc; // alloc is cap + 2...
-	int       mq_len;
-	int       mq_get;
-	int       mq_put;
-	bool      mq_closed;
-	nni_msg **mq_msgs;
+	nni_mtx         mq_lock;
+	int             mq_cap;
+	int             mq_alloc; // alloc is cap + 2...
+	bool            mq_closed;
+	nni_msg **      mq_msgs;
+	nni_atomic_bool mq_slow;
+	nni_atomic_bool mq_putting;
+	nni_atomic_int  mq_put;
+	nni_atomic_bool mq_getting;
+	nni_atomic_int  mq_get;
 
 	nni_list mq_aio_putq;
 	nni_list mq_aio_getq;
@@ -35,6 +53,105 @@ struct nni_msgq {
 
 static void nni_msgq_run_notify(nni_msgq *);
 
+// nni_msgq_len is only exact for the holder of the lock, or for the
+// producer or consumer on the fast path, as the other side may be
+// moving at the same time.  (A stale answer just sends the caller to
+// the lock.)
+static int
+nni_msgq_len(nni_msgq *mq)
+{
+	int len = nni_atomic_get(&mq->mq_put) - nni_atomic_get(&mq->mq_get);
+
+	return (len < 0 ? len + mq->mq_alloc : len);
+}
+
+static void
+nni_msgq_push(nni_msgq *mq, nni_msg *msg)
+{
+	int put = nni_atomic_get(&mq->mq_put);
+
+	mq->mq_msgs[put++] = msg;
+	if (put == mq->mq_alloc) {
+		put = 0;
+	}
+	// Publishes the message to the consumer.
+	nni_atomic_set(&mq->mq_put, put);
+}
+
+static nni_msg *
+nni_msgq_pop(nni_msgq *mq)
+{
+	int      get = nni_atomic_get(&mq->mq_get);
+	nni_msg *msg = mq->mq_msgs[get++];
+
+	if (get == mq->mq_alloc) {
+		get = 0;
+	}
+	// Hands the slot back to the producer.
+	nni_atomic_set(&mq->mq_get, get);
+	return (msg);
+}
+
+static void
+nni_msgq_lock(nni_msgq *mq)
+{
+	nni_mtx_lock(&mq->mq_lock);
+	nni_atomic_set_bool(&mq->mq_slow, true);
+
+	// Anyone already on a fast path is only a few instructions from
+	// leaving it, unless they were preempted.
+	for (int i = 0; nni_atomic_get_bool(&mq->mq_putting) ||
+	     nni_atomic_get_bool(&mq->mq_getting);
+	     i++) {
+		if (i > 1000) {
+			nni_msleep(1);
+		}
+	}
+}
+
+static void
+nni_msgq_unlock(nni_msgq *mq)
+{
+	if (!mq->mq_closed && (mq->mq_sendable == NULL) &&
+	    (mq->mq_recvable == NULL) && nni_list_empty(&mq->mq_aio_putq) &&
+	    nni_list_empty(&mq->mq_aio_getq)) {
+		nni_atomic_set_bool(&mq->mq_slow, false);
+	}
+	nni_mtx_unlock(&mq->mq_lock);
+}
+
+static bool
+nni_msgq_fast_put(nni_msgq *mq, nni_msg *msg)
+{
+	bool ok = false;
+
+	if (nni_atomic_swap_bool(&mq->mq_putting, true)) {
+		return (false); // another producer is here
+	}
+	if (!nni_atomic_get_bool(&mq->mq_slow) &&
+	    (nni_msgq_len(mq) < mq->mq_cap)) {
+		nni_msgq_push(mq, msg);
+		ok = true;
+	}
+	nni_atomic_set_bool(&mq->mq_putting, false);
+	return (ok);
+}
+
+static nni_msg *
+nni_msgq_fast_get(nni_msgq *mq)
+{
+	nni_msg *msg = NULL;
+
+	if (nni_atomic_swap_bool(&mq->mq_getting, true)) {
+		return (NULL); // another consumer is here
+	}
+	if (!nni_atomic_get_bool(&mq->mq_slow) && (nni_msgq_len(mq) != 0)) {
+		msg = nni_msgq_pop(mq);
+	}
+	nni_atomic_set_bool(&mq->mq_getting, false);
+	return (msg);
+}
+
 int
 nni_msgq_init(nni_msgq **mqp, unsigned cap)
 {
@@ -45,7 +162,8 @@ nni_msgq_init(nni_msgq **mqp, unsigned cap)
 	// waiting writer when cap == 0. (We can "briefly" move the message
 	// through.)  This lets us behave the same as unbuffered Go channels.
 	// The second cell is to permit pushback later, e.g. for REQ to stash
-	// a message back at the end to do a retry.
+	// a message back at the end to do a retry.  (The ring also needs
+	// one cell free to tell full from empty.)
 	alloc = cap + 2;
 
 	if ((mq = NNI_ALLOC_STRUCT(mq)) == NULL) {
@@ -58,14 +176,16 @@ nni_msgq_init(nni_msgq **mqp, unsigned cap)
 	nni_aio_list_init(&mq->mq_aio_putq);
 	nni_aio_list_init(&mq->mq_aio_getq);
 	nni_mtx_init(&mq->mq_lock);
+	nni_atomic_init_bool(&mq->mq_slow);
+	nni_atomic_init_bool(&mq->mq_putting);
+	nni_atomic_init_bool(&mq->mq_getting);
+	nni_atomic_init(&mq->mq_put);
+	nni_atomic_init(&mq->mq_get);
 	mq->mq_cap      = cap;
 	mq->mq_alloc    = alloc;
 	mq->mq_recvable = NULL;
 	mq->mq_sendable = NULL;
-	mq->mq_len      = 0;
-	mq->mq_get      = 0;
-	mq->mq_put      = 0;
-	mq->mq_closed   = 0;
+	mq->mq_closed   = false;
 	*mqp            = mq;
 
 	return (0);
@@ -80,13 +200,8 @@ nni_msgq_fini(nni_msgq *mq)
 	nni_mtx_fini(&mq->mq_lock);
 
 	/* Free any orphaned messages. */
-	while (mq->mq_len > 0) {
-		nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get >= mq->mq_alloc) {
-			mq->mq_get = 0;
-		}
-		mq->mq_len--;
-		nni_msg_free(msg);
+	while (nni_msgq_len(mq) > 0) {
+		nni_msg_free(nni_msgq_pop(mq));
 	}
 
 	if (mq->mq_sendable) {
@@ -124,13 +239,9 @@ nni_msgq_run_putq(nni_msgq *mq)
 		}
 
 		// Otherwise if we have room in the buffer, just queue it.
-		if (mq->mq_len < mq->mq_cap) {
+		if (nni_msgq_len(mq) < mq->mq_cap) {
 			nni_list_remove(&mq->mq_aio_putq, waio);
-			mq->mq_msgs[mq->mq_put++] = msg;
-			if (mq->mq_put == mq->mq_alloc) {
-				mq->mq_put = 0;
-			}
-			mq->mq_len++;
+			nni_msgq_push(mq, msg);
 			nni_aio_set_msg(waio, NULL);
 			nni_aio_finish(waio, 0, len);
 			continue;
@@ -149,15 +260,9 @@ nni_msgq_run_getq(nni_msgq *mq)
 	while ((raio = nni_list_first(&mq->mq_aio_getq)) != NULL) {
 		nni_aio *waio;
 		// If anything is waiting in the queue, get it first.
-		if (mq->mq_len != 0) {
-			nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-			if (mq->mq_get == mq->mq_alloc) {
-				mq->mq_get = 0;
-			}
-			mq->mq_len--;
-
+		if (nni_msgq_len(mq) != 0) {
 			nni_aio_list_remove(raio);
-			nni_aio_finish_msg(raio, msg);
+			nni_aio_finish_msg(raio, nni_msgq_pop(mq));
 			continue;
 		}
 
@@ -187,12 +292,14 @@ nni_msgq_run_getq(nni_msgq *mq)
 static void
 nni_msgq_run_notify(nni_msgq *mq)
 {
-	if (mq->mq_len < mq->mq_cap || !nni_list_empty(&mq->mq_aio_getq)) {
+	int len = nni_msgq_len(mq);
+
+	if (len < mq->mq_cap || !nni_list_empty(&mq->mq_aio_getq)) {
 		nni_pollable_raise(mq->mq_sendable);
 	} else {
 		nni_pollable_clear(mq->mq_sendable);
 	}
-	if ((mq->mq_len != 0) || !nni_list_empty(&mq->mq_aio_putq)) {
+	if ((len != 0) || !nni_list_empty(&mq->mq_aio_putq)) {
 		nni_pollable_raise(mq->mq_recvable);
 	} else {
 		nni_pollable_clear(mq->mq_recvable);
@@ -204,31 +311,41 @@ nni_msgq_cancel(nni_aio *aio, void *arg, int rv)
 {
 	nni_msgq *mq = arg;
 
-	nni_mtx_lock(&mq->mq_lock);
+	nni_msgq_lock(mq);
 	if (nni_aio_list_active(aio)) {
 		nni_aio_list_remove(aio);
 		nni_aio_finish_error(aio, rv);
 	}
 	nni_msgq_run_notify(mq);
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 }
 
 void
 nni_msgq_aio_put(nni_msgq *mq, nni_aio *aio)
 {
-	int rv;
+	nni_msg *msg;
+	size_t   len;
+	int      rv;
 
 	if (nni_aio_begin(aio) != 0) {
 		return;
 	}
-	nni_mtx_lock(&mq->mq_lock);
+	msg = nni_aio_get_msg(aio);
+	len = nni_msg_len(msg);
+	if (nni_msgq_fast_put(mq, msg)) {
+		nni_aio_set_msg(aio, NULL);
+		nni_aio_finish(aio, 0, len);
+		return;
+	}
+
+	nni_msgq_lock(mq);
 
 	// If this is an instantaneous poll operation, and the queue has
 	// no room, nobody is waiting to receive, then report NNG_ETIMEDOUT.
 	rv = nni_aio_schedule(aio, nni_msgq_cancel, mq);
-	if ((rv != 0) && (mq->mq_len >= mq->mq_cap) &&
+	if ((rv != 0) && (nni_msgq_len(mq) >= mq->mq_cap) &&
 	    (nni_list_empty(&mq->mq_aio_getq))) {
-		nni_mtx_unlock(&mq->mq_lock);
+		nni_msgq_unlock(mq);
 		nni_aio_finish_error(aio, rv);
 		return;
 	}
@@ -236,22 +353,28 @@ nni_msgq_aio_put(nni_msgq *mq, nni_aio *aio)
 	nni_msgq_run_putq(mq);
 	nni_msgq_run_notify(mq);
 
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 }
 
 void
 nni_msgq_aio_get(nni_msgq *mq, nni_aio *aio)
 {
-	int rv;
+	nni_msg *msg;
+	int      rv;
 
 	if (nni_aio_begin(aio) != 0) {
 		return;
 	}
-	nni_mtx_lock(&mq->mq_lock);
+	if ((msg = nni_msgq_fast_get(mq)) != NULL) {
+		nni_aio_finish_msg(aio, msg);
+		return;
+	}
+
+	nni_msgq_lock(mq);
 	rv = nni_aio_schedule(aio, nni_msgq_cancel, mq);
-	if ((rv != 0) && (mq->mq_len == 0) &&
+	if ((rv != 0) && (nni_msgq_len(mq) == 0) &&
 	    (nni_list_empty(&mq->mq_aio_putq))) {
-		nni_mtx_unlock(&mq->mq_lock);
+		nni_msgq_unlock(mq);
 		nni_aio_finish_error(aio, rv);
 		return;
 	}
@@ -260,7 +383,7 @@ nni_msgq_aio_get(nni_msgq *mq, nni_aio *aio)
 	nni_msgq_run_getq(mq);
 	nni_msgq_run_notify(mq);
 
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 }
 
 int
@@ -268,9 +391,13 @@ nni_msgq_tryput(nni_msgq *mq, nni_msg *msg)
 {
 	nni_aio *raio;
 
-	nni_mtx_lock(&mq->mq_lock);
+	if (nni_msgq_fast_put(mq, msg)) {
+		return (0);
+	}
+
+	nni_msgq_lock(mq);
 	if (mq->mq_closed) {
-		nni_mtx_unlock(&mq->mq_lock);
+		nni_msgq_unlock(mq);
 		return (NNG_ECLOSED);
 	}
 
@@ -282,23 +409,19 @@ nni_msgq_tryput(nni_msgq *mq, nni_msg *msg)
 		nni_list_remove(&mq->mq_aio_getq, raio);
 		nni_aio_finish_msg(raio, msg);
 		nni_msgq_run_notify(mq);
-		nni_mtx_unlock(&mq->mq_lock);
+		nni_msgq_unlock(mq);
 		return (0);
 	}
 
 	// Otherwise if we have room in the buffer, just queue it.
-	if (mq->mq_len < mq->mq_cap) {
-		mq->mq_msgs[mq->mq_put++] = msg;
-		if (mq->mq_put == mq->mq_alloc) {
-			mq->mq_put = 0;
-		}
-		mq->mq_len++;
+	if (nni_msgq_len(mq) < mq->mq_cap) {
+		nni_msgq_push(mq, msg);
 		nni_msgq_run_notify(mq);
-		nni_mtx_unlock(&mq->mq_lock);
+		nni_msgq_unlock(mq);
 		return (0);
 	}
 
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 	return (NNG_EAGAIN);
 }
 
@@ -307,16 +430,11 @@ nni_msgq_close(nni_msgq *mq)
 {
 	nni_aio *aio;
 
-	nni_mtx_lock(&mq->mq_lock);
+	nni_msgq_lock(mq);
 	mq->mq_closed = true;
 	// Free the messages orphaned in the queue.
-	while (mq->mq_len > 0) {
-		nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get >= mq->mq_alloc) {
-			mq->mq_get = 0;
-		}
-		mq->mq_len--;
-		nni_msg_free(msg);
+	while (nni_msgq_len(mq) > 0) {
+		nni_msg_free(nni_msgq_pop(mq));
 	}
 
 	// Let all pending blockers know we are closing the queue.
@@ -326,7 +444,7 @@ nni_msgq_close(nni_msgq *mq)
 		nni_aio_finish_error(aio, NNG_ECLOSED);
 	}
 
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 }
 
 int
@@ -344,11 +462,9 @@ int
 nni_msgq_resize(nni_msgq *mq, int cap)
 {
 	int       alloc;
-	nni_msg * msg;
 	nni_msg **newq, **oldq;
-	int       oldget;
-	int       oldlen;
 	int       oldalloc;
+	int       put;
 
 	alloc = cap + 2;
 
@@ -361,17 +477,12 @@ nni_msgq_resize(nni_msgq *mq, int cap)
 		newq = NULL;
 	}
 
-	nni_mtx_lock(&mq->mq_lock);
-	while (mq->mq_len > (cap + 1)) {
+	nni_msgq_lock(mq);
+	while (nni_msgq_len(mq) > (cap + 1)) {
 		// too many messages -- we allow that one for
 		// the case of pushback or cap == 0.
 		// we delete the oldest messages first
-		msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get > mq->mq_alloc) {
-			mq->mq_get = 0;
-		}
-		mq->mq_len--;
-		nni_msg_free(msg);
+		nni_msg_free(nni_msgq_pop(mq));
 	}
 	if (newq == NULL) {
 		// Just shrinking the queue, no changes
@@ -380,47 +491,39 @@ nni_msgq_resize(nni_msgq *mq, int cap)
 	}
 
 	oldq     = mq->mq_msgs;
-	oldget   = mq->mq_get;
 	oldalloc = mq->mq_alloc;
-	oldlen   = mq->mq_len;
-
-	mq->mq_msgs = newq;
-	mq->mq_len = mq->mq_get = mq->mq_put = 0;
-	mq->mq_cap                           = cap;
-	mq->mq_alloc                         = alloc;
 
-	while (oldlen) {
-		mq->mq_msgs[mq->mq_put++] = oldq[oldget++];
-		if (oldget == oldalloc) {
-			oldget = 0;
-		}
-		if (mq->mq_put == mq->mq_alloc) {
-			mq->mq_put = 0;
-		}
-		mq->mq_len++;
-		oldlen--;
+	put = 0;
+	while (nni_msgq_len(mq) > 0) {
+		newq[put++] = nni_msgq_pop(mq);
 	}
 	nni_free(oldq, sizeof(nni_msg *) * oldalloc);
 
+	mq->mq_msgs  = newq;
+	mq->mq_cap   = cap;
+	mq->mq_alloc = alloc;
+	nni_atomic_set(&mq->mq_get, 0);
+	nni_atomic_set(&mq->mq_put, put);
+
 out:
 	// Wake everyone up -- we changed everything.
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 	return (0);
 }
 
 int
 nni_msgq_get_recvable(nni_msgq *mq, nni_pollable **sp)
 {
-	nni_mtx_lock(&mq->mq_lock);
+	nni_msgq_lock(mq);
 	if (mq->mq_recvable == NULL) {
 		int rv;
 		if ((rv = nni_pollable_alloc(&mq->mq_recvable)) != 0) {
-			nni_mtx_unlock(&mq->mq_lock);
+			nni_msgq_unlock(mq);
 			return (rv);
 		}
 		nni_msgq_run_notify(mq);
 	}
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 
 	*sp = mq->mq_recvable;
 	return (0);
@@ -429,16 +532,16 @@ nni_msgq_get_recvable(nni_msgq *mq, nni_pollable **sp)
 int
 nni_msgq_get_sendable(nni_msgq *mq, nni_pollable **sp)
 {
-	nni_mtx_lock(&mq->mq_lock);
+	nni_msgq_lock(mq);
 	if (mq->mq_sendable == NULL) {
 		int rv;
 		if ((rv = nni_pollable_alloc(&mq->mq_sendable)) != 0) {
-			nni_mtx_unlock(&mq->mq_lock);
+			nni_msgq_unlock(mq);
 			return (rv);
 		}
 		nni_msgq_run_notify(mq);
 	}
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_unlock(mq);
 
 	*sp = mq->mq_sendable;
 	return (0);
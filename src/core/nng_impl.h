@@ -30,11 +30,13 @@
 #include "core/clock.h"
 #include "core/device.h"
 #include "core/file.h"
+#include "core/handle.h"
 #include "core/idhash.h"
 #include "core/init.h"
 #include "core/list.h"
 #include "core/lmq.h"
 #include "core/message.h"
+#include "core/msgpool.h"
 #include "core/msgqueue.h"
 #include "core/options.h"
 #include "core/panic.h"
@@ -20,29 +20,17 @@
 // Operations on pipes (to the transport) are generally blocking operations,
 // performed in the context of the protocol.
 
-static nni_idhash *nni_pipes;
-static nni_mtx     nni_pipe_lk;
+static nni_handles *nni_pipes;
+static nni_mtx      nni_pipe_lk;
 
 int
 nni_pipe_sys_init(void)
 {
-	int rv;
-
 	nni_mtx_init(&nni_pipe_lk);
 
-	if ((rv = nni_idhash_init(&nni_pipes)) != 0) {
-		return (rv);
-	}
-
-	// Note that pipes have their own namespace.  ID hash will
-	// guarantee the that the first value is reasonable (non-zero),
-	// if we supply an out of range value (0).  (Consequently the
-	// value "1" has a bias -- its roughly twice as likely to be
-	// chosen as any other value.  This does not mater.)
-	nni_idhash_set_limits(
-	    nni_pipes, 1, 0x7fffffff, nni_random() & 0x7fffffffu);
-
-	return (0);
+	// Note that pipes have their own namespace, and their IDs are
+	// not predictable.
+	return (nni_handles_init(&nni_pipes, true));
 }
 
 void
@@ -51,7 +39,7 @@ nni_pipe_sys_fini(void)
 	nni_reap_drain();
 	nni_mtx_fini(&nni_pipe_lk);
 	if (nni_pipes != NULL) {
-		nni_idhash_fini(nni_pipes);
+		nni_handles_fini(nni_pipes);
 		nni_pipes = NULL;
 	}
 }
@@ -69,11 +57,13 @@ pipe_destroy(nni_pipe *p)
 	// This happens during initialization for example.
 	nni_mtx_lock(&nni_pipe_lk);
 	if (p->p_id != 0) {
-		nni_idhash_remove(nni_pipes, p->p_id);
-	}
-	// This wait guarantees that all callers are done with us.
-	while (p->p_refcnt != 0) {
-		nni_cv_wait(&p->p_cv);
+		nni_handle_close(nni_pipes, p->p_id);
+
+		// This wait guarantees that all callers are done with us.
+		while (nni_handle_refs(nni_pipes, p->p_id) != 0) {
+			nni_cv_wait(&p->p_cv);
+		}
+		nni_handle_free(nni_pipes, p->p_id);
 	}
 	nni_mtx_unlock(&nni_pipe_lk);
 
@@ -103,26 +93,26 @@ nni_pipe_find(nni_pipe **pp, uint32_t id)
 {
 	int       rv;
 	nni_pipe *p;
-	nni_mtx_lock(&nni_pipe_lk);
 
 	// We don't care if the pipe is "closed".  End users only have
 	// access to the pipe in order to obtain properties (which may
 	// be retried during the post-close notification callback) or to
-	// close the pipe.
-	if ((rv = nni_idhash_find(nni_pipes, id, (void **) &p)) == 0) {
-		p->p_refcnt++;
+	// close the pipe.  Only once it is being destroyed does the
+	// handle close.
+	if ((rv = nni_handle_hold(nni_pipes, id, (void **) &p)) == 0) {
 		*pp = p;
 	}
-	nni_mtx_unlock(&nni_pipe_lk);
 	return (rv);
 }
 
 void
 nni_pipe_rele(nni_pipe *p)
 {
+	if ((p->p_id == 0) || nni_handle_rele_fast(nni_pipes, p->p_id)) {
+		return;
+	}
 	nni_mtx_lock(&nni_pipe_lk);
-	p->p_refcnt--;
-	if (p->p_refcnt == 0) {
+	if (nni_handle_rele(nni_pipes, p->p_id) == 0) {
 		nni_cv_wake(&p->p_cv);
 	}
 	nni_mtx_unlock(&nni_pipe_lk);
@@ -180,6 +170,12 @@ nni_pipe_peer(nni_pipe *p)
 	return (p->p_tran_ops.p_peer(p->p_tran_data));
 }
 
+bool
+nni_pipe_framed(nni_pipe *p)
+{
+	return (p->p_tran_ops.p_framed);
+}
+
 static int
 pipe_create(nni_pipe **pp, nni_sock *sock, nni_tran *tran, void *tdata)
 {
@@ -206,7 +202,6 @@ pipe_create(nni_pipe **pp, nni_sock *sock, nni_tran *tran, void *tdata)
 	p->p_sock       = sock;
 	p->p_closed     = false;
 	p->p_cbs        = false;
-	p->p_refcnt     = 0;
 	st              = &p->p_stats;
 
 	nni_atomic_flag_reset(&p->p_stop);
@@ -216,11 +211,10 @@ pipe_create(nni_pipe **pp, nni_sock *sock, nni_tran *tran, void *tdata)
 	nni_mtx_init(&p->p_mtx);
 	nni_cv_init(&p->p_cv, &nni_pipe_lk);
 
-	nni_mtx_lock(&nni_pipe_lk);
-	if ((rv = nni_idhash_alloc32(nni_pipes, &p->p_id, p)) == 0) {
-		p->p_refcnt = 1;
-	}
-	nni_mtx_unlock(&nni_pipe_lk);
+	// The creator holds the first reference.  The ID is not published
+	// until the pipe is fully initialized, so nng_pipe lookups cannot
+	// find a half-built pipe.
+	rv = nni_handle_alloc(nni_pipes, &p->p_id, p, 1);
 
 	snprintf(st->s_scope, sizeof(st->s_scope), "pipe%u", p->p_id);
 
@@ -251,6 +245,7 @@ pipe_create(nni_pipe **pp, nni_sock *sock, nni_tran *tran, void *tdata)
 		nni_pipe_rele(p);
 		return (rv);
 	}
+	nni_handle_publish(nni_pipes, p->p_id);
 
 	*pp = p;
 	return (0);
@@ -37,6 +37,10 @@ extern void nni_pipe_close(nni_pipe *);
 extern uint16_t nni_pipe_proto(nni_pipe *);
 extern uint16_t nni_pipe_peer(nni_pipe *);
 
+// nni_pipe_framed returns true if the pipe's transport sends the frame
+// encoded by nni_msg_frame_prep, so that encoding it is worthwhile.
+extern bool nni_pipe_framed(nni_pipe *);
+
 // nni_pipe_getopt looks up the option.  The last argument is the type,
 // which.  If the type is NNI_TYPE_OPAQUE, then no format check is performed.
 extern int nni_pipe_getopt(
@@ -91,6 +91,7 @@ extern void nni_free(void *, size_t);
 typedef struct nni_plat_mtx nni_plat_mtx;
 typedef struct nni_plat_cv  nni_plat_cv;
 typedef struct nni_plat_thr nni_plat_thr;
+typedef struct nni_plat_tls nni_plat_tls;
 
 //
 // Threading & Synchronization Support
@@ -157,6 +158,17 @@ extern void nni_plat_thr_fini(nni_plat_thr *);
 // prevention in callbacks, for example.)
 extern bool nni_plat_thr_is_self(nni_plat_thr *);
 
+// nni_plat_tls is a thread-local storage slot holding a single pointer.
+// Every thread sees NULL until it stores something of its own.  Slots
+// are a scarce resource on some platforms, so use them sparingly.  The
+// destructor, if not NULL, is called with a thread's non-NULL value when
+// that thread exits.  Not all platforms can do that (Windows does not),
+// so callers must cope with values that are simply abandoned.
+extern int   nni_plat_tls_init(nni_plat_tls *, void (*)(void *));
+extern void  nni_plat_tls_fini(nni_plat_tls *);
+extern void  nni_plat_tls_set(nni_plat_tls *, void *);
+extern void *nni_plat_tls_get(nni_plat_tls *);
+
 //
 // Atomics support.  This will evolve over time.
 //
@@ -228,6 +240,11 @@ extern bool nni_atomic_cas(nni_atomic_int *, int, int);
 // option of using negative values for other purposes in the future.)
 extern nni_time nni_plat_clock(void);
 
+// nni_plat_clock_us is like nni_plat_clock, but in microseconds.  It is
+// meant for measuring short intervals, such as how long to spin, and
+// need not share a base with nni_plat_clock.
+extern uint64_t nni_plat_clock_us(void);
+
 // nni_plat_sleep sleeps for the specified number of milliseconds (at least).
 extern void nni_plat_sleep(nni_duration);
 
@@ -447,6 +464,34 @@ extern int nni_plat_file_put(const char *, const void *, size_t);
 // using the supplied size when no longer needed.
 extern int nni_plat_file_get(const char *, void **, size_t *);
 
+typedef struct nni_plat_fh nni_plat_fh;
+
+// nni_plat_file_open opens the named file for reading, returning its size.
+// This is for files that are too large to read all at once; they are read
+// piecewise with nni_plat_file_pread instead.  If the file is not a
+// regular file, NNG_ENOTSUP is returned, and nni_plat_file_get should be
+// used instead.  The handle is released with nni_plat_file_close.
+extern int nni_plat_file_open(const char *, nni_plat_fh *, uint64_t *);
+
+// nni_plat_file_pread reads up to the given size from the given offset,
+// returning the number of bytes read, which is less than asked for only at
+// the end of the file.  It does not move any file position, so one handle
+// may be shared by several readers.
+extern int nni_plat_file_pread(
+    nni_plat_fh *, void *, size_t, uint64_t, size_t *);
+
+// nni_plat_file_close closes a handle from nni_plat_file_open.
+extern void nni_plat_file_close(nni_plat_fh *);
+
+// nni_plat_file_info returns the size of the named file, the time it was
+// last modified, in nanoseconds since the Unix epoch (as fine as the file
+// system records it), and a number identifying the file on its volume
+// (the inode number), so that a file replaced by another is noticed even
+// if the size and time match.  If the path is not a regular file,
+// NNG_ENOTSUP is returned.
+extern int nni_plat_file_info(
+    const char *, uint64_t *, uint64_t *, uint64_t *);
+
 // nni_plat_file_delete deletes the named file.  If the name refers to
 // a directory, then that will be removed only if empty.
 extern int nni_plat_file_delete(const char *);
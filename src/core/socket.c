@@ -16,10 +16,10 @@
 
 // Socket implementation.
 
-static nni_list    sock_list;
-static nni_idhash *sock_hash;
-static nni_mtx     sock_lk;
-static nni_idhash *ctx_hash;
+static nni_list     sock_list;
+static nni_handles *sock_handles;
+static nni_mtx      sock_lk;
+static nni_handles *ctx_handles;
 
 struct nni_ctx {
 	nni_list_node     c_node;
@@ -27,9 +27,7 @@ struct nni_ctx {
 	nni_proto_ctx_ops c_ops;
 	void *            c_data;
 	size_t            c_size;
-	bool              c_closed;
-	unsigned          c_refcnt; // protected by global lock
-	uint32_t          c_id;
+	uint32_t          c_id; // handle holds the reference count
 	nng_duration      c_sndtimeo;
 	nng_duration      c_rcvtimeo;
 };
@@ -68,10 +66,9 @@ struct nni_socket {
 	nni_cv        s_cv;
 	nni_cv        s_close_cv;
 
-	uint32_t s_id;
+	uint32_t s_id; // handle holds the reference count
 	uint32_t s_flags;
-	unsigned s_refcnt; // protected by global lock
-	void *   s_data;   // Protocol private
+	void *   s_data; // Protocol private
 	size_t   s_size;
 
 	nni_msgq *s_uwq; // Upper write queue
@@ -87,6 +84,7 @@ struct nni_socket {
 	// options
 	nni_duration s_sndtimeo;  // send timeout
 	nni_duration s_rcvtimeo;  // receive timeout
+	int          s_busypoll;  // receive busy poll, in usec
 	nni_duration s_reconn;    // reconnect time
 	nni_duration s_reconnmax; // max reconnect time
 	size_t       s_rcvmaxsz;  // max receive size
@@ -187,6 +185,19 @@ sock_get_recvtimeo(void *s, void *buf, size_t *szp, nni_type t)
 	return (nni_copyout_ms(SOCK(s)->s_rcvtimeo, buf, szp, t));
 }
 
+static int
+sock_set_busypoll(void *s, const void *buf, size_t sz, nni_type t)
+{
+	return (nni_copyin_int(
+	    &SOCK(s)->s_busypoll, buf, sz, 0, 1000000, t));
+}
+
+static int
+sock_get_busypoll(void *s, void *buf, size_t *szp, nni_type t)
+{
+	return (nni_copyout_int(SOCK(s)->s_busypoll, buf, szp, t));
+}
+
 static int
 sock_set_sendtimeo(void *s, const void *buf, size_t sz, nni_type t)
 {
@@ -282,6 +293,11 @@ static const nni_option sock_options[] = {
 	    .o_get  = sock_get_recvtimeo,
 	    .o_set  = sock_set_recvtimeo,
 	},
+	{
+	    .o_name = NNG_OPT_RECVBUSYPOLL,
+	    .o_get  = sock_get_busypoll,
+	    .o_set  = sock_set_busypoll,
+	},
 	{
 	    .o_name = NNG_OPT_SENDTIMEO,
 	    .o_get  = sock_get_sendtimeo,
@@ -373,30 +389,23 @@ nni_sock_find(nni_sock **sockp, uint32_t id)
 	if ((rv = nni_init()) != 0) {
 		return (rv);
 	}
-	nni_mtx_lock(&sock_lk);
-	if ((rv = nni_idhash_find(sock_hash, id, (void **) &s)) == 0) {
-		if (s->s_closed) {
-			rv = NNG_ECLOSED;
-		} else {
-			s->s_refcnt++;
-			*sockp = s;
-		}
-	}
-	nni_mtx_unlock(&sock_lk);
-
-	if (rv == NNG_ENOENT) {
-		rv = NNG_ECLOSED;
+	// This takes no lock; a socket that is closing cannot be found.
+	if (nni_handle_hold(sock_handles, id, (void **) &s) != 0) {
+		return (NNG_ECLOSED);
 	}
-
-	return (rv);
+	*sockp = s;
+	return (0);
 }
 
 void
 nni_sock_rele(nni_sock *s)
 {
+	if (nni_handle_rele_fast(sock_handles, s->s_id)) {
+		return;
+	}
+	// The socket is closing, and the closer may be waiting for us.
 	nni_mtx_lock(&sock_lk);
-	s->s_refcnt--;
-	if (s->s_closed && (s->s_refcnt < 2)) {
+	if (nni_handle_rele(sock_handles, s->s_id) < 2) {
 		nni_cv_wake(&s->s_close_cv);
 	}
 	nni_mtx_unlock(&sock_lk);
@@ -520,7 +529,6 @@ nni_sock_create(nni_sock **sp, const nni_proto *proto)
 	s->s_reconnmax = 0;
 	s->s_rcvmaxsz  = 0; // unlimited by default
 	s->s_id        = 0;
-	s->s_refcnt    = 0;
 	s->s_self_id   = proto->proto_self;
 	s->s_peer_id   = proto->proto_peer;
 	s->s_flags     = proto->proto_flags;
@@ -587,26 +595,24 @@ nni_sock_sys_init(void)
 	NNI_LIST_INIT(&sock_list, nni_sock, s_node);
 	nni_mtx_init(&sock_lk);
 
-	if (((rv = nni_idhash_init(&sock_hash)) != 0) ||
-	    ((rv = nni_idhash_init(&ctx_hash)) != 0)) {
+	if (((rv = nni_handles_init(&sock_handles, false)) != 0) ||
+	    ((rv = nni_handles_init(&ctx_handles, false)) != 0)) {
 		nni_sock_sys_fini();
 		return (rv);
 	}
-	nni_idhash_set_limits(sock_hash, 1, 0x7fffffff, 1);
-	nni_idhash_set_limits(ctx_hash, 1, 0x7fffffff, 1);
 	return (0);
 }
 
 void
 nni_sock_sys_fini(void)
 {
-	if (sock_hash != NULL) {
-		nni_idhash_fini(sock_hash);
-		sock_hash = NULL;
+	if (sock_handles != NULL) {
+		nni_handles_fini(sock_handles);
+		sock_handles = NULL;
 	}
-	if (ctx_hash != NULL) {
-		nni_idhash_fini(ctx_hash);
-		ctx_hash = NULL;
+	if (ctx_handles != NULL) {
+		nni_handles_fini(ctx_handles);
+		ctx_handles = NULL;
 	}
 	nni_mtx_fini(&sock_lk);
 }
@@ -628,13 +634,15 @@ nni_sock_open(nni_sock **sockp, const nni_proto *proto)
 	}
 
 	nni_mtx_lock(&sock_lk);
-	if (nni_idhash_alloc32(sock_hash, &s->s_id, s) != 0) {
+	if ((rv = nni_handle_alloc(sock_handles, &s->s_id, s, 0)) != 0) {
+		nni_mtx_unlock(&sock_lk);
 		sock_destroy(s);
-	} else {
-		nni_list_append(&sock_list, s);
-		s->s_sock_ops.sock_open(s->s_data);
-		*sockp = s;
+		return (rv);
 	}
+	nni_list_append(&sock_list, s);
+	s->s_sock_ops.sock_open(s->s_data);
+	nni_handle_publish(sock_handles, s->s_id);
+	*sockp = s;
 	nni_mtx_unlock(&sock_lk);
 
 	// Set the socket name.
@@ -687,11 +695,10 @@ nni_sock_shutdown(nni_sock *sock)
 	nni_mtx_lock(&sock_lk);
 	nctx = nni_list_first(&sock->s_ctxs);
 	while ((ctx = nctx) != NULL) {
-		nctx          = nni_list_next(&sock->s_ctxs, ctx);
-		ctx->c_closed = true;
-		if (ctx->c_refcnt == 0) {
+		nctx = nni_list_next(&sock->s_ctxs, ctx);
+		if (nni_handle_close(ctx_handles, ctx->c_id) == 0) {
 			// No open operations.  So close it.
-			nni_idhash_remove(ctx_hash, ctx->c_id);
+			nni_handle_free(ctx_handles, ctx->c_id);
 			nni_list_remove(&sock->s_ctxs, ctx);
 			nni_ctx_destroy(ctx);
 		}
@@ -790,7 +797,7 @@ nni_sock_close(nni_sock *s)
 		return;
 	}
 	s->s_closed = true;
-	nni_idhash_remove(sock_hash, s->s_id);
+	nni_handle_close(sock_handles, s->s_id);
 
 	// We might have been removed from the list already, e.g. by
 	// nni_sock_closeall.  This is idempotent.
@@ -799,9 +806,11 @@ nni_sock_close(nni_sock *s)
 	// Wait for all other references to drop.  Note that we
 	// have a reference already (from our caller).
 	s->s_ctxwait = true;
-	while ((s->s_refcnt > 1) || (!nni_list_empty(&s->s_ctxs))) {
+	while ((nni_handle_refs(sock_handles, s->s_id) > 1) ||
+	    (!nni_list_empty(&s->s_ctxs))) {
 		nni_cv_wait(&s->s_close_cv);
 	}
+	nni_handle_free(sock_handles, s->s_id);
 	nni_mtx_unlock(&sock_lk);
 
 	// Because we already shut everything down before, we should not
@@ -820,7 +829,7 @@ nni_sock_closeall(void)
 {
 	nni_sock *s;
 
-	if (sock_hash == NULL) {
+	if (sock_handles == NULL) {
 		return;
 	}
 	for (;;) {
@@ -830,9 +839,13 @@ nni_sock_closeall(void)
 			return;
 		}
 		// Bump the reference count.  The close call below
-		// will drop it.
-		s->s_refcnt++;
+		// will drop it.  Sockets on the list are never closed,
+		// as closing one takes it off under the same lock.
 		nni_list_node_remove(&s->s_node);
+		if (nni_handle_hold(sock_handles, s->s_id, NULL) != 0) {
+			nni_mtx_unlock(&sock_lk);
+			continue;
+		}
 		nni_mtx_unlock(&sock_lk);
 		nni_sock_close(s);
 	}
@@ -852,6 +865,12 @@ nni_sock_recv(nni_sock *sock, nni_aio *aio)
 	sock->s_sock_ops.sock_recv(sock->s_data, aio);
 }
 
+int
+nni_sock_busypoll(nni_sock *sock)
+{
+	return (sock->s_busypoll);
+}
+
 // nni_sock_proto_id returns the socket's 16-bit protocol number.
 uint16_t
 nni_sock_proto_id(nni_sock *sock)
@@ -1160,28 +1179,20 @@ nni_ctx_find(nni_ctx **ctxp, uint32_t id, bool closing)
 	if ((rv = nni_init()) != 0) {
 		return (rv);
 	}
-	nni_mtx_lock(&sock_lk);
-	if ((rv = nni_idhash_find(ctx_hash, id, (void **) &ctx)) == 0) {
-		// We refuse a reference if either the socket is
-		// closed, or the context is closed.  (If the socket
-		// is closed, and we are only getting the reference so
-		// we can close it, then we still allow.  In the case
-		// the only valid operation will be to close the
-		// socket.)
-		if (ctx->c_closed || ((!closing) && ctx->c_sock->s_closed)) {
-			rv = NNG_ECLOSED;
-		} else {
-			ctx->c_refcnt++;
-			*ctxp = ctx;
-		}
+	// We refuse a reference if either the socket is closed, or the
+	// context is closed.  (If the socket is closed, and we are only
+	// getting the reference so we can close it, then we still allow.
+	// In the case the only valid operation will be to close the
+	// socket.)  The socket cannot go away while we hold the context.
+	if (nni_handle_hold(ctx_handles, id, (void **) &ctx) != 0) {
+		return (NNG_ECLOSED);
 	}
-	nni_mtx_unlock(&sock_lk);
-
-	if (rv == NNG_ENOENT) {
-		rv = NNG_ECLOSED;
+	if ((!closing) && nni_handle_closed(sock_handles, ctx->c_sock->s_id)) {
+		nni_ctx_rele(ctx);
+		return (NNG_ECLOSED);
 	}
-
-	return (rv);
+	*ctxp = ctx;
+	return (0);
 }
 
 static void
@@ -1199,19 +1210,21 @@ void
 nni_ctx_rele(nni_ctx *ctx)
 {
 	nni_sock *sock = ctx->c_sock;
+
+	if (nni_handle_rele_fast(ctx_handles, ctx->c_id)) {
+		// Not actually closing yet.
+		return;
+	}
 	nni_mtx_lock(&sock_lk);
-	ctx->c_refcnt--;
-	if ((ctx->c_refcnt > 0) || (!ctx->c_closed)) {
-		// Either still have an active reference, or not
-		// actually closing yet.
+	if (nni_handle_rele(ctx_handles, ctx->c_id) > 0) {
+		// Still have an active reference.
 		nni_mtx_unlock(&sock_lk);
 		return;
 	}
 
-	// Remove us from the hash, so we can't be found any more.
-	// This allows our ID to be reused later, although the system
-	// tries to avoid ID reuse.
-	nni_idhash_remove(ctx_hash, ctx->c_id);
+	// Release the ID.  It can be reused later, although the
+	// system tries to avoid ID reuse.
+	nni_handle_free(ctx_handles, ctx->c_id);
 	nni_list_remove(&sock->s_ctxs, ctx);
 	if (sock->s_closed || sock->s_ctxwait) {
 		nni_cv_wake(&sock->s_close_cv);
@@ -1237,9 +1250,7 @@ nni_ctx_open(nni_ctx **ctxp, nni_sock *sock)
 		return (NNG_ENOMEM);
 	}
 	ctx->c_size = sz;
-	ctx->c_data = ctx + 1;
-	ctx->c_closed   = false;
-	ctx->c_refcnt   = 1; // Caller implicitly gets a reference.
+	ctx->c_data     = ctx + 1;
 	ctx->c_sock     = sock;
 	ctx->c_ops      = sock->s_ctx_ops;
 	ctx->c_rcvtimeo = sock->s_rcvtimeo;
@@ -1251,20 +1262,22 @@ nni_ctx_open(nni_ctx **ctxp, nni_sock *sock)
 		nni_free(ctx, ctx->c_size);
 		return (NNG_ECLOSED);
 	}
-	if ((rv = nni_idhash_alloc32(ctx_hash, &ctx->c_id, ctx)) != 0) {
+	// Caller implicitly gets a reference.
+	if ((rv = nni_handle_alloc(ctx_handles, &ctx->c_id, ctx, 1)) != 0) {
 		nni_mtx_unlock(&sock_lk);
 		nni_free(ctx, ctx->c_size);
 		return (rv);
 	}
 
 	if ((rv = sock->s_ctx_ops.ctx_init(ctx->c_data, sock->s_data)) != 0) {
-		nni_idhash_remove(ctx_hash, ctx->c_id);
+		nni_handle_free(ctx_handles, ctx->c_id);
 		nni_mtx_unlock(&sock_lk);
 		nni_free(ctx, ctx->c_size);
 		return (rv);
 	}
 
 	nni_list_append(&sock->s_ctxs, ctx);
+	nni_handle_publish(ctx_handles, ctx->c_id);
 	nni_mtx_unlock(&sock_lk);
 
 	// Paranoia, fixing a possible race in close.  Don't let us
@@ -1285,10 +1298,7 @@ nni_ctx_open(nni_ctx **ctxp, nni_sock *sock)
 void
 nni_ctx_close(nni_ctx *ctx)
 {
-	nni_mtx_lock(&sock_lk);
-	ctx->c_closed = true;
-	nni_mtx_unlock(&sock_lk);
-
+	nni_handle_close(ctx_handles, ctx->c_id);
 	nni_ctx_rele(ctx);
 }
 
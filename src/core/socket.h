@@ -37,6 +37,7 @@ extern int      nni_sock_recvmsg(nni_sock *, nni_msg **, int);
 extern int      nni_sock_sendmsg(nni_sock *, nni_msg *, int);
 extern void     nni_sock_send(nni_sock *, nni_aio *);
 extern void     nni_sock_recv(nni_sock *, nni_aio *);
+extern int      nni_sock_busypoll(nni_sock *);
 extern uint32_t nni_sock_id(nni_sock *);
 
 // These are socket methods that protocol operations can expect to call.
@@ -124,7 +124,6 @@ struct nni_pipe {
 	bool               p_closed;
 	nni_atomic_flag    p_stop;
 	bool               p_cbs;
-	int                p_refcnt;
 	nni_mtx            p_mtx;
 	nni_cv             p_cv;
 	nni_reap_item      p_reap;
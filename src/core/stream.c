@@ -18,6 +18,9 @@
 #include "core/tcp.h"
 #include "supplemental/tls/tls_api.h"
 #include "supplemental/websocket/websocket.h"
+#ifdef NNG_TRANSPORT_SHM
+#include "transport/shm/shm_stream.h"
+#endif
 
 static struct {
 	const char *scheme;
@@ -32,6 +35,14 @@ static struct {
 	    .listener_alloc = nni_ipc_listener_alloc,
 	    .checkopt       = nni_ipc_checkopt,
 	},
+#ifdef NNG_TRANSPORT_SHM
+	{
+	    .scheme         = "shm",
+	    .dialer_alloc   = nni_shm_dialer_alloc,
+	    .listener_alloc = nni_shm_listener_alloc,
+	    .checkopt       = nni_shm_checkopt,
+	},
+#endif
 #ifdef NNG_TRANSPORT_TCP
 	{
 	    .scheme         = "tcp",
@@ -10,22 +10,104 @@
 
 #include "core/nng_impl.h"
 
+// Each worker thread owns its own queue of tasks.  A worker runs the tasks
+// on its own queue oldest first, and when that is empty it steals from the
+// tail of its peers' queues, that being the work the owner would have
+// reached last.  Tasks dispatched from a worker thread land on that
+// worker's own queue, so that completions stay local (and warm in cache)
+// rather than all contending on a single queue lock.  The taskq lock is
+// only used to park and wake idle workers, and dispatchers only take it
+// when there is somebody idle to wake.
 typedef struct nni_taskq_thr nni_taskq_thr;
 struct nni_taskq_thr {
-	nni_taskq *tqt_tq;
-	nni_thr    tqt_thread;
+	nni_taskq *    tqt_tq;
+	nni_thr        tqt_thread;
+	int            tqt_index;
+	nni_mtx        tqt_mtx;
+	nni_list       tqt_tasks;
+	nni_atomic_int tqt_len; // hint for thieves, avoids locking empties
 };
 struct nni_taskq {
-	nni_list       tq_tasks;
 	nni_mtx        tq_mtx;
 	nni_cv         tq_sched_cv;
-	nni_cv         tq_wait_cv;
 	nni_taskq_thr *tq_threads;
 	int            tq_nthreads;
+	nni_atomic_int tq_idle;
 	bool           tq_run;
 };
 
-static nni_taskq *nni_taskq_systq = NULL;
+static nni_taskq *  nni_taskq_systq = NULL;
+static nni_plat_tls nni_taskq_self;  // current worker, if any
+static bool         nni_task_spinok; // more than one CPU to spin on
+
+// nni_task_busy and nni_task_idle adjust the busy count, keeping
+// task_done in step for nni_task_spin.  Called with task_mtx held.
+static void
+nni_task_busy(nni_task *task)
+{
+	task->task_busy++;
+	nni_atomic_set_bool(&task->task_done, false);
+}
+
+static void
+nni_task_idle(nni_task *task)
+{
+	task->task_busy--;
+	if (task->task_busy == 0) {
+		nni_atomic_set_bool(&task->task_done, true);
+		nni_cv_wake(&task->task_cv);
+	}
+}
+
+static void
+nni_taskq_push(nni_taskq_thr *thr, nni_task *task)
+{
+	nni_mtx_lock(&thr->tqt_mtx);
+	nni_list_append(&thr->tqt_tasks, task);
+	nni_atomic_inc(&thr->tqt_len);
+	nni_mtx_unlock(&thr->tqt_mtx);
+}
+
+static nni_task *
+nni_taskq_pop(nni_taskq_thr *thr, bool steal)
+{
+	nni_task *task;
+
+	if (nni_atomic_get(&thr->tqt_len) == 0) {
+		return (NULL);
+	}
+	nni_mtx_lock(&thr->tqt_mtx);
+	task = steal ? nni_list_last(&thr->tqt_tasks)
+	             : nni_list_first(&thr->tqt_tasks);
+	if (task != NULL) {
+		nni_mtx_lock(&task->task_mtx);
+		nni_list_remove(&thr->tqt_tasks, task);
+		nni_mtx_unlock(&task->task_mtx);
+		nni_atomic_dec(&thr->tqt_len);
+	}
+	nni_mtx_unlock(&thr->tqt_mtx);
+	return (task);
+}
+
+static nni_task *
+nni_taskq_get(nni_taskq_thr *thr)
+{
+	nni_taskq *tq = thr->tqt_tq;
+	nni_task * task;
+
+	if ((task = nni_taskq_pop(thr, false)) != NULL) {
+		return (task);
+	}
+	// Start with our neighbor, so that thieves spread out.
+	for (int i = 1; i < tq->tq_nthreads; i++) {
+		int idx = (thr->tqt_index + i) % tq->tq_nthreads;
+		if ((task = nni_taskq_pop(&tq->tq_threads[idx], true)) !=
+		    NULL) {
+			return (task);
+		}
+	}
+	return (NULL);
+}
 
 static void
 nni_taskq_thread(void *self)
@@ -34,36 +116,34 @@ nni_taskq_thread(void *self)
 	nni_taskq *    tq  = thr->tqt_tq;
 	nni_task *     task;
 
-	nni_mtx_lock(&tq->tq_mtx);
-	for (;;) {
-		if ((task = nni_list_first(&tq->tq_tasks)) != NULL) {
-
-			nni_mtx_lock(&task->task_mtx);
-			nni_list_remove(&tq->tq_tasks, task);
-			nni_mtx_unlock(&task->task_mtx);
+	nni_plat_tls_set(&nni_taskq_self, thr);
 
+	for (;;) {
+		if ((task = nni_taskq_get(thr)) == NULL) {
+			// Announce that we are idle before looking one last
+			// time; dispatchers check the idle count after they
+			// have queued their task, so one of us will see the
+			// other.
+			nni_mtx_lock(&tq->tq_mtx);
+			nni_atomic_inc(&tq->tq_idle);
+			while (((task = nni_taskq_get(thr)) == NULL) &&
+			    tq->tq_run) {
+				nni_cv_wait(&tq->tq_sched_cv);
+			}
+			nni_atomic_dec(&tq->tq_idle);
 			nni_mtx_unlock(&tq->tq_mtx);
-
-			task->task_cb(task->task_arg);
-
-			nni_mtx_lock(&task->task_mtx);
-			task->task_busy--;
-			if (task->task_busy == 0) {
-				nni_cv_wake(&task->task_cv);
+			if (task == NULL) {
+				break;
 			}
-			nni_mtx_unlock(&task->task_mtx);
-
-			nni_mtx_lock(&tq->tq_mtx);
-
-			continue;
 		}
 
-		if (!tq->tq_run) {
-			break;
-		}
-		nni_cv_wait(&tq->tq_sched_cv);
+		task->task_cb(task->task_arg);
+
+		nni_mtx_lock(&task->task_mtx);
+		nni_task_idle(task);
+		nni_mtx_unlock(&task->task_mtx);
 	}
-	nni_mtx_unlock(&tq->tq_mtx);
+	nni_plat_tls_set(&nni_taskq_self, NULL);
 }
 
 int
@@ -80,15 +160,21 @@ nni_taskq_init(nni_taskq **tqp, int nthr)
 		return (NNG_ENOMEM);
 	}
 	tq->tq_nthreads = nthr;
-	NNI_LIST_INIT(&tq->tq_tasks, nni_task, task_node);
+	nni_atomic_init(&tq->tq_idle);
 
 	nni_mtx_init(&tq->tq_mtx);
 	nni_cv_init(&tq->tq_sched_cv, &tq->tq_mtx);
-	nni_cv_init(&tq->tq_wait_cv, &tq->tq_mtx);
 
+	for (int i = 0; i < nthr; i++) {
+		nni_taskq_thr *thr = &tq->tq_threads[i];
+		thr->tqt_tq        = tq;
+		thr->tqt_index     = i;
+		nni_mtx_init(&thr->tqt_mtx);
+		NNI_LIST_INIT(&thr->tqt_tasks, nni_task, task_node);
+		nni_atomic_init(&thr->tqt_len);
+	}
 	for (int i = 0; i < nthr; i++) {
 		int rv;
-		tq->tq_threads[i].tqt_tq = tq;
 #ifdef __NuttX__
 		tq->tq_threads[i].tqt_thread.name = "nngtaskq";
 #endif
@@ -122,7 +208,9 @@ nni_taskq_fini(nni_taskq *tq)
 	for (int i = 0; i < tq->tq_nthreads; i++) {
 		nni_thr_fini(&tq->tq_threads[i].tqt_thread);
 	}
-	nni_cv_fini(&tq->tq_wait_cv);
+	for (int i = 0; i < tq->tq_nthreads; i++) {
+		nni_mtx_fini(&tq->tq_threads[i].tqt_mtx);
+	}
 	nni_cv_fini(&tq->tq_sched_cv);
 	nni_mtx_fini(&tq->tq_mtx);
 	NNI_FREE_STRUCTS(tq->tq_threads, tq->tq_nthreads);
@@ -136,7 +224,7 @@ nni_task_exec(nni_task *task)
 	if (task->task_prep) {
 		task->task_prep = false;
 	} else {
-		task->task_busy++;
+		nni_task_busy(task);
 	}
 	nni_mtx_unlock(&task->task_mtx);
 
@@ -145,17 +233,15 @@ nni_task_exec(nni_task *task)
 	}
 
 	nni_mtx_lock(&task->task_mtx);
-	task->task_busy--;
-	if (task->task_busy == 0) {
-		nni_cv_wake(&task->task_cv);
-	}
+	nni_task_idle(task);
 	nni_mtx_unlock(&task->task_mtx);
 }
 
 void
 nni_task_dispatch(nni_task *task)
 {
-	nni_taskq *tq = task->task_tq;
+	nni_taskq *    tq = task->task_tq;
+	nni_taskq_thr *thr;
 
 	// If there is no callback to perform, then do nothing!
 	// The user will be none the wiser.
@@ -167,21 +253,33 @@ nni_task_dispatch(nni_task *task)
 	if (task->task_prep) {
 		task->task_prep = false;
 	} else {
-		task->task_busy++;
+		nni_task_busy(task);
 	}
 	nni_mtx_unlock(&task->task_mtx);
 
-	nni_mtx_lock(&tq->tq_mtx);
-	nni_list_append(&tq->tq_tasks, task);
-	nni_cv_wake1(&tq->tq_sched_cv); // waking just one waiter is adequate
-	nni_mtx_unlock(&tq->tq_mtx);
+	// From one of our own workers, keep the task local.  Otherwise
+	// spread tasks by address, which at least keeps any one task on a
+	// consistent worker; idle workers will steal to even things out.
+	thr = nni_plat_tls_get(&nni_taskq_self);
+	if ((thr == NULL) || (thr->tqt_tq != tq)) {
+		uintptr_t h = (uintptr_t) task;
+		h           = (h >> 4) ^ (h >> 12);
+		thr         = &tq->tq_threads[h % (unsigned) tq->tq_nthreads];
+	}
+	nni_taskq_push(thr, task);
+
+	if (nni_atomic_get(&tq->tq_idle) > 0) {
+		nni_mtx_lock(&tq->tq_mtx);
+		nni_cv_wake1(&tq->tq_sched_cv); // one waiter is adequate
+		nni_mtx_unlock(&tq->tq_mtx);
+	}
 }
 
 void
 nni_task_prep(nni_task *task)
 {
 	nni_mtx_lock(&task->task_mtx);
-	task->task_busy++;
+	nni_task_busy(task);
 	task->task_prep = true;
 	nni_mtx_unlock(&task->task_mtx);
 }
@@ -193,10 +291,7 @@ nni_task_abort(nni_task *task)
 	nni_mtx_lock(&task->task_mtx);
 	if (task->task_prep) {
 		task->task_prep = false;
-		task->task_busy--;
-		if (task->task_busy == 0) {
-			nni_cv_wake(&task->task_cv);
-		}
+		nni_task_idle(task);
 	}
 	nni_mtx_unlock(&task->task_mtx);
 }
@@ -210,6 +305,32 @@ nni_task_wait(nni_task *task)
 	nni_mtx_unlock(&task->task_mtx);
 }
 
+bool
+nni_task_spin(nni_task *task, int usec)
+{
+	uint64_t end;
+	bool     busy;
+
+	// On a single CPU, whoever would complete the task cannot run
+	// while we spin, so just block.
+	if ((usec <= 0) || !nni_task_spinok) {
+		return (false);
+	}
+	// Poll the done flag rather than the mutex, so that we do not
+	// contend with the thread that is trying to finish the task.  The
+	// flag can be stale, so confirm under the lock, once.
+	end = nni_plat_clock_us() + (uint64_t) usec;
+	while (!nni_atomic_get_bool(&task->task_done)) {
+		if (nni_plat_clock_us() >= end) {
+			return (false);
+		}
+	}
+	nni_mtx_lock(&task->task_mtx);
+	busy = task->task_busy != 0;
+	nni_mtx_unlock(&task->task_mtx);
+	return (!busy);
+}
+
 void
 nni_task_init(nni_task *task, nni_taskq *tq, nni_cb cb, void *arg)
 {
@@ -218,6 +339,8 @@ nni_task_init(nni_task *task, nni_taskq *tq, nni_cb cb, void *arg)
 	nni_cv_init(&task->task_cv, &task->task_mtx);
 	task->task_prep = false;
 	task->task_busy = 0;
+	nni_atomic_init_bool(&task->task_done);
+	nni_atomic_set_bool(&task->task_done, true);
 	task->task_cb   = cb;
 	task->task_arg  = arg;
 	task->task_tq   = tq != NULL ? tq : nni_taskq_systq;
@@ -239,6 +362,7 @@ int
 nni_taskq_sys_init(void)
 {
 	int nthrs;
+	int rv;
 
 #ifndef NNG_NUM_TASKQ_THREADS
 	nthrs = nni_plat_ncpu() * 2;
@@ -250,12 +374,22 @@ nni_taskq_sys_init(void)
 		nthrs = NNG_MAX_TASKQ_THREADS;
 	}
 #endif
-	return (nni_taskq_init(&nni_taskq_systq, nthrs));
+	nni_task_spinok = nni_plat_ncpu() > 1;
+	if ((rv = nni_plat_tls_init(&nni_taskq_self, NULL)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_taskq_init(&nni_taskq_systq, nthrs)) != 0) {
+		nni_plat_tls_fini(&nni_taskq_self);
+	}
+	return (rv);
 }
 
 void
 nni_taskq_sys_fini(void)
 {
-	nni_taskq_fini(nni_taskq_systq);
-	nni_taskq_systq = NULL;
+	if (nni_taskq_systq != NULL) {
+		nni_taskq_fini(nni_taskq_systq);
+		nni_taskq_systq = NULL;
+		nni_plat_tls_fini(&nni_taskq_self);
+	}
 }
@@ -22,6 +22,9 @@ extern void nni_taskq_fini(nni_taskq *);
 
 // nni_task_dispatch sends the task to the queue.  It is guaranteed to
 // succeed.  (If the queue is shutdown, then the behavior is undefined.)
+// When called from one of the queue's own worker threads, for example to
+// complete another aio from within a callback, the task is placed on that
+// worker's local queue.
 extern void nni_task_dispatch(nni_task *);
 
 // nni_task_exec runs the task synchronously, if possible.  (Under certain
@@ -44,6 +47,12 @@ extern void nni_task_prep(nni_task *);
 extern void nni_task_abort(nni_task *);
 
 extern void nni_task_wait(nni_task *);
+
+// nni_task_spin polls the task for up to the given number of
+// microseconds, returning true if it completed in that time.  This
+// trades CPU for the latency of being woken up, and so does nothing
+// on a single CPU.  Follow it with nni_task_wait.
+extern bool nni_task_spin(nni_task *, int);
 extern void  nni_task_init(nni_task *, nni_taskq *, nni_cb, void *);
 
 // nni_task_fini destroys the task.  It will reap resources asynchronously
@@ -59,14 +68,15 @@ extern void nni_taskq_sys_fini(void);
 // nni_task_framework.  Placing here allows for inlining this in
 // consuming structures.
 struct nni_task {
-	nni_list_node task_node;
-	void *        task_arg;
-	nni_cb        task_cb;
-	nni_taskq *   task_tq;
-	unsigned      task_busy;
-	bool          task_prep;
-	nni_mtx       task_mtx;
-	nni_cv        task_cv;
+	nni_list_node   task_node;
+	void *          task_arg;
+	nni_cb          task_cb;
+	nni_taskq *     task_tq;
+	unsigned        task_busy;
+	nni_atomic_bool task_done;
+	bool            task_prep;
+	nni_mtx         task_mtx;
+	nni_cv          task_cv;
 };
 
 #endif // CORE_TASKQ_H
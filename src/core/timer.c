@@ -15,12 +15,18 @@
 
 static void nni_timer_loop(void *);
 
-// XXX: replace this timer list with a minHeap based priority queue.
+// The pending timers are kept in a pairing heap, which is an intrusive
+// min-heap needing no allocation.  Insertion is constant time, and
+// removal (of either the earliest timer or an arbitrary one, as when
+// canceling) is amortized logarithmic.  Each node links to its first
+// child, its next sibling, and either its previous sibling or (for a
+// first child) its parent.  The root has no parent, so a node is in the
+// heap only if it is the root, or has a back link.
 struct nni_timer {
 	nni_mtx         t_mx;
 	nni_cv          t_wait_cv;
 	nni_cv          t_sched_cv;
-	nni_list        t_entries;
+	nni_timer_node *t_heap; // root of the heap, earliest expiration
 	nni_thr         t_thr;
 	int             t_run;
 	int             t_waiting;
@@ -31,6 +37,100 @@ typedef struct nni_timer nni_timer;
 
 static nni_timer nni_global_timer;
 
+// nni_timer_meld combines two heaps (each being a detached root), and
+// returns the new root.
+static nni_timer_node *
+nni_timer_meld(nni_timer_node *a, nni_timer_node *b)
+{
+	nni_timer_node *t;
+
+	if (a == NULL) {
+		return (b);
+	}
+	if (b == NULL) {
+		return (a);
+	}
+	if (b->t_expire < a->t_expire) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	b->t_prev    = a;
+	b->t_sibling = a->t_child;
+	if (a->t_child != NULL) {
+		a->t_child->t_prev = b;
+	}
+	a->t_child = b;
+	return (a);
+}
+
+// nni_timer_merge_pairs melds a list of siblings into a single heap,
+// using the usual two pass approach.  This is iterative, as the list
+// can be very long (e.g. after many insertions without a removal).
+static nni_timer_node *
+nni_timer_merge_pairs(nni_timer_node *first)
+{
+	nni_timer_node *pairs = NULL;
+	nni_timer_node *root  = NULL;
+
+	// First pass, left to right, meld adjacent pairs.  The results
+	// are pushed onto a stack (linked by t_sibling).
+	while (first != NULL) {
+		nni_timer_node *a = first;
+		nni_timer_node *b = a->t_sibling;
+
+		first        = (b != NULL) ? b->t_sibling : NULL;
+		a->t_prev    = NULL;
+		a->t_sibling = NULL;
+		if (b != NULL) {
+			b->t_prev    = NULL;
+			b->t_sibling = NULL;
+		}
+		a            = nni_timer_meld(a, b);
+		a->t_sibling = pairs;
+		pairs        = a;
+	}
+
+	// Second pass, right to left (popping the stack), meld the results.
+	while (pairs != NULL) {
+		nni_timer_node *next = pairs->t_sibling;
+		pairs->t_sibling     = NULL;
+		root                 = nni_timer_meld(root, pairs);
+		pairs                = next;
+	}
+	return (root);
+}
+
+static bool
+nni_timer_queued(nni_timer *timer, nni_timer_node *node)
+{
+	return ((node == timer->t_heap) || (node->t_prev != NULL));
+}
+
+static void
+nni_timer_remove(nni_timer *timer, nni_timer_node *node)
+{
+	nni_timer_node *sub;
+
+	if (node == timer->t_heap) {
+		timer->t_heap = nni_timer_merge_pairs(node->t_child);
+	} else {
+		if (node->t_prev->t_child == node) {
+			node->t_prev->t_child = node->t_sibling;
+		} else {
+			node->t_prev->t_sibling = node->t_sibling;
+		}
+		if (node->t_sibling != NULL) {
+			node->t_sibling->t_prev = node->t_prev;
+		}
+		sub           = nni_timer_merge_pairs(node->t_child);
+		timer->t_heap = nni_timer_meld(timer->t_heap, sub);
+	}
+	node->t_child   = NULL;
+	node->t_sibling = NULL;
+	node->t_prev    = NULL;
+}
+
 int
 nni_timer_sys_init(void)
 {
@@ -38,7 +138,6 @@ nni_timer_sys_init(void)
 	nni_timer *timer = &nni_global_timer;
 
 	memset(timer, 0, sizeof(*timer));
-	NNI_LIST_INIT(&timer->t_entries, nni_timer_node, t_node);
 
 	nni_mtx_init(&timer->t_mx);
 	nni_cv_init(&timer->t_sched_cv, &timer->t_mx);
@@ -76,8 +175,11 @@ nni_timer_sys_fini(void)
 void
 nni_timer_init(nni_timer_node *node, nni_cb cb, void *arg)
 {
-	node->t_cb  = cb;
-	node->t_arg = arg;
+	node->t_cb      = cb;
+	node->t_arg     = arg;
+	node->t_child   = NULL;
+	node->t_sibling = NULL;
+	node->t_prev    = NULL;
 }
 
 void
@@ -96,8 +198,8 @@ nni_timer_cancel(nni_timer_node *node)
 		timer->t_waiting = 1;
 		nni_cv_wait(&timer->t_wait_cv);
 	}
-	if (nni_list_active(&timer->t_entries, node)) {
-		nni_list_remove(&timer->t_entries, node);
+	if (nni_timer_queued(timer, node)) {
+		nni_timer_remove(timer, node);
 	}
 	nni_mtx_unlock(&timer->t_mx);
 }
@@ -110,21 +212,13 @@ nni_timer_schedule(nni_timer_node *node, nni_time when)
 	nni_mtx_lock(&timer->t_mx);
 	node->t_expire = when;
 
-	if (nni_list_active(&timer->t_entries, node)) {
-		nni_list_remove(&timer->t_entries, node);
+	if (nni_timer_queued(timer, node)) {
+		nni_timer_remove(timer, node);
 	}
 
 	if (when != NNI_TIME_NEVER) {
-		nni_timer_node *srch = nni_list_first(&timer->t_entries);
-		while ((srch != NULL) && (srch->t_expire < node->t_expire)) {
-			srch = nni_list_next(&timer->t_entries, srch);
-		}
-		if (srch != NULL) {
-			nni_list_insert_before(&timer->t_entries, node, srch);
-		} else {
-			nni_list_append(&timer->t_entries, node);
-		}
-		if (nni_list_first(&timer->t_entries) == node) {
+		timer->t_heap = nni_timer_meld(timer->t_heap, node);
+		if (timer->t_heap == node) {
 			nni_cv_wake1(&timer->t_sched_cv);
 		}
 	}
@@ -151,7 +245,7 @@ nni_timer_loop(void *arg)
 		}
 
 		now = nni_clock();
-		if ((node = nni_list_first(&timer->t_entries)) == NULL) {
+		if ((node = timer->t_heap) == NULL) {
 			nni_cv_wait(&timer->t_sched_cv);
 			nni_mtx_unlock(&timer->t_mx);
 			continue;
@@ -163,7 +257,7 @@ nni_timer_loop(void *arg)
 			continue;
 		}
 
-		nni_list_remove(&timer->t_entries, node);
+		nni_timer_remove(timer, node);
 
 		// Save the active node.  Note that the timer callback can
 		// free this memory or do something else with it, so it is
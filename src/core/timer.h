@@ -15,15 +15,17 @@
 
 // For the sake of simplicity, we just maintain a single global timer thread.
 
+typedef struct nni_timer_node nni_timer_node;
+
 struct nni_timer_node {
-	nni_time      t_expire;
-	nni_cb        t_cb;
-	void *        t_arg;
-	nni_list_node t_node;
+	nni_time        t_expire;
+	nni_cb          t_cb;
+	void *          t_arg;
+	nni_timer_node *t_child;   // first child in the timer heap
+	nni_timer_node *t_sibling; // next sibling in the timer heap
+	nni_timer_node *t_prev;    // previous sibling, or parent
 };
 
-typedef struct nni_timer_node nni_timer_node;
-
 extern void nni_timer_init(nni_timer_node *, nni_cb, void *);
 extern void nni_timer_fini(nni_timer_node *);
 extern void nni_timer_schedule(nni_timer_node *, nni_time);
@@ -17,6 +17,9 @@
 #ifdef NNG_TRANSPORT_IPC
 #include "nng/transport/ipc/ipc.h"
 #endif
+#ifdef NNG_TRANSPORT_SHM
+#include "nng/transport/shm/shm.h"
+#endif
 #ifdef NNG_TRANSPORT_TCP
 #include "nng/transport/tcp/tcp.h"
 #endif
@@ -192,6 +195,9 @@ static nni_tran_ctor nni_tran_ctors[] = {
 #ifdef NNG_TRANSPORT_IPC
 	nng_ipc_register,
 #endif
+#ifdef NNG_TRANSPORT_SHM
+	nng_shm_register,
+#endif
 #ifdef NNG_TRANSPORT_TCP
 	nng_tcp_register,
 #endif
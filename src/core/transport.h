@@ -154,6 +154,10 @@ struct nni_tran_pipe_ops {
 	// p_getopt is used to obtain an option.  Pipes don't implement
 	// option setting.
 	int (*p_getopt)(void *, const char *, void *, size_t *, nni_type);
+
+	// p_framed is true if the pipe sends the frame encoded by
+	// nni_msg_frame_prep, when a message has one.
+	bool p_framed;
 };
 
 // Transport implementation details.  Transports must implement the
@@ -305,7 +305,8 @@ nni_url_parse(nni_url **urlp, const char *raw)
 
 	// For compatibility reasons, we treat ipc:// and inproc:// paths
 	// specially. These names URLs have a path name (ipc) or arbitrary
-	// string (inproc) and don't include anything like a host.  Note that
+	// string (inproc) and don't include anything like a host.  shm://
+	// URLs also name the path of the IPC socket they meet on.  Note that
 	// in the case of path names, it is incumbent upon the application to
 	// ensure that valid and safe path names are used.  Note also that
 	// path names are not canonicalized, which means that the address and
@@ -314,6 +315,7 @@ nni_url_parse(nni_url **urlp, const char *raw)
 	// we recommend using absolute paths, such as ipc:///var/run/mysocket.
 
 	if ((strcmp(url->u_scheme, "ipc") == 0) ||
+	    (strcmp(url->u_scheme, "shm") == 0) ||
 	    (strcmp(url->u_scheme, "inproc") == 0)) {
 		if ((url->u_path = nni_strdup(s)) == NULL) {
 			rv = NNG_ENOMEM;
@@ -500,7 +502,8 @@ nni_url_asprintf(char **str, const nni_url *url)
 	const char *hostob = "";
 	const char *hostcb = "";
 
-	if ((strcmp(scheme, "ipc") == 0) || (strcmp(scheme, "inproc") == 0)) {
+	if ((strcmp(scheme, "ipc") == 0) || (strcmp(scheme, "shm") == 0) ||
+	    (strcmp(scheme, "inproc") == 0)) {
 		return (nni_asprintf(str, "%s://%s", scheme, url->u_path));
 	}
 
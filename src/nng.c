@@ -126,10 +126,16 @@ nng_recv(nng_socket s, void *buf, size_t *szp, int flags)
 int
 nng_recvmsg(nng_socket s, nng_msg **msgp, int flags)
 {
-	int      rv;
-	nng_aio *ap;
+	int       rv;
+	int       spin;
+	nng_aio * ap;
+	nni_sock *sock;
 
-	if ((rv = nng_aio_alloc(&ap, NULL, NULL)) != 0) {
+	if ((rv = nni_sock_find(&sock, s.id)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_aio_sync_alloc(&ap)) != 0) {
+		nni_sock_rele(sock);
 		return (rv);
 	}
 	if (flags & NNG_FLAG_NONBLOCK) {
@@ -138,8 +144,10 @@ nng_recvmsg(nng_socket s, nng_msg **msgp, int flags)
 		nng_aio_set_timeout(ap, NNG_DURATION_DEFAULT);
 	}
 
-	nng_recv_aio(s, ap);
-	nng_aio_wait(ap);
+	spin = nni_sock_busypoll(sock);
+	nni_sock_recv(sock, ap);
+	nni_sock_rele(sock);
+	nni_aio_wait_spin(ap, spin);
 
 	if ((rv = nng_aio_result(ap)) == 0) {
 		*msgp = nng_aio_get_msg(ap);
@@ -147,7 +155,7 @@ nng_recvmsg(nng_socket s, nng_msg **msgp, int flags)
 	} else if ((rv == NNG_ETIMEDOUT) && (flags == NNG_FLAG_NONBLOCK)) {
 		rv = NNG_EAGAIN;
 	}
-	nng_aio_free(ap);
+	nni_aio_sync_free(ap);
 
 	return (rv);
 }
@@ -176,10 +184,18 @@ nng_send(nng_socket s, void *buf, size_t len, int flags)
 int
 nng_sendmsg(nng_socket s, nng_msg *msg, int flags)
 {
-	int      rv;
-	nng_aio *ap;
+	int       rv;
+	nng_aio * ap;
+	nni_sock *sock;
 
-	if ((rv = nng_aio_alloc(&ap, NULL, NULL)) != 0) {
+	if (msg == NULL) {
+		return (NNG_EINVAL);
+	}
+	if ((rv = nni_sock_find(&sock, s.id)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_aio_sync_alloc(&ap)) != 0) {
+		nni_sock_rele(sock);
 		return (rv);
 	}
 	if (flags & NNG_FLAG_NONBLOCK) {
@@ -189,11 +205,12 @@ nng_sendmsg(nng_socket s, nng_msg *msg, int flags)
 	}
 
 	nng_aio_set_msg(ap, msg);
-	nng_send_aio(s, ap);
+	nni_sock_send(sock, ap);
+	nni_sock_rele(sock);
 	nng_aio_wait(ap);
 
 	rv = nng_aio_result(ap);
-	nng_aio_free(ap);
+	nni_aio_sync_free(ap);
 
 	// Possibly massage nonblocking attempt.  Note that nonblocking is
 	// still done asynchronously, and the calling thread loses context.
@@ -12,8 +12,10 @@
  * @date:    2020-11-30 13:38:44
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <nng/nng.h>
 #include <nng/compat/nanomsg/nn.h>
@@ -21,12 +23,20 @@
 #include <nng/protocol/reqrep0/rep.h>
 #include <nng/protocol/pubsub0/pub.h>
 #include <nng/protocol/pubsub0/sub.h>
+#include <nng/supplemental/util/platform.h>
 
 #include "nxipc.h"
 
-#define NNG_NUTTX_TOPIC_NAME_LEN 15
+#define NNG_NUTTX_VARINT_MAX 10 /* bytes in a LEB128 encoded size_t */
+#define NNG_NUTTX_TOPIC_BUCKETS_MIN 16
+#define NNG_NUTTX_CACHE_SUFFIX ".cache" /* server for a publisher's cache */
+#define NNG_NUTTX_CACHE_GET 1
 #define NNG_NUTTX_SEND_TIMEOUT_MS 200
 #define NNG_NUTTX_RECV_TIMEOUT_MS 200
+#define NNG_NUTTX_WORKERS_MAX 256
+#define NNG_NUTTX_AFFINITY_MAX 32
+#define NNG_NUTTX_CACHE_TOPICS_MAX 256 /* topics a publisher's cache keeps */
+#define NNG_NUTTX_CACHE_BYTES_MAX (64 * 1024) /* and their content, in all */
 
 typedef enum {
     NNG_NUTTX_MODE_REQREP = 0,
@@ -40,6 +50,7 @@ typedef enum {
     NNG_NUTTX_TRANS_TYPE_INPROC = 0,
     NNG_NUTTX_TRANS_TYPE_IPC,
     NNG_NUTTX_TRANS_TYPE_TCP,
+    NNG_NUTTX_TRANS_TYPE_SHM,
 
     NNG_NUTTX_TRANS_TYPE_MAX
 } nng_nuttx_trans_type_t;
@@ -49,6 +60,7 @@ typedef enum {
     NNG_NUTTX_RECV_RET_SEND,
     NNG_NUTTX_SEND_RET_RECV,
     NNG_NUTTX_RECV_RET_RECV,
+    NNG_NUTTX_RECV_RET_DONE,
 } nng_nuttx_aio_state_t;
 
 typedef struct nng_trans_hdr {
@@ -58,26 +70,131 @@ typedef struct nng_trans_hdr {
     unsigned char* data[];
 } nng_trans_hdr_t;
 
-typedef struct nng_server_ctx {
+struct nng_server_ctx;
+
+typedef struct nng_server_worker {
     nng_nuttx_aio_state_t state;
-    char* name;
-    nng_socket fd;
+    int id;
     nng_aio* aio;
     nng_ctx  nng;
+    struct nng_server_ctx* server;
+    struct nng_server_worker* next; /* parked on a lane */
+} nng_server_worker_t;
+
+/* Transactions whose op code has an affinity are run on that worker's
+ * lane: one at a time, in the order they arrived.  Whichever worker
+ * finds the lane idle runs it, so no thread ever blocks waiting. */
+typedef struct nng_server_lane {
+    bool busy;
+    nng_server_worker_t* head;
+    nng_server_worker_t* tail;
+} nng_server_lane_t;
+
+typedef struct nng_server_affinity {
+    int op_code;
+    int worker;
+} nng_server_affinity_t;
+
+typedef struct nng_server_ctx {
+    char* name;
+    nng_socket fd;
     on_transaction on_trans_cb;
     void* priv;
+    nng_mtx* mtx;
+    int nworkers;
+    nng_server_worker_t* workers;
+    nng_server_lane_t* lanes;
+    bool closing; /* lanes take no more work */
+    int naffinity;
+    nng_server_affinity_t affinity[NNG_NUTTX_AFFINITY_MAX];
 } nng_server_ctx_t;
 
+struct nng_client_ctx;
+
+/* One transaction.  These are pooled by the client, and each keeps its
+ * own REQ context, so any number can be in flight on one connection. */
+typedef struct nng_client_call {
+    nng_nuttx_aio_state_t state;
+    nng_aio* aio;
+    nng_ctx  nng;
+    struct nng_client_ctx* client;
+    struct nng_client_call* next; /* free list */
+    struct nng_client_call* link; /* every call of the client */
+    int seq;
+    nng_time deadline;
+    on_transaction_done done_cb;
+    void* priv;
+    bool waiter; /* a handle was given out; wait will release it */
+    bool done;
+    bool in_cb; /* done_cb is running, on cb_thread */
+    pthread_t cb_thread;
+    int ret;
+    nng_msg* reply;
+} nng_client_call_t;
+
 typedef struct nng_client_ctx {
     char* name;
     nng_socket fd;
+    nng_mtx* mtx;
+    nng_cv* cv;
+    int seq;
+    int running; /* calls started and not yet done */
+    int waiting; /* threads waiting for a call */
+    nng_client_call_t* free_calls;
+    nng_client_call_t* calls;
 } nng_client_ctx_t;
 
+
+/*
+ * A topic goes out as its length, as a LEB128 varint, followed by its
+ * bytes, and then the content.  Subscribing to the encoded length and
+ * topic so matches exactly that topic, of any length and content.
+ */
+typedef struct nng_topic_entry {
+    struct nng_topic_entry* next;
+    uint32_t hash;
+    on_topic_listener listener;
+    void* priv;
+    uint64_t seq; /* live messages delivered, on a subscriber */
+    nng_msg* value; /* latest content, on a caching publisher */
+    struct nng_topic_entry* older; /* publish order, for eviction */
+    struct nng_topic_entry* newer;
+    size_t topic_len;
+    uint8_t topic[];
+} nng_topic_entry_t;
+
+/* Topics hashed with FNV-1a, chained, and doubled once full. */
+typedef struct nng_topic_table {
+    nng_topic_entry_t** buckets;
+    size_t nbuckets;
+    size_t ntopics;
+} nng_topic_table_t;
+
 typedef struct nng_pub_ctx {
     char* name;
     nng_socket fd;
+    int flags;
+    nng_mtx* mtx;
+    nng_topic_table_t cache; /* topic -> latest content */
+    nng_topic_entry_t* oldest; /* cached topics, least recently published */
+    nng_topic_entry_t* newest;
+    size_t cache_bytes;
+    void* cache_server;
 } nng_pub_ctx_t;
 
+struct nng_sub_ctx;
+
+/* A cached value fetched for a newly registered topic, waiting for the
+ * subscriber's worker to deliver it. */
+typedef struct nng_sub_cached {
+    struct nng_sub_cached* next;
+    struct nng_sub_ctx* sub;
+    nng_msg* msg;
+    uint64_t seq; /* the topic's live messages when it was fetched */
+    size_t topic_len;
+    uint8_t topic[];
+} nng_sub_cached_t;
+
 typedef struct nng_sub_ctx {
     nng_nuttx_aio_state_t state;
     char* name;
@@ -86,17 +203,18 @@ typedef struct nng_sub_ctx {
     nng_ctx  nng;
     on_topic_listener listener;
     void* priv;
+    nng_mtx* mtx;
+    nng_topic_table_t topics; /* topic -> listener */
+    char* cache_name; /* with NXIPC_SUB_CACHE only */
+    void* cache_client; /* connected on first use */
+    nng_sub_cached_t* cached; /* fetched, not yet delivered */
+    nng_sub_cached_t* cached_tail;
+    bool closing;
 } nng_sub_ctx_t;
 
-typedef struct nng_nuttx_topic {
-    uint8_t topic[NNG_NUTTX_TOPIC_NAME_LEN + 1];
-    size_t content_len;
-    uint8_t content[];
-} nng_nuttx_topic_t;
-
 
 const char* const nng_nuttx_trans_prefix_str[] = {
-    "inproc://", "ipc://", "tcp://"
+    "inproc://", "ipc://", "tcp://", "shm://"
 };
 
 #define nxipc_log(fmt, args...)  do { fprintf(stderr, fmt, ## args); } while(0)
@@ -111,105 +229,274 @@ static inline void nxipc_free(void* ptr)
     free(ptr);
 }
 
+/* Names that already carry a transport prefix, such as "shm:///tmp/svc"
+ * for a server in another process, are used as given; any other name is
+ * an inproc one. */
+static const char* nng_nuttx_trans_prefix(const char* name)
+{
+    for (int i = 0; i < NNG_NUTTX_TRANS_TYPE_MAX; i++) {
+        const char* prefix = nng_nuttx_trans_prefix_str[i];
+
+        if (strncmp(name, prefix, strlen(prefix)) == 0) {
+            return "";
+        }
+    }
+
+    return nng_nuttx_trans_prefix_str[NNG_NUTTX_TRANS_TYPE_INPROC];
+}
+
+/* Run the transaction held in the worker's aio, and send the reply. */
+static void nng_server_execute(nng_server_worker_t* w)
+{
+    int ret = 0;
+    nng_server_ctx_t* ctx = w->server;
+    nng_msg* msg = nng_aio_get_msg(w->aio);
+    nxparcel* parcel = NULL;
+    nng_trans_hdr_t hdr;
+
+    memcpy(&hdr, nng_msg_body(msg), sizeof(nng_trans_hdr_t));
+    ret = nng_msg_trim(msg, sizeof(nng_trans_hdr_t));
+
+    if (ret != 0 || nng_msg_len(msg) != hdr.len) {
+        hdr.op_code = -EINVAL;
+    } else {
+        if (ctx->on_trans_cb != NULL) {
+            hdr.op_code = ctx->on_trans_cb(ctx->priv, hdr.op_code, msg, &parcel);
+        } else {
+            hdr.op_code = -EINVAL;
+        }
+    }
+
+    // send response; the reply parcel goes as is, with the header put
+    // in its headroom, and the callback may hand back the request itself
+    if (parcel != NULL && parcel != msg) {
+        nng_msg_free(msg);
+        msg = parcel;
+    } else if (parcel == NULL) {
+        nng_msg_clear(msg);
+    }
+
+    hdr.len = nng_msg_len(msg);
+
+    if (nng_msg_insert(msg, &hdr, sizeof(nng_trans_hdr_t)) != 0) {
+        nng_msg_clear(msg);
+        hdr.op_code = -ENOMEM;
+        hdr.len = 0;
+        nng_msg_append(msg, &hdr, sizeof(nng_trans_hdr_t));
+    }
+
+    w->state = NNG_NUTTX_SEND_RET_RECV;
+    nng_aio_set_msg(w->aio, msg);
+    nng_ctx_send(w->nng, w->aio);
+}
+
+/* Returns the lane for the op code, or -1 if it may run anywhere. */
+static int nng_server_lane_lookup(nng_server_ctx_t* ctx, int op_code)
+{
+    int lane = -1;
+
+    for (int i = 0; i < ctx->naffinity; i++) {
+        if (ctx->affinity[i].op_code == op_code) {
+            lane = ctx->affinity[i].worker;
+            break;
+        }
+    }
+
+    return lane;
+}
+
+static void nng_server_dispatch(nng_server_worker_t* w)
+{
+    nng_server_ctx_t* ctx = w->server;
+    nng_server_lane_t* lane;
+    int op_code;
+    int id;
+
+    memcpy(&op_code, (char*)nng_msg_body(nng_aio_get_msg(w->aio)) + \
+           offsetof(nng_trans_hdr_t, op_code), sizeof(op_code));
+
+    nng_mtx_lock(ctx->mtx);
+
+    if (ctx->closing) {
+        // shutting down; the worker is about to be stopped
+        nng_mtx_unlock(ctx->mtx);
+        nng_msg_free(nng_aio_get_msg(w->aio));
+        nng_aio_set_msg(w->aio, NULL);
+        return;
+    }
+
+    if ((id = nng_server_lane_lookup(ctx, op_code)) < 0) {
+        nng_mtx_unlock(ctx->mtx);
+        nng_server_execute(w);
+        return;
+    }
+
+    lane = &ctx->lanes[id];
+    w->next = NULL;
+
+    if (lane->busy) {
+        // park it; whoever owns the lane will run it
+        if (lane->tail != NULL) {
+            lane->tail->next = w;
+        } else {
+            lane->head = w;
+        }
+
+        lane->tail = w;
+        nng_mtx_unlock(ctx->mtx);
+        return;
+    }
+
+    lane->busy = true;
+
+    while (w != NULL) {
+        nng_mtx_unlock(ctx->mtx);
+        nng_server_execute(w);
+        nng_mtx_lock(ctx->mtx);
+
+        // once closing, what was parked has been freed already
+        if ((w = ctx->closing ? NULL : lane->head) != NULL) {
+            if ((lane->head = w->next) == NULL) {
+                lane->tail = NULL;
+            }
+        }
+    }
+
+    lane->busy = false;
+    nng_mtx_unlock(ctx->mtx);
+}
+
 static void nng_server_worker(void* arg)
 {
     int ret = 0;
-    nng_server_ctx_t* ctx = (nng_server_ctx_t*)arg;
+    nng_server_worker_t* w = (nng_server_worker_t*)arg;
 
-    if (NULL == ctx) {
+    if (NULL == w) {
         return;
     }
 
-    switch (ctx->state) {
+    switch (w->state) {
     case NNG_NUTTX_INIT_RECV:
-        ctx->state = NNG_NUTTX_RECV_RET_SEND;
-        nng_ctx_recv(ctx->nng, ctx->aio);
+        w->state = NNG_NUTTX_RECV_RET_SEND;
+        nng_ctx_recv(w->nng, w->aio);
         break;
 
     case NNG_NUTTX_RECV_RET_SEND: {
         nng_msg* msg;
-        nxparcel* parcel = NULL;
-        nng_trans_hdr_t* hdr;
-        uint32_t seq, op_code, len;
 
-        if ((ret = nng_aio_result(ctx->aio)) != 0) {
+        if ((ret = nng_aio_result(w->aio)) != 0) {
             if (ret == NNG_ETIMEDOUT) {
-                nng_ctx_recv(ctx->nng, ctx->aio);
-            } else {
+                nng_ctx_recv(w->nng, w->aio);
+            } else if (ret != NNG_ECLOSED && ret != NNG_ECANCELED) {
                 nxipc_log("%s: nng_aio_result.error=%d(%s)\n", __func__, ret, nng_strerror(ret));
             }
 
             break;
         }
 
-        msg = nng_aio_get_msg(ctx->aio);
+        msg = nng_aio_get_msg(w->aio);
 
-        if (msg == NULL || nng_msg_body(msg) == NULL) {
-            nng_ctx_recv(ctx->nng, ctx->aio);
+        if (msg == NULL || nng_msg_len(msg) < sizeof(nng_trans_hdr_t)) {
+            nng_msg_free(msg);
+            nng_ctx_recv(w->nng, w->aio);
             break;
         }
 
-        // parse & execute
-        hdr = (nng_trans_hdr_t*)nng_msg_body(msg);
-        ret = nng_msg_trim(msg, sizeof(nng_trans_hdr_t));
+        nng_server_dispatch(w);
+    }
+    break;
 
-        if (ret != 0 || nng_msg_len(msg) != hdr->len) {
-            hdr->op_code = -EINVAL;
-        } else {
-            if (ctx->on_trans_cb != NULL) {
-                hdr->op_code = ctx->on_trans_cb(ctx->priv, hdr->op_code, msg, &parcel);
-            } else {
-                hdr->op_code = -EINVAL;
+    case NNG_NUTTX_SEND_RET_RECV:
+        if ((ret = nng_aio_result(w->aio)) != 0) {
+            nng_msg_free(nng_aio_get_msg(w->aio));
+
+            if (ret == NNG_ECLOSED || ret == NNG_ECANCELED) {
+                break;
             }
+
+            nxipc_log("%s: nng_aio_result=%d\n", __func__, ret);
         }
 
-        // send response
-        nng_msg_clear(msg);
-        ret = nng_msg_append(msg, hdr, sizeof(nng_trans_hdr_t));
+        w->state = NNG_NUTTX_RECV_RET_SEND;
+        nng_ctx_recv(w->nng, w->aio);
+        break;
+
+    default:
+        nxipc_log("%s: bad state %d", __func__, w->state);
+        break;
+    }
 
-        if (ret == 0) {
-            hdr = (nng_trans_hdr_t*)nng_msg_body(msg);
+    return;
+}
 
-            if (parcel != NULL && (hdr->len = nng_msg_len(parcel)) > 0) {
-                nng_msg_append(msg, nng_msg_body(parcel), hdr->len);
-                nng_msg_free(parcel);
-            } else {
-                hdr->len = 0;
+static void nng_server_free(nng_server_ctx_t* ctx)
+{
+    nng_server_worker_t* w;
+
+    // Parked workers are idle, so stopping them would not free their
+    // requests; do that here, and keep lane owners from running them.
+    if (ctx->mtx != NULL && ctx->lanes != NULL) {
+        nng_mtx_lock(ctx->mtx);
+        ctx->closing = true;
+
+        for (int i = 0; i < ctx->nworkers; i++) {
+            while ((w = ctx->lanes[i].head) != NULL) {
+                ctx->lanes[i].head = w->next;
+                nng_msg_free(nng_aio_get_msg(w->aio));
+                nng_aio_set_msg(w->aio, NULL);
             }
+
+            ctx->lanes[i].tail = NULL;
         }
 
-        ctx->state = NNG_NUTTX_SEND_RET_RECV;
-        nng_aio_set_msg(ctx->aio, msg);
-        nng_ctx_send(ctx->nng, ctx->aio);
+        nng_mtx_unlock(ctx->mtx);
     }
-    break;
 
-    case NNG_NUTTX_SEND_RET_RECV:
-        if ((ret = nng_aio_result(ctx->aio)) != 0) {
-            nng_msg_free(nng_aio_get_msg(ctx->aio));
-            nxipc_log("%s: nng_aio_result=%d", __func__, ret);
+    if (ctx->workers != NULL) {
+        for (int i = 0; i < ctx->nworkers; i++) {
+            nng_aio_stop(ctx->workers[i].aio);
         }
 
-        ctx->state = NNG_NUTTX_RECV_RET_SEND;
-        nng_ctx_recv(ctx->nng, ctx->aio);
-        break;
+        for (int i = 0; i < ctx->nworkers; i++) {
+            nng_ctx_close(ctx->workers[i].nng);
+            nng_aio_free(ctx->workers[i].aio);
+        }
+    }
 
-    default:
-        nxipc_log("%s: bad state %d", __func__, ctx->state);
-        break;
+    nng_close(ctx->fd);
+
+    if (ctx->mtx != NULL) {
+        nng_mtx_free(ctx->mtx);
     }
 
-    return;
+    if (ctx->workers != NULL) {
+        nxipc_free(ctx->workers);
+    }
+
+    if (ctx->lanes != NULL) {
+        nxipc_free(ctx->lanes);
+    }
+
+    if (ctx->name != NULL) {
+        nxipc_free(ctx->name);
+    }
+
+    nxipc_free(ctx);
 }
 
 void* nxipc_server_create(const char* name)
+{
+    return nxipc_server_create_ex(name, 1);
+}
+
+void* nxipc_server_create_ex(const char* name, int workers)
 {
     nng_server_ctx_t* ctx = NULL;
-    const nng_nuttx_trans_type_t trans_type = NNG_NUTTX_TRANS_TYPE_INPROC;
+    const char* prefix = nng_nuttx_trans_prefix(name);
     int name_len = strlen(name);
     int ret = 0;
 
-    if (name_len <= 0) {
+    if (name_len <= 0 || workers <= 0 || workers > NNG_NUTTX_WORKERS_MAX) {
         ret = -EINVAL;
         goto err;
     }
@@ -223,16 +510,22 @@ void* nxipc_server_create(const char* name)
 
     memset(ctx, 0, sizeof(nng_server_ctx_t));
 
-    ctx->name = nxipc_calloc(strlen(nng_nuttx_trans_prefix_str[trans_type]) + name_len + 1);
+    ctx->name = nxipc_calloc(strlen(prefix) + name_len + 1);
+    ctx->workers = nxipc_calloc(sizeof(nng_server_worker_t) * workers);
+    ctx->lanes = nxipc_calloc(sizeof(nng_server_lane_t) * workers);
 
-    if (ctx->name == NULL) {
+    if (ctx->name == NULL || ctx->workers == NULL || ctx->lanes == NULL) {
         ret = -ENOMEM;
         goto err;
     }
 
-    strcpy(ctx->name, nng_nuttx_trans_prefix_str[trans_type]);
+    strcpy(ctx->name, prefix);
     strcat(ctx->name, name);
 
+    if ((ret = nng_mtx_alloc(&ctx->mtx)) != 0) {
+        goto err;
+    }
+
     if ((ret = nng_rep0_open(&ctx->fd)) != 0) {
         goto err;
     }
@@ -244,16 +537,28 @@ void* nxipc_server_create(const char* name)
     nng_setopt_ms(ctx->fd, NNG_OPT_RECVTIMEO, NNG_NUTTX_RECV_TIMEOUT_MS);
     nng_setopt_ms(ctx->fd, NNG_OPT_SENDTIMEO, NNG_NUTTX_SEND_TIMEOUT_MS);
 
-    if ((ret = nng_aio_alloc(&ctx->aio, nng_server_worker, ctx)) != 0) {
-        goto err;
-    }
+    for (int i = 0; i < workers; i++) {
+        nng_server_worker_t* w = &ctx->workers[i];
 
-    if ((ret = nng_ctx_open(&ctx->nng, ctx->fd)) != 0) {
-        goto err;
+        w->id = i;
+        w->server = ctx;
+
+        if ((ret = nng_aio_alloc(&w->aio, nng_server_worker, w)) != 0) {
+            goto err;
+        }
+
+        if ((ret = nng_ctx_open(&w->nng, ctx->fd)) != 0) {
+            nng_aio_free(w->aio);
+            goto err;
+        }
+
+        ctx->nworkers++;
     }
 
-    ctx->state = NNG_NUTTX_INIT_RECV;
-    nng_server_worker(ctx);
+    for (int i = 0; i < workers; i++) {
+        ctx->workers[i].state = NNG_NUTTX_INIT_RECV;
+        nng_server_worker(&ctx->workers[i]);
+    }
 
     return ctx;
 
@@ -261,13 +566,7 @@ err:
     nxipc_log("%s.ret=%d(%s)\n", __func__, ret, nng_strerror(ret));
 
     if (ctx != NULL) {
-        nng_close(ctx->fd);
-
-        if (ctx->name != NULL) {
-            nxipc_free(ctx->name);
-        }
-
-        nxipc_free(ctx);
+        nng_server_free(ctx);
     }
 
     return NULL;
@@ -277,62 +576,147 @@ void nxipc_server_set_transaction_cb(void* nng_server_ctx, on_transaction cb, vo
 {
     if (nng_server_ctx != NULL && cb != NULL) {
         nng_server_ctx_t* ctx = (nng_server_ctx_t*)nng_server_ctx;
+        nng_mtx_lock(ctx->mtx);
         ctx->on_trans_cb = cb;
         ctx->priv = cb_priv;
+        nng_mtx_unlock(ctx->mtx);
     }
 }
 
+int nxipc_server_set_affinity(void* nng_server_ctx, int op_code, int worker)
+{
+    int ret = 0;
+    int i;
+    nng_server_ctx_t* ctx = (nng_server_ctx_t*)nng_server_ctx;
+
+    if (ctx == NULL || worker >= ctx->nworkers) {
+        return -EINVAL;
+    }
+
+    nng_mtx_lock(ctx->mtx);
+
+    for (i = 0; i < ctx->naffinity; i++) {
+        if (ctx->affinity[i].op_code == op_code) {
+            break;
+        }
+    }
+
+    if (worker < 0) {
+        // remove it, if present
+        if (i < ctx->naffinity) {
+            ctx->affinity[i] = ctx->affinity[--ctx->naffinity];
+        }
+    } else if (i < ctx->naffinity) {
+        ctx->affinity[i].worker = worker;
+    } else if (ctx->naffinity < NNG_NUTTX_AFFINITY_MAX) {
+        ctx->affinity[i].op_code = op_code;
+        ctx->affinity[i].worker = worker;
+        ctx->naffinity++;
+    } else {
+        ret = -ENOSPC;
+    }
+
+    nng_mtx_unlock(ctx->mtx);
+
+    return ret;
+}
+
 int nxipc_server_release(void* nng_server_ctx)
 {
     if (nng_server_ctx != NULL) {
-        nng_server_ctx_t* ctx = (nng_server_ctx_t*)nng_server_ctx;
-        nng_aio_stop(ctx->aio);
-        nng_aio_wait(ctx->aio);
-        nng_ctx_close(ctx->nng);
-        nng_aio_free(ctx->aio);
-        nng_close(ctx->fd);
+        nng_server_free((nng_server_ctx_t*)nng_server_ctx);
+    }
 
-        if (ctx->name != NULL) {
-            nxipc_free(ctx->name);
-            ctx->name = NULL;
+    return 0;
+}
+
+
+static void nng_client_call_fini(nng_client_call_t* call)
+{
+    nng_aio_free(call->aio);
+    nng_ctx_close(call->nng);
+    nng_msg_free(call->reply);
+    nxipc_free(call);
+}
+
+static void nng_client_free(nng_client_ctx_t* ctx)
+{
+    nng_client_call_t* call;
+
+    nng_close(ctx->fd);
+
+    if (ctx->mtx != NULL) {
+        // closing the socket fails anything in flight; let it finish,
+        // and let anyone already waiting for a call have it
+        nng_mtx_lock(ctx->mtx);
+
+        while (ctx->running > 0 || ctx->waiting > 0) {
+            nng_cv_wait(ctx->cv);
         }
 
-        nxipc_free(ctx);
+        nng_mtx_unlock(ctx->mtx);
     }
-}
 
+    // this includes handles that were never waited for
+    while ((call = ctx->calls) != NULL) {
+        ctx->calls = call->link;
+        nng_client_call_fini(call);
+    }
 
-void* nxipc_client_connect(const char* server_name)
+    if (ctx->cv != NULL) {
+        nng_cv_free(ctx->cv);
+    }
+
+    if (ctx->mtx != NULL) {
+        nng_mtx_free(ctx->mtx);
+    }
+
+    if (ctx->name != NULL) {
+        nxipc_free(ctx->name);
+    }
+
+    nxipc_free(ctx);
+}
+
+static nng_client_ctx_t* nng_client_open(const char* server_name, bool quiet)
 {
     int ret = 0;
     nng_client_ctx_t* ctx = NULL;
     int name_len = strlen(server_name);
-    const nng_nuttx_trans_type_t trans_type = NNG_NUTTX_TRANS_TYPE_INPROC;
+    const char* prefix = nng_nuttx_trans_prefix(server_name);
 
     if (name_len <= 0) {
         ret = -EINVAL;
         goto err;
     }
 
-    ctx = nxipc_calloc(sizeof(nng_server_ctx_t));
+    ctx = nxipc_calloc(sizeof(nng_client_ctx_t));
 
     if (ctx == NULL) {
         ret = -ENOMEM;
         goto err;
     }
 
-    memset(ctx, 0, sizeof(nng_server_ctx_t));
+    memset(ctx, 0, sizeof(nng_client_ctx_t));
 
-    ctx->name = nxipc_calloc(strlen(nng_nuttx_trans_prefix_str[trans_type]) + name_len + 1);
+    ctx->name = nxipc_calloc(strlen(prefix) + name_len + 1);
 
     if (ctx->name == NULL) {
         ret = -ENOMEM;
         goto err;
     }
 
-    strcpy(ctx->name, nng_nuttx_trans_prefix_str[trans_type]);
+    strcpy(ctx->name, prefix);
     strcat(ctx->name, server_name);
 
+    if ((ret = nng_mtx_alloc(&ctx->mtx)) != 0) {
+        goto err;
+    }
+
+    if ((ret = nng_cv_alloc(&ctx->cv, ctx->mtx)) != 0) {
+        goto err;
+    }
+
     if ((ret = nng_req0_open(&ctx->fd)) != 0) {
         goto err;
     }
@@ -347,129 +731,625 @@ void* nxipc_client_connect(const char* server_name)
     return ctx;
 
 err:
-    nxipc_log("%s.ret=%d(%s)\n", __func__, ret, nng_strerror(ret));
+    if (!quiet) {
+        nxipc_log("%s.ret=%d(%s)\n", __func__, ret, nng_strerror(ret));
+    }
 
     if (ctx != NULL) {
-        nng_close(ctx->fd);
+        nng_client_free(ctx);
+    }
 
-        if (ctx->name != NULL) {
-            nxipc_free(ctx->name);
+    return NULL;
+}
+
+void* nxipc_client_connect(const char* server_name)
+{
+    return nng_client_open(server_name, false);
+}
+
+int nxipc_client_disconnect(void* nng_client_ctx)
+{
+    nng_client_ctx_t* ctx = (nng_client_ctx_t*)nng_client_ctx;
+    nng_client_call_t* call;
+
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    // from a done callback, this would wait for that callback forever
+    nng_mtx_lock(ctx->mtx);
+
+    for (call = ctx->calls; call != NULL; call = call->link) {
+        if (call->in_cb && pthread_equal(call->cb_thread, pthread_self())) {
+            nng_mtx_unlock(ctx->mtx);
+            nxipc_log("%s: called from a done callback\n", __func__);
+            return -EDEADLK;
         }
+    }
 
-        nxipc_free(ctx);
+    nng_mtx_unlock(ctx->mtx);
+    nng_client_free(ctx);
+    return 0;
+}
+
+/* Caller holds the client lock. */
+static void nng_client_call_release(nng_client_call_t* call)
+{
+    nng_client_ctx_t* ctx = call->client;
+
+    if (call->reply != NULL) {
+        nng_msg_free(call->reply);
+        call->reply = NULL;
     }
 
-    return NULL;
+    call->next = ctx->free_calls;
+    ctx->free_calls = call;
 }
 
-int nxipc_client_disconnect(void* nng_client_ctx)
+static void nng_client_call_done(nng_client_call_t* call, int ret, nng_msg* reply)
 {
-    if (nng_client_ctx != NULL) {
-        nng_client_ctx_t* ctx = (nng_client_ctx_t*)nng_client_ctx;
+    nng_client_ctx_t* ctx = call->client;
 
-        if (ctx->name != NULL) {
-            nxipc_free(ctx->name);
-            ctx->name = NULL;
+    if (call->done_cb != NULL) {
+        nng_mtx_lock(ctx->mtx);
+        call->cb_thread = pthread_self();
+        call->in_cb = true;
+        nng_mtx_unlock(ctx->mtx);
+
+        call->done_cb(call->priv, ret, reply);
+    }
+
+    nng_mtx_lock(ctx->mtx);
+    call->in_cb = false;
+    call->ret = ret;
+    call->reply = reply;
+    call->done = true;
+
+    if (!call->waiter) {
+        nng_client_call_release(call);
+    }
+
+    // wakes waiters for this call, and a disconnect waiting for all
+    ctx->running--;
+    nng_cv_wake(ctx->cv);
+    nng_mtx_unlock(ctx->mtx);
+}
+
+static nng_duration nng_client_call_remaining(nng_client_call_t* call)
+{
+    nng_time now;
+
+    if (call->deadline == 0) {
+        return NNG_DURATION_INFINITE;
+    }
+
+    now = nng_clock();
+    return call->deadline > now ? (nng_duration)(call->deadline - now) : 0;
+}
+
+static void nng_client_worker(void* arg)
+{
+    int ret;
+    nng_msg* msg;
+    nng_trans_hdr_t hdr;
+    nng_client_call_t* call = (nng_client_call_t*)arg;
+
+    switch (call->state) {
+    case NNG_NUTTX_SEND_RET_RECV:
+        if ((ret = nng_aio_result(call->aio)) != 0) {
+            nng_msg_free(nng_aio_get_msg(call->aio));
+            nng_client_call_done(call, ret, NULL);
+            break;
         }
 
-        nng_close(ctx->fd);
-        nxipc_free(ctx);
+        call->state = NNG_NUTTX_RECV_RET_DONE;
+        nng_aio_set_timeout(call->aio, nng_client_call_remaining(call));
+        nng_ctx_recv(call->nng, call->aio);
+        break;
+
+    case NNG_NUTTX_RECV_RET_DONE:
+        if ((ret = nng_aio_result(call->aio)) != 0) {
+            nng_client_call_done(call, ret, NULL);
+            break;
+        }
+
+        msg = nng_aio_get_msg(call->aio);
+
+        if (nng_msg_len(msg) < sizeof(nng_trans_hdr_t)) {
+            nng_msg_free(msg);
+            nng_client_call_done(call, -EPROTO, NULL);
+            break;
+        }
+
+        memcpy(&hdr, nng_msg_body(msg), sizeof(nng_trans_hdr_t));
+        nng_msg_trim(msg, sizeof(nng_trans_hdr_t));
+
+        if (hdr.seq != call->seq || hdr.len != nng_msg_len(msg)) {
+            nxipc_log("%s: bad reply seq=%d/%d len=%lu/%lu\n", __func__, hdr.seq,
+                      call->seq, (unsigned long)hdr.len, (unsigned long)nng_msg_len(msg));
+            nng_msg_free(msg);
+            nng_client_call_done(call, -EPROTO, NULL);
+            break;
+        }
+
+        // the server's status comes back in the op code
+        nng_client_call_done(call, hdr.op_code, msg);
+        break;
+
+    default:
+        nxipc_log("%s: bad state %d", __func__, call->state);
+        break;
     }
 }
 
-int nxipc_client_transaction(const void* nng_client_ctx, int op_code, \
-                             const nxparcel* in, nxparcel* out)
+static nng_client_call_t* nng_client_call_get(nng_client_ctx_t* ctx)
+{
+    nng_client_call_t* call;
+
+    nng_mtx_lock(ctx->mtx);
+
+    if ((call = ctx->free_calls) != NULL) {
+        ctx->free_calls = call->next;
+        ctx->running++;
+    }
+
+    nng_mtx_unlock(ctx->mtx);
+
+    if (call == NULL) {
+        if ((call = nxipc_calloc(sizeof(nng_client_call_t))) == NULL) {
+            return NULL;
+        }
+
+        call->client = ctx;
+
+        if (nng_aio_alloc(&call->aio, nng_client_worker, call) != 0) {
+            nxipc_free(call);
+            return NULL;
+        }
+
+        if (nng_ctx_open(&call->nng, ctx->fd) != 0) {
+            nng_aio_free(call->aio);
+            nxipc_free(call);
+            return NULL;
+        }
+
+        nng_mtx_lock(ctx->mtx);
+        call->link = ctx->calls;
+        ctx->calls = call;
+        ctx->running++;
+        nng_mtx_unlock(ctx->mtx);
+    }
+
+    call->next = NULL;
+    call->done = false;
+    call->reply = NULL;
+    call->ret = 0;
+    return call;
+}
+
+/* Starts a call with the message, which is always consumed. */
+static int nng_client_call_start(nng_client_ctx_t* ctx, int op_code, nng_msg* msg, \
+                                 int timeout_ms, on_transaction_done cb, void* cb_priv, \
+                                 void** handle)
+{
+    nng_trans_hdr_t hdr;
+    nng_client_call_t* call;
+
+    hdr.seq = 0;
+    hdr.op_code = op_code;
+    hdr.len = nng_msg_len(msg);
+
+    if (nng_msg_insert(msg, &hdr, sizeof(nng_trans_hdr_t)) != 0 ||
+        (call = nng_client_call_get(ctx)) == NULL) {
+        nng_msg_free(msg);
+        return -ENOMEM;
+    }
+
+    nng_mtx_lock(ctx->mtx);
+    call->seq = ++ctx->seq;
+    nng_mtx_unlock(ctx->mtx);
+
+    if (timeout_ms == 0) {
+        timeout_ms = NNG_NUTTX_SEND_TIMEOUT_MS + NNG_NUTTX_RECV_TIMEOUT_MS;
+    }
+
+    call->deadline = timeout_ms > 0 ? nng_clock() + timeout_ms : 0;
+    call->done_cb = cb;
+    call->priv = cb_priv;
+    call->waiter = (handle != NULL);
+    call->state = NNG_NUTTX_SEND_RET_RECV;
+
+    memcpy((char*)nng_msg_body(msg) + offsetof(nng_trans_hdr_t, seq), &call->seq, sizeof(call->seq));
+
+    if (handle != NULL) {
+        *handle = call;
+    }
+
+    nng_aio_set_msg(call->aio, msg);
+    nng_aio_set_timeout(call->aio, nng_client_call_remaining(call));
+    nng_ctx_send(call->nng, call->aio);
+
+    return 0;
+}
+
+int nxipc_client_transaction_async(const void* nng_client_ctx, int op_code, \
+                                   const nxparcel* in, int timeout_ms, \
+                                   on_transaction_done cb, void* cb_priv, void** handle)
 {
-    int ret = 0;
     nng_msg* msg;
-    nng_trans_hdr_t* hdr;
     nng_client_ctx_t* ctx = (nng_client_ctx_t*)nng_client_ctx;
 
     if (NULL == ctx) {
-        ret = -EINVAL;
-        goto out;
+        return -EINVAL;
     }
 
-    nng_msg_alloc(&msg, sizeof(nng_trans_hdr_t));
+    if ((in != NULL ? nng_msg_dup(&msg, in) : nng_msg_alloc(&msg, 0)) != 0) {
+        return -ENOMEM;
+    }
 
-    if (msg == NULL) {
-        ret = -ENOMEM;
-        goto out;
+    return nng_client_call_start(ctx, op_code, msg, timeout_ms, cb, cb_priv, handle);
+}
+
+int nxipc_client_transaction_async_zc(const void* nng_client_ctx, int op_code, \
+                                      nxparcel* in, int timeout_ms, \
+                                      on_transaction_done cb, void* cb_priv, void** handle)
+{
+    nng_client_ctx_t* ctx = (nng_client_ctx_t*)nng_client_ctx;
+
+    if (NULL == ctx) {
+        nng_msg_free(in);
+        return -EINVAL;
+    }
+
+    if (in == NULL && nng_msg_alloc(&in, 0) != 0) {
+        return -ENOMEM;
+    }
+
+    return nng_client_call_start(ctx, op_code, in, timeout_ms, cb, cb_priv, handle);
+}
+
+/* Waits for the call, and releases it; the reply is taken or copied. */
+static int nng_client_call_wait(void* handle, nxparcel* out, nxparcel** outp)
+{
+    int ret;
+    nng_client_call_t* call = (nng_client_call_t*)handle;
+    nng_client_ctx_t* ctx;
+
+    if (call == NULL || !call->waiter) {
+        return -EINVAL;
     }
 
-    hdr = (nng_trans_hdr_t*)nng_msg_body(msg);
-    hdr->seq = 0;
-    hdr->op_code = op_code;
-    hdr->len = 0;
+    ctx = call->client;
+    nng_mtx_lock(ctx->mtx);
+
+    ctx->waiting++;
 
-    if (in != NULL && (hdr->len = nng_msg_len(in)) > 0) {
-        nng_msg_append(msg, nng_msg_body((nng_msg*)in), hdr->len);
+    while (!call->done) {
+        nng_cv_wait(ctx->cv);
     }
 
-    ret = nng_sendmsg(ctx->fd, msg, 0);
+    ctx->waiting--;
+
+    ret = call->ret;
+
+    if (outp != NULL) {
+        *outp = call->reply;
+        call->reply = NULL;
+    } else if (call->reply != NULL && out != NULL && nng_msg_len(call->reply) > 0) {
+        nng_msg_append(out, nng_msg_body(call->reply), nng_msg_len(call->reply));
+    }
+
+    call->waiter = false;
+    nng_client_call_release(call);
+
+    if (ctx->waiting == 0) {
+        nng_cv_wake(ctx->cv);
+    }
+
+    nng_mtx_unlock(ctx->mtx);
+
+    return ret;
+}
+
+int nxipc_client_transaction_wait(void* handle, nxparcel* out)
+{
+    return nng_client_call_wait(handle, out, NULL);
+}
+
+int nxipc_client_transaction_wait_zc(void* handle, nxparcel** out)
+{
+    if (out != NULL) {
+        *out = NULL;
+    }
+
+    return nng_client_call_wait(handle, NULL, out);
+}
+
+int nxipc_client_transaction(const void* nng_client_ctx, int op_code, \
+                             const nxparcel* in, nxparcel* out)
+{
+    int ret;
+    void* call;
+
+    ret = nxipc_client_transaction_async(nng_client_ctx, op_code, in, 0, NULL, NULL, &call);
+
+    if (ret != 0) {
+        nxipc_log("%s: %d\n", __func__, ret);
+        return ret;
+    }
+
+    return nxipc_client_transaction_wait(call, out);
+}
+
+int nxipc_client_transaction_zc(const void* nng_client_ctx, int op_code, \
+                                nxparcel* in, nxparcel** out)
+{
+    int ret;
+    void* call;
+
+    if (out != NULL) {
+        *out = NULL;
+    }
+
+    ret = nxipc_client_transaction_async_zc(nng_client_ctx, op_code, in, 0, NULL, NULL, &call);
+
+    if (ret != 0) {
+        nxipc_log("%s: %d\n", __func__, ret);
+        return ret;
+    }
+
+    if (out == NULL) {
+        return nxipc_client_transaction_wait(call, NULL);
+    }
+
+    return nxipc_client_transaction_wait_zc(call, out);
+}
+
+/* FNV-1a */
+static uint32_t nng_topic_hash(const void* topic, size_t topic_len)
+{
+    const uint8_t* p = (const uint8_t*)topic;
+    uint32_t h = 2166136261u;
+
+    while (topic_len-- > 0) {
+        h = (h ^ *p++) * 16777619u;
+    }
+
+    return h;
+}
+
+static nng_topic_entry_t** nng_topic_find(nng_topic_table_t* tab, uint32_t hash, const void* topic, size_t topic_len)
+{
+    nng_topic_entry_t** pe;
+
+    if (tab->nbuckets == 0) {
+        return NULL;
+    }
+
+    pe = &tab->buckets[hash & (tab->nbuckets - 1)];
+
+    for (; *pe != NULL; pe = &(*pe)->next) {
+        if ((*pe)->hash == hash && (*pe)->topic_len == topic_len &&
+            memcmp((*pe)->topic, topic, topic_len) == 0) {
+            return pe;
+        }
+    }
+
+    return NULL;
+}
+
+static int nng_topic_grow(nng_topic_table_t* tab)
+{
+    size_t i;
+    size_t nbuckets;
+    nng_topic_entry_t* e;
+    nng_topic_entry_t** buckets;
+
+    if (tab->ntopics < tab->nbuckets) {
+        return 0;
+    }
+
+    nbuckets = tab->nbuckets == 0 ? NNG_NUTTX_TOPIC_BUCKETS_MIN : tab->nbuckets * 2;
+    buckets = nxipc_calloc(nbuckets * sizeof(nng_topic_entry_t*));
+
+    if (buckets == NULL) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < tab->nbuckets; i++) {
+        while ((e = tab->buckets[i]) != NULL) {
+            tab->buckets[i] = e->next;
+            e->next = buckets[e->hash & (nbuckets - 1)];
+            buckets[e->hash & (nbuckets - 1)] = e;
+        }
+    }
+
+    if (tab->buckets != NULL) {
+        nxipc_free(tab->buckets);
+    }
+
+    tab->buckets = buckets;
+    tab->nbuckets = nbuckets;
+    return 0;
+}
+
+/* Finds the topic's entry, adding an empty one if it has none. */
+static nng_topic_entry_t* nng_topic_get(nng_topic_table_t* tab, const void* topic, size_t topic_len)
+{
+    uint32_t hash = nng_topic_hash(topic, topic_len);
+    nng_topic_entry_t** pe;
+    nng_topic_entry_t* e;
+
+    if ((pe = nng_topic_find(tab, hash, topic, topic_len)) != NULL) {
+        return *pe;
+    }
+
+    if (nng_topic_grow(tab) != 0 ||
+        (e = nxipc_calloc(sizeof(nng_topic_entry_t) + topic_len)) == NULL) {
+        return NULL;
+    }
+
+    e->hash = hash;
+    e->topic_len = topic_len;
+    memcpy(e->topic, topic, topic_len);
+    e->next = tab->buckets[hash & (tab->nbuckets - 1)];
+    tab->buckets[hash & (tab->nbuckets - 1)] = e;
+    tab->ntopics++;
+
+    return e;
+}
+
+static void nng_topic_remove(nng_topic_table_t* tab, const void* topic, size_t topic_len)
+{
+    nng_topic_entry_t* e;
+    nng_topic_entry_t** pe;
+
+    if ((pe = nng_topic_find(tab, nng_topic_hash(topic, topic_len), topic, topic_len)) != NULL) {
+        e = *pe;
+        *pe = e->next;
+        tab->ntopics--;
+        nng_msg_free(e->value);
+        nxipc_free(e);
+    }
+}
+
+static void nng_topic_clear(nng_topic_table_t* tab)
+{
+    size_t i;
+    nng_topic_entry_t* e;
+
+    for (i = 0; i < tab->nbuckets; i++) {
+        while ((e = tab->buckets[i]) != NULL) {
+            tab->buckets[i] = e->next;
+            nng_msg_free(e->value);
+            nxipc_free(e);
+        }
+    }
+
+    if (tab->buckets != NULL) {
+        nxipc_free(tab->buckets);
+    }
+
+    tab->buckets = NULL;
+    tab->nbuckets = 0;
+    tab->ntopics = 0;
+}
+
+/* The cache server's transaction callback: replies with a copy of the
+ * topic's latest content, or -ENOENT if nothing was published on it. */
+static int nng_pub_cache_get(const void* cookie, const int code, const nxparcel* in, nxparcel** out)
+{
+    nng_pub_ctx_t* ctx = (nng_pub_ctx_t*)cookie;
+    nng_topic_entry_t** pe;
+    int ret = -ENOENT;
+
+    if (code != NNG_NUTTX_CACHE_GET) {
+        return -EINVAL;
+    }
+
+    nng_mtx_lock(ctx->mtx);
+    pe = nng_topic_find(&ctx->cache, nng_topic_hash(nng_msg_body((nng_msg*)in), nng_msg_len(in)),
+            nng_msg_body((nng_msg*)in), nng_msg_len(in));
+
+    if (pe != NULL && (*pe)->value != NULL) {
+        ret = nng_msg_dup(out, (*pe)->value) == 0 ? 0 : -ENOMEM;
+    }
+
+    nng_mtx_unlock(ctx->mtx);
 
-    if (ret < 0) {
-        nxipc_log("%s: %s\n", __func__, nng_strerror(ret));
-        goto out;
-    }
+    return ret;
+}
 
-    ret = nng_recvmsg(ctx->fd, &msg, 0);
+static void nng_pub_free(nng_pub_ctx_t* ctx)
+{
+    nng_close(ctx->fd);
 
-    if (ret < 0 || msg == NULL || nng_msg_body(msg) == NULL) {
-        nxipc_log("client_recv.ret=%s, msg=%p\n", nng_strerror(ret), msg);
-        goto out;
+    if (ctx->cache_server != NULL) {
+        nxipc_server_release(ctx->cache_server);
     }
 
-    hdr = (nng_trans_hdr_t*)nng_msg_body(msg);
-    ret = nng_msg_trim(msg, sizeof(nng_trans_hdr_t));
+    nng_topic_clear(&ctx->cache);
 
-    if (ret == 0 && hdr->len == nng_msg_len(msg)) {
-        if (hdr->len > 0 && out != NULL) {
-            nng_msg_append(out, nng_msg_body(msg), hdr->len);
-        }
+    if (ctx->mtx != NULL) {
+        nng_mtx_free(ctx->mtx);
     }
 
-out:
-    nng_msg_free(msg);
+    if (ctx->name != NULL) {
+        nxipc_free(ctx->name);
+    }
 
-    return ret;
+    nxipc_free(ctx);
 }
 
-void* nxipc_pub_create(const char* name)
+void* nxipc_pub_create_ex(const char* name, int flags)
 {
     int ret = 0;
     nng_pub_ctx_t* ctx = NULL;
     int name_len = strlen(name);
-    const nng_nuttx_trans_type_t trans_type = NNG_NUTTX_TRANS_TYPE_INPROC;
+    const char* prefix = nng_nuttx_trans_prefix(name);
+    char* cache_name;
 
     if (name_len <= 0) {
         ret = -EINVAL;
         goto err;
     }
 
-    ctx = nxipc_calloc(sizeof(nng_server_ctx_t));
+    ctx = nxipc_calloc(sizeof(nng_pub_ctx_t));
 
     if (ctx == NULL) {
         ret = -ENOMEM;
         goto err;
     }
 
-    memset(ctx, 0, sizeof(nng_server_ctx_t));
+    memset(ctx, 0, sizeof(nng_pub_ctx_t));
+    ctx->flags = flags;
 
-    ctx->name = nxipc_calloc(strlen(nng_nuttx_trans_prefix_str[trans_type]) + name_len + 1);
+    ctx->name = nxipc_calloc(strlen(prefix) + name_len + 1);
 
     if (ctx->name == NULL) {
         ret = -ENOMEM;
         goto err;
     }
 
-    strcpy(ctx->name, nng_nuttx_trans_prefix_str[trans_type]);
+    strcpy(ctx->name, prefix);
     strcat(ctx->name, name);
 
+    if ((ret = nng_mtx_alloc(&ctx->mtx)) != 0) {
+        goto err;
+    }
+
     if ((ret = nng_pub0_open(&ctx->fd)) != 0) {
         goto err;
     }
 
+    if ((flags & NXIPC_PUB_CONFLATE) != 0 &&
+        (ret = nng_setopt_bool(ctx->fd, NNG_OPT_PUB_CONFLATE, true)) != 0) {
+        goto err;
+    }
+
+    /* The cache is up before the publisher, so that a subscriber that
+     * reaches the publisher can always reach its cache too. */
+    if ((flags & NXIPC_PUB_CACHE) != 0) {
+        cache_name = nxipc_calloc(name_len + strlen(NNG_NUTTX_CACHE_SUFFIX) + 1);
+
+        if (cache_name == NULL) {
+            ret = -ENOMEM;
+            goto err;
+        }
+
+        strcpy(cache_name, name);
+        strcat(cache_name, NNG_NUTTX_CACHE_SUFFIX);
+        ctx->cache_server = nxipc_server_create(cache_name);
+        nxipc_free(cache_name);
+
+        if (ctx->cache_server == NULL) {
+            ret = -ENOMEM;
+            goto err;
+        }
+
+        nxipc_server_set_transaction_cb(ctx->cache_server, nng_pub_cache_get, ctx);
+    }
+
     if ((ret = nng_listen(ctx->fd, ctx->name, NULL, 0)) != 0) {
         goto err;
     }
@@ -479,78 +1359,300 @@ err:
     nxipc_log("%s.ret=%d(%s)\n", __func__, ret, nng_strerror(ret));
 
     if (ctx != NULL) {
-        nng_close(ctx->fd);
-
-        if (ctx->name != NULL) {
-            nxipc_free(ctx->name);
-        }
-
-        nxipc_free(ctx);
+        nng_pub_free(ctx);
     }
 
     return NULL;
 }
 
+void* nxipc_pub_create(const char* name)
+{
+    return nxipc_pub_create_ex(name, 0);
+}
+
 int nxipc_pub_release(void* nng_pub_ctx)
 {
     if (nng_pub_ctx != NULL) {
-        nng_pub_ctx_t* ctx = (nng_pub_ctx_t*)nng_pub_ctx;
+        nng_pub_free((nng_pub_ctx_t*)nng_pub_ctx);
+    }
 
-        nng_close(ctx->fd);
+    return 0;
+}
 
-        if (ctx->name != NULL) {
-            nxipc_free(ctx->name);
-            ctx->name = NULL;
+static size_t nng_varint_put(uint8_t* buf, size_t val)
+{
+    size_t n = 0;
+
+    while (val >= 0x80) {
+        buf[n++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+
+    buf[n++] = (uint8_t)val;
+    return n;
+}
+
+/* Returns the bytes used, or 0 if buf does not hold a whole varint. */
+static size_t nng_varint_get(const uint8_t* buf, size_t len, size_t* val)
+{
+    size_t v = 0;
+    size_t n;
+
+    for (n = 0; n < len && n < NNG_NUTTX_VARINT_MAX; n++) {
+        v |= (size_t)(buf[n] & 0x7f) << (7 * n);
+
+        if ((buf[n] & 0x80) == 0) {
+            *val = v;
+            return n + 1;
         }
+    }
 
-        nxipc_free(ctx);
+    return 0;
+}
+
+static size_t nng_pub_cache_cost(const nng_topic_entry_t* e)
+{
+    return sizeof(nng_topic_entry_t) + e->topic_len + nng_msg_len(e->value);
+}
+
+/* Makes the entry, which has a value, the most recently published one.
+ * Caller holds the lock. */
+static void nng_pub_cache_link(nng_pub_ctx_t* ctx, nng_topic_entry_t* e)
+{
+    e->older = ctx->newest;
+    e->newer = NULL;
+
+    if (ctx->newest != NULL) {
+        ctx->newest->newer = e;
+    } else {
+        ctx->oldest = e;
     }
+
+    ctx->newest = e;
+    ctx->cache_bytes += nng_pub_cache_cost(e);
 }
 
-int nxipc_pub_topic_msg(void* nng_pub_ctx, const void* topic, size_t topic_len, const nxparcel* parcel)
+/* Takes the entry out of the publish order, if it is in it.  Caller
+ * holds the lock. */
+static void nng_pub_cache_unlink(nng_pub_ctx_t* ctx, nng_topic_entry_t* e)
+{
+    if (e->value == NULL) {
+        return;
+    }
+
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        ctx->oldest = e->newer;
+    }
+
+    if (e->newer != NULL) {
+        e->newer->older = e->older;
+    } else {
+        ctx->newest = e->older;
+    }
+
+    e->older = NULL;
+    e->newer = NULL;
+    ctx->cache_bytes -= nng_pub_cache_cost(e);
+}
+
+/* Sends the message with the topic header put in front; always consumes it. */
+static int nng_pub_send(nng_pub_ctx_t* ctx, const void* topic, size_t topic_len, nng_msg* msg)
 {
     int ret = 0;
-    int send_len = 0;
+    uint8_t hdr[NNG_NUTTX_VARINT_MAX];
+    size_t hdr_len = nng_varint_put(hdr, topic_len);
+    nng_topic_entry_t* e;
+    nng_msg* value;
+
+    if ((ctx->flags & NXIPC_PUB_CACHE) != 0) {
+        if (nng_msg_dup(&value, msg) != 0) {
+            nng_msg_free(msg);
+            return -ENOMEM;
+        }
+
+        nng_mtx_lock(ctx->mtx);
+
+        if ((e = nng_topic_get(&ctx->cache, topic, topic_len)) != NULL) {
+            nng_pub_cache_unlink(ctx, e);
+            nng_msg_free(e->value);
+            e->value = value;
+            value = NULL;
+            nng_pub_cache_link(ctx, e);
+
+            /* Content too large for the cache at all is not kept, and
+             * otherwise the least recently published topics go first. */
+            if (nng_pub_cache_cost(e) > NNG_NUTTX_CACHE_BYTES_MAX) {
+                nng_pub_cache_unlink(ctx, e);
+                nng_topic_remove(&ctx->cache, e->topic, e->topic_len);
+            }
+
+            while (ctx->cache_bytes > NNG_NUTTX_CACHE_BYTES_MAX ||
+                   ctx->cache.ntopics > NNG_NUTTX_CACHE_TOPICS_MAX) {
+                e = ctx->oldest;
+                nng_pub_cache_unlink(ctx, e);
+                nng_topic_remove(&ctx->cache, e->topic, e->topic_len);
+            }
+        }
+
+        nng_mtx_unlock(ctx->mtx);
+        nng_msg_free(value);
+    }
+
+    if (nng_msg_insert(msg, topic, topic_len) != 0 ||
+        nng_msg_insert(msg, hdr, hdr_len) != 0) {
+        nng_msg_free(msg);
+        return -ENOMEM;
+    }
+
+    /* PUB matches queued messages on the encoded topic */
+    if ((ctx->flags & NXIPC_PUB_CONFLATE) != 0 &&
+        nng_msg_header_append_u32(msg, hdr_len + topic_len) != 0) {
+        nng_msg_free(msg);
+        return -ENOMEM;
+    }
+
+    ret = nng_sendmsg(ctx->fd, msg, 0);
+
+    if (ret != 0) {
+        nng_msg_free(msg);
+        nxipc_log("%s.ret=%d\n", __func__, ret);
+    }
+
+    return ret;
+}
+
+int nxipc_pub_topic_msg(void* nng_pub_ctx, const void* topic, size_t topic_len, const nxparcel* parcel)
+{
     nng_pub_ctx_t* ctx = (nng_pub_ctx_t*)nng_pub_ctx;
-    nng_nuttx_topic_t* topic_data;
     nng_msg* msg = NULL;
 
     if (topic == NULL || ctx == NULL /*|| ctx->proto != NN_PUB*/) {
         return -EINVAL;
     }
 
-    nng_msg_alloc(&msg, sizeof(nng_nuttx_topic_t));
-    topic_data = (nng_nuttx_topic_t*)nng_msg_body(msg);
+    if ((parcel != NULL ? nng_msg_dup(&msg, parcel) : nng_msg_alloc(&msg, 0)) != 0) {
+        return -ENOMEM;
+    }
 
-    if (topic_data == NULL || msg == NULL) {
-        nng_msg_free(msg);
+    return nng_pub_send(ctx, topic, topic_len, msg);
+}
+
+int nxipc_pub_topic_msg_zc(void* nng_pub_ctx, const void* topic, size_t topic_len, nxparcel* parcel)
+{
+    nng_pub_ctx_t* ctx = (nng_pub_ctx_t*)nng_pub_ctx;
+
+    if (topic == NULL || ctx == NULL) {
+        nng_msg_free(parcel);
+        return -EINVAL;
+    }
+
+    if (parcel == NULL && nng_msg_alloc(&parcel, 0) != 0) {
         return -ENOMEM;
     }
 
-    memcpy(topic_data->topic, topic, topic_len > NNG_NUTTX_TOPIC_NAME_LEN ? NNG_NUTTX_TOPIC_NAME_LEN : topic_len);
+    return nng_pub_send(ctx, topic, topic_len, parcel);
+}
 
-    if (parcel != NULL) {
-        topic_data->content_len = nng_msg_len(parcel);
-        nng_msg_append(msg, nng_msg_body((nng_msg*)parcel), topic_data->content_len);
-    } else {
-        topic_data->content_len = 0;
+/* Hands the content to the topic's own listener, or the default one.
+ * Live messages are counted per topic; cached content (cached_seq given)
+ * is only handed over if no live message for the topic has been since it
+ * was fetched, as that one is at least as new. */
+static void nng_sub_dispatch(nng_sub_ctx_t* ctx, const void* topic, size_t topic_len, nng_msg* msg,
+                             const uint64_t* cached_seq)
+{
+    nng_topic_entry_t** pe = NULL;
+    on_topic_listener listener = ctx->listener;
+    void* priv = ctx->priv;
+
+    nng_mtx_lock(ctx->mtx);
+
+    if (ctx->topics.ntopics > 0) {
+        pe = nng_topic_find(&ctx->topics, nng_topic_hash(topic, topic_len), topic, topic_len);
     }
 
-    ret = nng_sendmsg(ctx->fd, msg, 0);
+    if (cached_seq != NULL && (pe == NULL || (*pe)->seq != *cached_seq)) {
+        nng_mtx_unlock(ctx->mtx);
+        return;
+    }
 
-    if (ret != 0) {
-        nng_msg_free(msg);
-        nxipc_log("%s.ret=%d, send_len=%d\n", __func__, ret, send_len);
+    if (pe != NULL) {
+        if (cached_seq == NULL) {
+            (*pe)->seq++;
+        }
+
+        if ((*pe)->listener != NULL) {
+            listener = (*pe)->listener;
+            priv = (*pe)->priv;
+        }
     }
 
-    return ret;
+    nng_mtx_unlock(ctx->mtx);
+
+    if (listener != NULL) {
+        listener(priv, topic, topic_len, msg);
+    }
+}
+
+static void nng_sub_cached_free(nng_sub_cached_t* c)
+{
+    nng_msg_free(c->msg);
+    nxipc_free(c);
+}
+
+/* Delivers the cached content fetched since the last time, in order;
+ * returns false once the subscriber is closing. */
+static bool nng_sub_deliver_cached(nng_sub_ctx_t* ctx)
+{
+    nng_sub_cached_t* c;
+    nng_sub_cached_t* next;
+    bool closing;
+
+    nng_mtx_lock(ctx->mtx);
+    c = ctx->cached;
+    ctx->cached = NULL;
+    ctx->cached_tail = NULL;
+    closing = ctx->closing;
+    nng_mtx_unlock(ctx->mtx);
+
+    for (; c != NULL; c = next) {
+        next = c->next;
+
+        if (!closing) {
+            nng_sub_dispatch(ctx, c->topic, c->topic_len, c->msg, &c->seq);
+        }
+
+        nng_sub_cached_free(c);
+    }
+
+    return !closing;
+}
+
+/* Receives the next message.  Cached content queued meanwhile cancels
+ * the receive, so the worker wakes to deliver it. */
+static void nng_sub_recv(nng_sub_ctx_t* ctx)
+{
+    bool cached;
+
+    nng_ctx_recv(ctx->nng, ctx->aio);
+
+    nng_mtx_lock(ctx->mtx);
+    cached = (ctx->cached != NULL);
+    nng_mtx_unlock(ctx->mtx);
+
+    if (cached) {
+        nng_aio_cancel(ctx->aio);
+    }
 }
 
 static void nng_sub_worker(void* arg)
 {
     int ret;
     nng_msg* msg = NULL;
-    nng_nuttx_topic_t* topic;
+    const uint8_t* topic;
+    size_t topic_len = 0;
+    size_t hdr_len;
     nng_sub_ctx_t* ctx = (nng_sub_ctx_t*)arg;
 
     if (NULL == ctx) {
@@ -560,14 +1662,23 @@ static void nng_sub_worker(void* arg)
     switch (ctx->state) {
     case NNG_NUTTX_INIT_RECV:
         ctx->state = NNG_NUTTX_RECV_RET_RECV;
-        nng_ctx_recv(ctx->nng, ctx->aio);
+        nng_sub_recv(ctx);
         break;
 
     case NNG_NUTTX_RECV_RET_RECV:
+        /* cached content goes first: it is older than what was received */
+        if (!nng_sub_deliver_cached(ctx)) {
+            if (nng_aio_result(ctx->aio) == 0) {
+                nng_msg_free(nng_aio_get_msg(ctx->aio));
+            }
+
+            break;
+        }
+
         if ((ret = nng_aio_result(ctx->aio)) != 0) {
-            if (ret == NNG_ETIMEDOUT) {
-                nng_ctx_recv(ctx->nng, ctx->aio);
-            } else {
+            if (ret == NNG_ETIMEDOUT || ret == NNG_ECANCELED) {
+                nng_sub_recv(ctx);
+            } else if (ret != NNG_ECLOSED) {
                 nxipc_log("%s: nng_aio_result.error=%d(%s)\n", __func__, ret, nng_strerror(ret));
             }
 
@@ -577,22 +1688,22 @@ static void nng_sub_worker(void* arg)
         msg = nng_aio_get_msg(ctx->aio);
 
         if (msg == NULL || nng_msg_body(msg) == NULL) {
-            nng_ctx_recv(ctx->nng, ctx->aio);
+            nng_sub_recv(ctx);
             break;
         }
 
-        topic = (nng_nuttx_topic_t*)nng_msg_body(msg);
-        nng_msg_trim(msg, sizeof(nng_nuttx_topic_t));
-        ret = nng_msg_len(msg);
+        hdr_len = nng_varint_get(nng_msg_body(msg), nng_msg_len(msg), &topic_len);
 
-        if (ret != topic->content_len) {
-            nxipc_log("%s.content_len=%lu, rc=%d\n", __func__, topic->content_len, ret);
-        } else if (ctx->listener != NULL) {
-            ctx->listener(ctx->priv, topic->topic, NNG_NUTTX_TOPIC_NAME_LEN, msg);
+        if (hdr_len == 0 || topic_len > nng_msg_len(msg) - hdr_len) {
+            nxipc_log("%s.bad topic header, len=%lu\n", __func__, (unsigned long)nng_msg_len(msg));
+        } else {
+            topic = (uint8_t*)nng_msg_body(msg) + hdr_len;
+            nng_msg_trim(msg, hdr_len + topic_len);
+            nng_sub_dispatch(ctx, topic, topic_len, msg, NULL);
         }
 
         nng_msg_free(msg);
-        nng_ctx_recv(ctx->nng, ctx->aio);
+        nng_sub_recv(ctx);
         break;
 
     default:
@@ -603,12 +1714,12 @@ static void nng_sub_worker(void* arg)
     return;
 }
 
-void* nxipc_sub_connect(const char* name, on_topic_listener listener, void* listener_priv)
+void* nxipc_sub_connect_ex(const char* name, on_topic_listener listener, void* listener_priv, int flags)
 {
     int ret = 0;
     nng_sub_ctx_t* ctx = NULL;
     int name_len = strlen(name);
-    const nng_nuttx_trans_type_t trans_type = NNG_NUTTX_TRANS_TYPE_INPROC;
+    const char* prefix = nng_nuttx_trans_prefix(name);
 
     if (name_len <= 0) {
         ret = -EINVAL;
@@ -624,16 +1735,30 @@ void* nxipc_sub_connect(const char* name, on_topic_listener listener, void* list
 
     memset(ctx, 0, sizeof(nng_sub_ctx_t));
 
-    ctx->name = nxipc_calloc(strlen(nng_nuttx_trans_prefix_str[trans_type]) + name_len + 1);
+    ctx->name = nxipc_calloc(strlen(prefix) + name_len + 1);
 
     if (ctx->name == NULL) {
         ret = -ENOMEM;
         goto err;
     }
 
-    strcpy(ctx->name, nng_nuttx_trans_prefix_str[trans_type]);
+    strcpy(ctx->name, prefix);
     strcat(ctx->name, name);
 
+    /* Only caching publishers serve this; it is connected to the first
+     * time a topic is registered, and again until that works. */
+    if ((flags & NXIPC_SUB_CACHE) != 0) {
+        ctx->cache_name = nxipc_calloc(name_len + strlen(NNG_NUTTX_CACHE_SUFFIX) + 1);
+
+        if (ctx->cache_name == NULL) {
+            ret = -ENOMEM;
+            goto err;
+        }
+
+        strcpy(ctx->cache_name, name);
+        strcat(ctx->cache_name, NNG_NUTTX_CACHE_SUFFIX);
+    }
+
     if ((ret = nng_sub0_open(&ctx->fd)) != 0) {
         goto err;
     }
@@ -646,6 +1771,10 @@ void* nxipc_sub_connect(const char* name, on_topic_listener listener, void* list
     ctx->listener = listener;
     ctx->priv = listener_priv;
 
+    if ((ret = nng_mtx_alloc(&ctx->mtx)) != 0) {
+        goto err;
+    }
+
     if ((ret = nng_aio_alloc(&ctx->aio, nng_sub_worker, ctx)) != 0) {
         goto err;
     }
@@ -654,6 +1783,11 @@ void* nxipc_sub_connect(const char* name, on_topic_listener listener, void* list
         goto err;
     }
 
+    if ((flags & NXIPC_SUB_CONFLATE) != 0 &&
+        (ret = nng_ctx_setopt_bool(ctx->nng, NNG_OPT_SUB_CONFLATE, true)) != 0) {
+        goto err;
+    }
+
     ctx->state = NNG_NUTTX_INIT_RECV;
     nng_sub_worker(ctx);
 
@@ -662,82 +1796,265 @@ err:
     nxipc_log("%s.ret=%d(%s)\n", __func__, ret, nng_strerror(ret));
 
     if (ctx != NULL) {
+        nng_aio_free(ctx->aio);
         nng_close(ctx->fd);
 
+        if (ctx->mtx != NULL) {
+            nng_mtx_free(ctx->mtx);
+        }
+
         if (ctx->name != NULL) {
             nxipc_free(ctx->name);
         }
 
+        if (ctx->cache_name != NULL) {
+            nxipc_free(ctx->cache_name);
+        }
+
         nxipc_free(ctx);
     }
 
     return NULL;
 }
 
+void* nxipc_sub_connect(const char* name, on_topic_listener listener, void* listener_priv)
+{
+    return nxipc_sub_connect_ex(name, listener, listener_priv, 0);
+}
+
 void nxipc_sub_disconnect(void* nng_sub_ctx)
 {
     if (nng_sub_ctx != NULL) {
         nng_sub_ctx_t* ctx = (nng_sub_ctx_t*)nng_sub_ctx;
+        nng_sub_cached_t* c;
 
+        nng_mtx_lock(ctx->mtx);
+        ctx->closing = true;
+        nng_mtx_unlock(ctx->mtx);
+
+        /* fetches still running finish first, as they wake the worker */
+        nxipc_client_disconnect(ctx->cache_client);
         nng_aio_stop(ctx->aio);
         nng_aio_wait(ctx->aio);
         nng_ctx_close(ctx->nng);
         nng_aio_free(ctx->aio);
         nng_close(ctx->fd);
 
+        while ((c = ctx->cached) != NULL) {
+            ctx->cached = c->next;
+            nng_sub_cached_free(c);
+        }
+
+        nng_topic_clear(&ctx->topics);
+        nng_mtx_free(ctx->mtx);
+
         if (ctx->name != NULL) {
             nxipc_free(ctx->name);
             ctx->name = NULL;
         }
 
+        nxipc_free(ctx->cache_name);
+
         nxipc_free(ctx);
     }
 }
 
 
-int nxipc_sub_register_topic(void* nng_sub_ctx, const void* topic, size_t topic_len)
+/* Subscribes to the encoded topic, so that only that exact topic matches. */
+static int nng_sub_setopt_topic(nng_sub_ctx_t* ctx, const char* opt, const void* topic, size_t topic_len)
+{
+    int ret;
+    uint8_t hdr[NNG_NUTTX_VARINT_MAX];
+    uint8_t* buf;
+    size_t hdr_len;
+
+    if (topic_len == 0) {
+        /* no topic at all is everything */
+        return nng_ctx_setopt(ctx->nng, opt, "", 0);
+    }
+
+    hdr_len = nng_varint_put(hdr, topic_len);
+    buf = nxipc_calloc(hdr_len + topic_len);
+
+    if (buf == NULL) {
+        return NNG_ENOMEM;
+    }
+
+    memcpy(buf, hdr, hdr_len);
+    memcpy(buf + hdr_len, topic, topic_len);
+    ret = nng_ctx_setopt(ctx->nng, opt, buf, hdr_len + topic_len);
+    nxipc_free(buf);
+
+    return ret;
+}
+
+/* Queues the fetched content for the worker, and wakes it. */
+static void nng_sub_cached_done(void* cookie, int ret, const nxparcel* out)
+{
+    nng_sub_cached_t* c = (nng_sub_cached_t*)cookie;
+    nng_sub_ctx_t* ctx = c->sub;
+
+    if (ret == 0 && out != NULL && nng_msg_dup(&c->msg, out) == 0) {
+        nng_mtx_lock(ctx->mtx);
+
+        if (!ctx->closing) {
+            if (ctx->cached_tail != NULL) {
+                ctx->cached_tail->next = c;
+            } else {
+                ctx->cached = c;
+            }
+
+            ctx->cached_tail = c;
+            c = NULL;
+        }
+
+        nng_mtx_unlock(ctx->mtx);
+
+        if (c == NULL) {
+            nng_aio_cancel(ctx->aio);
+            return;
+        }
+    }
+
+    nng_sub_cached_free(c);
+}
+
+/* The cache client, connected now if it is not yet: the publisher may
+ * have come up after the subscriber.  None without NXIPC_SUB_CACHE. */
+static void* nng_sub_cache_client(nng_sub_ctx_t* ctx)
+{
+    void* client;
+    void* extra = NULL;
+
+    if (ctx->cache_name == NULL) {
+        return NULL;
+    }
+
+    nng_mtx_lock(ctx->mtx);
+    client = ctx->cache_client;
+    nng_mtx_unlock(ctx->mtx);
+
+    if (client != NULL || (client = nng_client_open(ctx->cache_name, true)) == NULL) {
+        return client;
+    }
+
+    nng_mtx_lock(ctx->mtx);
+
+    if (ctx->cache_client == NULL) {
+        ctx->cache_client = client;
+    } else {
+        extra = client;
+        client = ctx->cache_client;
+    }
+
+    nng_mtx_unlock(ctx->mtx);
+
+    if (extra != NULL) {
+        nxipc_client_disconnect(extra);
+    }
+
+    return client;
+}
+
+/* Fetches the publisher's latest content for the topic, if it caches and
+ * has any, for the worker to hand to the topic's listener.  Seq is the
+ * topic's count of live messages now. */
+static void nng_sub_fetch_cached(nng_sub_ctx_t* ctx, const void* topic, size_t topic_len, uint64_t seq)
+{
+    nng_sub_cached_t* c;
+    nng_msg* in = NULL;
+    void* client;
+
+    if ((client = nng_sub_cache_client(ctx)) == NULL) {
+        return;
+    }
+
+    if ((c = nxipc_calloc(sizeof(nng_sub_cached_t) + topic_len)) == NULL) {
+        return;
+    }
+
+    c->sub = ctx;
+    c->seq = seq;
+    c->topic_len = topic_len;
+    memcpy(c->topic, topic, topic_len);
+
+    if (nng_msg_alloc(&in, 0) != 0 || nng_msg_append(in, topic, topic_len) != 0) {
+        nng_msg_free(in);
+        nng_sub_cached_free(c);
+        return;
+    }
+
+    if (nxipc_client_transaction_async_zc(client, NNG_NUTTX_CACHE_GET, in, 0,
+                                          nng_sub_cached_done, c, NULL) != 0) {
+        nng_sub_cached_free(c);
+    }
+}
+
+int nxipc_sub_register_topic_listener(void* nng_sub_ctx, const void* topic, size_t topic_len, \
+        on_topic_listener listener, void* listener_priv)
 {
     int ret = 0;
+    uint64_t seq = 0;
+    nng_topic_entry_t* e;
     nng_sub_ctx_t* ctx = (nng_sub_ctx_t*)nng_sub_ctx;
 
-    if (topic == NULL || ctx == NULL /* || ctx->proto != NN_SUB*/) {
+    if ((topic == NULL && topic_len != 0) || ctx == NULL) {
         return -EINVAL;
     }
 
-    if (topic_len > NNG_NUTTX_TOPIC_NAME_LEN) {
-        nxipc_log("%s.topic len(%lu) > max(%d)\n", __func__, topic_len, NNG_NUTTX_TOPIC_NAME_LEN);
-        topic_len = NNG_NUTTX_TOPIC_NAME_LEN;
+    /* Every registered topic has an entry, which counts its live
+     * messages, even if it has no listener of its own. */
+    nng_mtx_lock(ctx->mtx);
+
+    if ((e = nng_topic_get(&ctx->topics, topic, topic_len)) != NULL) {
+        if (listener != NULL) {
+            e->listener = listener;
+            e->priv = listener_priv;
+        }
+
+        seq = e->seq;
+    }
+
+    nng_mtx_unlock(ctx->mtx);
+
+    if (e == NULL) {
+        return -ENOMEM;
     }
 
-    ret  = nng_ctx_setopt(ctx->nng, NNG_OPT_SUB_SUBSCRIBE, topic, topic_len);
+    ret = nng_sub_setopt_topic(ctx, NNG_OPT_SUB_SUBSCRIBE, topic, topic_len);
 
-    if (ret < 0) {
+    if (ret != 0) {
         nxipc_log("%s.ret=%d(%s)\n", __func__, ret, nng_strerror(ret));
+    } else if (topic_len > 0) {
+        nng_sub_fetch_cached(ctx, topic, topic_len, seq);
     }
 
     return ret;
 }
 
+int nxipc_sub_register_topic(void* nng_sub_ctx, const void* topic, size_t topic_len)
+{
+    return nxipc_sub_register_topic_listener(nng_sub_ctx, topic, topic_len, NULL, NULL);
+}
+
 int nxipc_sub_unregister_topic(void* nng_sub_ctx, const void* topic, size_t topic_len)
 {
     int ret = 0;
     nng_sub_ctx_t* ctx = (nng_sub_ctx_t*)nng_sub_ctx;
 
-    if (topic == NULL || ctx == NULL /* || ctx->proto != NN_SUB*/) {
+    if ((topic == NULL && topic_len != 0) || ctx == NULL) {
         return -EINVAL;
     }
 
-    if (topic_len > NNG_NUTTX_TOPIC_NAME_LEN) {
-        nxipc_log("%s.topic len(%lu) > max(%d)\n", __func__, topic_len, NNG_NUTTX_TOPIC_NAME_LEN);
-        topic_len = NNG_NUTTX_TOPIC_NAME_LEN;
-    }
+    nng_mtx_lock(ctx->mtx);
+    nng_topic_remove(&ctx->topics, topic, topic_len);
+    nng_mtx_unlock(ctx->mtx);
 
-    ret  = nng_ctx_setopt(ctx->nng, NNG_OPT_SUB_UNSUBSCRIBE, topic, topic_len);
+    ret = nng_sub_setopt_topic(ctx, NNG_OPT_SUB_UNSUBSCRIBE, topic, topic_len);
 
-    if (ret < 0) {
+    if (ret != 0) {
         nxipc_log("%s.ret=%d(%s)\n", __func__, ret, nng_strerror(ret));
     }
 
     return ret;
 }
-
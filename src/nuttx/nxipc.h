@@ -24,21 +24,63 @@ extern "C" {
 
 typedef int (*on_transaction)(const void* cookie, const int code, \
         const nxparcel* in, nxparcel** out);
+typedef void (*on_transaction_done)(void* cookie, int ret, \
+        const nxparcel* out);
 typedef int (*on_topic_listener)(const void* cookie, const void* topic, \
         const size_t topic_len, const nxparcel* parcel);
 
 /**
  * @brief:nxipc_server_create
  *
+ * Names are inproc names, reachable within the process, unless they
+ * start with a transport prefix.  "shm:///path" serves other processes
+ * on the same host through shared memory; clients, publishers and
+ * subscribers take the same form of name.
+ *
  * @param name
  *
  * @return
  */
 void* nxipc_server_create(const char* name);
 
+/**
+ * @brief:nxipc_server_create_ex
+ *
+ * Like nxipc_server_create, but with a pool of workers, each able to
+ * have a transaction in progress.  Transactions from different clients
+ * then run concurrently, so the transaction callback must be thread
+ * safe.  nxipc_server_create is the same as a pool of one.
+ *
+ * @param name
+ * @param workers number of concurrent transactions, 1 to 256
+ *
+ * @return
+ */
+void* nxipc_server_create_ex(const char* name, int workers);
+
+/**
+ * @brief:nxipc_server_set_affinity
+ *
+ * Binds an op code to one worker.  Transactions with that op code are
+ * then run one at a time, in the order received, even with a pool of
+ * workers; other op codes still run concurrently.  A worker of -1
+ * removes the binding.
+ *
+ * @param nxipc_server_ctx
+ * @param op_code
+ * @param worker index of the worker, less than the pool size
+ *
+ * @return 0, -EINVAL, or -ENOSPC if too many op codes are bound
+ */
+int nxipc_server_set_affinity(void* nxipc_server_ctx, int op_code, int worker);
+
 /**
  * @brief:nxipc_server_set_transaction_cb
  *
+ * The callback may set *out to a parcel it allocated, which nxipc then
+ * owns and sends back as is.  It may also set *out to in itself (after
+ * changing it, if it likes), to reply without allocating or copying.
+ *
  * @param nxipc_server_ctx
  * @param cb
  * @param cb_priv
@@ -67,9 +109,14 @@ void* nxipc_client_connect(const char* server_name);
 /**
  * @brief:nxipc_client_disconnect
  *
+ * Fails the transactions still in flight, whose callbacks run (with
+ * NNG_ECLOSED) before this returns, and releases handles that were
+ * never waited for.  It cannot be called from a done callback of the
+ * same client, which would have to wait for itself.
+ *
  * @param nxipc_client_ctx
  *
- * @return
+ * @return 0, or -EDEADLK (and nothing is done) from a done callback
  */
 int nxipc_client_disconnect(void* nxipc_client_ctx);
 
@@ -81,11 +128,100 @@ int nxipc_client_disconnect(void* nxipc_client_ctx);
  * @param in
  * @param out
  *
- * @return
+ * @return as for nxipc_client_transaction_wait
  */
 int nxipc_client_transaction(const void* nxipc_client_ctx, int op_code, \
         const nxparcel* in, nxparcel* out);
 
+/**
+ * @brief:nxipc_client_transaction_async
+ *
+ * Starts a transaction without waiting for it.  Any number may be in
+ * flight on one client handle, from any number of threads; each reply
+ * is matched to its call by sequence number.
+ *
+ * When the transaction finishes, cb (if not NULL) is called with the
+ * result and the reply; the reply is only valid during the callback.
+ * The callback runs on an nng thread and must not block for long.
+ *
+ * If handle is not NULL, it receives a handle that may be passed to
+ * nxipc_client_transaction_wait once.  A handle that is never waited
+ * for is released when the client is disconnected.
+ *
+ * @param nxipc_client_ctx
+ * @param op_code
+ * @param in copied; the caller keeps it
+ * @param timeout_ms deadline for the whole transaction; 0 for the
+ *        default (400 ms), or -1 for none
+ * @param cb
+ * @param cb_priv
+ * @param handle
+ *
+ * @return 0 if started, or a negative errno
+ */
+int nxipc_client_transaction_async(const void* nxipc_client_ctx, int op_code, \
+        const nxparcel* in, int timeout_ms, on_transaction_done cb, \
+        void* cb_priv, void** handle);
+
+/**
+ * @brief:nxipc_client_transaction_async_zc
+ *
+ * Like nxipc_client_transaction_async, but the parcel is sent as is,
+ * without copying, with the transaction header put in its headroom.
+ * The parcel is always consumed, even on failure.
+ *
+ * @return 0 if started, or a negative errno
+ */
+int nxipc_client_transaction_async_zc(const void* nxipc_client_ctx, int op_code, \
+        nxparcel* in, int timeout_ms, on_transaction_done cb, \
+        void* cb_priv, void** handle);
+
+/**
+ * @brief:nxipc_client_transaction_wait
+ *
+ * Waits for a transaction started by nxipc_client_transaction_async,
+ * appends the reply to out (if not NULL), and releases the handle.
+ *
+ * @param handle
+ * @param out
+ *
+ * @return the value returned by the server's transaction callback, an
+ *         nng error (e.g. NNG_ETIMEDOUT), or a negative errno
+ */
+int nxipc_client_transaction_wait(void* handle, nxparcel* out);
+
+/**
+ * @brief:nxipc_client_transaction_wait_zc
+ *
+ * Like nxipc_client_transaction_wait, but hands back the reply parcel
+ * itself, rather than copying it.  The caller must free *out, which is
+ * NULL if there was no reply.
+ *
+ * @param handle
+ * @param out
+ *
+ * @return as for nxipc_client_transaction_wait
+ */
+int nxipc_client_transaction_wait_zc(void* handle, nxparcel** out);
+
+/**
+ * @brief:nxipc_client_transaction_zc
+ *
+ * nxipc_client_transaction without copies: the request parcel is sent
+ * as is and always consumed, and the reply parcel is handed back in
+ * *out (NULL if none), for the caller to free.  A reply can be passed
+ * straight back in as the next request.
+ *
+ * @param nxipc_client_ctx
+ * @param op_code
+ * @param in
+ * @param out may be NULL if the reply is not wanted
+ *
+ * @return as for nxipc_client_transaction_wait
+ */
+int nxipc_client_transaction_zc(const void* nxipc_client_ctx, int op_code, \
+        nxparcel* in, nxparcel** out);
+
 /**
  * @brief:nxipc_pub_create
  *
@@ -95,6 +231,30 @@ int nxipc_client_transaction(const void* nxipc_client_ctx, int op_code, \
  */
 void* nxipc_pub_create(const char* name);
 
+/* nxipc_pub_create_ex flags */
+#define NXIPC_PUB_CONFLATE 0x1 /* slow subscribers get only the latest per topic */
+#define NXIPC_PUB_CACHE 0x2 /* keep the latest content of each topic */
+
+/**
+ * @brief:nxipc_pub_create_ex
+ *
+ * Like nxipc_pub_create, with flags.  With NXIPC_PUB_CONFLATE, a
+ * subscriber that falls behind has only the newest message of each
+ * topic waiting for it, rather than every update.  With
+ * NXIPC_PUB_CACHE, the latest content of each topic is kept (a copy
+ * per publish), and a subscriber (connected with NXIPC_SUB_CACHE)
+ * registering a topic is handed it straight away.  The cache is served under the name with ".cache"
+ * appended.  It is bounded, in topics and in bytes; the topics least
+ * recently published are dropped from it first, and content larger
+ * than the whole cache is not kept.
+ *
+ * @param name
+ * @param flags NXIPC_PUB_* flags, or'ed together
+ *
+ * @return
+ */
+void* nxipc_pub_create_ex(const char* name, int flags);
+
 /**
  * @brief:nxipc_pub_release
  *
@@ -107,6 +267,9 @@ int nxipc_pub_release(void* nxipc_pub_ctx);
 /**
  * @brief:nxipc_pub_topic_msg
  *
+ * Topics are byte strings of any length, sent ahead of the content as
+ * a varint length and the bytes.
+ *
  * @param nxipc_pub_ctx
  * @param topic
  * @param topic_len
@@ -118,9 +281,28 @@ int nxipc_pub_release(void* nxipc_pub_ctx);
 int nxipc_pub_topic_msg(void* nxipc_pub_ctx, const void* topic, size_t topic_len, \
         const nxparcel* parcel);
 
+/**
+ * @brief:nxipc_pub_topic_msg_zc
+ *
+ * Like nxipc_pub_topic_msg, but the parcel is published as is, with the
+ * topic header put in its headroom.  The parcel is always consumed.
+ *
+ * @param nxipc_pub_ctx
+ * @param topic
+ * @param topic_len
+ * @param parcel
+ *
+ * @return
+ */
+int nxipc_pub_topic_msg_zc(void* nxipc_pub_ctx, const void* topic, size_t topic_len, \
+        nxparcel* parcel);
+
 /**
  * @brief:nxipc_sub_connect
  *
+ * The listener gets the content of every registered topic without a
+ * listener of its own, along with the topic and its length.
+ *
  * @param name
  * @param listener
  * @param listener_priv
@@ -129,6 +311,32 @@ int nxipc_pub_topic_msg(void* nxipc_pub_ctx, const void* topic, size_t topic_len
  */
 void* nxipc_sub_connect(const char* name, on_topic_listener listener, void* listener_priv);
 
+/* nxipc_sub_connect_ex flags */
+#define NXIPC_SUB_CONFLATE 0x1 /* queue only the latest of each topic */
+#define NXIPC_SUB_CACHE 0x2 /* fetch a registered topic's cached content */
+
+/**
+ * @brief:nxipc_sub_connect_ex
+ *
+ * Like nxipc_sub_connect, with flags.  With NXIPC_SUB_CONFLATE, while
+ * a listener is busy, only the newest message of each registered topic
+ * waits for it, rather than every update.  This does not work together
+ * with subscribing to all topics (a topic_len of 0), which then only
+ * keeps the newest message of any topic.  With NXIPC_SUB_CACHE, the
+ * latest content of each topic registered is fetched from the
+ * publisher's cache (see NXIPC_PUB_CACHE); leave it off unless the
+ * publisher caches, as each registration then tries to reach it.
+ *
+ * @param name
+ * @param listener
+ * @param listener_priv
+ * @param flags NXIPC_SUB_* flags, or'ed together
+ *
+ * @return
+ */
+void* nxipc_sub_connect_ex(const char* name, on_topic_listener listener, \
+        void* listener_priv, int flags);
+
 /**
  * @brief:nxipc_sub_disconnect
  *
@@ -139,6 +347,15 @@ void nxipc_sub_disconnect(void* nxipc_sub_ctx);
 /**
  * @brief:nxipc_sub_register_topic
  *
+ * Subscribes to exactly this topic.  A topic_len of 0 subscribes to
+ * all topics.  If the subscriber was connected with NXIPC_SUB_CACHE and
+ * the publisher caches (NXIPC_PUB_CACHE), the topic's latest content
+ * is fetched, and given to the listener on the
+ * subscriber's thread like any other message, unless a live update of
+ * the topic has reached the listener since.  The publisher's cache is
+ * connected to the first time a topic is registered, and again on
+ * later ones until that works.
+ *
  * @param nxipc_sub_ctx
  * @param topic
  * @param topic_len
@@ -147,6 +364,27 @@ void nxipc_sub_disconnect(void* nxipc_sub_ctx);
  */
 int nxipc_sub_register_topic(void* nxipc_sub_ctx, const void* topic, size_t topic_len);
 
+/**
+ * @brief:nxipc_sub_register_topic_listener
+ *
+ * Like nxipc_sub_register_topic, but the topic's content goes to this
+ * listener rather than the one given to nxipc_sub_connect.  Topics are
+ * looked up in a hash table, so a subscriber may route many topics to
+ * different listeners.  Registering the topic again replaces its
+ * listener.  A listener may still be called once for a message already
+ * on its way when the topic is unregistered.
+ *
+ * @param nxipc_sub_ctx
+ * @param topic
+ * @param topic_len
+ * @param listener
+ * @param listener_priv
+ *
+ * @return
+ */
+int nxipc_sub_register_topic_listener(void* nxipc_sub_ctx, const void* topic, size_t topic_len, \
+        on_topic_listener listener, void* listener_priv);
+
 /**
  * @brief:nxipc_sub_unregister_topic
  *
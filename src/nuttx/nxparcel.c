@@ -1,5 +1,7 @@
 #include "nxparcel.h"
 
+#include <string.h>
+
 int nxparcel_alloc(nxparcel** msg) {
     return nng_msg_alloc(msg, 0);
 }
@@ -51,3 +53,188 @@ int nxparcel_size(const nxparcel* msg) {
 void nxparcel_clear(nxparcel* msg) {
     nng_msg_clear(msg);
 }
+
+void nxparcel_writer_begin(nxparcel_writer* w, nxparcel* msg) {
+    w->msg = msg;
+    w->base = nng_msg_len(msg);
+    w->ptr = (uint8_t*)nng_msg_body(msg) + w->base;
+    w->end = w->ptr;
+    w->err = 0;
+}
+
+int nxparcel_writer_grow(nxparcel_writer* w, size_t size) {
+    uint8_t* body;
+    size_t used;
+    size_t want;
+
+    if (w->err != 0) {
+        return w->err;
+    }
+
+    body = nng_msg_body(w->msg);
+    used = w->ptr - body;
+    want = nng_msg_len(w->msg) * 2;
+
+    /* Grow geometrically, so a long run of small writes stays cheap. */
+    if (want < used + size) {
+        want = used + size;
+    }
+
+    if (want < 64) {
+        want = 64;
+    }
+
+    if (nng_msg_realloc(w->msg, want) != 0) {
+        /* Leave no room, so every later write comes back here. */
+        w->err = -ENOMEM;
+        w->end = w->ptr;
+        return w->err;
+    }
+
+    body = nng_msg_body(w->msg);
+    w->ptr = body + used;
+    w->end = body + want;
+    return 0;
+}
+
+int nxparcel_reserve(nxparcel_writer* w, size_t size) {
+    if ((size_t)(w->end - w->ptr) >= size) {
+        return w->err;
+    }
+
+    return nxparcel_writer_grow(w, size);
+}
+
+int nxparcel_writer_commit(nxparcel_writer* w) {
+    if (w->err != 0) {
+        nng_msg_chop(w->msg, nng_msg_len(w->msg) - w->base);
+    } else {
+        nng_msg_chop(w->msg, w->end - w->ptr);
+    }
+
+    w->ptr = (uint8_t*)nng_msg_body(w->msg) + nng_msg_len(w->msg);
+    w->end = w->ptr;
+    return w->err;
+}
+
+void nxparcel_write(nxparcel_writer* w, const void* data, size_t size) {
+    uint8_t* p = nxparcel_writer_room(w, size);
+
+    if (p != NULL && size > 0) {
+        memcpy(p, data, size);
+    }
+}
+
+void nxparcel_write_u32_array(nxparcel_writer* w, const uint32_t* vals, size_t count) {
+    uint8_t* p;
+
+    if (nxparcel_reserve(w, 4 + count * 4) != 0) {
+        return;
+    }
+
+    nxparcel_write_u32(w, (uint32_t)count);
+    p = nxparcel_writer_room(w, count * 4);
+
+    for (size_t i = 0; i < count; i++, p += 4) {
+        p[0] = (uint8_t)(vals[i] >> 24);
+        p[1] = (uint8_t)(vals[i] >> 16);
+        p[2] = (uint8_t)(vals[i] >> 8);
+        p[3] = (uint8_t)vals[i];
+    }
+}
+
+void nxparcel_write_string(nxparcel_writer* w, const char* str) {
+    size_t len = strlen(str);
+
+    nxparcel_write_u32(w, (uint32_t)len);
+    nxparcel_write(w, str, len);
+}
+
+void nxparcel_write_parcel(nxparcel_writer* w, const nxparcel* nested) {
+    size_t len = nng_msg_len(nested);
+
+    nxparcel_write_u32(w, (uint32_t)len);
+    nxparcel_write(w, nng_msg_body((nxparcel*)nested), len);
+}
+
+void nxparcel_reader_begin(nxparcel_reader* r, const nxparcel* msg) {
+    r->ptr = nng_msg_body((nxparcel*)msg);
+    r->end = r->ptr + nng_msg_len(msg);
+    r->err = 0;
+}
+
+int nxparcel_reader_error(const nxparcel_reader* r) {
+    return r->err;
+}
+
+size_t nxparcel_reader_remaining(const nxparcel_reader* r) {
+    return r->end - r->ptr;
+}
+
+int nxparcel_read(nxparcel_reader* r, void* data, size_t size) {
+    const uint8_t* p = nxparcel_reader_take(r, size);
+
+    if (p == NULL) {
+        return -ENODATA;
+    }
+
+    if (size > 0) {
+        memcpy(data, p, size);
+    }
+
+    return 0;
+}
+
+int nxparcel_read_u32_array(nxparcel_reader* r, uint32_t* vals, size_t max, size_t* count) {
+    const uint8_t* p;
+    uint32_t n;
+
+    if (nxparcel_read_u32_at(r, &n) != 0) {
+        return -ENODATA;
+    }
+
+    if (n > nxparcel_reader_remaining(r) / 4) {
+        nxparcel_reader_take(r, SIZE_MAX);
+        return -ENODATA;
+    }
+
+    p = nxparcel_reader_take(r, (size_t)n * 4);
+
+    if (n > max) {
+        return -ENOSPC;
+    }
+
+    for (uint32_t i = 0; i < n; i++, p += 4) {
+        vals[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    *count = n;
+    return 0;
+}
+
+int nxparcel_read_string(nxparcel_reader* r, const char** str, size_t* len) {
+    const uint8_t* p;
+    uint32_t n;
+
+    if (nxparcel_read_u32_at(r, &n) != 0 || (p = nxparcel_reader_take(r, n)) == NULL) {
+        return -ENODATA;
+    }
+
+    *str = (const char*)p;
+    *len = n;
+    return 0;
+}
+
+int nxparcel_read_parcel(nxparcel_reader* r, nxparcel_reader* nested) {
+    const uint8_t* p;
+    uint32_t n;
+
+    if (nxparcel_read_u32_at(r, &n) != 0 || (p = nxparcel_reader_take(r, n)) == NULL) {
+        return -ENODATA;
+    }
+
+    nested->ptr = p;
+    nested->end = p + n;
+    nested->err = 0;
+    return 0;
+}
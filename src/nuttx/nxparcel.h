@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #include <nng/nng.h>
 
@@ -149,6 +150,286 @@ int nxparcel_size(const nxparcel* msg);
  */
 void nxparcel_clear(nxparcel* msg);
 
+/*
+ * Cursors
+ *
+ * A writer reserves room in the parcel up front and then fills it in
+ * place, so a run of fields costs one bounds check each and no more
+ * than the occasional grow, rather than an append (and possible
+ * realloc) apiece.  Errors are sticky: once a write fails, the rest
+ * are skipped, and nxparcel_writer_commit reports it and takes back
+ * everything written since nxparcel_writer_begin, so a whole struct
+ * can be written with a single check at the end, and a failed one
+ * never leaves part of itself in the parcel.
+ *
+ * A reader walks the parcel without trimming it, so a parcel can be
+ * read any number of times, including one that is shared.  Reads past
+ * the end fail, leave the value untouched, and are likewise sticky.
+ *
+ * Integers are big endian, as for nxparcel_append_u32 and friends, so
+ * the two APIs can read what each other wrote.  Arrays, strings and
+ * nested parcels are preceded by a u32 count of elements or bytes.
+ */
+
+typedef struct nxparcel_writer {
+    nxparcel* msg;
+    uint8_t* ptr; /* next byte to write */
+    uint8_t* end; /* end of the room reserved, ptr once failed */
+    size_t base;  /* parcel length at nxparcel_writer_begin */
+    int err;
+} nxparcel_writer;
+
+typedef struct nxparcel_reader {
+    const uint8_t* ptr; /* next byte to read */
+    const uint8_t* end;
+    int err;
+} nxparcel_reader;
+
+/**
+ * @brief:nxparcel_writer_begin
+ *
+ * Starts writing at the end of the parcel.  Nothing else may change the
+ * parcel until nxparcel_writer_commit.
+ *
+ * @param w
+ * @param msg
+ */
+void nxparcel_writer_begin(nxparcel_writer* w, nxparcel* msg);
+
+/**
+ * @brief:nxparcel_reserve
+ *
+ * Makes sure at least size more bytes can be written without growing
+ * the parcel again.  Writers reserve as they go, so this is only
+ * needed to size the parcel once for a known amount of data.
+ *
+ * @param w
+ * @param size
+ *
+ * @return 0, or -ENOMEM (which is sticky)
+ */
+int nxparcel_reserve(nxparcel_writer* w, size_t size);
+
+/**
+ * @brief:nxparcel_writer_commit
+ *
+ * Ends writing, giving back any room reserved but not written.  If
+ * any write failed, the parcel is put back as it was before
+ * nxparcel_writer_begin.
+ *
+ * @param w
+ *
+ * @return 0, or the first error hit while writing
+ */
+int nxparcel_writer_commit(nxparcel_writer* w);
+
+/**
+ * @brief:nxparcel_write
+ *
+ * @param w
+ * @param data
+ * @param size
+ */
+void nxparcel_write(nxparcel_writer* w, const void* data, size_t size);
+
+/**
+ * @brief:nxparcel_write_u32_array
+ *
+ * @param w
+ * @param vals
+ * @param count
+ */
+void nxparcel_write_u32_array(nxparcel_writer* w, const uint32_t* vals, size_t count);
+
+/**
+ * @brief:nxparcel_write_string
+ *
+ * Writes the length of the string and its bytes, without the NUL.
+ *
+ * @param w
+ * @param str
+ */
+void nxparcel_write_string(nxparcel_writer* w, const char* str);
+
+/**
+ * @brief:nxparcel_write_parcel
+ *
+ * Writes a parcel into this one, read back with nxparcel_read_parcel.
+ *
+ * @param w
+ * @param nested
+ */
+void nxparcel_write_parcel(nxparcel_writer* w, const nxparcel* nested);
+
+/**
+ * @brief:nxparcel_reader_begin
+ *
+ * @param r
+ * @param msg
+ */
+void nxparcel_reader_begin(nxparcel_reader* r, const nxparcel* msg);
+
+/**
+ * @brief:nxparcel_reader_error
+ *
+ * @param r
+ *
+ * @return 0, or -ENODATA if any read went past the end
+ */
+int nxparcel_reader_error(const nxparcel_reader* r);
+
+/**
+ * @brief:nxparcel_reader_remaining
+ *
+ * @param r
+ *
+ * @return bytes left to read
+ */
+size_t nxparcel_reader_remaining(const nxparcel_reader* r);
+
+/**
+ * @brief:nxparcel_read
+ *
+ * @param r
+ * @param data
+ * @param size
+ *
+ * @return 0 or -ENODATA
+ */
+int nxparcel_read(nxparcel_reader* r, void* data, size_t size);
+
+/**
+ * @brief:nxparcel_read_u32_array
+ *
+ * Reads an array written by nxparcel_write_u32_array.  An array of
+ * more than max elements fails with -ENOSPC, and is skipped.
+ *
+ * @param r
+ * @param vals
+ * @param max room in vals, in elements
+ * @param count set to the number of elements read
+ *
+ * @return 0, -ENODATA or -ENOSPC
+ */
+int nxparcel_read_u32_array(nxparcel_reader* r, uint32_t* vals, size_t max, size_t* count);
+
+/**
+ * @brief:nxparcel_read_string
+ *
+ * Reads a string written by nxparcel_write_string, without copying it.
+ * The string points into the parcel, and is not NUL terminated.
+ *
+ * @param r
+ * @param str
+ * @param len
+ *
+ * @return 0 or -ENODATA
+ */
+int nxparcel_read_string(nxparcel_reader* r, const char** str, size_t* len);
+
+/**
+ * @brief:nxparcel_read_parcel
+ *
+ * Reads a parcel written by nxparcel_write_parcel, without copying it:
+ * nested is set up to read it in place.
+ *
+ * @param r
+ * @param nested
+ *
+ * @return 0 or -ENODATA
+ */
+int nxparcel_read_parcel(nxparcel_reader* r, nxparcel_reader* nested);
+
+/* Slow path of the writers below. */
+int nxparcel_writer_grow(nxparcel_writer* w, size_t size);
+
+static inline uint8_t* nxparcel_writer_room(nxparcel_writer* w, size_t size)
+{
+    if ((size_t)(w->end - w->ptr) < size && nxparcel_writer_grow(w, size) != 0) {
+        return NULL;
+    }
+
+    w->ptr += size;
+    return w->ptr - size;
+}
+
+static inline void nxparcel_write_u16(nxparcel_writer* w, uint16_t val)
+{
+    uint8_t* p = nxparcel_writer_room(w, 2);
+
+    if (p != NULL) {
+        p[0] = (uint8_t)(val >> 8);
+        p[1] = (uint8_t)val;
+    }
+}
+
+static inline void nxparcel_write_u32(nxparcel_writer* w, uint32_t val)
+{
+    uint8_t* p = nxparcel_writer_room(w, 4);
+
+    if (p != NULL) {
+        p[0] = (uint8_t)(val >> 24);
+        p[1] = (uint8_t)(val >> 16);
+        p[2] = (uint8_t)(val >> 8);
+        p[3] = (uint8_t)val;
+    }
+}
+
+static inline void nxparcel_write_u64(nxparcel_writer* w, uint64_t val)
+{
+    nxparcel_write_u32(w, (uint32_t)(val >> 32));
+    nxparcel_write_u32(w, (uint32_t)val);
+}
+
+static inline const uint8_t* nxparcel_reader_take(nxparcel_reader* r, size_t size)
+{
+    if ((size_t)(r->end - r->ptr) < size) {
+        r->err = -ENODATA;
+        r->ptr = r->end;
+        return NULL;
+    }
+
+    r->ptr += size;
+    return r->ptr - size;
+}
+
+static inline int nxparcel_read_u16_at(nxparcel_reader* r, uint16_t* val)
+{
+    const uint8_t* p = nxparcel_reader_take(r, 2);
+
+    if (p == NULL) {
+        return -ENODATA;
+    }
+
+    *val = (uint16_t)((p[0] << 8) | p[1]);
+    return 0;
+}
+
+static inline int nxparcel_read_u32_at(nxparcel_reader* r, uint32_t* val)
+{
+    const uint8_t* p = nxparcel_reader_take(r, 4);
+
+    if (p == NULL) {
+        return -ENODATA;
+    }
+
+    *val = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    return 0;
+}
+
+static inline int nxparcel_read_u64_at(nxparcel_reader* r, uint64_t* val)
+{
+    uint32_t hi;
+    uint32_t lo;
+
+    if (nxparcel_read_u32_at(r, &hi) != 0 || nxparcel_read_u32_at(r, &lo) != 0) {
+        return -ENODATA;
+    }
+
+    *val = ((uint64_t)hi << 32) | lo;
+    return 0;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,22 @@ nni_plat_clock(void)
 	return (msec);
 }
 
+uint64_t
+nni_plat_clock_us(void)
+{
+	struct timespec ts;
+	uint64_t        usec;
+
+	if (clock_gettime(NNG_USE_CLOCKID, &ts) != 0) {
+		nni_panic("clock_gettime failed: %s", strerror(errno));
+	}
+
+	usec = ts.tv_sec;
+	usec *= 1000000;
+	usec += (ts.tv_nsec / 1000);
+	return (usec);
+}
+
 void
 nni_plat_sleep(nni_duration ms)
 {
@@ -85,6 +101,23 @@ nni_plat_clock(void)
 	return (ms);
 }
 
+uint64_t
+nni_plat_clock_us(void)
+{
+	uint64_t usec;
+
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL) != 0) {
+		nni_panic("gettimeofday failed: %s", strerror(errno));
+	}
+
+	usec = tv.tv_sec;
+	usec *= 1000000;
+	usec += tv.tv_usec;
+	return (usec);
+}
+
 void
 nni_plat_sleep(nni_duration ms)
 {
@@ -27,6 +27,10 @@
 #include <sys/file.h>
 #endif
 
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0u
+#endif
+
 // File support.
 
 static int
@@ -114,7 +118,12 @@ nni_plat_file_get(const char *name, void **datap, size_t *lenp)
 		return (rv);
 	}
 
-	len = st.st_size;
+	if ((uint64_t) st.st_size > SIZE_MAX) {
+		// Too large to hold in memory here.
+		rv = NNG_ENOMEM;
+		goto done;
+	}
+	len = (size_t) st.st_size;
 	if (len > 0) {
 		if ((data = nni_alloc(len)) == NULL) {
 			rv = NNG_ENOMEM;
@@ -135,6 +144,92 @@ done:
 	return (rv);
 }
 
+int
+nni_plat_file_open(const char *name, nni_plat_fh *fh, uint64_t *sizep)
+{
+	int         fd;
+	struct stat st;
+	int         rv;
+
+	if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+		return (nni_plat_errno(errno));
+	}
+	if (fstat(fd, &st) != 0) {
+		rv = nni_plat_errno(errno);
+		(void) close(fd);
+		return (rv);
+	}
+	if (!S_ISREG(st.st_mode)) {
+		(void) close(fd);
+		return (NNG_ENOTSUP);
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	// Files are mostly read front to back, so read ahead.
+	(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	fh->fd = fd;
+	*sizep = (uint64_t) st.st_size;
+	return (0);
+}
+
+int
+nni_plat_file_pread(
+    nni_plat_fh *fh, void *buf, size_t len, uint64_t off, size_t *np)
+{
+	size_t  n = 0;
+	ssize_t rv;
+
+	while (n < len) {
+		rv = pread(
+		    fh->fd, (char *) buf + n, len - n, (off_t) (off + n));
+		if (rv < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (nni_plat_errno(errno));
+		}
+		if (rv == 0) {
+			break; // end of file
+		}
+		n += (size_t) rv;
+	}
+	*np = n;
+	return (0);
+}
+
+void
+nni_plat_file_close(nni_plat_fh *fh)
+{
+	(void) close(fh->fd);
+	fh->fd = -1;
+}
+
+int
+nni_plat_file_info(
+    const char *name, uint64_t *sizep, uint64_t *mtimep, uint64_t *idp)
+{
+	struct stat st;
+	uint64_t    ns;
+
+	if (stat(name, &st) != 0) {
+		return (nni_plat_errno(errno));
+	}
+	if (!S_ISREG(st.st_mode)) {
+		return (NNG_ENOTSUP);
+	}
+#if defined(NNG_HAVE_STAT_MTIM)
+	ns = (uint64_t) st.st_mtim.tv_nsec;
+#elif defined(NNG_HAVE_STAT_MTIMESPEC)
+	ns = (uint64_t) st.st_mtimespec.tv_nsec;
+#else
+	ns = 0;
+#endif
+	*sizep  = (uint64_t) st.st_size;
+	*mtimep = (uint64_t) st.st_mtime * 1000000000u + ns;
+	*idp    = (uint64_t) st.st_ino;
+	return (0);
+}
+
 // nni_plat_file_delete deletes the named file or directory.
 int
 nni_plat_file_delete(const char *name)
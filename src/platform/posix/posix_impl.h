@@ -69,10 +69,18 @@ struct nni_plat_thr {
 	void *arg;
 };
 
+struct nni_plat_tls {
+	pthread_key_t key;
+};
+
 struct nni_plat_flock {
 	int fd;
 };
 
+struct nni_plat_fh {
+	int fd;
+};
+
 #define NNG_PLATFORM_DIR_SEP "/"
 
 #ifdef NNG_HAVE_STDATOMIC
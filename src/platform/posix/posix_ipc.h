@@ -20,6 +20,9 @@
 
 #include <sys/types.h> // For mode_t
 
+// Maximum number of descriptors passed with a single write or read.
+#define NNI_IPC_MAX_FDS 4
+
 struct nni_ipc_conn {
 	nng_stream      stream;
 	nni_posix_pfd * pfd;
@@ -30,6 +33,11 @@ struct nni_ipc_conn {
 	nni_aio *       dial_aio;
 	nni_ipc_dialer *dialer;
 	nni_reap_item   reap;
+	bool            wantfds;
+	int             nsendfds;
+	int             nrecvfds;
+	int             sendfds[NNI_IPC_MAX_FDS];
+	int             recvfds[NNI_IPC_MAX_FDS];
 };
 
 struct nni_ipc_dialer {
@@ -47,6 +55,17 @@ extern void nni_posix_ipc_init(nni_ipc_conn *, nni_posix_pfd *);
 extern void nni_posix_ipc_start(nni_ipc_conn *);
 extern void nni_posix_ipc_dialer_rele(nni_ipc_dialer *);
 
+// Descriptor passing (SCM_RIGHTS).  nni_posix_ipc_send_fds attaches the
+// descriptors to the next write on the connection; the caller must keep
+// them open until that write completes.  Received descriptors are only
+// kept after nni_posix_ipc_want_fds has been called (otherwise they are
+// discarded by the kernel), and nni_posix_ipc_take_fds transfers them to
+// the caller, returning how many there were.  Any that are never taken
+// are closed with the connection.
+extern int  nni_posix_ipc_send_fds(nni_ipc_conn *, const int *, int);
+extern void nni_posix_ipc_want_fds(nni_ipc_conn *);
+extern int  nni_posix_ipc_take_fds(nni_ipc_conn *, int *, int);
+
 #endif // NNG_PLATFORM_POSIX
 
 #endif // PLATFORM_POSIX_IPC_H
\ No newline at end of file
@@ -19,6 +19,7 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <sys/un.h>
+#include <unistd.h>
 #if defined(NNG_HAVE_GETPEERUCRED)
 #include <ucred.h>
 #elif defined(NNG_HAVE_LOCALPEERCRED) || defined(NNG_HAVE_SOCKPEERCRED)
@@ -26,7 +27,6 @@
 #endif
 #if defined(NNG_HAVE_GETPEEREID)
 #include <sys/types.h>
-#include <unistd.h>
 #endif
 
 #ifndef MSG_NOSIGNAL
@@ -38,7 +38,7 @@
 typedef struct nni_ipc_conn ipc_conn;
 
 static void
-ipc_dowrite(ipc_conn *c)
+ipc_dowrite(ipc_conn *c, nni_aio_completions *done)
 {
 	nni_aio *aio;
 	int      fd;
@@ -55,6 +55,9 @@ ipc_dowrite(ipc_conn *c)
 		nni_iov *     aiov;
 		struct msghdr hdr;
 		struct iovec  iovec[16];
+#ifdef SCM_RIGHTS
+		char cmsg[CMSG_SPACE(NNI_IPC_MAX_FDS * sizeof(int))];
+#endif
 
 		memset(&hdr, 0, sizeof(hdr));
 		nni_aio_get_iov(aio, &naiov, &aiov);
@@ -75,6 +78,21 @@ ipc_dowrite(ipc_conn *c)
 
 		hdr.msg_iovlen = niov;
 		hdr.msg_iov    = iovec;
+#ifdef SCM_RIGHTS
+		if (c->nsendfds > 0) {
+			struct cmsghdr *cm;
+			size_t          len = c->nsendfds * sizeof(int);
+
+			memset(cmsg, 0, sizeof(cmsg));
+			hdr.msg_control    = cmsg;
+			hdr.msg_controllen = CMSG_SPACE(len);
+			cm                 = CMSG_FIRSTHDR(&hdr);
+			cm->cmsg_level     = SOL_SOCKET;
+			cm->cmsg_type      = SCM_RIGHTS;
+			cm->cmsg_len       = CMSG_LEN(len);
+			memcpy(CMSG_DATA(cm), c->sendfds, len);
+		}
+#endif
 
 		if ((n = sendmsg(fd, &hdr, MSG_NOSIGNAL)) < 0) {
 			switch (errno) {
@@ -95,19 +113,79 @@ ipc_dowrite(ipc_conn *c)
 			}
 		}
 
+		// Descriptors go out with the first byte.
+		c->nsendfds = 0;
+
 		nni_aio_bump_count(aio, n);
 		// We completed the entire operation on this aio.
 		// (Sendmsg never returns a partial result.)
 		nni_aio_list_remove(aio);
-		nni_aio_finish(aio, 0, nni_aio_count(aio));
+		if (done != NULL) {
+			nni_aio_completions_add(
+			    done, aio, 0, nni_aio_count(aio));
+		} else {
+			nni_aio_finish(aio, 0, nni_aio_count(aio));
+		}
 
 		// Go back to start of loop to see if there is another
 		// aio ready for us to process.
 	}
 }
 
+#ifdef SCM_RIGHTS
+static int
+ipc_recvfds(ipc_conn *c, int fd, struct iovec *iov, int niov)
+{
+	struct msghdr   hdr;
+	struct cmsghdr *cm;
+	char            cmsg[CMSG_SPACE(NNI_IPC_MAX_FDS * sizeof(int))];
+	int             flags = 0;
+	int             n;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov        = iov;
+	hdr.msg_iovlen     = niov;
+	hdr.msg_control    = cmsg;
+	hdr.msg_controllen = sizeof(cmsg);
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	if ((n = recvmsg(fd, &hdr, flags)) <= 0) {
+		return (n);
+	}
+	for (cm = CMSG_FIRSTHDR(&hdr); cm != NULL;
+	     cm = CMSG_NXTHDR(&hdr, cm)) {
+		int    fds[NNI_IPC_MAX_FDS];
+		size_t cnt;
+
+		if ((cm->cmsg_level != SOL_SOCKET) ||
+		    (cm->cmsg_type != SCM_RIGHTS)) {
+			continue;
+		}
+		cnt = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cm), cnt * sizeof(int));
+		for (size_t i = 0; i < cnt; i++) {
+			if (c->nrecvfds < NNI_IPC_MAX_FDS) {
+				c->recvfds[c->nrecvfds++] = fds[i];
+			} else {
+				(void) close(fds[i]);
+			}
+		}
+	}
+	return (n);
+}
+#else
+static int
+ipc_recvfds(ipc_conn *c, int fd, struct iovec *iov, int niov)
+{
+	NNI_ARG_UNUSED(c);
+	return (readv(fd, iov, niov));
+}
+#endif
+
 static void
-ipc_doread(ipc_conn *c)
+ipc_doread(ipc_conn *c, nni_aio_completions *done)
 {
 	nni_aio *aio;
 	int      fd;
@@ -138,7 +216,12 @@ ipc_doread(ipc_conn *c)
 			}
 		}
 
-		if ((n = readv(fd, iovec, niov)) < 0) {
+		if (c->wantfds) {
+			n = ipc_recvfds(c, fd, iovec, niov);
+		} else {
+			n = readv(fd, iovec, niov);
+		}
+		if (n < 0) {
 			switch (errno) {
 			case EINTR:
 				continue;
@@ -164,7 +247,12 @@ ipc_doread(ipc_conn *c)
 
 		// We completed the entire operation on this aio.
 		nni_aio_list_remove(aio);
-		nni_aio_finish(aio, 0, nni_aio_count(aio));
+		if (done != NULL) {
+			nni_aio_completions_add(
+			    done, aio, 0, nni_aio_count(aio));
+		} else {
+			nni_aio_finish(aio, 0, nni_aio_count(aio));
+		}
 
 		// Go back to start of loop to see if there is another
 		// aio ready for us to process.
@@ -210,18 +298,20 @@ ipc_close(void *arg)
 static void
 ipc_cb(nni_posix_pfd *pfd, unsigned events, void *arg)
 {
-	ipc_conn *c = arg;
+	ipc_conn *         c = arg;
+	nni_aio_completions done;
 
 	if (events & (NNI_POLL_HUP | NNI_POLL_ERR | NNI_POLL_INVAL)) {
 		ipc_error(c, NNG_ECONNSHUT);
 		return;
 	}
+	nni_aio_completions_init(&done);
 	nni_mtx_lock(&c->mtx);
 	if ((events & NNI_POLL_IN) != 0) {
-		ipc_doread(c);
+		ipc_doread(c, &done);
 	}
 	if ((events & NNI_POLL_OUT) != 0) {
-		ipc_dowrite(c);
+		ipc_dowrite(c, &done);
 	}
 	events = 0;
 	if (!nni_list_empty(&c->writeq)) {
@@ -234,6 +324,10 @@ ipc_cb(nni_posix_pfd *pfd, unsigned events, void *arg)
 		nni_posix_pfd_arm(pfd, events);
 	}
 	nni_mtx_unlock(&c->mtx);
+
+	// We hold no locks here, so those consumers that allow it can have
+	// their callbacks run right here on the poller thread.
+	nni_aio_completions_run(&done);
 }
 
 static void
@@ -268,7 +362,7 @@ ipc_send(void *arg, nni_aio *aio)
 	nni_aio_list_append(&c->writeq, aio);
 
 	if (nni_list_first(&c->writeq) == aio) {
-		ipc_dowrite(c);
+		ipc_dowrite(c, NULL);
 		// If we are still the first thing on the list, that
 		// means we didn't finish the job, so arm the poller to
 		// complete us.
@@ -302,7 +396,7 @@ ipc_recv(void *arg, nni_aio *aio)
 	// many cases.  We also need not arm a list if it was already
 	// armed.
 	if (nni_list_first(&c->readq) == aio) {
-		ipc_doread(c);
+		ipc_doread(c, NULL);
 		// If we are still the first thing on the list, that
 		// means we didn't finish the job, so arm the poller to
 		// complete us.
@@ -492,6 +586,9 @@ ipc_reap(void *arg)
 	if (c->pfd != NULL) {
 		nni_posix_pfd_fini(c->pfd);
 	}
+	for (int i = 0; i < c->nrecvfds; i++) {
+		(void) close(c->recvfds[i]);
+	}
 	nni_mtx_fini(&c->mtx);
 
 	if (c->dialer != NULL) {
@@ -583,3 +680,45 @@ nni_posix_ipc_init(nni_ipc_conn *c, nni_posix_pfd *pfd)
 {
 	c->pfd = pfd;
 }
+
+int
+nni_posix_ipc_send_fds(nni_ipc_conn *c, const int *fds, int n)
+{
+#ifdef SCM_RIGHTS
+	if ((n < 0) || (n > NNI_IPC_MAX_FDS)) {
+		return (NNG_EINVAL);
+	}
+	nni_mtx_lock(&c->mtx);
+	memcpy(c->sendfds, fds, n * sizeof(int));
+	c->nsendfds = n;
+	nni_mtx_unlock(&c->mtx);
+	return (0);
+#else
+	NNI_ARG_UNUSED(c);
+	NNI_ARG_UNUSED(fds);
+	NNI_ARG_UNUSED(n);
+	return (NNG_ENOTSUP);
+#endif
+}
+
+void
+nni_posix_ipc_want_fds(nni_ipc_conn *c)
+{
+	nni_mtx_lock(&c->mtx);
+	c->wantfds = true;
+	nni_mtx_unlock(&c->mtx);
+}
+
+int
+nni_posix_ipc_take_fds(nni_ipc_conn *c, int *fds, int max)
+{
+	int n;
+
+	nni_mtx_lock(&c->mtx);
+	n = c->nrecvfds < max ? c->nrecvfds : max;
+	memcpy(fds, c->recvfds, n * sizeof(int));
+	c->nrecvfds -= n;
+	memmove(c->recvfds, c->recvfds + n, c->nrecvfds * sizeof(int));
+	nni_mtx_unlock(&c->mtx);
+	return (n);
+}
@@ -34,6 +34,13 @@ typedef struct nni_posix_pollq nni_posix_pollq;
 
 #define NNI_MAX_EPOLL_EVENTS 64
 
+// NNG_MAX_POLLER_THREADS bounds the number of pollq shards we will create
+// when sizing from the number of CPUs.  NNG_NUM_POLLER_THREADS, if defined,
+// fixes the number of shards outright.
+#ifndef NNG_MAX_POLLER_THREADS
+#define NNG_MAX_POLLER_THREADS 8
+#endif
+
 // flags we always want enabled as long as at least one event is active
 #define NNI_EPOLL_FLAGS ((unsigned) EPOLLONESHOT | (unsigned) EPOLLERR)
 
@@ -48,6 +55,14 @@ typedef struct nni_posix_pollq nni_posix_pollq;
 // The pfd mutex protects the pfd's own "closing" flag (test and set),
 // the callback and arg, and its event mask.  This mutex is used a lot,
 // but it should be uncontended excepting possibly when closing.
+//
+// Sharding:
+//
+// We run several independent pollqs, each with its own epoll handle,
+// worker thread, event fd, and reap queue.  A pfd is bound to exactly
+// one pollq for its entire life, chosen when it is created, so there
+// is no state shared between the shards.  This lets readiness events
+// for different descriptors be processed on different cores.
 
 // nni_posix_pollq is a work structure that manages state for the epoll-based
 // pollq implementation
@@ -74,8 +89,17 @@ struct nni_posix_pfd {
 	nni_cv           cv;
 };
 
-// single global instance for now.
-static nni_posix_pollq nni_posix_global_pollq;
+static nni_posix_pollq *nni_posix_pollqs;
+static int              nni_posix_npollq;
+
+static nni_posix_pollq *
+nni_posix_pollq_get(int fd)
+{
+	// Descriptors are allocated densely by the kernel, so simply
+	// spreading them by their value keeps the shards balanced without
+	// needing any shared state.
+	return (&nni_posix_pollqs[(unsigned) fd % (unsigned) nni_posix_npollq]);
+}
 
 int
 nni_posix_pfd_init(nni_posix_pfd **pfdp, int fd)
@@ -85,7 +109,7 @@ nni_posix_pfd_init(nni_posix_pfd **pfdp, int fd)
 	struct epoll_event ev;
 	int                rv;
 
-	pq = &nni_posix_global_pollq;
+	pq = nni_posix_pollq_get(fd);
 
 	(void) fcntl(fd, F_SETFD, FD_CLOEXEC);
 	(void) fcntl(fd, F_SETFL, O_NONBLOCK);
@@ -388,13 +412,54 @@ nni_posix_pollq_create(nni_posix_pollq *pq)
 int
 nni_posix_pollq_sysinit(void)
 {
-	return (nni_posix_pollq_create(&nni_posix_global_pollq));
+	int n;
+	int rv;
+
+#ifndef NNG_NUM_POLLER_THREADS
+	n = nni_plat_ncpu();
+#if NNG_MAX_POLLER_THREADS > 0
+	if (n > NNG_MAX_POLLER_THREADS) {
+		n = NNG_MAX_POLLER_THREADS;
+	}
+#endif
+#else
+	n = NNG_NUM_POLLER_THREADS;
+#endif
+	if (n < 1) {
+		n = 1;
+	}
+
+	if ((nni_posix_pollqs = NNI_ALLOC_STRUCTS(nni_posix_pollqs, n)) ==
+	    NULL) {
+		return (NNG_ENOMEM);
+	}
+	for (int i = 0; i < n; i++) {
+		if ((rv = nni_posix_pollq_create(&nni_posix_pollqs[i])) != 0) {
+			while (i > 0) {
+				i--;
+				nni_posix_pollq_destroy(&nni_posix_pollqs[i]);
+			}
+			NNI_FREE_STRUCTS(nni_posix_pollqs, n);
+			nni_posix_pollqs = NULL;
+			return (rv);
+		}
+	}
+	nni_posix_npollq = n;
+	return (0);
 }
 
 void
 nni_posix_pollq_sysfini(void)
 {
-	nni_posix_pollq_destroy(&nni_posix_global_pollq);
+	if (nni_posix_pollqs == NULL) {
+		return;
+	}
+	for (int i = 0; i < nni_posix_npollq; i++) {
+		nni_posix_pollq_destroy(&nni_posix_pollqs[i]);
+	}
+	NNI_FREE_STRUCTS(nni_posix_pollqs, nni_posix_npollq);
+	nni_posix_pollqs = NULL;
+	nni_posix_npollq = 0;
 }
 
 #endif // NNG_HAVE_EPOLL
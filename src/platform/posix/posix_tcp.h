@@ -33,6 +33,7 @@ struct nni_tcp_dialer {
 	bool                    closed;
 	bool                    nodelay;
 	bool                    keepalive;
+	int                     busypoll;
 	struct sockaddr_storage src;
 	size_t                  srclen;
 	nni_mtx                 mtx;
@@ -42,7 +43,7 @@ struct nni_tcp_dialer {
 
 extern int  nni_posix_tcp_alloc(nni_tcp_conn **, nni_tcp_dialer *);
 extern void nni_posix_tcp_init(nni_tcp_conn *, nni_posix_pfd *);
-extern void nni_posix_tcp_start(nni_tcp_conn *, int, int);
+extern void nni_posix_tcp_start(nni_tcp_conn *, int, int, int);
 extern void nni_posix_tcp_dialer_rele(nni_tcp_dialer *);
 
 #endif // PLATFORM_POSIX_TCP_H
\ No newline at end of file
@@ -28,7 +28,7 @@
 #include "posix_tcp.h"
 
 static void
-tcp_dowrite(nni_tcp_conn *c)
+tcp_dowrite(nni_tcp_conn *c, nni_aio_completions *done)
 {
 	nni_aio *aio;
 	int      fd;
@@ -89,7 +89,12 @@ tcp_dowrite(nni_tcp_conn *c)
 		// We completed the entire operation on this aio.
 		// (Sendmsg never returns a partial result.)
 		nni_aio_list_remove(aio);
-		nni_aio_finish(aio, 0, nni_aio_count(aio));
+		if (done != NULL) {
+			nni_aio_completions_add(
+			    done, aio, 0, nni_aio_count(aio));
+		} else {
+			nni_aio_finish(aio, 0, nni_aio_count(aio));
+		}
 
 		// Go back to start of loop to see if there is another
 		// aio ready for us to process.
@@ -97,7 +102,7 @@ tcp_dowrite(nni_tcp_conn *c)
 }
 
 static void
-tcp_doread(nni_tcp_conn *c)
+tcp_doread(nni_tcp_conn *c, nni_aio_completions *done)
 {
 	nni_aio *aio;
 	int      fd;
@@ -154,7 +159,12 @@ tcp_doread(nni_tcp_conn *c)
 
 		// We completed the entire operation on this aio.
 		nni_aio_list_remove(aio);
-		nni_aio_finish(aio, 0, nni_aio_count(aio));
+		if (done != NULL) {
+			nni_aio_completions_add(
+			    done, aio, 0, nni_aio_count(aio));
+		} else {
+			nni_aio_finish(aio, 0, nni_aio_count(aio));
+		}
 
 		// Go back to start of loop to see if there is another
 		// aio ready for us to process.
@@ -227,18 +237,20 @@ tcp_free(void *arg)
 static void
 tcp_cb(nni_posix_pfd *pfd, unsigned events, void *arg)
 {
-	nni_tcp_conn *c = arg;
+	nni_tcp_conn *      c = arg;
+	nni_aio_completions done;
 
 	if (events & (NNI_POLL_HUP | NNI_POLL_ERR | NNI_POLL_INVAL)) {
 		tcp_error(c, NNG_ECONNSHUT);
 		return;
 	}
+	nni_aio_completions_init(&done);
 	nni_mtx_lock(&c->mtx);
 	if ((events & NNI_POLL_IN) != 0) {
-		tcp_doread(c);
+		tcp_doread(c, &done);
 	}
 	if ((events & NNI_POLL_OUT) != 0) {
-		tcp_dowrite(c);
+		tcp_dowrite(c, &done);
 	}
 	events = 0;
 	if (!nni_list_empty(&c->writeq)) {
@@ -251,6 +263,10 @@ tcp_cb(nni_posix_pfd *pfd, unsigned events, void *arg)
 		nni_posix_pfd_arm(pfd, events);
 	}
 	nni_mtx_unlock(&c->mtx);
+
+	// We hold no locks here, so those consumers that allow it can have
+	// their callbacks run right here on the poller thread.
+	nni_aio_completions_run(&done);
 }
 
 static void
@@ -285,7 +301,7 @@ tcp_send(void *arg, nni_aio *aio)
 	nni_aio_list_append(&c->writeq, aio);
 
 	if (nni_list_first(&c->writeq) == aio) {
-		tcp_dowrite(c);
+		tcp_dowrite(c, NULL);
 		// If we are still the first thing on the list, that
 		// means we didn't finish the job, so arm the poller to
 		// complete us.
@@ -319,7 +335,7 @@ tcp_recv(void *arg, nni_aio *aio)
 	// many cases.  We also need not arm a list if it was already
 	// armed.
 	if (nni_list_first(&c->readq) == aio) {
-		tcp_doread(c);
+		tcp_doread(c, NULL);
 		// If we are still the first thing on the list, that
 		// means we didn't finish the job, so arm the poller to
 		// complete us.
@@ -509,13 +525,23 @@ nni_posix_tcp_init(nni_tcp_conn *c, nni_posix_pfd *pfd)
 }
 
 void
-nni_posix_tcp_start(nni_tcp_conn *c, int nodelay, int keepalive)
+nni_posix_tcp_start(nni_tcp_conn *c, int nodelay, int keepalive, int busypoll)
 {
 	// Configure the initial socket options.
 	(void) setsockopt(nni_posix_pfd_fd(c->pfd), IPPROTO_TCP, TCP_NODELAY,
 	    &nodelay, sizeof(int));
 	(void) setsockopt(nni_posix_pfd_fd(c->pfd), SOL_SOCKET, SO_KEEPALIVE,
 	    &keepalive, sizeof(int));
+#ifdef SO_BUSY_POLL
+	if (busypoll > 0) {
+		// Raising this past the system default needs privileges,
+		// so this is only a best effort.
+		(void) setsockopt(nni_posix_pfd_fd(c->pfd), SOL_SOCKET,
+		    SO_BUSY_POLL, &busypoll, sizeof(int));
+	}
+#else
+	NNI_ARG_UNUSED(busypoll);
+#endif
 
 	nni_posix_pfd_set_cb(c->pfd, tcp_cb, c);
 }
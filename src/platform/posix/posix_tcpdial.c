@@ -119,6 +119,7 @@ tcp_dialer_cb(nni_posix_pfd *pfd, unsigned ev, void *arg)
 	int             rv;
 	int             ka;
 	int             nd;
+	int             bp;
 
 	nni_mtx_lock(&d->mtx);
 	aio = c->dial_aio;
@@ -151,6 +152,7 @@ tcp_dialer_cb(nni_posix_pfd *pfd, unsigned ev, void *arg)
 	nni_aio_set_prov_extra(aio, 0, NULL);
 	nd = d->nodelay ? 1 : 0;
 	ka = d->keepalive ? 1 : 0;
+	bp = d->busypoll;
 
 	nni_mtx_unlock(&d->mtx);
 
@@ -161,7 +163,7 @@ tcp_dialer_cb(nni_posix_pfd *pfd, unsigned ev, void *arg)
 		return;
 	}
 
-	nni_posix_tcp_start(c, nd, ka);
+	nni_posix_tcp_start(c, nd, ka, bp);
 	nni_aio_set_output(aio, 0, c);
 	nni_aio_finish(aio, 0, 0);
 }
@@ -179,6 +181,7 @@ nni_tcp_dial(nni_tcp_dialer *d, nni_aio *aio)
 	int                     rv;
 	int                     ka;
 	int                     nd;
+	int                     bp;
 	nng_sockaddr            sa;
 
 	if (nni_aio_begin(aio) != 0) {
@@ -249,8 +252,9 @@ nni_tcp_dial(nni_tcp_dialer *d, nni_aio *aio)
 	nni_aio_set_prov_extra(aio, 0, NULL);
 	nd = d->nodelay ? 1 : 0;
 	ka = d->keepalive ? 1 : 0;
+	bp = d->busypoll;
 	nni_mtx_unlock(&d->mtx);
-	nni_posix_tcp_start(c, nd, ka);
+	nni_posix_tcp_start(c, nd, ka, bp);
 	nni_aio_set_output(aio, 0, c);
 	nni_aio_finish(aio, 0, 0);
 	return;
@@ -289,6 +293,34 @@ tcp_dialer_get_nodelay(void *arg, void *buf, size_t *szp, nni_type t)
 	return (nni_copyout_bool(b, buf, szp, t));
 }
 
+static int
+tcp_dialer_set_busypoll(void *arg, const void *buf, size_t sz, nni_type t)
+{
+	nni_tcp_dialer *d = arg;
+	int             rv;
+	int             usec;
+
+	if (((rv = nni_copyin_int(&usec, buf, sz, 0, 1000000, t)) != 0) ||
+	    (d == NULL)) {
+		return (rv);
+	}
+	nni_mtx_lock(&d->mtx);
+	d->busypoll = usec;
+	nni_mtx_unlock(&d->mtx);
+	return (0);
+}
+
+static int
+tcp_dialer_get_busypoll(void *arg, void *buf, size_t *szp, nni_type t)
+{
+	int             usec;
+	nni_tcp_dialer *d = arg;
+	nni_mtx_lock(&d->mtx);
+	usec = d->busypoll;
+	nni_mtx_unlock(&d->mtx);
+	return (nni_copyout_int(usec, buf, szp, t));
+}
+
 static int
 tcp_dialer_set_keepalive(void *arg, const void *buf, size_t sz, nni_type t)
 {
@@ -394,6 +426,11 @@ static const nni_option tcp_dialer_options[] = {
 	    .o_get  = tcp_dialer_get_keepalive,
 	    .o_set  = tcp_dialer_set_keepalive,
 	},
+	{
+	    .o_name = NNG_OPT_TCP_BUSYPOLL,
+	    .o_get  = tcp_dialer_get_busypoll,
+	    .o_set  = tcp_dialer_set_busypoll,
+	},
 	{
 	    .o_name = NULL,
 	},
@@ -36,6 +36,7 @@ struct nni_tcp_listener {
 	bool           closed;
 	bool           nodelay;
 	bool           keepalive;
+	int            busypoll;
 	nni_mtx        mtx;
 };
 
@@ -93,6 +94,7 @@ tcp_listener_doaccept(nni_tcp_listener *l)
 		int            rv;
 		int            nd;
 		int            ka;
+		int            bp;
 		nni_posix_pfd *pfd;
 		nni_tcp_conn * c;
 
@@ -155,8 +157,9 @@ tcp_listener_doaccept(nni_tcp_listener *l)
 
 		ka = l->keepalive ? 1 : 0;
 		nd = l->nodelay ? 1 : 0;
+		bp = l->busypoll;
 		nni_aio_list_remove(aio);
-		nni_posix_tcp_start(c, nd, ka);
+		nni_posix_tcp_start(c, nd, ka, bp);
 		nni_aio_set_output(aio, 0, c);
 		nni_aio_finish(aio, 0, 0);
 	}
@@ -368,6 +371,34 @@ tcp_listener_get_nodelay(void *arg, void *buf, size_t *szp, nni_type t)
 	return (nni_copyout_bool(b, buf, szp, t));
 }
 
+static int
+tcp_listener_set_busypoll(void *arg, const void *buf, size_t sz, nni_type t)
+{
+	nni_tcp_listener *l = arg;
+	int               rv;
+	int               usec;
+
+	if (((rv = nni_copyin_int(&usec, buf, sz, 0, 1000000, t)) != 0) ||
+	    (l == NULL)) {
+		return (rv);
+	}
+	nni_mtx_lock(&l->mtx);
+	l->busypoll = usec;
+	nni_mtx_unlock(&l->mtx);
+	return (0);
+}
+
+static int
+tcp_listener_get_busypoll(void *arg, void *buf, size_t *szp, nni_type t)
+{
+	int               usec;
+	nni_tcp_listener *l = arg;
+	nni_mtx_lock(&l->mtx);
+	usec = l->busypoll;
+	nni_mtx_unlock(&l->mtx);
+	return (nni_copyout_int(usec, buf, szp, t));
+}
+
 static int
 tcp_listener_set_keepalive(void *arg, const void *buf, size_t sz, nni_type t)
 {
@@ -410,6 +441,11 @@ static const nni_option tcp_listener_options[] = {
 	    .o_set  = tcp_listener_set_keepalive,
 	    .o_get  = tcp_listener_get_keepalive,
 	},
+	{
+	    .o_name = NNG_OPT_TCP_BUSYPOLL,
+	    .o_set  = tcp_listener_set_busypoll,
+	    .o_get  = tcp_listener_get_busypoll,
+	},
 	{
 	    .o_name = NULL,
 	},
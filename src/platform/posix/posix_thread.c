@@ -253,6 +253,33 @@ nni_plat_thr_is_self(nni_plat_thr *thr)
 	return (pthread_self() == thr->tid);
 }
 
+int
+nni_plat_tls_init(nni_plat_tls *tls, void (*dtor)(void *))
+{
+	if (pthread_key_create(&tls->key, dtor) != 0) {
+		return (NNG_ENOMEM);
+	}
+	return (0);
+}
+
+void
+nni_plat_tls_fini(nni_plat_tls *tls)
+{
+	(void) pthread_key_delete(tls->key);
+}
+
+void
+nni_plat_tls_set(nni_plat_tls *tls, void *val)
+{
+	(void) pthread_setspecific(tls->key, val);
+}
+
+void *
+nni_plat_tls_get(nni_plat_tls *tls)
+{
+	return (pthread_getspecific(tls->key));
+}
+
 void
 nni_atfork_child(void)
 {
@@ -19,6 +19,22 @@ nni_plat_clock(void)
 	return (GetTickCount64());
 }
 
+uint64_t
+nni_plat_clock_us(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER        now;
+
+	// The frequency is fixed at boot, so racing to set it is harmless.
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&now);
+	return ((uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+	    (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 /
+	        freq.QuadPart);
+}
+
 void
 nni_plat_sleep(nni_duration dur)
 {
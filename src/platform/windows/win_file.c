@@ -16,6 +16,7 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // File support.
 
@@ -164,6 +165,108 @@ done:
 	return (rv);
 }
 
+int
+nni_plat_file_open(const char *name, nni_plat_fh *fh, uint64_t *sizep)
+{
+	int           rv;
+	HANDLE        h;
+	LARGE_INTEGER sz;
+
+	h = CreateFile(name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+	    NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (h == INVALID_HANDLE_VALUE) {
+		return (nni_win_error(GetLastError()));
+	}
+	if (GetFileType(h) != FILE_TYPE_DISK) {
+		(void) CloseHandle(h);
+		return (NNG_ENOTSUP);
+	}
+	if (!GetFileSizeEx(h, &sz)) {
+		rv = nni_win_error(GetLastError());
+		(void) CloseHandle(h);
+		return (rv);
+	}
+	fh->h  = h;
+	*sizep = (uint64_t) sz.QuadPart;
+	return (0);
+}
+
+int
+nni_plat_file_pread(
+    nni_plat_fh *fh, void *buf, size_t len, uint64_t off, size_t *np)
+{
+	size_t n = 0;
+
+	while (n < len) {
+		OVERLAPPED ov;
+		DWORD      want;
+		DWORD      got;
+
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset     = (DWORD) (off + n);
+		ov.OffsetHigh = (DWORD) ((off + n) >> 32);
+		want = (DWORD) ((len - n) > 0x40000000u ? 0x40000000u
+		                                        : (len - n));
+		if (!ReadFile(fh->h, (char *) buf + n, want, &got, &ov)) {
+			DWORD err = GetLastError();
+			if (err == ERROR_HANDLE_EOF) {
+				break;
+			}
+			return (nni_win_error(err));
+		}
+		if (got == 0) {
+			break; // end of file
+		}
+		n += got;
+	}
+	*np = n;
+	return (0);
+}
+
+void
+nni_plat_file_close(nni_plat_fh *fh)
+{
+	(void) CloseHandle(fh->h);
+	fh->h = INVALID_HANDLE_VALUE;
+}
+
+int
+nni_plat_file_info(
+    const char *name, uint64_t *sizep, uint64_t *mtimep, uint64_t *idp)
+{
+	HANDLE                     h;
+	BY_HANDLE_FILE_INFORMATION fi;
+	uint64_t                   t;
+	int                        rv;
+
+	// No access is needed to read the attributes, and backup semantics
+	// lets this open directories, so that they can be told apart.
+	h = CreateFile(name, 0,
+	    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+	    OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (h == INVALID_HANDLE_VALUE) {
+		return (nni_win_error(GetLastError()));
+	}
+	if (!GetFileInformationByHandle(h, &fi)) {
+		rv = nni_win_error(GetLastError());
+		(void) CloseHandle(h);
+		return (rv);
+	}
+	(void) CloseHandle(h);
+	if ((fi.dwFileAttributes &
+	        (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) != 0) {
+		return (NNG_ENOTSUP);
+	}
+	*sizep = ((uint64_t) fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+	*idp   = ((uint64_t) fi.nFileIndexHigh << 32) | fi.nFileIndexLow;
+
+	// File times count 100ns intervals since 1601.
+	t = ((uint64_t) fi.ftLastWriteTime.dwHighDateTime << 32) |
+	    fi.ftLastWriteTime.dwLowDateTime;
+	*mtimep = (t - 116444736000000000ull) * 100;
+	return (0);
+}
+
 // nni_plat_file_delete deletes the named file.
 int
 nni_plat_file_delete(const char *name)
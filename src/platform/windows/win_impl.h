@@ -35,6 +35,10 @@ struct nni_plat_thr {
 	DWORD  id;
 };
 
+struct nni_plat_tls {
+	DWORD index;
+};
+
 struct nni_plat_mtx {
 	SRWLOCK srl;
 	DWORD   owner;
@@ -81,6 +85,10 @@ struct nni_plat_flock {
 	HANDLE h;
 };
 
+struct nni_plat_fh {
+	HANDLE h;
+};
+
 extern int nni_win_error(int);
 
 extern int nni_win_tcp_conn_init(nni_tcp_conn **, SOCKET);
@@ -325,6 +325,34 @@ nni_plat_thr_is_self(nni_plat_thr *thr)
 	return (GetCurrentThreadId() == thr->id);
 }
 
+int
+nni_plat_tls_init(nni_plat_tls *tls, void (*dtor)(void *))
+{
+	NNI_ARG_UNUSED(dtor);
+	if ((tls->index = TlsAlloc()) == TLS_OUT_OF_INDEXES) {
+		return (NNG_ENOMEM);
+	}
+	return (0);
+}
+
+void
+nni_plat_tls_fini(nni_plat_tls *tls)
+{
+	(void) TlsFree(tls->index);
+}
+
+void
+nni_plat_tls_set(nni_plat_tls *tls, void *val)
+{
+	(void) TlsSetValue(tls->index, val);
+}
+
+void *
+nni_plat_tls_get(nni_plat_tls *tls)
+{
+	return (TlsGetValue(tls->index));
+}
+
 static LONG plat_inited = 0;
 
 int
@@ -17,6 +17,15 @@
 // a broadcast.  It has nothing more sophisticated because it does not
 // perform sender-side filtering.  Its best effort delivery, so anything
 // that can't receive the message won't get one.
+//
+// With conflation on, a message may name its topic by carrying the
+// length of the topic, as a 32-bit header, ahead of a body that starts
+// with the topic.  A subscriber that is behind then only keeps the
+// newest message queued for each topic: a new message takes the place
+// of a queued one for the same topic, rather than going to the back of
+// the queue.  The header is only a hint for us, and is not sent.  Since
+// queued messages are matched by prefix, no topic may be a prefix of
+// another (length prefixed topics are one way to ensure this).
 
 #ifndef NNI_PROTO_SUB_V0
 #define NNI_PROTO_SUB_V0 NNI_PROTO(2, 1)
@@ -36,11 +45,14 @@ static void pub0_pipe_fini(void *);
 
 // pub0_sock is our per-socket protocol private structure.
 struct pub0_sock {
-	nni_list      pipes;
-	nni_mtx       mtx;
-	bool          closed;
-	size_t        sendbuf;
-	nni_pollable *sendable;
+	nni_list        pipes;
+	int             npipes;
+	int             nframed; // pipes that send a prepared frame
+	nni_mtx         mtx;
+	bool            closed;
+	size_t          sendbuf;
+	nni_pollable *  sendable;
+	nni_atomic_bool conflate;
 };
 
 // pub0_pipe is our per-pipe protocol private structure.
@@ -50,6 +62,7 @@ struct pub0_pipe {
 	nni_lmq       sendq;
 	bool          closed;
 	bool          busy;
+	bool          framed;
 	nni_aio *     aio_send;
 	nni_aio *     aio_recv;
 	nni_list_node node;
@@ -77,6 +90,7 @@ pub0_sock_init(void *arg, nni_sock *nsock)
 	nni_mtx_init(&sock->mtx);
 	NNI_LIST_INIT(&sock->pipes, pub0_pipe, node);
 	sock->sendbuf = 16; // fairly arbitrary
+	nni_atomic_init_bool(&sock->conflate);
 	return (0);
 }
 
@@ -132,9 +146,10 @@ pub0_pipe_init(void *arg, nni_pipe *pipe, void *s)
 		return (rv);
 	}
 
-	p->busy = false;
-	p->pipe = pipe;
-	p->pub  = s;
+	p->busy   = false;
+	p->framed = nni_pipe_framed(pipe);
+	p->pipe   = pipe;
+	p->pub    = s;
 	return (0);
 }
 
@@ -149,6 +164,10 @@ pub0_pipe_start(void *arg)
 	}
 	nni_mtx_lock(&sock->mtx);
 	nni_list_append(&sock->pipes, p);
+	sock->npipes++;
+	if (p->framed) {
+		sock->nframed++;
+	}
 	nni_mtx_unlock(&sock->mtx);
 
 	// Start the receiver.
@@ -172,6 +191,10 @@ pub0_pipe_close(void *arg)
 
 	if (nni_list_active(&sock->pipes, p)) {
 		nni_list_remove(&sock->pipes, p);
+		sock->npipes--;
+		if (p->framed) {
+			sock->nframed--;
+		}
 	}
 	nni_mtx_unlock(&sock->mtx);
 }
@@ -226,6 +249,22 @@ pub0_sock_recv(void *arg, nni_aio *aio)
 	}
 }
 
+// pub0_same_topic checks whether a queued message is for the topic
+// of the new one, which is the first topic bytes of its body.
+typedef struct {
+	const uint8_t *topic;
+	size_t         len;
+} pub0_topic;
+
+static bool
+pub0_same_topic(nng_msg *queued, void *arg)
+{
+	pub0_topic *t = arg;
+
+	return ((nni_msg_len(queued) >= t->len) &&
+	    (memcmp(nni_msg_body(queued), t->topic, t->len) == 0));
+}
+
 static void
 pub0_sock_send(void *arg, nni_aio *aio)
 {
@@ -233,17 +272,49 @@ pub0_sock_send(void *arg, nni_aio *aio)
 	pub0_pipe *p;
 	nng_msg *  msg;
 	size_t     len;
+	pub0_topic topic;
 
 	msg = nni_aio_get_msg(aio);
-	len = nni_msg_len(msg);
+
+	topic.len = 0;
+	if (nni_atomic_get_bool(&sock->conflate) &&
+	    (nni_msg_header_len(msg) == sizeof(uint32_t))) {
+		topic.len = nni_msg_header_trim_u32(msg);
+		if (topic.len > nni_msg_len(msg)) {
+			topic.len = nni_msg_len(msg);
+		}
+	}
+	len         = nni_msg_len(msg);
+	topic.topic = nni_msg_body(msg);
+
 	nni_mtx_lock(&sock->mtx);
+	if (sock->npipes == 0) {
+		nni_mtx_unlock(&sock->mtx);
+		nni_msg_free(msg);
+		nni_aio_finish(aio, 0, len);
+		return;
+	}
+	// Encode the wire frame while we still own the message outright.
+	// The pipes that would each build their own length header then
+	// share the one frame instead; for just one, it is no saving.
+	if (sock->nframed > 1) {
+		nni_msg_frame_prep(msg);
+	}
+	// Take all the references we need in one go.  Our own reference
+	// goes to the last pipe.
+	nni_msg_clone_n(msg, sock->npipes - 1);
 	NNI_LIST_FOREACH (&sock->pipes, p) {
-
-		nni_msg_clone(msg);
 		if (p->busy) {
+			nni_msg *old;
+			if ((topic.len > 0) &&
+			    (nni_lmq_replace(&p->sendq, msg, pub0_same_topic,
+			         &topic, &old) == 0)) {
+				// Superseded while still waiting to go.
+				nni_msg_free(old);
+				continue;
+			}
 			if (nni_lmq_full(&p->sendq)) {
 				// Make space for the new message.
-				nni_msg *old;
 				(void) nni_lmq_getq(&p->sendq, &old);
 				nni_msg_free(old);
 			}
@@ -255,7 +326,6 @@ pub0_sock_send(void *arg, nni_aio *aio)
 		}
 	}
 	nni_mtx_unlock(&sock->mtx);
-	nng_msg_free(msg);
 	nni_aio_finish(aio, 0, len);
 }
 
@@ -316,6 +386,27 @@ pub0_sock_get_sendbuf(void *arg, void *buf, size_t *szp, nni_type t)
 	return (nni_copyout_int(val, buf, szp, t));
 }
 
+static int
+pub0_sock_get_conflate(void *arg, void *buf, size_t *szp, nni_type t)
+{
+	pub0_sock *sock = arg;
+	return (nni_copyout_bool(
+	    nni_atomic_get_bool(&sock->conflate), buf, szp, t));
+}
+
+static int
+pub0_sock_set_conflate(void *arg, const void *buf, size_t sz, nni_type t)
+{
+	pub0_sock *sock = arg;
+	bool       val;
+	int        rv;
+
+	if ((rv = nni_copyin_bool(&val, buf, sz, t)) == 0) {
+		nni_atomic_set_bool(&sock->conflate, val);
+	}
+	return (rv);
+}
+
 static nni_proto_pipe_ops pub0_pipe_ops = {
 	.pipe_size  = sizeof(pub0_pipe),
 	.pipe_init  = pub0_pipe_init,
@@ -336,6 +427,11 @@ static nni_option pub0_sock_options[] = {
 	    .o_get  = pub0_sock_get_sendbuf,
 	    .o_set  = pub0_sock_set_sendbuf,
 	},
+	{
+	    .o_name = NNG_OPT_PUB_CONFLATE,
+	    .o_get  = pub0_sock_get_conflate,
+	    .o_set  = pub0_sock_set_conflate,
+	},
 	{
 	    .o_name = NULL,
 	},
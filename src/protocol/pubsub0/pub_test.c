@@ -7,12 +7,15 @@
 // found online at https://opensource.org/licenses/MIT.
 //
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <nng/nng.h>
 #include <nng/protocol/pubsub0/pub.h>
 #include <nng/protocol/pubsub0/sub.h>
 
+#include "core/nng_impl.h"
+
 #include <acutest.h>
 #include <testutil.h>
 
@@ -323,6 +326,203 @@ test_pub_cooked(void)
 	TEST_NNG_PASS(nng_close(s));
 }
 
+static void
+test_pub_fanout(void)
+{
+	nng_socket pub;
+	nng_socket subs[6];
+	char       addr[2][64];
+	size_t     sizes[] = { 0, 5, 1000, 4096, 70000 };
+
+	// Mix of stream transports, which share the pre-encoded frame, and
+	// inproc, which shares the message itself.
+	testutil_scratch_addr("tcp", sizeof(addr[0]), addr[0]);
+	testutil_scratch_addr("ipc", sizeof(addr[1]), addr[1]);
+	TEST_NNG_PASS(nng_pub0_open(&pub));
+	TEST_NNG_PASS(nng_listen(pub, addr[0], NULL, 0));
+	TEST_NNG_PASS(nng_listen(pub, addr[1], NULL, 0));
+	for (int i = 0; i < 6; i++) {
+		TEST_NNG_PASS(nng_sub0_open(&subs[i]));
+		TEST_NNG_PASS(
+		    nng_setopt(subs[i], NNG_OPT_SUB_SUBSCRIBE, "", 0));
+		TEST_NNG_PASS(nng_setopt_ms(subs[i], NNG_OPT_RECVTIMEO, 2000));
+		TEST_NNG_PASS(nng_setopt_size(subs[i], NNG_OPT_RECVMAXSZ, 0));
+		if (i < 4) {
+			TEST_NNG_PASS(nng_dial(subs[i], addr[i % 2], NULL, 0));
+		} else {
+			TEST_NNG_PASS(testutil_marry(pub, subs[i]));
+		}
+	}
+	testutil_sleep(100);
+
+	for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+		nng_msg *m;
+		TEST_NNG_PASS(nng_msg_alloc(&m, sizes[n]));
+		for (size_t j = 0; j < sizes[n]; j++) {
+			((uint8_t *) nng_msg_body(m))[j] = (uint8_t) (j + n);
+		}
+		TEST_NNG_PASS(nng_sendmsg(pub, m, 0));
+
+		for (int i = 0; i < 6; i++) {
+			uint8_t *body;
+			TEST_NNG_PASS(nng_recvmsg(subs[i], &m, 0));
+			TEST_CHECK(nng_msg_len(m) == sizes[n]);
+			body = nng_msg_body(m);
+			for (size_t j = 0; j < nng_msg_len(m); j++) {
+				if (body[j] != (uint8_t) (j + n)) {
+					TEST_CHECK(false);
+					TEST_MSG("sub %d size %d byte %d", i,
+					    (int) sizes[n], (int) j);
+					break;
+				}
+			}
+			nng_msg_free(m);
+		}
+	}
+
+	for (int i = 0; i < 6; i++) {
+		TEST_NNG_PASS(nng_close(subs[i]));
+	}
+	TEST_NNG_PASS(nng_close(pub));
+}
+
+static void
+test_pub_frame_headroom(void)
+{
+	nni_msg *m;
+	uint8_t *body;
+	size_t   len;
+
+	// Large power of two sizes have no headroom.  Making room for the
+	// frame would copy the body, so it is left to the transports.
+	TEST_NNG_PASS(nni_msg_alloc(&m, 4096));
+	body = nni_msg_body(m);
+	nni_msg_frame_prep(m);
+	TEST_CHECK(nni_msg_body(m) == body);
+	TEST_CHECK(nni_msg_frame(m, &len) == NULL);
+	nni_msg_free(m);
+
+	TEST_NNG_PASS(nni_msg_alloc(&m, 1000));
+	body = nni_msg_body(m);
+	nni_msg_frame_prep(m);
+	TEST_CHECK(nni_msg_body(m) == body);
+	TEST_CHECK(nni_msg_frame(m, &len) != NULL);
+	TEST_CHECK(len == 1000 + NNI_MSG_FRAME_PREFIX);
+	nni_msg_free(m);
+}
+
+static void
+test_pub_conflate_option(void)
+{
+	nng_socket pub;
+	bool       b;
+
+	TEST_NNG_PASS(nng_pub0_open(&pub));
+	TEST_NNG_PASS(nng_getopt_bool(pub, NNG_OPT_PUB_CONFLATE, &b));
+	TEST_CHECK(!b);
+	TEST_NNG_PASS(nng_setopt_bool(pub, NNG_OPT_PUB_CONFLATE, true));
+	TEST_NNG_PASS(nng_getopt_bool(pub, NNG_OPT_PUB_CONFLATE, &b));
+	TEST_CHECK(b);
+	TEST_NNG_FAIL(nng_setopt_int(pub, NNG_OPT_PUB_CONFLATE, 1),
+	    NNG_EBADTYPE);
+	TEST_NNG_PASS(nng_close(pub));
+}
+
+static void
+pub_send_topic(nng_socket pub, const char *topic, const char *val)
+{
+	nng_msg *m;
+
+	TEST_NNG_PASS(nng_msg_alloc(&m, 0));
+	TEST_NNG_PASS(nng_msg_append(m, topic, strlen(topic)));
+	TEST_NNG_PASS(nng_msg_append(m, val, strlen(val) + 1));
+	TEST_NNG_PASS(nng_msg_header_append_u32(m, (uint32_t) strlen(topic)));
+	TEST_NNG_PASS(nng_sendmsg(pub, m, 0));
+}
+
+static char *
+pub_stream_recv(nng_stream *s, size_t *lenp)
+{
+	uint8_t hdr[8];
+	char *  buf;
+	size_t  len = 0;
+
+	TEST_NNG_PASS(testutil_stream_recv_wait(
+	    testutil_stream_recv_start(s, hdr, sizeof(hdr))));
+	for (int i = 0; i < 8; i++) {
+		len = (len << 8u) | hdr[i];
+	}
+	TEST_ASSERT((buf = malloc(len)) != NULL);
+	TEST_NNG_PASS(testutil_stream_recv_wait(
+	    testutil_stream_recv_start(s, buf, len)));
+	*lenp = len;
+	return (buf);
+}
+
+static void
+test_pub_conflate(void)
+{
+	nng_socket         pub;
+	nng_stream_dialer *d;
+	nng_stream *       s;
+	nng_aio *          aio;
+	nng_msg *          m;
+	char               addr[64];
+	char *             buf;
+	size_t             len;
+	// An SP header from a sub peer.
+	uint8_t hello[8] = { 0, 'S', 'P', 0, 0, 33, 0, 0 };
+
+	// A peer of our own, which stops reading after the handshake, so
+	// that the pipe stays busy and everything after the first message
+	// has to queue.
+	testutil_scratch_addr("tcp", sizeof(addr), addr);
+	TEST_NNG_PASS(nng_pub0_open(&pub));
+	TEST_NNG_PASS(nng_setopt_bool(pub, NNG_OPT_PUB_CONFLATE, true));
+	TEST_NNG_PASS(nng_listen(pub, addr, NULL, 0));
+	TEST_NNG_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	TEST_NNG_PASS(nng_stream_dialer_alloc(&d, addr));
+	nng_stream_dialer_dial(d, aio);
+	nng_aio_wait(aio);
+	TEST_NNG_PASS(nng_aio_result(aio));
+	s = nng_aio_get_output(aio, 0);
+	TEST_NNG_PASS(testutil_stream_send_wait(
+	    testutil_stream_send_start(s, hello, sizeof(hello))));
+	TEST_NNG_PASS(testutil_stream_recv_wait(
+	    testutil_stream_recv_start(s, hello, sizeof(hello))));
+	testutil_sleep(100);
+
+	// More than the socket buffers can hold.
+	TEST_NNG_PASS(nng_msg_alloc(&m, 16 * 1024 * 1024));
+	TEST_NNG_PASS(nng_sendmsg(pub, m, 0));
+	testutil_sleep(100);
+
+	pub_send_topic(pub, "alpha", "1");
+	pub_send_topic(pub, "beta", "1");
+	pub_send_topic(pub, "alpha", "2");
+	pub_send_topic(pub, "alpha", "3");
+	pub_send_topic(pub, "beta", "2");
+	TEST_NNG_SEND_STR(pub, "end"); // no topic, so always queued
+
+	buf = pub_stream_recv(s, &len);
+	TEST_CHECK(len == 16 * 1024 * 1024);
+	free(buf);
+	buf = pub_stream_recv(s, &len);
+	TEST_CHECK(strcmp(buf, "alpha3") == 0);
+	free(buf);
+	buf = pub_stream_recv(s, &len);
+	TEST_CHECK(strcmp(buf, "beta2") == 0);
+	free(buf);
+	buf = pub_stream_recv(s, &len);
+	TEST_CHECK(strcmp(buf, "end") == 0);
+	free(buf);
+
+	nng_stream_free(s);
+	nng_stream_dialer_free(d);
+	nng_aio_free(aio);
+	TEST_NNG_PASS(nng_close(pub));
+}
+
 TEST_LIST = {
 	{ "pub identity", test_pub_identity },
 	{ "pub cannot recv", test_pub_cannot_recv },
@@ -339,5 +539,9 @@ TEST_LIST = {
 	{ "sub context recv cancel", test_sub_ctx_recv_cancel },
 	{ "pub send buf option", test_pub_send_buf_option },
 	{ "pub cooked", test_pub_cooked },
+	{ "pub fanout", test_pub_fanout },
+	{ "pub frame headroom", test_pub_frame_headroom },
+	{ "pub conflate option", test_pub_conflate_option },
+	{ "pub conflate", test_pub_conflate },
 	{ NULL, NULL },
 };
@@ -36,15 +36,27 @@
 typedef struct sub0_pipe  sub0_pipe;
 typedef struct sub0_sock  sub0_sock;
 typedef struct sub0_ctx   sub0_ctx;
-typedef struct sub0_topic sub0_topic;
+typedef struct sub0_node  sub0_node;
 
 static void sub0_recv_cb(void *);
 static void sub0_pipe_fini(void *);
 
-struct sub0_topic {
-	nni_list_node node;
-	size_t        len;
-	void *        buf;
+// Subscriptions are kept in a compressed prefix (radix) trie.  Each node
+// holds the run of bytes leading to it from its parent, whether a
+// subscription ends there, and its children sorted by their first byte.
+// Matching walks down from the root along the message body, so its cost
+// depends on the length of the topic rather than on the number of
+// subscriptions.  Apart from the root, a node that does not end a
+// subscription always has at least two children.
+struct sub0_node {
+	sub0_node * parent;
+	uint8_t *   key;   // bytes leading here from the parent
+	size_t      len;   // length of key
+	bool        topic; // a subscription ends at this node
+	unsigned    nkids;
+	unsigned    kidcap;
+	uint8_t *   first; // first byte of each child's key, sorted
+	sub0_node **kids;
 };
 
 // sub0_ctx is a context for a SUB socket.  The advantage of contexts is
@@ -52,10 +64,11 @@ struct sub0_topic {
 struct sub0_ctx {
 	nni_list_node node;
 	sub0_sock *   sock;
-	nni_list      topics;     // TODO: Consider patricia trie
+	sub0_node     topics;     // root of the subscription trie
 	nni_list      recv_queue; // can have multiple pending receives
 	nni_lmq       lmq;
 	bool          prefer_new;
+	bool          conflate;
 };
 
 // sub0_sock is our per-socket protocol private structure.
@@ -65,6 +78,7 @@ struct sub0_sock {
 	nni_list     contexts; // all contexts
 	size_t       recv_buf_len;
 	bool         prefer_new;
+	bool         conflate;
 	nni_mtx      lk;
 };
 
@@ -75,6 +89,265 @@ struct sub0_pipe {
 	nni_aio    aio_recv;
 };
 
+static sub0_node *
+sub0_node_alloc(const uint8_t *key, size_t len)
+{
+	sub0_node *node;
+
+	if ((node = NNI_ALLOC_STRUCT(node)) == NULL) {
+		return (NULL);
+	}
+	if ((len > 0) && ((node->key = nni_alloc(len)) == NULL)) {
+		NNI_FREE_STRUCT(node);
+		return (NULL);
+	}
+	if (len > 0) {
+		memcpy(node->key, key, len);
+	}
+	node->len = len;
+	return (node);
+}
+
+static void
+sub0_node_free(sub0_node *node)
+{
+	nni_free(node->key, node->len);
+	nni_free(node->first, node->kidcap);
+	nni_free(node->kids, node->kidcap * sizeof(sub0_node *));
+	NNI_FREE_STRUCT(node);
+}
+
+// sub0_node_find looks for the child whose key starts with c.  If there
+// is none, idxp is left pointing at where such a child would be inserted.
+static bool
+sub0_node_find(sub0_node *node, uint8_t c, unsigned *idxp)
+{
+	unsigned lo = 0;
+	unsigned hi = node->nkids;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (node->first[mid] == c) {
+			*idxp = mid;
+			return (true);
+		}
+		if (node->first[mid] < c) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*idxp = lo;
+	return (false);
+}
+
+static int
+sub0_node_add_kid(sub0_node *node, unsigned idx, sub0_node *kid)
+{
+	if (node->nkids == node->kidcap) {
+		unsigned    cap = node->kidcap ? node->kidcap * 2 : 2;
+		uint8_t *   first;
+		sub0_node **kids;
+
+		if (cap > 256) {
+			cap = 256; // can never have more than one per byte
+		}
+		if ((first = nni_alloc(cap)) == NULL) {
+			return (NNG_ENOMEM);
+		}
+		if ((kids = nni_alloc(cap * sizeof(sub0_node *))) == NULL) {
+			nni_free(first, cap);
+			return (NNG_ENOMEM);
+		}
+		if (node->nkids > 0) {
+			memcpy(first, node->first, node->nkids);
+			memcpy(kids, node->kids, node->nkids * sizeof(kid));
+		}
+		nni_free(node->first, node->kidcap);
+		nni_free(node->kids, node->kidcap * sizeof(sub0_node *));
+		node->first  = first;
+		node->kids   = kids;
+		node->kidcap = cap;
+	}
+	memmove(&node->first[idx + 1], &node->first[idx], node->nkids - idx);
+	memmove(&node->kids[idx + 1], &node->kids[idx],
+	    (node->nkids - idx) * sizeof(kid));
+	node->first[idx] = kid->key[0];
+	node->kids[idx]  = kid;
+	node->nkids++;
+	kid->parent = node;
+	return (0);
+}
+
+static void
+sub0_node_del_kid(sub0_node *node, unsigned idx)
+{
+	node->nkids--;
+	memmove(&node->first[idx], &node->first[idx + 1], node->nkids - idx);
+	memmove(&node->kids[idx], &node->kids[idx + 1],
+	    (node->nkids - idx) * sizeof(sub0_node *));
+}
+
+// sub0_node_set_key replaces the key of the node, which must keep its
+// first byte so that the parent's ordering stays valid.
+static int
+sub0_node_set_key(sub0_node *node, const uint8_t *key1, size_t len1,
+    const uint8_t *key2, size_t len2)
+{
+	uint8_t *key;
+
+	if ((key = nni_alloc(len1 + len2)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	memcpy(key, key1, len1);
+	if (len2 > 0) {
+		memcpy(key + len1, key2, len2);
+	}
+	nni_free(node->key, node->len);
+	node->key = key;
+	node->len = len1 + len2;
+	return (0);
+}
+
+static int
+sub0_trie_add(sub0_node *node, const uint8_t *buf, size_t sz)
+{
+	sub0_node *kid;
+	sub0_node *mid;
+	unsigned   idx;
+	size_t     n;
+	int        rv;
+
+	for (;;) {
+		if (sz == 0) {
+			node->topic = true;
+			return (0);
+		}
+		if (!sub0_node_find(node, buf[0], &idx)) {
+			if ((kid = sub0_node_alloc(buf, sz)) == NULL) {
+				return (NNG_ENOMEM);
+			}
+			kid->topic = true;
+			if ((rv = sub0_node_add_kid(node, idx, kid)) != 0) {
+				sub0_node_free(kid);
+			}
+			return (rv);
+		}
+		kid = node->kids[idx];
+		for (n = 1; (n < kid->len) && (n < sz); n++) {
+			if (kid->key[n] != buf[n]) {
+				break;
+			}
+		}
+		if (n < kid->len) {
+			// We diverge part way along this edge, so split it
+			// with a new node where the paths separate.
+			if ((mid = sub0_node_alloc(kid->key, n)) == NULL) {
+				return (NNG_ENOMEM);
+			}
+			if ((rv = sub0_node_add_kid(mid, 0, kid)) != 0) {
+				sub0_node_free(mid);
+				return (rv);
+			}
+			if ((rv = sub0_node_set_key(kid, kid->key + n,
+			         kid->len - n, NULL, 0)) != 0) {
+				kid->parent = node;
+				sub0_node_free(mid);
+				return (rv);
+			}
+			mid->first[0]   = kid->key[0];
+			mid->parent     = node;
+			node->kids[idx] = mid;
+			kid             = mid;
+		}
+		buf += n;
+		sz -= n;
+		node = kid;
+	}
+}
+
+static sub0_node *
+sub0_trie_find(sub0_node *node, const uint8_t *buf, size_t sz)
+{
+	sub0_node *kid;
+	unsigned   idx;
+
+	while (sz > 0) {
+		if (!sub0_node_find(node, buf[0], &idx)) {
+			return (NULL);
+		}
+		kid = node->kids[idx];
+		if ((sz < kid->len) ||
+		    (memcmp(kid->key, buf, kid->len) != 0)) {
+			return (NULL);
+		}
+		buf += kid->len;
+		sz -= kid->len;
+		node = kid;
+	}
+	return (node->topic ? node : NULL);
+}
+
+// sub0_trie_prune removes the subscription ending at node, and then
+// tidies up nodes that are no longer needed.
+static void
+sub0_trie_prune(sub0_node *node)
+{
+	sub0_node *parent;
+	sub0_node *kid;
+	unsigned   idx;
+
+	node->topic = false;
+	while (((parent = node->parent) != NULL) && (!node->topic)) {
+		if (node->nkids == 0) {
+			(void) sub0_node_find(parent, node->key[0], &idx);
+			sub0_node_del_kid(parent, idx);
+			sub0_node_free(node);
+			node = parent;
+			continue;
+		}
+		if (node->nkids == 1) {
+			// Fold the node into its only child.  If we cannot
+			// get the memory to do that, leaving the node in
+			// place is harmless.
+			kid = node->kids[0];
+			if (sub0_node_set_key(kid, node->key, node->len,
+			        kid->key, kid->len) == 0) {
+				(void) sub0_node_find(
+				    parent, node->key[0], &idx);
+				parent->kids[idx] = kid;
+				kid->parent       = parent;
+				node->nkids       = 0;
+				sub0_node_free(node);
+			}
+		}
+		break;
+	}
+}
+
+static void
+sub0_trie_fini(sub0_node *root)
+{
+	sub0_node *node = root;
+	sub0_node *parent;
+
+	while (node != NULL) {
+		if (node->nkids > 0) {
+			node->nkids--;
+			node = node->kids[node->nkids];
+			continue;
+		}
+		parent = node->parent;
+		if (node != root) {
+			sub0_node_free(node);
+		}
+		node = (node != root) ? parent : NULL;
+	}
+	nni_free(root->first, root->kidcap);
+	nni_free(root->kids, root->kidcap * sizeof(sub0_node *));
+	memset(root, 0, sizeof(*root));
+}
+
 static void
 sub0_ctx_cancel(nng_aio *aio, void *arg, int rv)
 {
@@ -154,9 +427,8 @@ sub0_ctx_close(void *arg)
 static void
 sub0_ctx_fini(void *arg)
 {
-	sub0_ctx *  ctx  = arg;
-	sub0_sock * sock = ctx->sock;
-	sub0_topic *topic;
+	sub0_ctx * ctx  = arg;
+	sub0_sock *sock = ctx->sock;
 
 	sub0_ctx_close(ctx);
 
@@ -164,11 +436,7 @@ sub0_ctx_fini(void *arg)
 	nni_list_remove(&sock->contexts, ctx);
 	nni_mtx_unlock(&sock->lk);
 
-	while ((topic = nni_list_first(&ctx->topics)) != 0) {
-		nni_list_remove(&ctx->topics, topic);
-		nni_free(topic->buf, topic->len);
-		NNI_FREE_STRUCT(topic);
-	}
+	sub0_trie_fini(&ctx->topics);
 
 	nni_lmq_fini(&ctx->lmq);
 }
@@ -190,9 +458,10 @@ sub0_ctx_init(void *ctx_arg, void *sock_arg)
 		return (rv);
 	}
 	ctx->prefer_new = prefer_new;
+	ctx->conflate   = sock->conflate;
 
 	nni_aio_list_init(&ctx->recv_queue);
-	NNI_LIST_INIT(&ctx->topics, sub0_topic, node);
+	memset(&ctx->topics, 0, sizeof(ctx->topics));
 
 	ctx->sock = sock;
 
@@ -297,23 +566,53 @@ sub0_pipe_close(void *arg)
 	nni_aio_close(&p->aio_recv);
 }
 
+// sub0_matches checks the body against the subscriptions.  On a match,
+// depthp (if not NULL) gets the length of the subscription matched,
+// which is the shortest one that does.
 static bool
-sub0_matches(sub0_ctx *ctx, uint8_t *body, size_t len)
+sub0_matches(sub0_ctx *ctx, uint8_t *body, size_t len, size_t *depthp)
 {
-	sub0_topic *topic;
-
-	// This is a naive and trivial matcher.  Replace with a real
-	// patricia trie later.
-	NNI_LIST_FOREACH (&ctx->topics, topic) {
-		if (len < topic->len) {
-			continue;
-		}
-		if ((topic->len == 0) ||
-		    (memcmp(topic->buf, body, topic->len) == 0)) {
+	sub0_node *node  = &ctx->topics;
+	size_t     depth = 0;
+	sub0_node *kid;
+	unsigned   idx;
+
+	for (;;) {
+		if (node->topic) {
+			if (depthp != NULL) {
+				*depthp = depth;
+			}
 			return (true);
 		}
+		if ((len == 0) || (!sub0_node_find(node, body[0], &idx))) {
+			return (false);
+		}
+		kid = node->kids[idx];
+		if ((len < kid->len) ||
+		    (memcmp(kid->key, body, kid->len) != 0)) {
+			return (false);
+		}
+		body += kid->len;
+		len -= kid->len;
+		depth += kid->len;
+		node = kid;
 	}
-	return (false);
+}
+
+// With conflation, a queued message is superseded by a new one that
+// matched the same subscription, which is its first topic bytes.
+typedef struct {
+	const uint8_t *topic;
+	size_t         len;
+} sub0_topic;
+
+static bool
+sub0_same_topic(nng_msg *queued, void *arg)
+{
+	sub0_topic *t = arg;
+
+	return ((nni_msg_len(queued) >= t->len) &&
+	    (memcmp(nni_msg_body(queued), t->topic, t->len) == 0));
 }
 
 static void
@@ -328,6 +627,7 @@ sub0_recv_cb(void *arg)
 	nni_list   finish;
 	nng_aio *  aio;
 	bool       submatch;
+	sub0_topic topic;
 
 	if (nni_aio_result(&p->aio_recv) != 0) {
 		nni_pipe_close(p->pipe);
@@ -340,20 +640,24 @@ sub0_recv_cb(void *arg)
 	nni_aio_set_msg(&p->aio_recv, NULL);
 	nni_msg_set_pipe(msg, nni_pipe_id(p->pipe));
 
-	body     = nni_msg_body(msg);
-	len      = nni_msg_len(msg);
-	submatch = false;
+	body        = nni_msg_body(msg);
+	len         = nni_msg_len(msg);
+	submatch    = false;
+	topic.topic = body;
 
 	nni_mtx_lock(&sock->lk);
 	// Go through all contexts.  We will try to send up.
 	NNI_LIST_FOREACH (&sock->contexts, ctx) {
 
-		if (nni_lmq_full(&ctx->lmq) && !ctx->prefer_new) {
+		nni_msg *old;
+
+		if (nni_lmq_full(&ctx->lmq) && !ctx->prefer_new &&
+		    !ctx->conflate) {
 			// Cannot deliver here, as receive buffer is full.
 			continue;
 		}
 
-		if (!sub0_matches(ctx, body, len)) {
+		if (!sub0_matches(ctx, body, len, &topic.len)) {
 			continue;
 		}
 
@@ -370,9 +674,15 @@ sub0_recv_cb(void *arg)
 
 			// Save for synchronous completion
 			nni_list_append(&finish, aio);
+		} else if (ctx->conflate && (topic.len > 0) &&
+		    (nni_lmq_replace(&ctx->lmq, msg, sub0_same_topic, &topic,
+		         &old) == 0)) {
+			// Superseded while still waiting to be received.
+			nni_msg_free(old);
+		} else if (nni_lmq_full(&ctx->lmq) && !ctx->prefer_new) {
+			nni_msg_free(msg);
 		} else if (nni_lmq_full(&ctx->lmq)) {
 			// Make space for the new message.
-			nni_msg *old;
 			(void) nni_lmq_getq(&ctx->lmq, &old);
 			nni_msg_free(old);
 
@@ -438,71 +748,35 @@ sub0_ctx_set_recv_buf_len(void *arg, const void *buf, size_t sz, nni_type t)
 	return (0);
 }
 
-// For now we maintain subscriptions on a sorted linked list.  As we do not
-// expect to have huge numbers of subscriptions, and as the operation is
-// really O(n), we think this is acceptable.  In the future we might decide
-// to replace this with a patricia trie, like old nanomsg had.
-
 static int
 sub0_ctx_subscribe(void *arg, const void *buf, size_t sz, nni_type t)
 {
-	sub0_ctx *  ctx  = arg;
-	sub0_sock * sock = ctx->sock;
-	sub0_topic *topic;
-	sub0_topic *new_topic;
+	sub0_ctx * ctx  = arg;
+	sub0_sock *sock = ctx->sock;
+	int        rv;
 	NNI_ARG_UNUSED(t);
 
 	nni_mtx_lock(&sock->lk);
-	NNI_LIST_FOREACH (&ctx->topics, topic) {
-		if (topic->len != sz) {
-			continue;
-		}
-		if (memcmp(topic->buf, buf, sz) == 0) {
-			// Already have it.
-			nni_mtx_unlock(&sock->lk);
-			return (0);
-		}
-	}
-	if ((new_topic = NNI_ALLOC_STRUCT(new_topic)) == NULL) {
-		nni_mtx_unlock(&sock->lk);
-		return (NNG_ENOMEM);
-	}
-	if ((sz > 0) && ((new_topic->buf = nni_alloc(sz)) == NULL)) {
-		nni_mtx_unlock(&sock->lk);
-		NNI_FREE_STRUCT(new_topic);
-		return (NNG_ENOMEM);
-	}
-	memcpy(new_topic->buf, buf, sz);
-	new_topic->len = sz;
-	nni_list_append(&ctx->topics, new_topic);
+	rv = sub0_trie_add(&ctx->topics, buf, sz);
 	nni_mtx_unlock(&sock->lk);
-	return (0);
+	return (rv);
 }
 
 static int
 sub0_ctx_unsubscribe(void *arg, const void *buf, size_t sz, nni_type t)
 {
-	sub0_ctx *  ctx  = arg;
-	sub0_sock * sock = ctx->sock;
-	sub0_topic *topic;
-	size_t      len;
+	sub0_ctx * ctx  = arg;
+	sub0_sock *sock = ctx->sock;
+	sub0_node *node;
+	size_t     len;
 	NNI_ARG_UNUSED(t);
 
 	nni_mtx_lock(&sock->lk);
-	NNI_LIST_FOREACH (&ctx->topics, topic) {
-		if (topic->len != sz) {
-			continue;
-		}
-		if (memcmp(topic->buf, buf, sz) == 0) {
-			// Matched!
-			break;
-		}
-	}
-	if (topic == NULL) {
+	if ((node = sub0_trie_find(&ctx->topics, buf, sz)) == NULL) {
 		nni_mtx_unlock(&sock->lk);
 		return (NNG_ENOENT);
 	}
-	nni_list_remove(&ctx->topics, topic);
+	sub0_trie_prune(node);
 
 	// Now we need to make sure that any messages that are waiting still
 	// match the subscription.  We basically just run through the queue
@@ -512,16 +786,14 @@ sub0_ctx_unsubscribe(void *arg, const void *buf, size_t sz, nni_type t)
 		nni_msg *msg;
 
 		(void) nni_lmq_getq(&ctx->lmq, &msg);
-		if (sub0_matches(ctx, nni_msg_body(msg), nni_msg_len(msg))) {
+		if (sub0_matches(
+		        ctx, nni_msg_body(msg), nni_msg_len(msg), NULL)) {
 			(void) nni_lmq_putq(&ctx->lmq, msg);
 		} else {
 			nni_msg_free(msg);
 		}
 	}
 	nni_mtx_unlock(&sock->lk);
-
-	nni_free(topic->buf, topic->len);
-	NNI_FREE_STRUCT(topic);
 	return (0);
 }
 
@@ -561,6 +833,42 @@ sub0_ctx_set_prefer_new(void *arg, const void *buf, size_t sz, nni_type t)
 	return (0);
 }
 
+static int
+sub0_ctx_get_conflate(void *arg, void *buf, size_t *szp, nni_type t)
+{
+	sub0_ctx * ctx  = arg;
+	sub0_sock *sock = ctx->sock;
+	bool       val;
+
+	nni_mtx_lock(&sock->lk);
+	val = ctx->conflate;
+	nni_mtx_unlock(&sock->lk);
+
+	return (nni_copyout_bool(val, buf, szp, t));
+}
+
+static int
+sub0_ctx_set_conflate(void *arg, const void *buf, size_t sz, nni_type t)
+{
+	sub0_ctx * ctx  = arg;
+	sub0_sock *sock = ctx->sock;
+	bool       val;
+	int        rv;
+
+	if ((rv = nni_copyin_bool(&val, buf, sz, t)) != 0) {
+		return (rv);
+	}
+
+	nni_mtx_lock(&sock->lk);
+	ctx->conflate = val;
+	if (&sock->master == ctx) {
+		sock->conflate = val;
+	}
+	nni_mtx_unlock(&sock->lk);
+
+	return (0);
+}
+
 static nni_option sub0_ctx_options[] = {
 	{
 	    .o_name = NNG_OPT_RECVBUF,
@@ -580,6 +888,11 @@ static nni_option sub0_ctx_options[] = {
 	    .o_get  = sub0_ctx_get_prefer_new,
 	    .o_set  = sub0_ctx_set_prefer_new,
 	},
+	{
+	    .o_name = NNG_OPT_SUB_CONFLATE,
+	    .o_get  = sub0_ctx_get_conflate,
+	    .o_set  = sub0_ctx_set_conflate,
+	},
 	{
 	    .o_name = NULL,
 	},
@@ -657,6 +970,20 @@ sub0_sock_set_prefer_new(void *arg, const void *buf, size_t sz, nni_type t)
 	return (sub0_ctx_set_prefer_new(&sock->master, buf, sz, t));
 }
 
+static int
+sub0_sock_get_conflate(void *arg, void *buf, size_t *szp, nni_type t)
+{
+	sub0_sock *sock = arg;
+	return (sub0_ctx_get_conflate(&sock->master, buf, szp, t));
+}
+
+static int
+sub0_sock_set_conflate(void *arg, const void *buf, size_t sz, nni_type t)
+{
+	sub0_sock *sock = arg;
+	return (sub0_ctx_set_conflate(&sock->master, buf, sz, t));
+}
+
 // This is the global protocol structure -- our linkage to the core.
 // This should be the only global non-static symbol in this file.
 static nni_proto_pipe_ops sub0_pipe_ops = {
@@ -700,6 +1027,11 @@ static nni_option sub0_sock_options[] = {
 	    .o_get  = sub0_sock_get_prefer_new,
 	    .o_set  = sub0_sock_set_prefer_new,
 	},
+	{
+	    .o_name = NNG_OPT_SUB_CONFLATE,
+	    .o_get  = sub0_sock_get_conflate,
+	    .o_set  = sub0_sock_set_conflate,
+	},
 	// terminate list
 	{
 	    .o_name = NULL,
@@ -523,6 +523,90 @@ test_sub_filter(void)
 	TEST_NNG_PASS(nng_close(pub));
 }
 
+// sub_check_filter sends each message, then a sentinel, and verifies that
+// exactly the expected messages (in order) arrive ahead of the sentinel.
+static void
+sub_check_filter(
+    nng_socket pub, nng_socket sub, const char **sends, const char **expect)
+{
+	char   buf[32];
+	size_t sz;
+
+	for (int i = 0; sends[i] != NULL; i++) {
+		TEST_NNG_PASS(
+		    nng_send(pub, (void *) sends[i], strlen(sends[i]), 0));
+	}
+	TEST_NNG_PASS(nng_send(pub, "~end", 4, 0));
+	for (int i = 0; expect[i] != NULL; i++) {
+		sz = sizeof(buf);
+		TEST_NNG_PASS(nng_recv(sub, buf, &sz, 0));
+		TEST_CHECK(sz == strlen(expect[i]));
+		TEST_CHECK(memcmp(buf, expect[i], sz) == 0);
+		TEST_MSG("expected %s", expect[i]);
+	}
+	sz = sizeof(buf);
+	TEST_NNG_PASS(nng_recv(sub, buf, &sz, 0));
+	TEST_CHECK(sz == 4);
+	TEST_CHECK(memcmp(buf, "~end", 4) == 0);
+}
+
+static void
+test_sub_filter_overlap(void)
+{
+	nng_socket  sub;
+	nng_socket  pub;
+	const char *opt1 = NNG_OPT_SUB_SUBSCRIBE;
+	const char *opt2 = NNG_OPT_SUB_UNSUBSCRIBE;
+	const char *all[] = { "a", "ab", "abz", "abc1", "abd", "abcdefg", "x1",
+		"y", NULL };
+	const char *exp1[] = { "ab", "abz", "abc1", "abd", "abcdefg", "x1",
+		NULL };
+	const char *exp2[] = { "abc1", "abd", "abcdefg", "x1", NULL };
+	const char *exp3[] = { "abd", "abcdefg", "x1", NULL };
+	const char *exp4[] = { "x1", NULL };
+
+	TEST_NNG_PASS(nng_sub0_open(&sub));
+	TEST_NNG_PASS(nng_pub0_open(&pub));
+	TEST_NNG_PASS(nng_setopt_ms(pub, NNG_OPT_SENDTIMEO, 1000));
+	TEST_NNG_PASS(nng_setopt_ms(sub, NNG_OPT_RECVTIMEO, 1000));
+	TEST_NNG_PASS(nng_setopt_int(sub, NNG_OPT_RECVBUF, 32));
+
+	// Subscriptions that share prefixes with each other, added in an
+	// order that forces edges to be split.
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "~end", 4));
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "abcdef", 6));
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "abd", 3));
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "abc", 3));
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "ab", 2));
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "ab", 2));
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "x", 1));
+
+	TEST_NNG_PASS(testutil_marry(pub, sub));
+
+	sub_check_filter(pub, sub, all, exp1);
+
+	TEST_NNG_PASS(nng_setopt(sub, opt2, "ab", 2));
+	TEST_NNG_FAIL(nng_setopt(sub, opt2, "ab", 2), NNG_ENOENT);
+	TEST_NNG_FAIL(nng_setopt(sub, opt2, "abcd", 4), NNG_ENOENT);
+	sub_check_filter(pub, sub, all, exp2);
+
+	TEST_NNG_PASS(nng_setopt(sub, opt2, "abc", 3));
+	sub_check_filter(pub, sub, all, exp3);
+
+	TEST_NNG_PASS(nng_setopt(sub, opt2, "abcdef", 6));
+	TEST_NNG_PASS(nng_setopt(sub, opt2, "abd", 3));
+	sub_check_filter(pub, sub, all, exp4);
+
+	// The empty subscription matches everything.
+	TEST_NNG_PASS(nng_setopt(sub, opt1, "", 0));
+	sub_check_filter(pub, sub, all, all);
+	TEST_NNG_PASS(nng_setopt(sub, opt2, "", 0));
+	sub_check_filter(pub, sub, all, exp4);
+
+	TEST_NNG_PASS(nng_close(sub));
+	TEST_NNG_PASS(nng_close(pub));
+}
+
 static void
 test_sub_multi_context(void)
 {
@@ -598,6 +682,42 @@ test_sub_multi_context(void)
 	nng_aio_free(aio2);
 }
 
+void
+test_sub_conflate(void)
+{
+	nng_socket sub;
+	nng_socket pub;
+	nng_msg *  msg;
+	bool       b;
+
+	TEST_NNG_PASS(nng_sub0_open(&sub));
+	TEST_NNG_PASS(nng_pub0_open(&pub));
+	TEST_NNG_PASS(nng_getopt_bool(sub, NNG_OPT_SUB_CONFLATE, &b));
+	TEST_CHECK(!b);
+	TEST_NNG_PASS(nng_setopt_bool(sub, NNG_OPT_SUB_CONFLATE, true));
+	TEST_NNG_PASS(nng_getopt_bool(sub, NNG_OPT_SUB_CONFLATE, &b));
+	TEST_CHECK(b);
+	TEST_NNG_PASS(nng_setopt_int(sub, NNG_OPT_RECVBUF, 2));
+	TEST_NNG_PASS(nng_setopt(sub, NNG_OPT_SUB_SUBSCRIBE, "a/", 2));
+	TEST_NNG_PASS(nng_setopt(sub, NNG_OPT_SUB_SUBSCRIBE, "b/", 2));
+	TEST_NNG_PASS(nng_setopt_ms(sub, NNG_OPT_RECVTIMEO, 200));
+	TEST_NNG_PASS(nng_setopt_ms(pub, NNG_OPT_SENDTIMEO, 1000));
+	TEST_NNG_PASS(testutil_marry(pub, sub));
+	TEST_NNG_SEND_STR(pub, "a/1");
+	TEST_NNG_SEND_STR(pub, "b/1");
+	TEST_NNG_SEND_STR(pub, "a/2");
+	TEST_NNG_SEND_STR(pub, "a/3");
+	TEST_NNG_SEND_STR(pub, "b/2");
+	testutil_sleep(100);
+	// Each takes the place of the last for its subscription, so the
+	// queue never overflows, and only the newest of each remain.
+	TEST_NNG_RECV_STR(sub, "a/3");
+	TEST_NNG_RECV_STR(sub, "b/2");
+	TEST_NNG_FAIL(nng_recvmsg(sub, &msg, 0), NNG_ETIMEDOUT);
+	TEST_NNG_PASS(nng_close(pub));
+	TEST_NNG_PASS(nng_close(sub));
+}
+
 static void
 test_sub_cooked(void)
 {
@@ -630,7 +750,9 @@ TEST_LIST = {
 	{ "sub prefer new option", test_sub_prefer_new_option },
 	{ "sub drop new", test_sub_drop_new },
 	{ "sub drop old", test_sub_drop_old },
+	{ "sub conflate", test_sub_conflate },
 	{ "sub filter", test_sub_filter },
+	{ "sub filter overlap", test_sub_filter_overlap },
 	{ "sub multi context", test_sub_multi_context },
 	{ "sub cooked", test_sub_cooked },
 	{ NULL, NULL },
@@ -48,6 +48,54 @@ extern int   nni_http_res_parse(nni_http_res *, void *, size_t, size_t *);
 extern void  nni_http_res_get_data(nni_http_res *, void **, size_t *);
 extern char *nni_http_res_headers(nni_http_res *);
 
+// File content cache, used by the file and directory handlers.  Files
+// are reference counted, and a file handed out by the cache stays valid
+// until it is released, even if it is evicted from the cache.
+typedef struct nni_http_file  nni_http_file;
+typedef struct nni_http_cache nni_http_cache;
+
+// nni_http_cache_init creates a cache, which is empty and limited to no
+// size at all until nni_http_cache_set_size is called.  Its statistics
+// are registered under a scope named for the (unique) server id, which
+// also reports the server's host and port.
+extern int  nni_http_cache_init(
+    nni_http_cache **, uint32_t, const char *, const char *);
+extern void nni_http_cache_fini(nni_http_cache *);
+
+// nni_http_cache_set_size sets the total number of bytes of file content
+// the cache may hold, evicting files as needed.  Zero disables it.
+extern void nni_http_cache_set_size(nni_http_cache *, size_t);
+
+// nni_http_cache_get returns the content of the named file, from the cache
+// if it has not changed there, or else from the file system (in which case
+// it is added to the cache, if it fits).  The caller must release the file
+// with nni_http_file_rele, which can also be used as an nni_cb.
+extern int nni_http_cache_get(
+    nni_http_cache *, const char *, nni_http_file **);
+extern void nni_http_file_rele(void *);
+
+// NNI_HTTP_FILE_CHUNK is the most of a file that is read at once.  Files
+// larger than this that are not cached are not held in memory, but read
+// piece by piece as they are sent.
+#define NNI_HTTP_FILE_CHUNK (64 * 1024)
+
+// nni_http_file_data returns the content and size of the file.  The content
+// is NULL if the file is not held in memory, and must be read instead,
+// with nni_http_file_read.
+extern void nni_http_file_data(nni_http_file *, void **, uint64_t *);
+
+// nni_http_file_read reads up to the given size from the given offset,
+// returning the number of bytes read.  That is less than asked for only if
+// the file has become shorter since it was opened.
+extern int nni_http_file_read(
+    nni_http_file *, void *, size_t, uint64_t, size_t *);
+
+// nni_http_file_validators returns the modification time of the file (in
+// nanoseconds), its file number, and the time formatted as an HTTP date,
+// if they are known.
+extern bool nni_http_file_validators(
+    nni_http_file *, uint64_t *, uint64_t *, char **);
+
 // Chunked transfer encoding.  For the moment this is not part of our public
 // API.  We can change that later.
 
@@ -132,6 +180,8 @@ extern int nni_http_req_copy_data(nni_http_req *, const void *, size_t);
 extern int nni_http_res_copy_data(nni_http_res *, const void *, size_t);
 extern int nni_http_req_set_data(nni_http_req *, const void *, size_t);
 extern int nni_http_res_set_data(nni_http_res *, const void *, size_t);
+extern int nni_http_res_set_data_dtor(
+    nni_http_res *, const void *, size_t, nni_cb, void *);
 extern int nni_http_req_alloc_data(nni_http_req *, size_t);
 extern int nni_http_res_alloc_data(nni_http_res *, size_t);
 extern const char *nni_http_req_get_method(nni_http_req *);
@@ -226,6 +276,11 @@ extern int nni_http_server_set_error_page(
 extern int nni_http_server_set_error_file(
     nni_http_server *, uint16_t, const char *);
 
+// nni_http_server_set_cache sets the amount of file content, in bytes,
+// that the server may keep in memory for its file and directory handlers.
+// Zero, the default, disables the cache.
+extern void nni_http_server_set_cache(nni_http_server *, size_t);
+
 // nni_http_server_res_error takes replaces the body of the res with
 // a custom error page previously set for the server, using the status
 // of the res.  The res must have the status set first.
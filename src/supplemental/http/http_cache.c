@@ -0,0 +1,391 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "core/nng_impl.h"
+#include "http_api.h"
+
+// The file cache keeps the content of recently served files, so that a
+// request for a file that has not changed does not have to open and read
+// it again.  Each request still checks the file's size and modification
+// time, so changes are seen at once.  Only copies are kept, never the file
+// itself, so what is sent cannot change (or vanish) while it is sent.
+// Files that are too large to cache are opened and read piecewise.
+//
+// Files are looked up by a hash of their path, using an ID hash.  Two
+// paths with the same hash cannot both be cached; the later one simply
+// replaces the earlier.  The entries are also kept on a list, most
+// recently used first, and the least recently used are evicted to stay
+// within the size limit.
+
+struct nni_http_file {
+	nni_atomic_u64   f_ref;
+	nni_list_node    f_node;
+	char *           f_path;
+	uint64_t         f_key;
+	void *           f_data; // content, if held in memory
+	nni_file_handle *f_fh;   // otherwise, where to read it from
+	uint64_t         f_size;
+	uint64_t         f_mtime; // nanoseconds
+	uint64_t         f_id;    // file (inode) number
+	bool             f_valid; // size, mtime and id are known
+	char             f_lastmod[64];
+};
+
+struct nni_http_cache {
+	nni_mtx       c_mtx;
+	nni_idhash *  c_files;
+	nni_list      c_lru;
+	size_t        c_bytes;
+	size_t        c_max;
+	char          c_scope[24]; // "http-server%u"
+	char *        c_host;
+	char *        c_port;
+	nni_stat_item c_root;
+	nni_stat_item c_host_stat;
+	nni_stat_item c_port_stat;
+	nni_stat_item c_hits;
+	nni_stat_item c_misses;
+	nni_stat_item c_size;
+	nni_stat_item c_entries;
+};
+
+static uint64_t
+http_cache_key(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+
+	while (*path != '\0') {
+		h ^= (uint8_t) *path++;
+		h *= 0x100000001b3ull;
+	}
+	return (h);
+}
+
+// http_cache_date formats the time as an HTTP date (RFC 7231, IMF-fixdate),
+// such as "Sun, 06 Nov 1994 08:49:37 GMT".  This is done by hand, because
+// the C library routines depend on the locale, and are not all reentrant.
+static void
+http_cache_date(char *buf, size_t sz, uint64_t t)
+{
+	// The epoch was a Thursday.
+	static const char *wdays = "ThuFriSatSunMonTueWed";
+	static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	uint64_t           ndays  = t / 86400;
+	unsigned           secs   = (unsigned) (t % 86400);
+	uint64_t           z      = ndays + 719468;
+	uint64_t           era    = z / 146097;
+	unsigned           doe    = (unsigned) (z - era * 146097);
+	unsigned           yoe;
+	unsigned           doy;
+	unsigned           mp;
+	unsigned           day;
+	unsigned           month;
+	uint64_t           year;
+
+	// Converting days to a civil date, as described by Howard Hinnant.
+	yoe   = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy   = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp    = (5 * doy + 2) / 153;
+	day   = doy - (153 * mp + 2) / 5 + 1;
+	month = mp < 10 ? mp + 3 : mp - 9;
+	year  = (uint64_t) yoe + era * 400 + (month <= 2 ? 1 : 0);
+
+	(void) snprintf(buf, sz, "%.3s, %02u %.3s %04llu %02u:%02u:%02u GMT",
+	    wdays + (ndays % 7) * 3, day, months + (month - 1) * 3,
+	    (unsigned long long) year, secs / 3600, (secs / 60) % 60,
+	    secs % 60);
+}
+
+static void
+http_file_free(nni_http_file *f)
+{
+	if (f->f_fh != NULL) {
+		nni_file_close(f->f_fh);
+	} else if (f->f_size > 0) {
+		nni_free(f->f_data, (size_t) f->f_size);
+	}
+	nni_strfree(f->f_path);
+	NNI_FREE_STRUCT(f);
+}
+
+void
+nni_http_file_rele(void *arg)
+{
+	nni_http_file *f = arg;
+
+	if (nni_atomic_dec64_nv(&f->f_ref) == 0) {
+		http_file_free(f);
+	}
+}
+
+void
+nni_http_file_data(nni_http_file *f, void **datap, uint64_t *sizep)
+{
+	*datap = f->f_data;
+	*sizep = f->f_size;
+}
+
+int
+nni_http_file_read(
+    nni_http_file *f, void *buf, size_t len, uint64_t off, size_t *np)
+{
+	if (f->f_fh == NULL) {
+		// Held in memory; the caller would not normally do this.
+		if (off >= f->f_size) {
+			*np = 0;
+		} else {
+			uint64_t left = f->f_size - off;
+
+			*np = len < left ? len : (size_t) left;
+			memcpy(buf, (char *) f->f_data + off, *np);
+		}
+		return (0);
+	}
+	return (nni_file_pread(f->f_fh, buf, len, off, np));
+}
+
+bool
+nni_http_file_validators(
+    nni_http_file *f, uint64_t *mtimep, uint64_t *idp, char **lastmodp)
+{
+	if (!f->f_valid) {
+		return (false);
+	}
+	*mtimep   = f->f_mtime;
+	*idp      = f->f_id;
+	*lastmodp = f->f_lastmod;
+	return (true);
+}
+
+// http_file_load reads the file into memory if whole is true, or if
+// it cannot be read piecewise, and otherwise opens it to be read later.
+static int
+http_file_load(const char *path, bool whole, nni_http_file **fp)
+{
+	nni_http_file *f;
+	size_t         size;
+	int            rv;
+
+	if ((f = NNI_ALLOC_STRUCT(f)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	nni_atomic_init64(&f->f_ref);
+	nni_atomic_set64(&f->f_ref, 1);
+	NNI_LIST_NODE_INIT(&f->f_node);
+	if ((f->f_path = nni_strdup(path)) == NULL) {
+		NNI_FREE_STRUCT(f);
+		return (NNG_ENOMEM);
+	}
+	rv = whole ? NNG_ENOTSUP : nni_file_open(path, &f->f_fh, &f->f_size);
+	if (rv == NNG_ENOTSUP) {
+		f->f_fh = NULL;
+		if ((rv = nni_file_get(path, &f->f_data, &size)) == 0) {
+			f->f_size = size;
+		}
+	}
+	if (rv != 0) {
+		nni_strfree(f->f_path);
+		NNI_FREE_STRUCT(f);
+		return (rv);
+	}
+	*fp = f;
+	return (0);
+}
+
+// http_cache_remove takes the file out of the cache, and drops the
+// cache's reference.  The cache lock must be held.
+static void
+http_cache_remove(nni_http_cache *c, nni_http_file *f)
+{
+	nni_idhash_remove(c->c_files, f->f_key);
+	nni_list_remove(&c->c_lru, f);
+	c->c_bytes -= (size_t) f->f_size;
+	nni_stat_dec_atomic(&c->c_size, f->f_size);
+	nni_stat_dec_atomic(&c->c_entries, 1);
+	nni_http_file_rele(f);
+}
+
+// http_cache_trim evicts the least recently used files, until the total
+// size is no more than max.  The cache lock must be held.
+static void
+http_cache_trim(nni_http_cache *c, size_t max)
+{
+	nni_http_file *f;
+
+	while (c->c_bytes > max) {
+		f = nni_list_last(&c->c_lru);
+		http_cache_remove(c, f);
+	}
+}
+
+int
+nni_http_cache_get(nni_http_cache *c, const char *path, nni_http_file **fp)
+{
+	nni_http_file *f;
+	uint64_t       key;
+	uint64_t       size;
+	uint64_t       mtime;
+	uint64_t       id;
+	size_t         max;
+	void *         other;
+	int            rv;
+
+	if ((rv = nni_file_info(path, &size, &mtime, &id)) != 0) {
+		if (rv != NNG_ENOTSUP) {
+			return (rv);
+		}
+		// Not a regular file, so it cannot be validated or cached.
+		nni_stat_inc_atomic(&c->c_misses, 1);
+		return (http_file_load(path, true, fp));
+	}
+
+	key = http_cache_key(path);
+	nni_mtx_lock(&c->c_mtx);
+	max = c->c_max;
+	if (nni_idhash_find(c->c_files, key, (void **) &f) == 0) {
+		if ((strcmp(f->f_path, path) == 0) && (f->f_mtime == mtime) &&
+		    (f->f_id == id) && (f->f_size == size)) {
+			nni_list_remove(&c->c_lru, f);
+			nni_list_prepend(&c->c_lru, f);
+			nni_atomic_inc64(&f->f_ref);
+			nni_mtx_unlock(&c->c_mtx);
+			nni_stat_inc_atomic(&c->c_hits, 1);
+			*fp = f;
+			return (0);
+		}
+		// Changed (or a different path); this will be replaced.
+		http_cache_remove(c, f);
+	}
+	nni_mtx_unlock(&c->c_mtx);
+
+	// Small files, and those we may cache, are read whole.  Others are
+	// read as they are sent, so they need not all be in memory at once.
+	nni_stat_inc_atomic(&c->c_misses, 1);
+	if ((rv = http_file_load(path,
+	         (size <= NNI_HTTP_FILE_CHUNK) || (size <= max), &f)) != 0) {
+		return (rv);
+	}
+	f->f_key   = key;
+	f->f_mtime = mtime;
+	f->f_id    = id;
+	f->f_valid = true;
+	http_cache_date(
+	    f->f_lastmod, sizeof(f->f_lastmod), mtime / 1000000000u);
+	if (f->f_size != size) {
+		// It changed while we were reading it.  Send what we
+		// have, but do not keep it, nor claim to know its age.
+		f->f_valid = false;
+		*fp        = f;
+		return (0);
+	}
+
+	nni_mtx_lock(&c->c_mtx);
+	if ((f->f_fh == NULL) && (c->c_max > 0) && (f->f_size <= c->c_max) &&
+	    (nni_idhash_find(c->c_files, key, &other) != 0) &&
+	    (nni_idhash_insert(c->c_files, key, f) == 0)) {
+		http_cache_trim(c, c->c_max - (size_t) f->f_size);
+		nni_list_prepend(&c->c_lru, f);
+		c->c_bytes += (size_t) f->f_size;
+		nni_atomic_inc64(&f->f_ref);
+		nni_stat_inc_atomic(&c->c_size, f->f_size);
+		nni_stat_inc_atomic(&c->c_entries, 1);
+	}
+	nni_mtx_unlock(&c->c_mtx);
+	*fp = f;
+	return (0);
+}
+
+void
+nni_http_cache_set_size(nni_http_cache *c, size_t max)
+{
+	nni_mtx_lock(&c->c_mtx);
+	c->c_max = max;
+	http_cache_trim(c, max);
+	nni_mtx_unlock(&c->c_mtx);
+}
+
+static void
+http_cache_stats_init(nni_http_cache *c, uint32_t id)
+{
+	(void) snprintf(c->c_scope, sizeof(c->c_scope), "http-server%u", id);
+	nni_stat_init_scope(&c->c_root, c->c_scope, "http server file cache");
+
+	nni_stat_init_string(
+	    &c->c_host_stat, "host", "server host name", c->c_host);
+	nni_stat_add(&c->c_root, &c->c_host_stat);
+
+	nni_stat_init_string(
+	    &c->c_port_stat, "port", "server port", c->c_port);
+	nni_stat_add(&c->c_root, &c->c_port_stat);
+
+	nni_stat_init_atomic(
+	    &c->c_hits, "hits", "files served from the cache");
+	nni_stat_add(&c->c_root, &c->c_hits);
+
+	nni_stat_init_atomic(
+	    &c->c_misses, "misses", "files read from the file system");
+	nni_stat_add(&c->c_root, &c->c_misses);
+
+	nni_stat_init_atomic(&c->c_size, "size", "size of cached files");
+	nni_stat_set_type(&c->c_size, NNG_STAT_LEVEL);
+	nni_stat_set_unit(&c->c_size, NNG_UNIT_BYTES);
+	nni_stat_add(&c->c_root, &c->c_size);
+
+	nni_stat_init_atomic(&c->c_entries, "entries", "cached files");
+	nni_stat_set_type(&c->c_entries, NNG_STAT_LEVEL);
+	nni_stat_add(&c->c_root, &c->c_entries);
+
+	nni_stat_register(&c->c_root);
+}
+
+int
+nni_http_cache_init(nni_http_cache **cp, uint32_t id, const char *host,
+    const char *port)
+{
+	nni_http_cache *c;
+	int             rv;
+
+	if ((c = NNI_ALLOC_STRUCT(c)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if (((c->c_host = nni_strdup(host)) == NULL) ||
+	    ((c->c_port = nni_strdup(port)) == NULL)) {
+		nni_strfree(c->c_host);
+		NNI_FREE_STRUCT(c);
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_idhash_init(&c->c_files)) != 0) {
+		nni_strfree(c->c_port);
+		nni_strfree(c->c_host);
+		NNI_FREE_STRUCT(c);
+		return (rv);
+	}
+	nni_mtx_init(&c->c_mtx);
+	NNI_LIST_INIT(&c->c_lru, nni_http_file, f_node);
+	http_cache_stats_init(c, id);
+	*cp = c;
+	return (0);
+}
+
+void
+nni_http_cache_fini(nni_http_cache *c)
+{
+	nni_stat_unregister(&c->c_root);
+	nni_mtx_lock(&c->c_mtx);
+	http_cache_trim(c, 0);
+	nni_mtx_unlock(&c->c_mtx);
+	nni_idhash_fini(c->c_files);
+	nni_mtx_fini(&c->c_mtx);
+	nni_strfree(c->c_port);
+	nni_strfree(c->c_host);
+	NNI_FREE_STRUCT(c);
+}
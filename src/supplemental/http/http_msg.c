@@ -32,6 +32,8 @@ typedef struct nni_http_entity {
 	size_t size; // allocated/expected size
 	size_t len;  // current length
 	bool   own;  // if true, data is "ours", and should be freed
+	nni_cb dtor; // if set, called with dtor_arg to release data
+	void * dtor_arg;
 } nni_http_entity;
 
 struct nng_http_req {
@@ -84,14 +86,25 @@ http_headers_reset(nni_list *hdrs)
 }
 
 static void
-http_entity_reset(nni_http_entity *entity)
+http_entity_release(nni_http_entity *entity)
 {
 	if (entity->own && entity->size) {
 		nni_free(entity->data, entity->size);
 	}
+	if (entity->dtor != NULL) {
+		entity->dtor(entity->dtor_arg);
+	}
+	entity->own      = false;
+	entity->dtor     = NULL;
+	entity->dtor_arg = NULL;
+}
+
+static void
+http_entity_reset(nni_http_entity *entity)
+{
+	http_entity_release(entity);
 	entity->data = NULL;
 	entity->size = 0;
-	entity->own  = false;
 }
 
 void
@@ -290,12 +303,9 @@ nni_http_res_get_header(nni_http_res *res, const char *key)
 static void
 http_entity_set_data(nni_http_entity *entity, const void *data, size_t size)
 {
-	if (entity->own) {
-		nni_free(entity->data, entity->size);
-	}
+	http_entity_release(entity);
 	entity->data = (void *) data;
 	entity->size = size;
-	entity->own  = false;
 }
 
 static int
@@ -323,8 +333,9 @@ http_entity_copy_data(nni_http_entity *entity, const void *data, size_t size)
 static int
 http_set_content_length(nni_http_entity *entity, nni_list *hdrs)
 {
-	char buf[16];
-	(void) snprintf(buf, sizeof(buf), "%u", (unsigned) entity->size);
+	char buf[24];
+	(void) snprintf(
+	    buf, sizeof(buf), "%llu", (unsigned long long) entity->size);
 	return (http_set_header(hdrs, "Content-Length", buf));
 }
 
@@ -372,6 +383,25 @@ nni_http_res_set_data(nni_http_res *res, const void *data, size_t size)
 	return (rv);
 }
 
+// nni_http_res_set_data_dtor is like nni_http_res_set_data, but the
+// response takes responsibility for the data, calling dtor with arg once
+// it is no longer needed (when the data is replaced, or the response is
+// reset or freed).  The dtor is called even if this fails.
+int
+nni_http_res_set_data_dtor(nni_http_res *res, const void *data, size_t size,
+    nni_cb dtor, void *arg)
+{
+	int rv;
+
+	if ((rv = nni_http_res_set_data(res, data, size)) != 0) {
+		dtor(arg);
+		return (rv);
+	}
+	res->data.dtor     = dtor;
+	res->data.dtor_arg = arg;
+	return (0);
+}
+
 int
 nni_http_req_copy_data(nni_http_req *req, const void *data, size_t size)
 {
@@ -766,6 +766,19 @@ nng_http_server_set_error_file(
 #endif
 }
 
+int
+nng_http_server_set_cache(nng_http_server *srv, size_t size)
+{
+#ifdef NNG_SUPP_HTTP
+	nni_http_server_set_cache(srv, size);
+	return (0);
+#else
+	NNI_ARG_UNUSED(srv);
+	NNI_ARG_UNUSED(size);
+	return (NNG_ENOTSUP);
+#endif
+}
+
 int
 nng_http_server_set_tls(nng_http_server *srv, struct nng_tls_config *cfg)
 {
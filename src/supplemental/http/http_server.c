@@ -63,6 +63,10 @@ typedef struct http_sconn {
 	nni_aio *         rxaio;
 	nni_aio *         txaio;
 	nni_aio *         txdataio;
+	nni_http_file *   txfile; // file body, sent after the response
+	uint64_t          txoff;
+	uint64_t          txlen;
+	void *            txbuf; // NNI_HTTP_FILE_CHUNK bytes, when needed
 	nni_reap_item     reap;
 } http_sconn;
 
@@ -88,6 +92,7 @@ struct nng_http_server {
 	char *               hostname;
 	nni_list             errors;
 	nni_mtx              errors_mtx;
+	nni_http_cache *     cache;
 	nni_reap_item        reap;
 };
 
@@ -265,6 +270,7 @@ nni_http_handler_set_method(nni_http_handler *h, const char *method)
 
 static nni_list http_servers;
 static nni_mtx  http_servers_lk;
+static uint32_t http_servers_seq; // protected by http_servers_lk
 
 static void
 http_sconn_reap(void *arg)
@@ -283,6 +289,12 @@ http_sconn_reap(void *arg)
 	}
 	nni_http_req_free(sc->req);
 	nni_http_res_free(sc->res);
+	if (sc->txfile != NULL) {
+		nni_http_file_rele(sc->txfile);
+	}
+	if (sc->txbuf != NULL) {
+		nni_free(sc->txbuf, NNI_HTTP_FILE_CHUNK);
+	}
 	nni_aio_free(sc->rxaio);
 	nni_aio_free(sc->txaio);
 	nni_aio_free(sc->txdataio);
@@ -331,6 +343,38 @@ http_sconn_close(http_sconn *sc)
 	nni_mtx_unlock(&s->mtx);
 }
 
+// http_sconn_txfile sends the next piece of a file body.  The file is read
+// as it goes, so that only a piece of it is held in memory at a time.
+static void
+http_sconn_txfile(http_sconn *sc)
+{
+	nni_iov iov;
+	size_t  n;
+
+	if ((sc->txbuf == NULL) &&
+	    ((sc->txbuf = nni_alloc(NNI_HTTP_FILE_CHUNK)) == NULL)) {
+		http_sconn_close(sc);
+		return;
+	}
+	n = sc->txlen < NNI_HTTP_FILE_CHUNK ? (size_t) sc->txlen
+	                                    : NNI_HTTP_FILE_CHUNK;
+	if ((nni_http_file_read(sc->txfile, sc->txbuf, n, sc->txoff, &n) !=
+	        0) ||
+	    (n == 0)) {
+		// The file got shorter (or failed) while we were sending it.
+		// The Content-Length is already gone, so all we can do is
+		// close the connection, so that the client sees it is short.
+		http_sconn_close(sc);
+		return;
+	}
+	sc->txoff += n;
+	sc->txlen -= n;
+	iov.iov_buf = sc->txbuf;
+	iov.iov_len = n;
+	nni_aio_set_iov(sc->txdataio, 1, &iov);
+	nni_http_write_full(sc->conn, sc->txdataio);
+}
+
 static void
 http_sconn_txdatdone(void *arg)
 {
@@ -341,6 +385,12 @@ http_sconn_txdatdone(void *arg)
 		http_sconn_close(sc);
 		return;
 	}
+	if (sc->txlen > 0) {
+		http_sconn_txfile(sc);
+		return;
+	}
+	nni_http_file_rele(sc->txfile);
+	sc->txfile = NULL;
 
 	nni_http_res_free(sc->res);
 	sc->res = NULL;
@@ -366,6 +416,11 @@ http_sconn_txdone(void *arg)
 		return;
 	}
 
+	if (sc->txfile != NULL) {
+		http_sconn_txfile(sc);
+		return;
+	}
+
 	if (sc->close) {
 		http_sconn_close(sc);
 		return;
@@ -797,6 +852,10 @@ http_sconn_cbdone(void *arg)
 			// the HTTP header.
 			nni_http_res_get_data(res, &data, &size);
 			nni_http_res_set_data(res, NULL, size);
+			if (sc->txfile != NULL) {
+				nni_http_file_rele(sc->txfile);
+				sc->txfile = NULL;
+			}
 		} else if (nni_http_res_is_error(res)) {
 			(void) nni_http_server_res_error(s, res);
 		}
@@ -916,6 +975,9 @@ http_server_fini(nni_http_server *s)
 	nni_mtx_unlock(&s->errors_mtx);
 	nni_mtx_fini(&s->errors_mtx);
 
+	if (s->cache != NULL) {
+		nni_http_cache_fini(s->cache);
+	}
 	nni_aio_free(s->accaio);
 	nni_mtx_fini(&s->mtx);
 	nni_strfree(s->hostname);
@@ -966,6 +1028,15 @@ http_server_init(nni_http_server **serverp, const nni_url *url)
 		return (NNG_ENOMEM);
 	}
 
+	// Servers on the same port may differ by host, and a server may
+	// outlive a closed one with the same address, so statistics scopes
+	// are numbered instead.  The caller holds http_servers_lk.
+	if ((rv = nni_http_cache_init(&s->cache, ++http_servers_seq,
+	         url->u_hostname, url->u_port)) != 0) {
+		http_server_fini(s);
+		return (rv);
+	}
+
 	if ((rv = nng_stream_listener_alloc_url(&s->listener, &myurl)) != 0) {
 		http_server_fini(s);
 		return (rv);
@@ -1135,6 +1206,12 @@ nni_http_server_set_error_file(
 	return (rv);
 }
 
+void
+nni_http_server_set_cache(nni_http_server *s, size_t size)
+{
+	nni_http_cache_set_size(s->cache, size);
+}
+
 int
 nni_http_server_res_error(nni_http_server *s, nni_http_res *res)
 {
@@ -1367,65 +1444,399 @@ typedef struct http_file {
 } http_file;
 
 static void
-http_handle_file(nni_aio *aio)
+http_file_error(nni_aio *aio, int rv)
 {
-	nni_http_handler *h   = nni_aio_get_input(aio, 1);
-	nni_http_res *    res = NULL;
-	void *            data;
-	size_t            size;
-	int               rv;
-	http_file *       hf = nni_http_handler_get_data(h);
-	const char *      ctype;
+	nni_http_res *res;
+	uint16_t      status;
+
+	switch (rv) {
+	case NNG_ENOMEM:
+		status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
+		break;
+	case NNG_ENOENT:
+		status = NNG_HTTP_STATUS_NOT_FOUND;
+		break;
+	case NNG_EPERM:
+		status = NNG_HTTP_STATUS_FORBIDDEN;
+		break;
+	default:
+		status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
+		break;
+	}
+	if ((rv = nni_http_res_alloc_error(&res, status)) != 0) {
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_aio_set_output(aio, 0, res);
+	nni_aio_finish(aio, 0, 0);
+}
 
-	if ((ctype = hf->ctype) == NULL) {
-		ctype = "application/octet-stream";
+static bool
+http_range_num(const char **sp, uint64_t *valp)
+{
+	const char *s = *sp;
+	uint64_t    v = 0;
+
+	if (!isdigit((unsigned char) *s)) {
+		return (false);
+	}
+	while (isdigit((unsigned char) *s)) {
+		if (v > (UINT64_MAX - 9) / 10) {
+			return (false);
+		}
+		v = (v * 10) + (uint64_t)(*s - '0');
+		s++;
 	}
+	*sp   = s;
+	*valp = v;
+	return (true);
+}
 
-	// This is a very simplistic file server, suitable only for small
-	// files.  In the future we can use an AIO based file read, where
-	// we read files a bit at a time, or even mmap them, and serve
-	// them up chunkwise.  Applications could even come up with their own
-	// caching version of the http handler.
-	if ((rv = nni_file_get(hf->path, &data, &size)) != 0) {
-		uint16_t status;
-		switch (rv) {
-		case NNG_ENOMEM:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
-			break;
-		case NNG_ENOENT:
-			status = NNG_HTTP_STATUS_NOT_FOUND;
-			break;
-		case NNG_EPERM:
-			status = NNG_HTTP_STATUS_FORBIDDEN;
-			break;
-		default:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
+// http_file_range works out what part of a file to send, given the
+// request's Range header, if any.  Only a single range of bytes is
+// supported ("bytes=first-last", "bytes=first-", or "bytes=-suffix").
+// Anything else is ignored, and the whole file is sent, which RFC 7233
+// permits.  The status to send is returned.
+static uint16_t
+http_file_range(
+    const char *range, uint64_t size, uint64_t *offp, uint64_t *lenp)
+{
+	uint64_t first;
+	uint64_t last;
+
+	*offp = 0;
+	*lenp = size;
+	if ((range == NULL) || (nni_strncasecmp(range, "bytes=", 6) != 0)) {
+		return (NNG_HTTP_STATUS_OK);
+	}
+	range += 6;
+	while (*range == ' ') {
+		range++;
+	}
+	if (*range == '-') {
+		range++;
+		if (!http_range_num(&range, &last)) {
+			return (NNG_HTTP_STATUS_OK);
+		}
+		if ((last == 0) || (size == 0)) {
+			first = size; // nothing to send
+		} else {
+			first = (last < size) ? size - last : 0;
+		}
+		last = size - 1;
+	} else {
+		if ((!http_range_num(&range, &first)) || (*range++ != '-')) {
+			return (NNG_HTTP_STATUS_OK);
+		}
+		if (!http_range_num(&range, &last)) {
+			last = UINT64_MAX;
+		} else if (last < first) {
+			return (NNG_HTTP_STATUS_OK);
+		}
+	}
+	while (*range == ' ') {
+		range++;
+	}
+	if (*range != '\0') {
+		// Multiple ranges, or garbage.
+		return (NNG_HTTP_STATUS_OK);
+	}
+	if (first >= size) {
+		return (NNG_HTTP_STATUS_RANGE_NOT_SATISFIABLE);
+	}
+	if (last >= size) {
+		last = size - 1;
+	}
+	*offp = first;
+	*lenp = last - first + 1;
+	return (NNG_HTTP_STATUS_PARTIAL_CONTENT);
+}
+
+// http_accepts_gzip returns true if the request's Accept-Encoding header
+// lists gzip, without a quality of zero.
+static bool
+http_accepts_gzip(nni_http_req *req)
+{
+	const char *s;
+	size_t      n;
+
+	if ((s = nni_http_req_get_header(req, "Accept-Encoding")) == NULL) {
+		return (false);
+	}
+	for (;;) {
+		while ((*s == ' ') || (*s == ',')) {
+			s++;
+		}
+		if (*s == '\0') {
+			return (false);
+		}
+		n = strcspn(s, " ;,");
+		if ((n == 4) && (nni_strncasecmp(s, "gzip", 4) == 0)) {
 			break;
 		}
-		if ((rv = nni_http_res_alloc_error(&res, status)) != 0) {
+		s += strcspn(s, ",");
+	}
+	s += 4;
+	while ((*s == ' ') || (*s == ';')) {
+		s++;
+	}
+	if (nni_strncasecmp(s, "q=0", 3) != 0) {
+		return (true);
+	}
+	// "q=0", "q=0." and "q=0.000" are all zero, but "q=0.5" is not.
+	s += 3;
+	if (*s == '.') {
+		s++;
+		while (*s == '0') {
+			s++;
+		}
+	}
+	return (isdigit((unsigned char) *s) != 0);
+}
+
+// http_etag_match returns true if the list of entity tags, from an
+// If-None-Match header, includes the given tag.  This is the weak
+// comparison, so a "W/" prefix on a listed tag is ignored.
+static bool
+http_etag_match(const char *list, const char *etag)
+{
+	size_t len = strlen(etag);
+
+	for (;;) {
+		while ((*list == ' ') || (*list == ',')) {
+			list++;
+		}
+		if (*list == '\0') {
+			return (false);
+		}
+		if (*list == '*') {
+			return (true);
+		}
+		if (strncmp(list, "W/", 2) == 0) {
+			list += 2;
+		}
+		if ((strncmp(list, etag, len) == 0) &&
+		    ((list[len] == '\0') || (list[len] == ',') ||
+		        (list[len] == ' '))) {
+			return (true);
+		}
+		list += strcspn(list, ",");
+	}
+}
+
+// http_not_modified returns true if the client's copy of the file, as
+// described by its If-None-Match or If-Modified-Since header, is current.
+// If-Modified-Since must match our Last-Modified exactly.  Clients send
+// back the date they were given, and this means we need not parse dates.
+static bool
+http_not_modified(nni_http_req *req, const char *etag, const char *lastmod)
+{
+	const char *s;
+
+	if ((s = nni_http_req_get_header(req, "If-None-Match")) != NULL) {
+		return (http_etag_match(s, etag));
+	}
+	if ((s = nni_http_req_get_header(req, "If-Modified-Since")) != NULL) {
+		return (strcmp(s, lastmod) == 0);
+	}
+	return (false);
+}
+
+// http_if_range returns true if a Range request should be honored.  If
+// it carries an If-Range header, that must name the current file exactly,
+// by either its entity tag or its date; otherwise the whole file is sent.
+static bool
+http_if_range(nni_http_req *req, const char *etag, const char *lastmod)
+{
+	const char *s;
+
+	if ((s = nni_http_req_get_header(req, "If-Range")) == NULL) {
+		return (true);
+	}
+	if (etag == NULL) {
+		return (false);
+	}
+	return ((strcmp(s, etag) == 0) || (strcmp(s, lastmod) == 0));
+}
+
+// http_file_headers sets the validators for the file (if known), and
+// the headers describing its encoding.
+static int
+http_file_headers(nni_http_res *res, const char *etag, const char *lastmod,
+    bool gzip, bool vary)
+{
+	int rv;
+
+	if ((etag != NULL) &&
+	    (((rv = nni_http_res_set_header(res, "ETag", etag)) != 0) ||
+	        ((rv = nni_http_res_set_header(
+	              res, "Last-Modified", lastmod)) != 0))) {
+		return (rv);
+	}
+	if (gzip &&
+	    ((rv = nni_http_res_set_header(res, "Content-Encoding", "gzip")) !=
+	        0)) {
+		return (rv);
+	}
+	if (vary &&
+	    ((rv = nni_http_res_set_header(res, "Vary", "Accept-Encoding")) !=
+	        0)) {
+		return (rv);
+	}
+	return (0);
+}
+
+// http_serve_file finishes the handler aio with a response for the
+// file at path, or for the requested range of it.  If the client accepts
+// gzip, and there is a file of the same name with ".gz" appended, then
+// that is sent instead.  Files come from the server's cache, which reads
+// them from the file system only when they are not there, or have changed.
+static void
+http_serve_file(nni_aio *aio, const char *path, const char *ctype)
+{
+	nni_http_req *  req   = nni_aio_get_input(aio, 0);
+	nni_http_conn * conn  = nni_aio_get_input(aio, 2);
+	http_sconn *    sc    = nni_http_conn_get_ctx(conn);
+	nni_http_cache *cache = sc->server->cache;
+	nni_http_res *  res   = NULL;
+	nni_http_file * f     = NULL;
+	bool            gzip = false;
+	bool            vary = false;
+	void *          data;
+	uint64_t        size;
+	uint64_t        mtime;
+	uint64_t        id;
+	char *          lastmod = NULL;
+	char *          etag    = NULL;
+	char            etagbuf[80];
+	char *          gzpath;
+	uint16_t        status;
+	uint64_t        off;
+	uint64_t        len;
+	char            crange[64];
+	int             rv;
+
+	if (nni_asprintf(&gzpath, "%s.gz", path) == 0) {
+		if (http_accepts_gzip(req)) {
+			gzip = (nni_http_cache_get(cache, gzpath, &f) == 0);
+		}
+		// Whenever there is a compressed variant, caches must know
+		// that the response depends on Accept-Encoding, even when
+		// it is the plain file that is sent.
+		vary = gzip || nni_file_is_file(gzpath);
+		nni_strfree(gzpath);
+	}
+	if ((!gzip) && ((rv = nni_http_cache_get(cache, path, &f)) != 0)) {
+		http_file_error(aio, rv);
+		return;
+	}
+	nni_http_file_data(f, &data, &size);
+	if (nni_http_file_validators(f, &mtime, &id, &lastmod)) {
+		(void) snprintf(etagbuf, sizeof(etagbuf),
+		    "\"%llx-%llx-%llx%s\"", (unsigned long long) size,
+		    (unsigned long long) mtime, (unsigned long long) id,
+		    gzip ? "-gz" : "");
+		etag = etagbuf;
+	}
+
+	if ((etag != NULL) && http_not_modified(req, etag, lastmod)) {
+		if (((rv = nni_http_res_alloc(&res)) != 0) ||
+		    ((rv = nni_http_res_set_status(
+		          res, NNG_HTTP_STATUS_NOT_MODIFIED)) != 0) ||
+		    ((rv = http_file_headers(
+		          res, etag, lastmod, gzip, vary)) != 0)) {
+			nni_http_res_free(res);
+			nni_http_file_rele(f);
 			nni_aio_finish_error(aio, rv);
 			return;
 		}
+		nni_http_file_rele(f);
 		nni_aio_set_output(aio, 0, res);
 		nni_aio_finish(aio, 0, 0);
 		return;
 	}
+
+	status = http_file_range(http_if_range(req, etag, lastmod)
+	        ? nni_http_req_get_header(req, "Range")
+	        : NULL,
+	    size, &off, &len);
+	if (status == NNG_HTTP_STATUS_RANGE_NOT_SATISFIABLE) {
+		(void) snprintf(crange, sizeof(crange), "bytes */%llu",
+		    (unsigned long long) size);
+		nni_http_file_rele(f);
+		if (((rv = nni_http_res_alloc_error(&res, status)) != 0) ||
+		    ((rv = nni_http_res_set_header(
+		          res, "Content-Range", crange)) != 0) ||
+		    ((rv = http_file_headers(
+		          res, NULL, NULL, false, vary)) != 0)) {
+			nni_http_res_free(res);
+			nni_aio_finish_error(aio, rv);
+			return;
+		}
+		nni_aio_set_output(aio, 0, res);
+		nni_aio_finish(aio, 0, 0);
+		return;
+	}
+	(void) snprintf(crange, sizeof(crange), "bytes %llu-%llu/%llu",
+	    (unsigned long long) off, (unsigned long long) (off + len - 1),
+	    (unsigned long long) size);
+
 	if (((rv = nni_http_res_alloc(&res)) != 0) ||
-	    ((rv = nni_http_res_set_status(res, NNG_HTTP_STATUS_OK)) != 0) ||
+	    ((rv = nni_http_res_set_status(res, status)) != 0) ||
 	    ((rv = nni_http_res_set_header(res, "Content-Type", ctype)) !=
 	        0) ||
-	    ((rv = nni_http_res_copy_data(res, data, size)) != 0)) {
+	    ((rv = nni_http_res_set_header(res, "Accept-Ranges", "bytes")) !=
+	        0) ||
+	    ((rv = http_file_headers(res, etag, lastmod, gzip, vary)) != 0) ||
+	    ((status == NNG_HTTP_STATUS_PARTIAL_CONTENT) &&
+	        ((rv = nni_http_res_set_header(
+	              res, "Content-Range", crange)) != 0))) {
+		nni_http_res_free(res);
+		nni_http_file_rele(f);
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	if (data != NULL) {
+		// The response now holds the file, and releases it once it
+		// has been sent.
+		rv = nni_http_res_set_data_dtor(res, (char *) data + off,
+		    (size_t) len, nni_http_file_rele, f);
+	} else if ((uint64_t)(size_t) len != len) {
+		rv = NNG_EMSGSIZE;
+		nni_http_file_rele(f);
+	} else if ((rv = nni_http_res_set_data(res, NULL, (size_t) len)) ==
+	    0) {
+		// Only the headers go with the response; the connection
+		// reads and sends the body itself, once they are sent.
+		sc->txfile = f;
+		sc->txoff  = off;
+		sc->txlen  = len;
+	} else {
+		nni_http_file_rele(f);
+	}
+	if (rv != 0) {
 		nni_http_res_free(res);
-		nni_free(data, size);
 		nni_aio_finish_error(aio, rv);
 		return;
 	}
 
-	nni_free(data, size);
 	nni_aio_set_output(aio, 0, res);
 	nni_aio_finish(aio, 0, 0);
 }
 
+static void
+http_handle_file(nni_aio *aio)
+{
+	nni_http_handler *h  = nni_aio_get_input(aio, 1);
+	http_file *       hf = nni_http_handler_get_data(h);
+	const char *      ctype;
+
+	if ((ctype = hf->ctype) == NULL) {
+		ctype = "application/octet-stream";
+	}
+	http_serve_file(aio, hf->path, ctype);
+}
+
 static void
 http_file_free(void *arg)
 {
@@ -1493,9 +1904,6 @@ http_handle_dir(nni_aio *aio)
 {
 	nni_http_req *    req = nni_aio_get_input(aio, 0);
 	nni_http_handler *h   = nni_aio_get_input(aio, 1);
-	nni_http_res *    res = NULL;
-	void *            data;
-	size_t            size;
 	int               rv;
 	http_file *       hf   = nni_http_handler_get_data(h);
 	const char *      path = hf->path;
@@ -1545,12 +1953,6 @@ http_handle_dir(nni_aio *aio)
 
 	*dst = '\0';
 
-	// This is a very simplistic file server, suitable only for small
-	// files.  In the future we can use an AIO based file read, where
-	// we read files a bit at a time, or even mmap them, and serve
-	// them up chunkwise.  Applications could even come up with their
-	// own caching version of the http handler.
-
 	rv = 0;
 	if (nni_file_is_dir(pn)) {
 		sprintf(dst, "%s%s", NNG_PLATFORM_DIR_SEP, "index.html");
@@ -1562,58 +1964,16 @@ http_handle_dir(nni_aio *aio)
 		}
 	}
 
-	if (rv == 0) {
-		rv = nni_file_get(pn, &data, &size);
-	} else {
-		data = NULL;
-		size = 0;
-	}
-	ctype = http_lookup_type(pn);
-	if (ctype == NULL) {
-		ctype = "application/octet-stream";
-	}
-
-	nni_free(pn, pnsz);
 	if (rv != 0) {
-		uint16_t status;
-
-		switch (rv) {
-		case NNG_ENOMEM:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
-			break;
-		case NNG_ENOENT:
-			status = NNG_HTTP_STATUS_NOT_FOUND;
-			break;
-		case NNG_EPERM:
-			status = NNG_HTTP_STATUS_FORBIDDEN;
-			break;
-		default:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
-			break;
-		}
-		if ((rv = nni_http_res_alloc_error(&res, status)) != 0) {
-			nni_aio_finish_error(aio, rv);
-			return;
-		}
-		nni_aio_set_output(aio, 0, res);
-		nni_aio_finish(aio, 0, 0);
+		nni_free(pn, pnsz);
+		http_file_error(aio, rv);
 		return;
 	}
-
-	if (((rv = nni_http_res_alloc(&res)) != 0) ||
-	    ((rv = nni_http_res_set_status(res, NNG_HTTP_STATUS_OK)) != 0) ||
-	    ((rv = nni_http_res_set_header(res, "Content-Type", ctype)) !=
-	        0) ||
-	    ((rv = nni_http_res_copy_data(res, data, size)) != 0)) {
-		nni_http_res_free(res);
-		nni_free(data, size);
-		nni_aio_finish_error(aio, rv);
-		return;
+	if ((ctype = http_lookup_type(pn)) == NULL) {
+		ctype = "application/octet-stream";
 	}
-
-	nni_free(data, size);
-	nni_aio_set_output(aio, 0, res);
-	nni_aio_finish(aio, 0, 0);
+	http_serve_file(aio, pn, ctype);
+	nni_free(pn, pnsz);
 }
 
 int
@@ -461,6 +461,12 @@ tcp_check_bool(const void *val, size_t sz, nni_type t)
 	return (nni_copyin_bool(NULL, val, sz, t));
 }
 
+static int
+tcp_check_busypoll(const void *val, size_t sz, nni_type t)
+{
+	return (nni_copyin_int(NULL, val, sz, 0, 1000000, t));
+}
+
 static const nni_chkoption tcp_chkopts[] = {
 	{
 	    .o_name  = NNG_OPT_TCP_KEEPALIVE,
@@ -470,6 +476,10 @@ static const nni_chkoption tcp_chkopts[] = {
 	    .o_name  = NNG_OPT_TCP_NODELAY,
 	    .o_check = tcp_check_bool,
 	},
+	{
+	    .o_name  = NNG_OPT_TCP_BUSYPOLL,
+	    .o_check = tcp_check_busypoll,
+	},
 	{
 	    .o_name = NNG_OPT_TCP_BOUND_PORT,
 	},
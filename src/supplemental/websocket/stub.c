@@ -38,3 +38,11 @@ nni_ws_checkopt(const char *name, const void *data, size_t sz, nni_type t)
 	NNI_ARG_UNUSED(t);
 	return (NNG_ENOTSUP);
 }
+
+void
+nni_ws_mask(uint8_t *buf, size_t len, const uint8_t *mask)
+{
+	for (size_t i = 0; i < len; i++) {
+		buf[i] ^= mask[i % 4];
+	}
+}
@@ -348,6 +348,136 @@ ws_frame_fini(ws_frame *frame)
 	NNI_FREE_STRUCT(frame);
 }
 
+// Websocket masking XORs the payload with a repeating four byte key.  This
+// is on the data path for every byte a client sends (and a server
+// receives), so it is worth doing a wide word at a time.  The kernels here
+// cascade: the widest available handles the bulk of the buffer, and hands
+// off what remains to the next narrower one, finishing bytewise.  The
+// key is first rotated so that it lines up with an aligned start.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define NNI_WS_MASK_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define NNI_WS_MASK_SSE2
+#include <emmintrin.h>
+#endif
+
+static void
+ws_mask_words(uint8_t *buf, size_t len, const uint8_t key[8])
+{
+	uint64_t k64;
+	uint64_t w;
+
+	// memcpy keeps this free of alignment and aliasing problems; the
+	// compiler turns these into plain loads and stores.
+	memcpy(&k64, key, 8);
+	while (len >= 8) {
+		memcpy(&w, buf, 8);
+		w ^= k64;
+		memcpy(buf, &w, 8);
+		buf += 8;
+		len -= 8;
+	}
+	for (size_t i = 0; i < len; i++) {
+		buf[i] ^= key[i];
+	}
+}
+
+#ifdef NNI_WS_MASK_SSE2
+static void
+ws_mask_sse2(uint8_t *buf, size_t len, const uint8_t key[8])
+{
+	uint32_t k32;
+	__m128i  k128;
+
+	memcpy(&k32, key, 4);
+	k128 = _mm_set1_epi32((int) k32);
+	while (len >= 16) {
+		__m128i *p = (__m128i *) (void *) buf;
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k128));
+		buf += 16;
+		len -= 16;
+	}
+	ws_mask_words(buf, len, key);
+}
+#endif
+
+#ifdef NNI_WS_MASK_AVX2
+__attribute__((target("avx2"))) static void
+ws_mask_avx2(uint8_t *buf, size_t len, const uint8_t key[8])
+{
+	uint32_t k32;
+	__m256i  k256;
+
+	memcpy(&k32, key, 4);
+	k256 = _mm256_set1_epi32((int) k32);
+	while (len >= 128) {
+		__m256i *p  = (__m256i *) (void *) buf;
+		__m256i  v0 = _mm256_loadu_si256(p);
+		__m256i  v1 = _mm256_loadu_si256(p + 1);
+		__m256i  v2 = _mm256_loadu_si256(p + 2);
+		__m256i  v3 = _mm256_loadu_si256(p + 3);
+		_mm256_storeu_si256(p, _mm256_xor_si256(v0, k256));
+		_mm256_storeu_si256(p + 1, _mm256_xor_si256(v1, k256));
+		_mm256_storeu_si256(p + 2, _mm256_xor_si256(v2, k256));
+		_mm256_storeu_si256(p + 3, _mm256_xor_si256(v3, k256));
+		buf += 128;
+		len -= 128;
+	}
+	while (len >= 32) {
+		__m256i *p = (__m256i *) (void *) buf;
+		_mm256_storeu_si256(
+		    p, _mm256_xor_si256(_mm256_loadu_si256(p), k256));
+		buf += 32;
+		len -= 32;
+	}
+	ws_mask_words(buf, len, key);
+}
+#endif
+
+void
+nni_ws_mask(uint8_t *buf, size_t len, const uint8_t *mask)
+{
+	uint8_t key[8];
+	size_t  skip;
+
+	// Short payloads (control frames, small messages) are not worth
+	// anything more than the simple loop.
+	if (len < 32) {
+		for (size_t i = 0; i < len; i++) {
+			buf[i] ^= mask[i % 4];
+		}
+		return;
+	}
+
+	// Bring the buffer up to an eight byte boundary, then rotate the
+	// key so that key[0] applies to the first aligned byte.
+	skip = (size_t) ((8 - ((uintptr_t) buf & 7)) & 7);
+	for (size_t i = 0; i < skip; i++) {
+		buf[i] ^= mask[i % 4];
+	}
+	for (size_t i = 0; i < 8; i++) {
+		key[i] = mask[(i + skip) % 4];
+	}
+	buf += skip;
+	len -= skip;
+
+#ifdef NNI_WS_MASK_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		ws_mask_avx2(buf, len, key);
+		return;
+	}
+#endif
+#ifdef NNI_WS_MASK_SSE2
+	ws_mask_sse2(buf, len, key);
+#else
+	ws_mask_words(buf, len, key);
+#endif
+}
+
 static void
 ws_mask_frame(ws_frame *frame)
 {
@@ -358,9 +488,7 @@ ws_mask_frame(ws_frame *frame)
 	}
 	r = nni_random();
 	NNI_PUT32(frame->mask, r);
-	for (size_t i = 0; i < frame->len; i++) {
-		frame->buf[i] ^= frame->mask[i % 4];
-	}
+	nni_ws_mask(frame->buf, frame->len, frame->mask);
 	memcpy(frame->head + frame->hlen, frame->mask, 4);
 	frame->hlen += 4;
 	frame->head[1] |= 0x80; // set masked bit
@@ -374,9 +502,7 @@ ws_unmask_frame(ws_frame *frame)
 	if (!frame->masked) {
 		return;
 	}
-	for (size_t i = 0; i < frame->len; i++) {
-		frame->buf[i] ^= frame->mask[i % 4];
-	}
+	nni_ws_mask(frame->buf, frame->len, frame->mask);
 	frame->hlen -= 4;
 	frame->head[1] &= 0x7f; // clear masked bit
 	frame->masked = false;
@@ -1635,8 +1761,11 @@ ws_handler(nni_aio *aio)
 
 	nni_list_append(&l->reply, ws);
 	nni_aio_set_data(ws->httpaio, 0, l);
-	nni_http_write_res(conn, res, ws->httpaio);
+	// Take the connection away from the server before sending the
+	// reply; once the reply is out the peer may finish the upgrade
+	// and tear everything down before we would get another chance.
 	(void) nni_http_hijack(conn);
+	nni_http_write_res(conn, res, ws->httpaio);
 	nni_aio_set_output(aio, 0, NULL);
 	nni_aio_finish(aio, 0, 0);
 	return;
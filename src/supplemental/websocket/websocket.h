@@ -35,4 +35,9 @@ extern int nni_ws_listener_alloc(nng_stream_listener **, const nni_url *);
 extern int nni_ws_dialer_alloc(nng_stream_dialer **, const nni_url *);
 extern int nni_ws_checkopt(const char *, const void *, size_t, nni_type);
 
+// nni_ws_mask applies the four byte websocket mask to the payload in
+// place.  (Since this is just an XOR, it also removes it.)  The buffer
+// must start at the beginning of the masked payload.
+extern void nni_ws_mask(uint8_t *, size_t, const uint8_t *);
+
 #endif // NNG_SUPPLEMENTAL_WEBSOCKET_WEBSOCKET_H
@@ -12,7 +12,9 @@
 #include <nng/nng.h>
 #include <nng/supplemental/util/platform.h>
 
+#include "core/nng_impl.h"
 #include "supplemental/sha1/sha1.h"
+#include "supplemental/websocket/websocket.h"
 
 #include <acutest.h>
 #include <testutil.h>
@@ -406,9 +408,60 @@ test_websocket_fragmentation(void)
 	nng_stream_listener_free(l);
 }
 
+void
+test_websocket_mask(void)
+{
+	uint8_t  mask[4] = { 0x12, 0x8f, 0x5a, 0xe3 };
+	uint8_t *buf;
+	uint8_t *ref;
+	size_t   size = (1U << 20) + 67;
+
+	TEST_ASSERT((buf = nng_alloc(size)) != NULL);
+	TEST_ASSERT((ref = nng_alloc(size)) != NULL);
+	for (size_t i = 0; i < size; i++) {
+		ref[i] = (uint8_t) (i * 7 + (i >> 8));
+	}
+
+	// Every length up to a few vector widths, at every alignment,
+	// compared against the obvious byte at a time version.
+	for (size_t off = 0; off < 16; off++) {
+		for (size_t len = 0; len < 300; len++) {
+			memcpy(buf, ref, off + len);
+			nni_ws_mask(buf + off, len, mask);
+			for (size_t i = 0; i < len; i++) {
+				if (buf[off + i] !=
+				    (ref[off + i] ^ mask[i % 4])) {
+					TEST_CHECK(false);
+					TEST_MSG("off %d len %d at %d", (int) off,
+					    (int) len, (int) i);
+					break;
+				}
+			}
+			TEST_CHECK(memcmp(buf, ref, off) == 0);
+		}
+	}
+
+	// A large odd sized buffer, and then undo it.
+	memcpy(buf, ref, size);
+	nni_ws_mask(buf + 3, size - 3, mask);
+	for (size_t i = 3; i < size; i++) {
+		if (buf[i] != (ref[i] ^ mask[(i - 3) % 4])) {
+			TEST_CHECK(false);
+			TEST_MSG("mismatch at %d", (int) i);
+			break;
+		}
+	}
+	nni_ws_mask(buf + 3, size - 3, mask);
+	TEST_CHECK(memcmp(buf, ref, size) == 0);
+
+	nng_free(buf, size);
+	nng_free(ref, size);
+}
+
 TEST_LIST = {
 	{ "websocket stream wildcard", test_websocket_wildcard },
 	{ "websocket conn properties", test_websocket_conn_props },
 	{ "websocket fragmentation", test_websocket_fragmentation },
+	{ "websocket mask", test_websocket_mask },
 	{ NULL, NULL },
 };
@@ -11,26 +11,51 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/nng_impl.h"
 
 #include <nng/transport/ipc/ipc.h>
+#ifdef NNG_TRANSPORT_SHM
+#include <nng/transport/shm/shm.h>
+#endif
 
 // IPC transport.   Platform specific IPC operations must be
 // supplied as well.  Normally the IPC is UNIX domain sockets or
 // Windows named pipes.  Other platforms could use other mechanisms,
 // but all implementations on the platform must use the same mechanism.
+//
+// The shared memory transport (shm://) uses this same code.  Only the
+// byte stream underneath differs, and that is chosen by the URL scheme.
 
 typedef struct ipctran_pipe ipctran_pipe;
 typedef struct ipctran_ep   ipctran_ep;
 
+// As with TCP, small messages are taken right away, and those sent while
+// a write is in progress are later sent together in one write.  This is
+// off unless NNG_OPT_SENDBATCH is set.  These bound how many such messages
+// we hold, and how large each may be.
+#define IPCTRAN_TXQ_MAX 64
+#define IPCTRAN_BATCH_MSGMAX 1024
+#define IPCTRAN_DEF_SENDBATCH 0
+
 // ipc_pipe is one end of an IPC connection.
 struct ipctran_pipe {
 	nng_stream *    conn;
 	uint16_t        peer;
 	uint16_t        proto;
 	size_t          rcvmax;
+	size_t          txbatch;
+	nng_duration    txbatchtime;
 	bool            closed;
+	bool            txbusy;
+	bool            txwait;
+	nni_time        txqtime;
+	nni_aio *       txcur;
+	nni_lmq         txq;
+	size_t          txqlen;
+	uint8_t *       txbuf;
+	size_t          txbufsz;
 	nni_sockaddr    sa;
 	ipctran_ep *    ep;
 	nni_pipe *      npipe;
@@ -48,14 +73,18 @@ struct ipctran_pipe {
 	nni_aio *       txaio;
 	nni_aio *       rxaio;
 	nni_aio *       negoaio;
+	nni_aio *       txtimer;
 	nni_msg *       rxmsg;
 	nni_mtx         mtx;
+	nni_stat_item   st_txbatches;
 };
 
 struct ipctran_ep {
 	nni_mtx              mtx;
 	nni_sockaddr         sa;
 	size_t               rcvmax;
+	size_t               txbatch;
+	nng_duration         txbatchtime;
 	uint16_t             proto;
 	bool                 started;
 	bool                 closed;
@@ -78,6 +107,7 @@ static void ipctran_pipe_recv_start(ipctran_pipe *);
 static void ipctran_pipe_send_cb(void *);
 static void ipctran_pipe_recv_cb(void *);
 static void ipctran_pipe_nego_cb(void *);
+static void ipctran_pipe_txtimer_cb(void *);
 static void ipctran_ep_fini(void *);
 
 static int
@@ -103,6 +133,7 @@ ipctran_pipe_close(void *arg)
 	nni_aio_close(p->rxaio);
 	nni_aio_close(p->txaio);
 	nni_aio_close(p->negoaio);
+	nni_aio_close(p->txtimer);
 
 	nng_stream_close(p->conn);
 }
@@ -115,6 +146,7 @@ ipctran_pipe_stop(void *arg)
 	nni_aio_stop(p->rxaio);
 	nni_aio_stop(p->txaio);
 	nni_aio_stop(p->negoaio);
+	nni_aio_stop(p->txtimer);
 }
 
 static int
@@ -122,6 +154,10 @@ ipctran_pipe_init(void *arg, nni_pipe *npipe)
 {
 	ipctran_pipe *p = arg;
 	p->npipe        = npipe;
+
+	nni_stat_init_atomic(&p->st_txbatches, "txbatches",
+	    "writes carrying more than one message");
+	nni_pipe_add_stat(npipe, &p->st_txbatches);
 	return (0);
 }
 
@@ -144,10 +180,15 @@ ipctran_pipe_fini(void *arg)
 	nni_aio_free(p->rxaio);
 	nni_aio_free(p->txaio);
 	nni_aio_free(p->negoaio);
+	nni_aio_free(p->txtimer);
 	nng_stream_free(p->conn);
 	if (p->rxmsg) {
 		nni_msg_free(p->rxmsg);
 	}
+	nni_lmq_fini(&p->txq);
+	if (p->txbufsz > 0) {
+		nni_free(p->txbuf, p->txbufsz);
+	}
 	nni_mtx_fini(&p->mtx);
 	NNI_FREE_STRUCT(p);
 }
@@ -173,13 +214,20 @@ ipctran_pipe_alloc(ipctran_pipe **pipep)
 		return (NNG_ENOMEM);
 	}
 	nni_mtx_init(&p->mtx);
-	if (((rv = nni_aio_alloc(&p->txaio, ipctran_pipe_send_cb, p)) != 0) ||
+	if (((rv = nni_lmq_init(&p->txq, IPCTRAN_TXQ_MAX)) != 0) ||
+	    ((rv = nni_aio_alloc(&p->txaio, ipctran_pipe_send_cb, p)) != 0) ||
 	    ((rv = nni_aio_alloc(&p->rxaio, ipctran_pipe_recv_cb, p)) != 0) ||
 	    ((rv = nni_aio_alloc(&p->negoaio, ipctran_pipe_nego_cb, p)) !=
+	        0) ||
+	    ((rv = nni_aio_alloc(&p->txtimer, ipctran_pipe_txtimer_cb, p)) !=
 	        0)) {
 		ipctran_pipe_fini(p);
 		return (rv);
 	}
+	// Our stream callbacks only take the pipe lock and start more I/O,
+	// so they may run directly on the poller thread.
+	nni_aio_set_inline(p->txaio, true);
+	nni_aio_set_inline(p->rxaio, true);
 	nni_aio_list_init(&p->sendq);
 	nni_aio_list_init(&p->recvq);
 	nni_atomic_flag_reset(&p->reaped);
@@ -200,7 +248,9 @@ ipctran_ep_match(ipctran_ep *ep)
 	nni_list_remove(&ep->waitpipes, p);
 	nni_list_append(&ep->busypipes, p);
 	ep->useraio = NULL;
-	p->rcvmax   = ep->rcvmax;
+	p->rcvmax      = ep->rcvmax;
+	p->txbatch     = ep->txbatch;
+	p->txbatchtime = ep->txbatchtime;
 	nni_aio_set_output(aio, 0, p);
 	nni_aio_finish(aio, 0, 0);
 }
@@ -288,33 +338,43 @@ ipctran_pipe_send_cb(void *arg)
 	nni_aio *     txaio = p->txaio;
 
 	nni_mtx_lock(&p->mtx);
+	aio      = p->txcur;
+	p->txcur = NULL;
 	if ((rv = nni_aio_result(txaio)) != 0) {
 		nni_pipe_bump_error(p->npipe, rv);
 		// Intentionally we do not queue up another transfer.
 		// There's an excellent chance that the pipe is no longer
 		// usable, with a partial transfer.
 		// The protocol should see this error, and close the
-		// pipe itself, we hope.
-
-		while ((aio = nni_list_first(&p->sendq)) != NULL) {
-			nni_aio_list_remove(aio);
+		// pipe itself, we hope.  As with TCP, a batch that failed
+		// was already completed, and is dropped, like anything
+		// accepted behind it; queued senders are left for the close.
+		p->txbusy = false;
+		p->txqlen = 0;
+		nni_lmq_flush(&p->txq);
+		nni_mtx_unlock(&p->mtx);
+		if (aio != NULL) {
 			nni_aio_finish_error(aio, rv);
 		}
-		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
 	n = nni_aio_count(txaio);
 	nni_aio_iov_advance(txaio, n);
 	if (nni_aio_iov_count(txaio) != 0) {
+		p->txcur = aio;
 		nng_stream_send(p->conn, txaio);
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
-	aio = nni_list_first(&p->sendq);
-	nni_aio_list_remove(aio);
+	p->txbusy = false;
 	ipctran_pipe_send_start(p);
+	if (aio == NULL) {
+		// That was a batch, already accounted for.
+		nni_mtx_unlock(&p->mtx);
+		return;
+	}
 
 	msg = nni_aio_get_msg(aio);
 	n   = nni_msg_len(msg);
@@ -436,24 +496,142 @@ ipctran_pipe_send_cancel(nni_aio *aio, void *arg, int rv)
 	ipctran_pipe *p = arg;
 
 	nni_mtx_lock(&p->mtx);
-	if (!nni_aio_list_active(aio)) {
-		nni_mtx_unlock(&p->mtx);
-		return;
-	}
 	// If this is being sent, then cancel the pending transfer.
 	// The callback on the txaio will cause the user aio to
 	// be canceled too.
-	if (nni_list_first(&p->sendq) == aio) {
+	if (p->txcur == aio) {
 		nni_aio_abort(p->txaio, rv);
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
+	if (!nni_aio_list_active(aio)) {
+		nni_mtx_unlock(&p->mtx);
+		return;
+	}
 	nni_aio_list_remove(aio);
 	nni_mtx_unlock(&p->mtx);
 
 	nni_aio_finish_error(aio, rv);
 }
 
+// ipctran_pipe_txq_fill moves small messages from the front of the send
+// queue into the batch queue, completing their aios early.
+static void
+ipctran_pipe_txq_fill(ipctran_pipe *p)
+{
+	nni_aio *aio;
+
+	while ((aio = nni_list_first(&p->sendq)) != NULL) {
+		nni_msg *msg = nni_aio_get_msg(aio);
+		size_t   len = nni_msg_header_len(msg) + nni_msg_len(msg);
+
+		if ((len > IPCTRAN_BATCH_MSGMAX) ||
+		    (p->txqlen + len + sizeof(p->txhead) > p->txbatch) ||
+		    nni_lmq_full(&p->txq)) {
+			break;
+		}
+		nni_aio_list_remove(aio);
+		nni_aio_set_msg(aio, NULL);
+		if (nni_lmq_empty(&p->txq)) {
+			p->txqtime = nni_clock();
+		}
+		(void) nni_lmq_putq(&p->txq, msg);
+		p->txqlen += len + sizeof(p->txhead);
+		len = nni_msg_len(msg);
+		nni_pipe_bump_tx(p->npipe, len);
+		nni_aio_finish(aio, 0, len);
+	}
+}
+
+// ipctran_pipe_txq_send frames each message in the batch queue into our
+// transmit buffer, and starts writing it.
+static int
+ipctran_pipe_txq_send(ipctran_pipe *p)
+{
+	nni_msg *msg;
+	uint8_t *buf;
+	nni_iov  iov;
+	int      nmsgs = 0;
+
+	if (p->txbufsz < p->txqlen) {
+		size_t sz = p->txqlen < p->txbatch ? p->txbatch : p->txqlen;
+		if (p->txbufsz > 0) {
+			nni_free(p->txbuf, p->txbufsz);
+		}
+		if ((p->txbuf = nni_alloc(sz)) == NULL) {
+			p->txbufsz = 0;
+			p->txqlen  = 0;
+			nni_lmq_flush(&p->txq);
+			nni_pipe_bump_error(p->npipe, NNG_ENOMEM);
+			return (NNG_ENOMEM);
+		}
+		p->txbufsz = sz;
+	}
+
+	buf = p->txbuf;
+	while (nni_lmq_getq(&p->txq, &msg) == 0) {
+		size_t hlen = nni_msg_header_len(msg);
+		size_t blen = nni_msg_len(msg);
+		buf[0]      = 1; // message type, 1.
+		NNI_PUT64(buf + 1, (uint64_t) (hlen + blen));
+		buf += sizeof(p->txhead);
+		memcpy(buf, nni_msg_header(msg), hlen);
+		buf += hlen;
+		memcpy(buf, nni_msg_body(msg), blen);
+		buf += blen;
+		nni_msg_free(msg);
+		nmsgs++;
+	}
+	NNI_ASSERT((size_t) (buf - p->txbuf) == p->txqlen);
+	if (nmsgs > 1) {
+		nni_stat_inc_atomic(&p->st_txbatches, 1);
+	}
+
+	iov.iov_buf = p->txbuf;
+	iov.iov_len = p->txqlen;
+	p->txqlen   = 0;
+	p->txbusy   = true;
+	nni_aio_set_iov(p->txaio, 1, &iov);
+	nng_stream_send(p->conn, p->txaio);
+	return (0);
+}
+
+// ipctran_pipe_txq_hold returns true if the batch should wait for more
+// messages, as NNG_OPT_SENDBATCHTIME allows.  See tcptran_pipe_txq_hold.
+static bool
+ipctran_pipe_txq_hold(ipctran_pipe *p)
+{
+	nni_time now;
+
+	if ((p->txbatchtime <= 0) || (!nni_list_empty(&p->sendq))) {
+		return (false);
+	}
+	if (p->txwait) {
+		return (true);
+	}
+	now = nni_clock();
+	if (now >= p->txqtime + (nni_time) p->txbatchtime) {
+		return (false);
+	}
+	p->txwait = true;
+	nni_sleep_aio(
+	    (nng_duration) (p->txqtime + p->txbatchtime - now), p->txtimer);
+	return (true);
+}
+
+static void
+ipctran_pipe_txtimer_cb(void *arg)
+{
+	ipctran_pipe *p = arg;
+
+	nni_mtx_lock(&p->mtx);
+	p->txwait = false;
+	if (nni_aio_result(p->txtimer) == 0) {
+		ipctran_pipe_send_start(p);
+	}
+	nni_mtx_unlock(&p->mtx);
+}
+
 static void
 ipctran_pipe_send_start(ipctran_pipe *p)
 {
@@ -463,20 +641,54 @@ ipctran_pipe_send_start(ipctran_pipe *p)
 	int      niov;
 	nni_iov  iov[3];
 	uint64_t len;
+	uint8_t *frame;
+	size_t   flen;
 
 	if (p->closed) {
 		while ((aio = nni_list_first(&p->sendq)) != NULL) {
 			nni_list_remove(&p->sendq, aio);
 			nni_aio_finish_error(aio, NNG_ECLOSED);
 		}
+		nni_lmq_flush(&p->txq);
+		p->txqlen = 0;
+		return;
+	}
+	if (p->txbusy) {
 		return;
 	}
+
+	ipctran_pipe_txq_fill(p);
+	if (!nni_lmq_empty(&p->txq)) {
+		if (ipctran_pipe_txq_hold(p)) {
+			return;
+		}
+		if (ipctran_pipe_txq_send(p) == 0) {
+			ipctran_pipe_txq_fill(p);
+			return;
+		}
+	}
+
 	if ((aio = nni_list_first(&p->sendq)) == NULL) {
 		return;
 	}
+	nni_aio_list_remove(aio);
+	p->txcur  = aio;
+	p->txbusy = true;
 
 	// This runs to send the message.
 	msg = nni_aio_get_msg(aio);
+
+	// If the frame was encoded up front (nni_msg_frame_prep), it already
+	// has our message type and length, so it can go out as is.
+	if ((frame = nni_msg_frame(msg, &flen)) != NULL) {
+		iov[0].iov_buf = frame;
+		iov[0].iov_len = flen;
+		nni_aio_set_iov(p->txaio, 1, iov);
+		nng_stream_send(p->conn, p->txaio);
+		ipctran_pipe_txq_fill(p);
+		return;
+	}
+
 	len = nni_msg_len(msg) + nni_msg_header_len(msg);
 
 	p->txhead[0] = 1; // message type, 1.
@@ -499,6 +711,7 @@ ipctran_pipe_send_start(ipctran_pipe *p)
 	}
 	nni_aio_set_iov(txaio, niov, iov);
 	nng_stream_send(p->conn, txaio);
+	ipctran_pipe_txq_fill(p);
 }
 
 static void
@@ -517,8 +730,10 @@ ipctran_pipe_send(void *arg, nni_aio *aio)
 		return;
 	}
 	nni_list_append(&p->sendq, aio);
-	if (nni_list_first(&p->sendq) == aio) {
+	if (!p->txbusy) {
 		ipctran_pipe_send_start(p);
+	} else if (!p->closed) {
+		ipctran_pipe_txq_fill(p);
 	}
 	nni_mtx_unlock(&p->mtx);
 }
@@ -814,7 +1029,8 @@ ipctran_ep_init(ipctran_ep **epp, nni_sock *sock)
 	NNI_LIST_INIT(&ep->waitpipes, ipctran_pipe, node);
 	NNI_LIST_INIT(&ep->negopipes, ipctran_pipe, node);
 
-	ep->proto = nni_sock_proto_id(sock);
+	ep->proto   = nni_sock_proto_id(sock);
+	ep->txbatch = IPCTRAN_DEF_SENDBATCH;
 
 	nni_stat_init(&ep->st_rcvmaxsz, "rcvmaxsz", "maximum receive size");
 	nni_stat_set_type(&ep->st_rcvmaxsz, NNG_STAT_LEVEL);
@@ -912,6 +1128,81 @@ ipctran_ep_connect(void *arg, nni_aio *aio)
 	nni_mtx_unlock(&ep->mtx);
 }
 
+static int
+ipctran_ep_get_sendbatch(void *arg, void *v, size_t *szp, nni_type t)
+{
+	ipctran_ep *ep = arg;
+	int         rv;
+	nni_mtx_lock(&ep->mtx);
+	rv = nni_copyout_size(ep->txbatch, v, szp, t);
+	nni_mtx_unlock(&ep->mtx);
+	return (rv);
+}
+
+static int
+ipctran_ep_set_sendbatch(void *arg, const void *v, size_t sz, nni_type t)
+{
+	ipctran_ep *ep = arg;
+	size_t      val;
+	int         rv;
+	if ((rv = nni_copyin_size(&val, v, sz, 0, NNI_MAXSZ, t)) == 0) {
+		ipctran_pipe *p;
+		nni_mtx_lock(&ep->mtx);
+		ep->txbatch = val;
+		NNI_LIST_FOREACH (&ep->waitpipes, p) {
+			p->txbatch = val;
+		}
+		NNI_LIST_FOREACH (&ep->negopipes, p) {
+			p->txbatch = val;
+		}
+		NNI_LIST_FOREACH (&ep->busypipes, p) {
+			nni_mtx_lock(&p->mtx);
+			p->txbatch = val;
+			nni_mtx_unlock(&p->mtx);
+		}
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
+static int
+ipctran_ep_get_sendbatchtime(void *arg, void *v, size_t *szp, nni_type t)
+{
+	ipctran_ep *ep = arg;
+	int         rv;
+	nni_mtx_lock(&ep->mtx);
+	rv = nni_copyout_ms(ep->txbatchtime, v, szp, t);
+	nni_mtx_unlock(&ep->mtx);
+	return (rv);
+}
+
+static int
+ipctran_ep_set_sendbatchtime(
+    void *arg, const void *v, size_t sz, nni_type t)
+{
+	ipctran_ep * ep = arg;
+	nng_duration val;
+	int          rv;
+	if ((rv = nni_copyin_ms(&val, v, sz, t)) == 0) {
+		ipctran_pipe *p;
+		nni_mtx_lock(&ep->mtx);
+		ep->txbatchtime = val;
+		NNI_LIST_FOREACH (&ep->waitpipes, p) {
+			p->txbatchtime = val;
+		}
+		NNI_LIST_FOREACH (&ep->negopipes, p) {
+			p->txbatchtime = val;
+		}
+		NNI_LIST_FOREACH (&ep->busypipes, p) {
+			nni_mtx_lock(&p->mtx);
+			p->txbatchtime = val;
+			nni_mtx_unlock(&p->mtx);
+		}
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
 static int
 ipctran_ep_get_recvmaxsz(void *arg, void *v, size_t *szp, nni_type t)
 {
@@ -1015,6 +1306,7 @@ static nni_tran_pipe_ops ipctran_pipe_ops = {
 	.p_close  = ipctran_pipe_close,
 	.p_peer   = ipctran_pipe_peer,
 	.p_getopt = ipctran_pipe_getopt,
+	.p_framed = true,
 };
 
 static const nni_option ipctran_ep_options[] = {
@@ -1023,6 +1315,16 @@ static const nni_option ipctran_ep_options[] = {
 	    .o_get  = ipctran_ep_get_recvmaxsz,
 	    .o_set  = ipctran_ep_set_recvmaxsz,
 	},
+	{
+	    .o_name = NNG_OPT_SENDBATCH,
+	    .o_get  = ipctran_ep_get_sendbatch,
+	    .o_set  = ipctran_ep_set_sendbatch,
+	},
+	{
+	    .o_name = NNG_OPT_SENDBATCHTIME,
+	    .o_get  = ipctran_ep_get_sendbatchtime,
+	    .o_set  = ipctran_ep_set_sendbatchtime,
+	},
 	// terminate list
 	{
 	    .o_name = NULL,
@@ -1086,15 +1388,29 @@ ipctran_listener_setopt(
 }
 
 static int
-ipctran_check_recvmaxsz(const void *v, size_t sz, nni_type t)
+ipctran_check_size(const void *v, size_t sz, nni_type t)
 {
 	return (nni_copyin_size(NULL, v, sz, 0, NNI_MAXSZ, t));
 }
 
+static int
+ipctran_check_ms(const void *v, size_t sz, nni_type t)
+{
+	return (nni_copyin_ms(NULL, v, sz, t));
+}
+
 static nni_chkoption ipctran_checkopts[] = {
 	{
 	    .o_name  = NNG_OPT_RECVMAXSZ,
-	    .o_check = ipctran_check_recvmaxsz,
+	    .o_check = ipctran_check_size,
+	},
+	{
+	    .o_name  = NNG_OPT_SENDBATCH,
+	    .o_check = ipctran_check_size,
+	},
+	{
+	    .o_name  = NNG_OPT_SENDBATCHTIME,
+	    .o_check = ipctran_check_ms,
 	},
 	{
 	    .o_name = NULL,
@@ -1147,3 +1463,33 @@ nng_ipc_register(void)
 {
 	return (nni_tran_register(&ipc_tran));
 }
+
+#ifdef NNG_TRANSPORT_SHM
+static int
+shmtran_checkopt(const char *name, const void *buf, size_t sz, nni_type t)
+{
+	int rv;
+	rv = nni_chkopt(ipctran_checkopts, name, buf, sz, t);
+	if (rv == NNG_ENOTSUP) {
+		rv = nni_stream_checkopt("shm", name, buf, sz, t);
+	}
+	return (rv);
+}
+
+static nni_tran shm_tran = {
+	.tran_version  = NNI_TRANSPORT_VERSION,
+	.tran_scheme   = "shm",
+	.tran_dialer   = &ipctran_dialer_ops,
+	.tran_listener = &ipctran_listener_ops,
+	.tran_pipe     = &ipctran_pipe_ops,
+	.tran_init     = ipctran_init,
+	.tran_fini     = ipctran_fini,
+	.tran_checkopt = shmtran_checkopt,
+};
+
+int
+nng_shm_register(void)
+{
+	return (nni_tran_register(&shm_tran));
+}
+#endif // NNG_TRANSPORT_SHM
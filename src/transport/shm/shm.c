@@ -0,0 +1,1134 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core/nng_impl.h"
+#include "platform/posix/posix_ipc.h"
+
+#include "shm_stream.h"
+
+// Shared memory streams.  The dialer creates a memfd holding a header
+// page followed by two rings, one for each direction, and one eventfd
+// for each side to be woken on (its "doorbell").  These are passed to
+// the listener over an IPC connection, together with a short hello.
+//
+// Each ring has exactly one producer and one consumer.  The producer
+// advances head after copying data in, and the consumer advances tail
+// after copying data out, so neither side ever takes a lock or makes
+// a system call to move data.  A side that has nothing to do sets its
+// sleep flag, looks once more, and then waits for its doorbell.  The
+// other side rings the doorbell only when it makes progress while that
+// flag is set.  Sends and receives may complete with partial counts,
+// which the SP transport handles as it does for other streams.
+//
+// The IPC connection stays open with a one byte read outstanding, so
+// that we notice a peer that exits without closing cleanly.
+
+#define SHM_MAGIC 0x4d48534eu // "NSHM"
+#define SHM_VERSION 1
+#define SHM_HDR_SIZE 4096
+#define SHM_RING_SIZE (1u << 20)
+#define SHM_RING_MIN 4096
+#define SHM_RING_MAX (1u << 28)
+#define SHM_CACHELINE 64
+#define SHM_HELLO_TIMEOUT 5000 // msec, for the listener
+
+typedef struct shm_conn     shm_conn;
+typedef struct shm_dialer   shm_dialer;
+typedef struct shm_listener shm_listener;
+
+// shm_hello is sent over IPC, and is also kept at the front of the
+// shared header so that the listener can check it against the mapping.
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ringsz;
+	uint32_t reserved;
+} shm_hello;
+
+typedef struct {
+	uint32_t sleep;  // owner is waiting on its doorbell
+	uint32_t closed; // owner has closed its end
+	uint8_t  pad[SHM_CACHELINE - 2 * sizeof(uint32_t)];
+} shm_side;
+
+typedef struct {
+	uint64_t head; // bytes ever written, only moved by the producer
+	uint8_t  pad1[SHM_CACHELINE - sizeof(uint64_t)];
+	uint64_t tail; // bytes ever read, only moved by the consumer
+	uint8_t  pad2[SHM_CACHELINE - sizeof(uint64_t)];
+} shm_ring;
+
+typedef struct {
+	shm_hello info;
+	uint8_t   pad[SHM_CACHELINE - sizeof(shm_hello)];
+	shm_side  side[2]; // 0 is the dialer, 1 the listener
+	shm_ring  ring[2]; // ring[n] is written by side n
+} shm_hdr;
+
+enum shm_state {
+	SHM_DIALING,
+	SHM_HELLO,
+	SHM_READY,
+};
+
+struct shm_conn {
+	nng_stream     stream;
+	nng_stream *   ipc;
+	nni_posix_pfd *pfd;    // our own doorbell
+	int            peerfd; // the peer's doorbell
+	int            fds[3]; // memfd, dialer and listener doorbells
+	int            side;
+	enum shm_state state;
+	uint8_t *      map;
+	size_t         mapsz;
+	uint64_t       ringsz;
+	uint64_t       mask;
+	shm_side *     self;
+	shm_side *     peer;
+	shm_ring *     tx;
+	shm_ring *     rx;
+	uint8_t *      txbuf;
+	uint8_t *      rxbuf;
+	bool           closed;
+	bool           peergone;
+	nni_list       readq;
+	nni_list       writeq;
+	nni_mtx        mtx;
+	nni_aio *      aio; // handshake, then watches the IPC connection
+	nni_aio *      useraio;
+	int            abortrv; // set if the handshake was aborted
+	shm_hello      hello;
+	uint8_t        probe;
+	shm_dialer *   dialer;
+	shm_listener * listener;
+	nni_list_node  node;
+	nni_reap_item  reap;
+};
+
+struct shm_dialer {
+	nng_stream_dialer  sd;
+	nng_stream_dialer *ipc;
+	nni_list           conns; // dials in progress
+	bool               closed;
+	nni_mtx            mtx;
+	nni_cv             cv;
+};
+
+struct shm_listener {
+	nng_stream_listener  sl;
+	nng_stream_listener *ipc;
+	nni_aio *            aio;
+	nni_list             acceptq;
+	nni_list             conns; // waiting for their hello
+	nni_list             ready; // completed, but not yet accepted
+	bool                 accepting;
+	bool                 closed;
+	nni_mtx              mtx;
+	nni_cv               cv;
+};
+
+static void shm_dial_cb(void *);
+static void shm_hello_cb(void *);
+static void shm_listener_doaccept(shm_listener *);
+
+static bool
+shm_peer_gone(shm_conn *c)
+{
+	return (c->peergone ||
+	    (__atomic_load_n(&c->peer->closed, __ATOMIC_ACQUIRE) != 0));
+}
+
+static void
+shm_ring_doorbell(int fd)
+{
+	uint64_t one = 1;
+
+	// The only failure possible is an overflowed counter, which
+	// still leaves the eventfd readable.
+	(void) write(fd, &one, sizeof(one));
+}
+
+// shm_notify wakes the peer if it is waiting for us.  It is called
+// after we have moved a head or tail.
+static void
+shm_notify(shm_conn *c)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((__atomic_load_n(&c->peer->sleep, __ATOMIC_RELAXED) != 0) &&
+	    (__atomic_exchange_n(&c->peer->sleep, 0, __ATOMIC_ACQ_REL) !=
+	        0)) {
+		shm_ring_doorbell(c->peerfd);
+	}
+}
+
+static bool
+shm_conn_dowrite(shm_conn *c)
+{
+	nni_aio *aio;
+	bool     progress = false;
+
+	while ((aio = nni_list_first(&c->writeq)) != NULL) {
+		uint64_t head;
+		uint64_t space;
+		size_t   n;
+		unsigned naiov;
+		nni_iov *aiov;
+
+		if (shm_peer_gone(c)) {
+			nni_aio_list_remove(aio);
+			nni_aio_finish_error(aio, NNG_ECONNSHUT);
+			continue;
+		}
+		head  = c->tx->head;
+		space = c->ringsz -
+		    (head - __atomic_load_n(&c->tx->tail, __ATOMIC_ACQUIRE));
+		if (space == 0) {
+			break;
+		}
+
+		nni_aio_get_iov(aio, &naiov, &aiov);
+		n = 0;
+		for (unsigned i = 0; (i < naiov) && (space > 0); i++) {
+			uint8_t *src = aiov[i].iov_buf;
+			size_t   len = aiov[i].iov_len;
+
+			if (len > space) {
+				len = (size_t) space;
+			}
+			space -= len;
+			while (len > 0) {
+				size_t off = (size_t)((head + n) & c->mask);
+				size_t cnt = (size_t) c->ringsz - off;
+
+				if (cnt > len) {
+					cnt = len;
+				}
+				memcpy(c->txbuf + off, src, cnt);
+				src += cnt;
+				len -= cnt;
+				n += cnt;
+			}
+		}
+		__atomic_store_n(&c->tx->head, head + n, __ATOMIC_RELEASE);
+		progress = true;
+
+		nni_aio_list_remove(aio);
+		nni_aio_finish(aio, 0, n);
+	}
+	return (progress);
+}
+
+static bool
+shm_conn_doread(shm_conn *c)
+{
+	nni_aio *aio;
+	bool     progress = false;
+
+	while ((aio = nni_list_first(&c->readq)) != NULL) {
+		uint64_t tail;
+		uint64_t avail;
+		size_t   n;
+		unsigned naiov;
+		nni_iov *aiov;
+
+		tail  = c->rx->tail;
+		avail = __atomic_load_n(&c->rx->head, __ATOMIC_ACQUIRE) - tail;
+		if (avail == 0) {
+			// Anything the peer wrote before leaving is
+			// still delivered.
+			if (shm_peer_gone(c)) {
+				nni_aio_list_remove(aio);
+				nni_aio_finish_error(aio, NNG_ECONNSHUT);
+				continue;
+			}
+			break;
+		}
+
+		nni_aio_get_iov(aio, &naiov, &aiov);
+		n = 0;
+		for (unsigned i = 0; (i < naiov) && (avail > 0); i++) {
+			uint8_t *dst = aiov[i].iov_buf;
+			size_t   len = aiov[i].iov_len;
+
+			if (len > avail) {
+				len = (size_t) avail;
+			}
+			avail -= len;
+			while (len > 0) {
+				size_t off = (size_t)((tail + n) & c->mask);
+				size_t cnt = (size_t) c->ringsz - off;
+
+				if (cnt > len) {
+					cnt = len;
+				}
+				memcpy(dst, c->rxbuf + off, cnt);
+				dst += cnt;
+				len -= cnt;
+				n += cnt;
+			}
+		}
+		__atomic_store_n(&c->rx->tail, tail + n, __ATOMIC_RELEASE);
+		progress = true;
+
+		nni_aio_list_remove(aio);
+		nni_aio_finish(aio, 0, n);
+	}
+	return (progress);
+}
+
+// shm_conn_blocked reports whether queued work still cannot proceed.
+static bool
+shm_conn_blocked(shm_conn *c)
+{
+	if (shm_peer_gone(c)) {
+		return (false);
+	}
+	if ((!nni_list_empty(&c->readq)) &&
+	    (__atomic_load_n(&c->rx->head, __ATOMIC_ACQUIRE) != c->rx->tail)) {
+		return (false);
+	}
+	if ((!nni_list_empty(&c->writeq)) &&
+	    ((c->tx->head -
+	         __atomic_load_n(&c->tx->tail, __ATOMIC_ACQUIRE)) <
+	        c->ringsz)) {
+		return (false);
+	}
+	return (true);
+}
+
+// shm_conn_run moves as much data as it can, and if anything is left
+// waiting, arranges to be woken when the peer makes progress.  Called
+// with the lock held.
+static void
+shm_conn_run(shm_conn *c)
+{
+	if ((c->closed) || (c->state != SHM_READY)) {
+		return;
+	}
+	for (;;) {
+		bool progress;
+
+		__atomic_store_n(&c->self->sleep, 0, __ATOMIC_RELAXED);
+		progress = shm_conn_doread(c);
+		progress = shm_conn_dowrite(c) || progress;
+		if (progress) {
+			shm_notify(c);
+		}
+		if (nni_list_empty(&c->readq) && nni_list_empty(&c->writeq)) {
+			return;
+		}
+
+		// Announce that we are going to sleep, and then look once
+		// more.  Any progress the peer makes after this point will
+		// see the flag, and ring our doorbell.
+		__atomic_store_n(&c->self->sleep, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (shm_conn_blocked(c)) {
+			nni_posix_pfd_arm(c->pfd, NNI_POLL_IN);
+			return;
+		}
+	}
+}
+
+static void
+shm_conn_cb(nni_posix_pfd *pfd, unsigned events, void *arg)
+{
+	shm_conn *c = arg;
+	uint64_t  val;
+
+	NNI_ARG_UNUSED(events);
+
+	// Reset the eventfd counter; we are about to look at everything.
+	(void) read(nni_posix_pfd_fd(pfd), &val, sizeof(val));
+
+	nni_mtx_lock(&c->mtx);
+	shm_conn_run(c);
+	nni_mtx_unlock(&c->mtx);
+}
+
+static void
+shm_conn_cancel(nni_aio *aio, void *arg, int rv)
+{
+	shm_conn *c = arg;
+
+	nni_mtx_lock(&c->mtx);
+	if (nni_aio_list_active(aio)) {
+		nni_aio_list_remove(aio);
+		nni_aio_finish_error(aio, rv);
+	}
+	nni_mtx_unlock(&c->mtx);
+}
+
+static void
+shm_conn_queue(shm_conn *c, nni_list *q, nni_aio *aio)
+{
+	int rv;
+
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
+	nni_mtx_lock(&c->mtx);
+	if (c->closed) {
+		nni_mtx_unlock(&c->mtx);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+		return;
+	}
+	if ((rv = nni_aio_schedule(aio, shm_conn_cancel, c)) != 0) {
+		nni_mtx_unlock(&c->mtx);
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_aio_list_append(q, aio);
+	if (nni_list_first(q) == aio) {
+		shm_conn_run(c);
+	}
+	nni_mtx_unlock(&c->mtx);
+}
+
+static void
+shm_conn_send(void *arg, nni_aio *aio)
+{
+	shm_conn *c = arg;
+	shm_conn_queue(c, &c->writeq, aio);
+}
+
+static void
+shm_conn_recv(void *arg, nni_aio *aio)
+{
+	shm_conn *c = arg;
+	shm_conn_queue(c, &c->readq, aio);
+}
+
+static void
+shm_conn_close(void *arg)
+{
+	shm_conn *c = arg;
+	nni_aio * aio;
+
+	nni_mtx_lock(&c->mtx);
+	if (c->closed) {
+		nni_mtx_unlock(&c->mtx);
+		return;
+	}
+	c->closed = true;
+	while (((aio = nni_list_first(&c->readq)) != NULL) ||
+	    ((aio = nni_list_first(&c->writeq)) != NULL)) {
+		nni_aio_list_remove(aio);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+	}
+	if ((c->map != NULL) && (c->peerfd >= 0)) {
+		__atomic_store_n(&c->self->closed, 1, __ATOMIC_RELEASE);
+		shm_ring_doorbell(c->peerfd);
+	}
+	if (c->pfd != NULL) {
+		nni_posix_pfd_close(c->pfd);
+	}
+	nni_mtx_unlock(&c->mtx);
+
+	if (c->ipc != NULL) {
+		nng_stream_close(c->ipc);
+	}
+}
+
+static void
+shm_conn_reap(void *arg)
+{
+	shm_conn *c = arg;
+
+	shm_conn_close(c);
+	nni_aio_free(c->aio);
+	nng_stream_free(c->ipc);
+	if (c->pfd != NULL) {
+		nni_posix_pfd_fini(c->pfd);
+	}
+	for (int i = 0; i < 3; i++) {
+		if (c->fds[i] >= 0) {
+			(void) close(c->fds[i]);
+		}
+	}
+	if (c->map != NULL) {
+		(void) munmap(c->map, c->mapsz);
+	}
+	nni_mtx_fini(&c->mtx);
+	NNI_FREE_STRUCT(c);
+}
+
+static void
+shm_conn_free(void *arg)
+{
+	shm_conn *c = arg;
+	nni_reap(&c->reap, shm_conn_reap, c);
+}
+
+static int
+shm_conn_getx(void *arg, const char *name, void *buf, size_t *szp, nni_type t)
+{
+	shm_conn *c = arg;
+	return (nni_stream_getx(c->ipc, name, buf, szp, t));
+}
+
+static int
+shm_conn_setx(
+    void *arg, const char *name, const void *buf, size_t sz, nni_type t)
+{
+	shm_conn *c = arg;
+	return (nni_stream_setx(c->ipc, name, buf, sz, t));
+}
+
+static int
+shm_conn_alloc(shm_conn **cp, int side, nni_cb cb)
+{
+	shm_conn *c;
+	int       rv;
+
+	if ((c = NNI_ALLOC_STRUCT(c)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_aio_alloc(&c->aio, cb, c)) != 0) {
+		NNI_FREE_STRUCT(c);
+		return (rv);
+	}
+	nni_mtx_init(&c->mtx);
+	nni_aio_list_init(&c->readq);
+	nni_aio_list_init(&c->writeq);
+	NNI_LIST_NODE_INIT(&c->node);
+	c->side   = side;
+	c->state  = side == 0 ? SHM_DIALING : SHM_HELLO;
+	c->peerfd = -1;
+	c->fds[0] = c->fds[1] = c->fds[2] = -1;
+
+	c->stream.s_free  = shm_conn_free;
+	c->stream.s_close = shm_conn_close;
+	c->stream.s_send  = shm_conn_send;
+	c->stream.s_recv  = shm_conn_recv;
+	c->stream.s_getx  = shm_conn_getx;
+	c->stream.s_setx  = shm_conn_setx;
+
+	*cp = c;
+	return (0);
+}
+
+// shm_conn_map maps the shared memory in fds[0], and lays out the
+// rings for our side.
+static int
+shm_conn_map(shm_conn *c, uint32_t ringsz)
+{
+	shm_hdr *hdr;
+	void *   map;
+	int      me   = c->side;
+	int      peer = 1 - c->side;
+
+	c->ringsz = ringsz;
+	c->mask   = ringsz - 1;
+	c->mapsz  = SHM_HDR_SIZE + 2 * (size_t) ringsz;
+
+	map = mmap(NULL, c->mapsz, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    c->fds[0], 0);
+	if (map == MAP_FAILED) {
+		return (nni_plat_errno(errno));
+	}
+	c->map   = map;
+	hdr      = map;
+	c->self  = &hdr->side[me];
+	c->peer  = &hdr->side[peer];
+	c->tx    = &hdr->ring[me];
+	c->rx    = &hdr->ring[peer];
+	c->txbuf = c->map + SHM_HDR_SIZE + (size_t) me * ringsz;
+	c->rxbuf = c->map + SHM_HDR_SIZE + (size_t) peer * ringsz;
+	return (0);
+}
+
+// shm_conn_start is called once the handshake is complete.  Our own
+// doorbell becomes a poller, and we start watching the IPC connection.
+static int
+shm_conn_start(shm_conn *c)
+{
+	int rv;
+
+	NNI_ASSERT(c->fds[1 + c->side] >= 0);
+	if ((rv = nni_posix_pfd_init(&c->pfd, c->fds[1 + c->side])) != 0) {
+		return (rv);
+	}
+	c->fds[1 + c->side] = -1;
+	c->peerfd           = c->fds[2 - c->side];
+	c->fds[2 - c->side] = -1;
+	(void) close(c->fds[0]); // the mapping keeps the memory alive
+	c->fds[0] = -1;
+
+	nni_posix_pfd_set_cb(c->pfd, shm_conn_cb, c);
+	c->state = SHM_READY;
+	return (0);
+}
+
+static void
+shm_conn_watch(shm_conn *c)
+{
+	nni_iov iov;
+
+	iov.iov_buf = &c->probe;
+	iov.iov_len = sizeof(c->probe);
+	nni_aio_set_iov(c->aio, 1, &iov);
+	nni_aio_set_timeout(c->aio, NNG_DURATION_INFINITE);
+	nng_stream_recv(c->ipc, c->aio);
+}
+
+// shm_conn_lost is the watch callback.  The peer never sends anything
+// more on the IPC connection, so any completion means it has gone.
+static void
+shm_conn_lost(shm_conn *c)
+{
+	nni_mtx_lock(&c->mtx);
+	c->peergone = true;
+	shm_conn_run(c);
+	nni_mtx_unlock(&c->mtx);
+}
+
+// Dialer.  The dialer creates the shared memory for each connection.
+static int
+shm_conn_create(shm_conn *c)
+{
+	shm_hdr *hdr;
+	int      rv;
+
+	c->hello.magic    = SHM_MAGIC;
+	c->hello.version  = SHM_VERSION;
+	c->hello.ringsz   = SHM_RING_SIZE;
+	c->hello.reserved = 0;
+
+	if ((c->fds[0] = memfd_create(
+	         "nng-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+		return (nni_plat_errno(errno));
+	}
+	// Sealing the size prevents either side from truncating the
+	// memory out from under the other, which would fault.
+	if ((ftruncate(c->fds[0], SHM_HDR_SIZE + 2 * (off_t) SHM_RING_SIZE) !=
+	        0) ||
+	    (fcntl(c->fds[0], F_ADD_SEALS,
+	         F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) ||
+	    ((c->fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) ||
+	    ((c->fds[2] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)) {
+		return (nni_plat_errno(errno));
+	}
+	if ((rv = shm_conn_map(c, SHM_RING_SIZE)) != 0) {
+		return (rv);
+	}
+	hdr       = (void *) c->map;
+	hdr->info = c->hello;
+	return (0);
+}
+
+static void
+shm_dial_cb(void *arg)
+{
+	shm_conn *  c = arg;
+	shm_dialer *d;
+	nni_aio *   aio;
+	nni_iov     iov;
+	int         rv;
+
+	if (c->state == SHM_READY) {
+		shm_conn_lost(c);
+		return;
+	}
+
+	d = c->dialer;
+	nni_mtx_lock(&d->mtx);
+	if (((rv = nni_aio_result(c->aio)) != 0) ||
+	    ((rv = c->abortrv) != 0)) {
+		goto error;
+	}
+	if (c->state == SHM_DIALING) {
+		c->ipc = nni_aio_get_output(c->aio, 0);
+		if (((rv = shm_conn_create(c)) != 0) ||
+		    ((rv = nni_posix_ipc_send_fds(
+		          (nni_ipc_conn *) c->ipc, c->fds, 3)) != 0)) {
+			goto error;
+		}
+		c->state    = SHM_HELLO;
+		iov.iov_buf = &c->hello;
+		iov.iov_len = sizeof(c->hello);
+		nni_aio_set_iov(c->aio, 1, &iov);
+		nng_stream_send(c->ipc, c->aio);
+		nni_mtx_unlock(&d->mtx);
+		return;
+	}
+
+	// The hello (and with it, the descriptors) has been sent.
+	if ((rv = shm_conn_start(c)) != 0) {
+		goto error;
+	}
+	nni_list_remove(&d->conns, c);
+	aio        = c->useraio;
+	c->useraio = NULL;
+	nni_aio_set_prov_extra(aio, 0, NULL);
+	nni_cv_wake(&d->cv);
+	nni_mtx_unlock(&d->mtx);
+
+	shm_conn_watch(c);
+	nni_aio_set_output(aio, 0, c);
+	nni_aio_finish(aio, 0, 0);
+	return;
+
+error:
+	nni_list_remove(&d->conns, c);
+	aio        = c->useraio;
+	c->useraio = NULL;
+	nni_aio_set_prov_extra(aio, 0, NULL);
+	nni_cv_wake(&d->cv);
+	nni_mtx_unlock(&d->mtx);
+
+	nni_aio_finish_error(aio, rv);
+	shm_conn_free(c);
+}
+
+static void
+shm_dialer_cancel(nni_aio *aio, void *arg, int rv)
+{
+	shm_dialer *d = arg;
+	shm_conn *  c;
+
+	nni_mtx_lock(&d->mtx);
+	if ((c = nni_aio_get_prov_extra(aio, 0)) != NULL) {
+		// The handshake callback finishes the user aio.  It may
+		// be between steps, so leave a note for it as well.
+		c->abortrv = rv;
+		nni_aio_abort(c->aio, rv);
+	}
+	nni_mtx_unlock(&d->mtx);
+}
+
+static void
+shm_dialer_dial(void *arg, nni_aio *aio)
+{
+	shm_dialer *d = arg;
+	shm_conn *  c;
+	int         rv;
+
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
+	if ((rv = shm_conn_alloc(&c, 0, shm_dial_cb)) != 0) {
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	c->dialer  = d;
+	c->useraio = aio;
+
+	nni_mtx_lock(&d->mtx);
+	if (d->closed) {
+		rv = NNG_ECLOSED;
+	} else {
+		rv = nni_aio_schedule(aio, shm_dialer_cancel, d);
+	}
+	if (rv != 0) {
+		nni_mtx_unlock(&d->mtx);
+		shm_conn_free(c);
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_list_append(&d->conns, c);
+	nni_aio_set_prov_extra(aio, 0, c);
+	nng_stream_dialer_dial(d->ipc, c->aio);
+	nni_mtx_unlock(&d->mtx);
+}
+
+static void
+shm_dialer_close(void *arg)
+{
+	shm_dialer *d = arg;
+	shm_conn *  c;
+
+	nni_mtx_lock(&d->mtx);
+	d->closed = true;
+	NNI_LIST_FOREACH (&d->conns, c) {
+		c->abortrv = NNG_ECLOSED;
+		nni_aio_abort(c->aio, NNG_ECLOSED);
+	}
+	nni_mtx_unlock(&d->mtx);
+	nng_stream_dialer_close(d->ipc);
+}
+
+static void
+shm_dialer_free(void *arg)
+{
+	shm_dialer *d = arg;
+
+	shm_dialer_close(d);
+	nni_mtx_lock(&d->mtx);
+	while (!nni_list_empty(&d->conns)) {
+		nni_cv_wait(&d->cv);
+	}
+	nni_mtx_unlock(&d->mtx);
+
+	nng_stream_dialer_free(d->ipc);
+	nni_cv_fini(&d->cv);
+	nni_mtx_fini(&d->mtx);
+	NNI_FREE_STRUCT(d);
+}
+
+static int
+shm_dialer_getx(
+    void *arg, const char *name, void *buf, size_t *szp, nni_type t)
+{
+	shm_dialer *d = arg;
+	return (nni_stream_dialer_getx(d->ipc, name, buf, szp, t));
+}
+
+static int
+shm_dialer_setx(
+    void *arg, const char *name, const void *buf, size_t sz, nni_type t)
+{
+	shm_dialer *d = arg;
+	return (nni_stream_dialer_setx(d->ipc, name, buf, sz, t));
+}
+
+// The IPC dialer and listener only look at the path, but insist on the
+// ipc scheme.
+static void
+shm_ipc_url(nng_url *ipc, const nng_url *url)
+{
+	*ipc          = *url;
+	ipc->u_scheme = (char *) "ipc";
+}
+
+int
+nni_shm_dialer_alloc(nng_stream_dialer **dp, const nng_url *url)
+{
+	shm_dialer *d;
+	nng_url     ipc;
+	int         rv;
+
+	if ((d = NNI_ALLOC_STRUCT(d)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	shm_ipc_url(&ipc, url);
+	if ((rv = nni_ipc_dialer_alloc(&d->ipc, &ipc)) != 0) {
+		NNI_FREE_STRUCT(d);
+		return (rv);
+	}
+	nni_mtx_init(&d->mtx);
+	nni_cv_init(&d->cv, &d->mtx);
+	NNI_LIST_INIT(&d->conns, shm_conn, node);
+
+	d->sd.sd_free  = shm_dialer_free;
+	d->sd.sd_close = shm_dialer_close;
+	d->sd.sd_dial  = shm_dialer_dial;
+	d->sd.sd_getx  = shm_dialer_getx;
+	d->sd.sd_setx  = shm_dialer_setx;
+
+	*dp = (void *) d;
+	return (0);
+}
+
+// Listener.  Each accepted IPC connection waits for its hello on its
+// own, so a slow or broken client cannot hold up the others.
+static int
+shm_conn_attach(shm_conn *c)
+{
+	struct stat st;
+	shm_hdr *   hdr;
+	uint32_t    ringsz = c->hello.ringsz;
+	int         seals;
+	int         rv;
+
+	if ((c->hello.magic != SHM_MAGIC) ||
+	    (c->hello.version != SHM_VERSION) || (ringsz < SHM_RING_MIN) ||
+	    (ringsz > SHM_RING_MAX) || ((ringsz & (ringsz - 1)) != 0)) {
+		return (NNG_EPROTO);
+	}
+	if ((fstat(c->fds[0], &st) != 0) ||
+	    ((seals = fcntl(c->fds[0], F_GET_SEALS)) < 0)) {
+		return (nni_plat_errno(errno));
+	}
+	if ((st.st_size != SHM_HDR_SIZE + 2 * (off_t) ringsz) ||
+	    ((seals & F_SEAL_SHRINK) == 0)) {
+		return (NNG_EPROTO);
+	}
+	if ((rv = shm_conn_map(c, ringsz)) != 0) {
+		return (rv);
+	}
+	hdr = (void *) c->map;
+	if (memcmp(&hdr->info, &c->hello, sizeof(c->hello)) != 0) {
+		return (NNG_EPROTO);
+	}
+	return (0);
+}
+
+static void
+shm_hello_cb(void *arg)
+{
+	shm_conn *    c = arg;
+	shm_listener *l;
+	nni_aio *     aio;
+	int           rv;
+
+	if (c->state == SHM_READY) {
+		shm_conn_lost(c);
+		return;
+	}
+
+	l = c->listener;
+	nni_mtx_lock(&l->mtx);
+	if (((rv = nni_aio_result(c->aio)) != 0) ||
+	    ((rv = c->abortrv) != 0)) {
+		goto error;
+	}
+	nni_aio_iov_advance(c->aio, nni_aio_count(c->aio));
+	if (nni_aio_iov_count(c->aio) > 0) {
+		nng_stream_recv(c->ipc, c->aio);
+		nni_mtx_unlock(&l->mtx);
+		return;
+	}
+	if (nni_posix_ipc_take_fds((nni_ipc_conn *) c->ipc, c->fds, 3) != 3) {
+		rv = NNG_EPROTO;
+		goto error;
+	}
+	if (((rv = shm_conn_attach(c)) != 0) ||
+	    ((rv = shm_conn_start(c)) != 0)) {
+		goto error;
+	}
+	nni_list_remove(&l->conns, c);
+	nni_cv_wake(&l->cv);
+	if ((aio = nni_list_first(&l->acceptq)) == NULL) {
+		nni_list_append(&l->ready, c);
+		nni_mtx_unlock(&l->mtx);
+		shm_conn_watch(c);
+		return;
+	}
+	nni_aio_list_remove(aio);
+	nni_mtx_unlock(&l->mtx);
+
+	shm_conn_watch(c);
+	nni_aio_set_output(aio, 0, c);
+	nni_aio_finish(aio, 0, 0);
+	return;
+
+error:
+	// The client gets nothing back; it sees the IPC connection close.
+	nni_list_remove(&l->conns, c);
+	nni_cv_wake(&l->cv);
+	nni_mtx_unlock(&l->mtx);
+	shm_conn_free(c);
+}
+
+static void
+shm_listener_cb(void *arg)
+{
+	shm_listener *l = arg;
+	shm_conn *    c;
+	nni_aio *     aio;
+	nni_iov       iov;
+	int           rv;
+
+	nni_mtx_lock(&l->mtx);
+	l->accepting = false;
+	if ((rv = nni_aio_result(l->aio)) != 0) {
+		if ((aio = nni_list_first(&l->acceptq)) != NULL) {
+			nni_aio_list_remove(aio);
+			nni_aio_finish_error(aio, rv);
+		}
+		goto done;
+	}
+	if ((rv = shm_conn_alloc(&c, 1, shm_hello_cb)) != 0) {
+		nng_stream_free(nni_aio_get_output(l->aio, 0));
+		goto done;
+	}
+	c->listener = l;
+	c->ipc      = nni_aio_get_output(l->aio, 0);
+	if (l->closed) {
+		shm_conn_free(c);
+		goto done;
+	}
+	nni_posix_ipc_want_fds((nni_ipc_conn *) c->ipc);
+	nni_list_append(&l->conns, c);
+	iov.iov_buf = &c->hello;
+	iov.iov_len = sizeof(c->hello);
+	nni_aio_set_iov(c->aio, 1, &iov);
+	nni_aio_set_timeout(c->aio, SHM_HELLO_TIMEOUT);
+	nng_stream_recv(c->ipc, c->aio);
+
+done:
+	shm_listener_doaccept(l);
+	nni_mtx_unlock(&l->mtx);
+}
+
+static void
+shm_listener_doaccept(shm_listener *l)
+{
+	if ((!l->accepting) && (!l->closed) &&
+	    (!nni_list_empty(&l->acceptq))) {
+		l->accepting = true;
+		nng_stream_listener_accept(l->ipc, l->aio);
+	}
+}
+
+static void
+shm_listener_cancel(nni_aio *aio, void *arg, int rv)
+{
+	shm_listener *l = arg;
+
+	nni_mtx_lock(&l->mtx);
+	if (nni_aio_list_active(aio)) {
+		nni_aio_list_remove(aio);
+		nni_aio_finish_error(aio, rv);
+	}
+	nni_mtx_unlock(&l->mtx);
+}
+
+static void
+shm_listener_accept(void *arg, nni_aio *aio)
+{
+	shm_listener *l = arg;
+	shm_conn *    c;
+	int           rv;
+
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
+	nni_mtx_lock(&l->mtx);
+	if (l->closed) {
+		nni_mtx_unlock(&l->mtx);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+		return;
+	}
+	if ((c = nni_list_first(&l->ready)) != NULL) {
+		nni_list_remove(&l->ready, c);
+		nni_mtx_unlock(&l->mtx);
+		nni_aio_set_output(aio, 0, c);
+		nni_aio_finish(aio, 0, 0);
+		return;
+	}
+	if ((rv = nni_aio_schedule(aio, shm_listener_cancel, l)) != 0) {
+		nni_mtx_unlock(&l->mtx);
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_aio_list_append(&l->acceptq, aio);
+	shm_listener_doaccept(l);
+	nni_mtx_unlock(&l->mtx);
+}
+
+static int
+shm_listener_listen(void *arg)
+{
+	shm_listener *l = arg;
+	return (nng_stream_listener_listen(l->ipc));
+}
+
+static void
+shm_listener_close(void *arg)
+{
+	shm_listener *l = arg;
+	shm_conn *    c;
+	nni_aio *     aio;
+
+	nni_mtx_lock(&l->mtx);
+	l->closed = true;
+	while ((aio = nni_list_first(&l->acceptq)) != NULL) {
+		nni_aio_list_remove(aio);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+	}
+	NNI_LIST_FOREACH (&l->conns, c) {
+		c->abortrv = NNG_ECLOSED;
+		nni_aio_abort(c->aio, NNG_ECLOSED);
+	}
+	while ((c = nni_list_first(&l->ready)) != NULL) {
+		nni_list_remove(&l->ready, c);
+		shm_conn_free(c);
+	}
+	nni_mtx_unlock(&l->mtx);
+	nng_stream_listener_close(l->ipc);
+}
+
+static void
+shm_listener_free(void *arg)
+{
+	shm_listener *l = arg;
+
+	shm_listener_close(l);
+	nni_aio_stop(l->aio);
+	nni_mtx_lock(&l->mtx);
+	while (!nni_list_empty(&l->conns)) {
+		nni_cv_wait(&l->cv);
+	}
+	nni_mtx_unlock(&l->mtx);
+
+	nni_aio_free(l->aio);
+	nng_stream_listener_free(l->ipc);
+	nni_cv_fini(&l->cv);
+	nni_mtx_fini(&l->mtx);
+	NNI_FREE_STRUCT(l);
+}
+
+static int
+shm_listener_getx(
+    void *arg, const char *name, void *buf, size_t *szp, nni_type t)
+{
+	shm_listener *l = arg;
+	return (nni_stream_listener_getx(l->ipc, name, buf, szp, t));
+}
+
+static int
+shm_listener_setx(
+    void *arg, const char *name, const void *buf, size_t sz, nni_type t)
+{
+	shm_listener *l = arg;
+	return (nni_stream_listener_setx(l->ipc, name, buf, sz, t));
+}
+
+int
+nni_shm_listener_alloc(nng_stream_listener **lp, const nng_url *url)
+{
+	shm_listener *l;
+	nng_url       ipc;
+	int           rv;
+
+	if ((l = NNI_ALLOC_STRUCT(l)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	shm_ipc_url(&ipc, url);
+	if ((rv = nni_ipc_listener_alloc(&l->ipc, &ipc)) != 0) {
+		NNI_FREE_STRUCT(l);
+		return (rv);
+	}
+	if ((rv = nni_aio_alloc(&l->aio, shm_listener_cb, l)) != 0) {
+		nng_stream_listener_free(l->ipc);
+		NNI_FREE_STRUCT(l);
+		return (rv);
+	}
+	nni_mtx_init(&l->mtx);
+	nni_cv_init(&l->cv, &l->mtx);
+	nni_aio_list_init(&l->acceptq);
+	NNI_LIST_INIT(&l->conns, shm_conn, node);
+	NNI_LIST_INIT(&l->ready, shm_conn, node);
+
+	l->sl.sl_free   = shm_listener_free;
+	l->sl.sl_close  = shm_listener_close;
+	l->sl.sl_listen = shm_listener_listen;
+	l->sl.sl_accept = shm_listener_accept;
+	l->sl.sl_getx   = shm_listener_getx;
+	l->sl.sl_setx   = shm_listener_setx;
+
+	*lp = (void *) l;
+	return (0);
+}
+
+int
+nni_shm_checkopt(const char *name, const void *buf, size_t sz, nni_type t)
+{
+	return (nni_ipc_checkopt(name, buf, sz, t));
+}
@@ -0,0 +1,22 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef NNG_TRANSPORT_SHM_SHM_STREAM_H
+#define NNG_TRANSPORT_SHM_SHM_STREAM_H
+
+// Shared memory byte streams.  A shm:// URL names the path of an IPC
+// socket, which is used to meet the peer and hand it the shared memory
+// and wakeup descriptors.  After that, data moves through a pair of
+// rings in the shared memory, and the IPC connection only serves to let
+// each side know when the other has gone away.
+extern int nni_shm_dialer_alloc(nng_stream_dialer **, const nng_url *);
+extern int nni_shm_listener_alloc(nng_stream_listener **, const nng_url *);
+extern int nni_shm_checkopt(const char *, const void *, size_t, nni_type);
+
+#endif // NNG_TRANSPORT_SHM_SHM_STREAM_H
@@ -21,6 +21,19 @@
 typedef struct tcptran_pipe tcptran_pipe;
 typedef struct tcptran_ep   tcptran_ep;
 
+// Small messages are accepted immediately, by copying them, so that the
+// protocol can hand us the next one while a write is still in progress.
+// Those that arrive during a write are coalesced into a single write once
+// the connection is free.  This is the most messages we will hold that
+// way, and the largest message we will copy to do so.  The limit on total
+// bytes is set by NNG_OPT_SENDBATCH, and NNG_OPT_SENDBATCHTIME lets an idle
+// connection wait a little for more messages before writing.  As accepted
+// messages are reported sent before they are written, this is off unless
+// NNG_OPT_SENDBATCH is set.
+#define TCPTRAN_TXQ_MAX 64
+#define TCPTRAN_BATCH_MSGMAX 1024
+#define TCPTRAN_DEF_SENDBATCH 0
+
 // tcp_pipe is one end of a TCP connection.
 struct tcptran_pipe {
 	nng_stream *    conn;
@@ -28,7 +41,17 @@ struct tcptran_pipe {
 	uint16_t        peer;
 	uint16_t        proto;
 	size_t          rcvmax;
+	size_t          txbatch; // max bytes to coalesce, zero disables
+	nng_duration    txbatchtime; // max time to wait to fill a batch
 	bool            closed;
+	bool            txbusy; // a write is in progress
+	bool            txwait; // the batch timer is running
+	nni_time        txqtime; // when the batch queue was last empty
+	nni_aio *       txcur;  // aio being written, NULL for a batch
+	nni_lmq         txq;    // accepted messages waiting to be batched
+	size_t          txqlen; // bytes these will take on the wire
+	uint8_t *       txbuf;
+	size_t          txbufsz;
 	nni_list_node   node;
 	tcptran_ep *    ep;
 	nni_atomic_flag reaped;
@@ -44,14 +67,18 @@ struct tcptran_pipe {
 	nni_aio *       txaio;
 	nni_aio *       rxaio;
 	nni_aio *       negoaio;
+	nni_aio *       txtimer;
 	nni_msg *       rxmsg;
 	nni_mtx         mtx;
+	nni_stat_item   st_txbatches;
 };
 
 struct tcptran_ep {
 	nni_mtx              mtx;
 	uint16_t             proto;
 	size_t               rcvmax;
+	size_t               txbatch;
+	nng_duration         txbatchtime;
 	bool                 fini;
 	bool                 started;
 	bool                 closed;
@@ -76,6 +103,7 @@ static void tcptran_pipe_recv_start(tcptran_pipe *);
 static void tcptran_pipe_send_cb(void *);
 static void tcptran_pipe_recv_cb(void *);
 static void tcptran_pipe_nego_cb(void *);
+static void tcptran_pipe_txtimer_cb(void *);
 static void tcptran_ep_fini(void *);
 
 static int
@@ -101,6 +129,7 @@ tcptran_pipe_close(void *arg)
 	nni_aio_close(p->rxaio);
 	nni_aio_close(p->txaio);
 	nni_aio_close(p->negoaio);
+	nni_aio_close(p->txtimer);
 
 	nng_stream_close(p->conn);
 }
@@ -113,6 +142,7 @@ tcptran_pipe_stop(void *arg)
 	nni_aio_stop(p->rxaio);
 	nni_aio_stop(p->txaio);
 	nni_aio_stop(p->negoaio);
+	nni_aio_stop(p->txtimer);
 }
 
 static int
@@ -121,6 +151,9 @@ tcptran_pipe_init(void *arg, nni_pipe *npipe)
 	tcptran_pipe *p = arg;
 	p->npipe        = npipe;
 
+	nni_stat_init_atomic(&p->st_txbatches, "txbatches",
+	    "writes carrying more than one message");
+	nni_pipe_add_stat(npipe, &p->st_txbatches);
 	return (0);
 }
 
@@ -144,8 +177,13 @@ tcptran_pipe_fini(void *arg)
 	nni_aio_free(p->rxaio);
 	nni_aio_free(p->txaio);
 	nni_aio_free(p->negoaio);
+	nni_aio_free(p->txtimer);
 	nng_stream_free(p->conn);
 	nni_msg_free(p->rxmsg);
+	nni_lmq_fini(&p->txq);
+	if (p->txbufsz > 0) {
+		nni_free(p->txbuf, p->txbufsz);
+	}
 	nni_mtx_fini(&p->mtx);
 	NNI_FREE_STRUCT(p);
 }
@@ -171,12 +209,20 @@ tcptran_pipe_alloc(tcptran_pipe **pipep)
 		return (NNG_ENOMEM);
 	}
 	nni_mtx_init(&p->mtx);
-	if (((rv = nni_aio_alloc(&p->txaio, tcptran_pipe_send_cb, p)) != 0) ||
+	if (((rv = nni_lmq_init(&p->txq, TCPTRAN_TXQ_MAX)) != 0) ||
+	    ((rv = nni_aio_alloc(&p->txaio, tcptran_pipe_send_cb, p)) != 0) ||
 	    ((rv = nni_aio_alloc(&p->rxaio, tcptran_pipe_recv_cb, p)) != 0) ||
-	    ((rv = nni_aio_alloc(&p->negoaio, tcptran_pipe_nego_cb, p)) != 0)) {
+	    ((rv = nni_aio_alloc(&p->negoaio, tcptran_pipe_nego_cb, p)) !=
+	        0) ||
+	    ((rv = nni_aio_alloc(&p->txtimer, tcptran_pipe_txtimer_cb, p)) !=
+	        0)) {
 		tcptran_pipe_fini(p);
 		return (rv);
 	}
+	// Our stream callbacks only take the pipe lock and start more I/O,
+	// so they may run directly on the poller thread.
+	nni_aio_set_inline(p->txaio, true);
+	nni_aio_set_inline(p->rxaio, true);
 	nni_aio_list_init(&p->recvq);
 	nni_aio_list_init(&p->sendq);
 	nni_atomic_flag_reset(&p->reaped);
@@ -199,7 +245,9 @@ tcptran_ep_match(tcptran_ep *ep)
 	nni_list_remove(&ep->waitpipes, p);
 	nni_list_append(&ep->busypipes, p);
 	ep->useraio = NULL;
-	p->rcvmax   = ep->rcvmax;
+	p->rcvmax      = ep->rcvmax;
+	p->txbatch     = ep->txbatch;
+	p->txbatchtime = ep->txbatchtime;
 	nni_aio_set_output(aio, 0, p);
 	nni_aio_finish(aio, 0, 0);
 }
@@ -288,7 +336,8 @@ tcptran_pipe_send_cb(void *arg)
 	nni_aio *     txaio = p->txaio;
 
 	nni_mtx_lock(&p->mtx);
-	aio = nni_list_first(&p->sendq);
+	aio      = p->txcur;
+	p->txcur = NULL;
 
 	if ((rv = nni_aio_result(txaio)) != 0) {
 		nni_pipe_bump_error(p->npipe, rv);
@@ -296,23 +345,35 @@ tcptran_pipe_send_cb(void *arg)
 		// There's an excellent chance that the pipe is no longer
 		// usable, with a partial transfer.
 		// The protocol should see this error, and close the
-		// pipe itself, we hope.
-		nni_aio_list_remove(aio);
+		// pipe itself, we hope.  A batch was already completed,
+		// so it is dropped, like anything accepted behind it;
+		// senders still queued were never tried, and are left
+		// for the close.
+		p->txbusy = false;
+		p->txqlen = 0;
+		nni_lmq_flush(&p->txq);
 		nni_mtx_unlock(&p->mtx);
-		nni_aio_finish_error(aio, rv);
+		if (aio != NULL) {
+			nni_aio_finish_error(aio, rv);
+		}
 		return;
 	}
 
 	n = nni_aio_count(txaio);
 	nni_aio_iov_advance(txaio, n);
 	if (nni_aio_iov_count(txaio) > 0) {
+		p->txcur = aio;
 		nng_stream_send(p->conn, txaio);
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
-	nni_aio_list_remove(aio);
+	p->txbusy = false;
 	tcptran_pipe_send_start(p);
+	if (aio == NULL) {
+		nni_mtx_unlock(&p->mtx);
+		return;
+	}
 
 	msg = nni_aio_get_msg(aio);
 	n   = nni_msg_len(msg);
@@ -415,24 +476,148 @@ tcptran_pipe_send_cancel(nni_aio *aio, void *arg, int rv)
 	tcptran_pipe *p = arg;
 
 	nni_mtx_lock(&p->mtx);
-	if (!nni_aio_list_active(aio)) {
-		nni_mtx_unlock(&p->mtx);
-		return;
-	}
 	// If this is being sent, then cancel the pending transfer.
 	// The callback on the txaio will cause the user aio to
 	// be canceled too.
-	if (nni_list_first(&p->sendq) == aio) {
+	if (p->txcur == aio) {
 		nni_aio_abort(p->txaio, rv);
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
+	if (!nni_aio_list_active(aio)) {
+		nni_mtx_unlock(&p->mtx);
+		return;
+	}
 	nni_aio_list_remove(aio);
 	nni_mtx_unlock(&p->mtx);
 
 	nni_aio_finish_error(aio, rv);
 }
 
+// tcptran_pipe_txq_fill accepts messages waiting on the send queue into
+// the batch queue, for as long as they are small enough and fit.  Their
+// aios are completed right away, so that the protocol can send more while
+// a write is in progress.
+static void
+tcptran_pipe_txq_fill(tcptran_pipe *p)
+{
+	nni_aio *aio;
+
+	while ((aio = nni_list_first(&p->sendq)) != NULL) {
+		nni_msg *msg = nni_aio_get_msg(aio);
+		size_t   len = nni_msg_header_len(msg) + nni_msg_len(msg);
+
+		if ((len > TCPTRAN_BATCH_MSGMAX) ||
+		    (p->txqlen + len + sizeof(uint64_t) > p->txbatch) ||
+		    nni_lmq_full(&p->txq)) {
+			break;
+		}
+		nni_aio_list_remove(aio);
+		nni_aio_set_msg(aio, NULL);
+		if (nni_lmq_empty(&p->txq)) {
+			p->txqtime = nni_clock();
+		}
+		(void) nni_lmq_putq(&p->txq, msg);
+		p->txqlen += len + sizeof(uint64_t);
+		len = nni_msg_len(msg);
+		nni_pipe_bump_tx(p->npipe, len);
+		nni_aio_finish(aio, 0, len);
+	}
+}
+
+// tcptran_pipe_txq_send coalesces everything in the batch queue into a
+// single buffer, and writes it.
+static int
+tcptran_pipe_txq_send(tcptran_pipe *p)
+{
+	nni_msg *msg;
+	uint8_t *buf;
+	nni_iov  iov;
+	int      nmsgs = 0;
+
+	if (p->txbufsz < p->txqlen) {
+		size_t sz = p->txqlen < p->txbatch ? p->txbatch : p->txqlen;
+		if (p->txbufsz > 0) {
+			nni_free(p->txbuf, p->txbufsz);
+		}
+		if ((p->txbuf = nni_alloc(sz)) == NULL) {
+			// Nothing else we can do; these are lost, just as if
+			// the connection had failed.
+			p->txbufsz = 0;
+			p->txqlen  = 0;
+			nni_lmq_flush(&p->txq);
+			nni_pipe_bump_error(p->npipe, NNG_ENOMEM);
+			return (NNG_ENOMEM);
+		}
+		p->txbufsz = sz;
+	}
+
+	buf = p->txbuf;
+	while (nni_lmq_getq(&p->txq, &msg) == 0) {
+		size_t hlen = nni_msg_header_len(msg);
+		size_t blen = nni_msg_len(msg);
+		NNI_PUT64(buf, (uint64_t) (hlen + blen));
+		buf += sizeof(uint64_t);
+		memcpy(buf, nni_msg_header(msg), hlen);
+		buf += hlen;
+		memcpy(buf, nni_msg_body(msg), blen);
+		buf += blen;
+		nni_msg_free(msg);
+		nmsgs++;
+	}
+	NNI_ASSERT((size_t) (buf - p->txbuf) == p->txqlen);
+	if (nmsgs > 1) {
+		nni_stat_inc_atomic(&p->st_txbatches, 1);
+	}
+
+	iov.iov_buf = p->txbuf;
+	iov.iov_len = p->txqlen;
+	p->txqlen   = 0;
+	p->txbusy   = true;
+	nni_aio_set_iov(p->txaio, 1, &iov);
+	nng_stream_send(p->conn, p->txaio);
+	return (0);
+}
+
+// tcptran_pipe_txq_hold returns true if the batch should wait for more
+// messages before it is written.  It waits only while nothing is left
+// over that did not fit, and only until its first message has waited as
+// long as NNG_OPT_SENDBATCHTIME allows.  The timer then sends it.
+static bool
+tcptran_pipe_txq_hold(tcptran_pipe *p)
+{
+	nni_time now;
+
+	if ((p->txbatchtime <= 0) || (!nni_list_empty(&p->sendq))) {
+		return (false);
+	}
+	if (p->txwait) {
+		// The timer is already running, and will be back soon.
+		return (true);
+	}
+	now = nni_clock();
+	if (now >= p->txqtime + (nni_time) p->txbatchtime) {
+		return (false);
+	}
+	p->txwait = true;
+	nni_sleep_aio(
+	    (nng_duration) (p->txqtime + p->txbatchtime - now), p->txtimer);
+	return (true);
+}
+
+static void
+tcptran_pipe_txtimer_cb(void *arg)
+{
+	tcptran_pipe *p = arg;
+
+	nni_mtx_lock(&p->mtx);
+	p->txwait = false;
+	if (nni_aio_result(p->txtimer) == 0) {
+		tcptran_pipe_send_start(p);
+	}
+	nni_mtx_unlock(&p->mtx);
+}
+
 static void
 tcptran_pipe_send_start(tcptran_pipe *p)
 {
@@ -442,21 +627,58 @@ tcptran_pipe_send_start(tcptran_pipe *p)
 	int      niov;
 	nni_iov  iov[3];
 	uint64_t len;
+	uint8_t *frame;
+	size_t   flen;
 
 	if (p->closed) {
 		while ((aio = nni_list_first(&p->sendq)) != NULL) {
 			nni_list_remove(&p->sendq, aio);
 			nni_aio_finish_error(aio, NNG_ECLOSED);
 		}
+		nni_lmq_flush(&p->txq);
+		p->txqlen = 0;
+		return;
+	}
+	if (p->txbusy) {
 		return;
 	}
 
+	// Small messages are accepted into the batch queue, and go out from
+	// there, along with anything accepted while the last write was in
+	// progress, all in one write.
+	tcptran_pipe_txq_fill(p);
+	if (!nni_lmq_empty(&p->txq)) {
+		if (tcptran_pipe_txq_hold(p)) {
+			return;
+		}
+		if (tcptran_pipe_txq_send(p) == 0) {
+			tcptran_pipe_txq_fill(p);
+			return;
+		}
+	}
+
 	if ((aio = nni_list_first(&p->sendq)) == NULL) {
 		return;
 	}
+	nni_aio_list_remove(aio);
+	p->txcur  = aio;
+	p->txbusy = true;
 
 	// This runs to send the message.
 	msg = nni_aio_get_msg(aio);
+
+	// A message that is shared across many pipes may come with its frame
+	// already encoded (see nni_msg_frame_prep).  If so, send that as is,
+	// skipping the leading message type byte which is only used by IPC.
+	if ((frame = nni_msg_frame(msg, &flen)) != NULL) {
+		iov[0].iov_buf = frame + 1;
+		iov[0].iov_len = flen - 1;
+		nni_aio_set_iov(p->txaio, 1, iov);
+		nng_stream_send(p->conn, p->txaio);
+		tcptran_pipe_txq_fill(p);
+		return;
+	}
+
 	len = nni_msg_len(msg) + nni_msg_header_len(msg);
 
 	NNI_PUT64(p->txlen, len);
@@ -478,6 +700,7 @@ tcptran_pipe_send_start(tcptran_pipe *p)
 	}
 	nni_aio_set_iov(txaio, niov, iov);
 	nng_stream_send(p->conn, txaio);
+	tcptran_pipe_txq_fill(p);
 }
 
 static void
@@ -496,8 +719,11 @@ tcptran_pipe_send(void *arg, nni_aio *aio)
 		return;
 	}
 	nni_list_append(&p->sendq, aio);
-	if (nni_list_first(&p->sendq) == aio) {
+	if (!p->txbusy) {
 		tcptran_pipe_send_start(p);
+	} else if (!p->closed) {
+		// Accept it now if it can go in the next batch.
+		tcptran_pipe_txq_fill(p);
 	}
 	nni_mtx_unlock(&p->mtx);
 }
@@ -857,8 +1083,9 @@ tcptran_ep_init(tcptran_ep **epp, nng_url *url, nni_sock *sock)
 	NNI_LIST_INIT(&ep->waitpipes, tcptran_pipe, node);
 	NNI_LIST_INIT(&ep->negopipes, tcptran_pipe, node);
 
-	ep->proto = nni_sock_proto_id(sock);
-	ep->url   = url;
+	ep->proto   = nni_sock_proto_id(sock);
+	ep->url     = url;
+	ep->txbatch = TCPTRAN_DEF_SENDBATCH;
 
 	nni_stat_init(&ep->st_rcvmaxsz, "rcvmaxsz", "maximum receive size");
 	nni_stat_set_type(&ep->st_rcvmaxsz, NNG_STAT_LEVEL);
@@ -1045,6 +1272,86 @@ tcptran_ep_set_recvmaxsz(void *arg, const void *v, size_t sz, nni_opt_type t)
 	return (rv);
 }
 
+static int
+tcptran_ep_get_sendbatch(void *arg, void *v, size_t *szp, nni_opt_type t)
+{
+	tcptran_ep *ep = arg;
+	int         rv;
+
+	nni_mtx_lock(&ep->mtx);
+	rv = nni_copyout_size(ep->txbatch, v, szp, t);
+	nni_mtx_unlock(&ep->mtx);
+	return (rv);
+}
+
+static int
+tcptran_ep_set_sendbatch(void *arg, const void *v, size_t sz, nni_opt_type t)
+{
+	tcptran_ep *ep = arg;
+	size_t      val;
+	int         rv;
+	if ((rv = nni_copyin_size(&val, v, sz, 0, NNI_MAXSZ, t)) == 0) {
+		tcptran_pipe *p;
+		nni_mtx_lock(&ep->mtx);
+		ep->txbatch = val;
+		// Pipes already handed to the socket pick this up the
+		// next time they fill their batch queue.
+		NNI_LIST_FOREACH (&ep->waitpipes, p) {
+			p->txbatch = val;
+		}
+		NNI_LIST_FOREACH (&ep->negopipes, p) {
+			p->txbatch = val;
+		}
+		NNI_LIST_FOREACH (&ep->busypipes, p) {
+			nni_mtx_lock(&p->mtx);
+			p->txbatch = val;
+			nni_mtx_unlock(&p->mtx);
+		}
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
+static int
+tcptran_ep_get_sendbatchtime(
+    void *arg, void *v, size_t *szp, nni_opt_type t)
+{
+	tcptran_ep *ep = arg;
+	int         rv;
+
+	nni_mtx_lock(&ep->mtx);
+	rv = nni_copyout_ms(ep->txbatchtime, v, szp, t);
+	nni_mtx_unlock(&ep->mtx);
+	return (rv);
+}
+
+static int
+tcptran_ep_set_sendbatchtime(
+    void *arg, const void *v, size_t sz, nni_opt_type t)
+{
+	tcptran_ep * ep = arg;
+	nng_duration val;
+	int          rv;
+	if ((rv = nni_copyin_ms(&val, v, sz, t)) == 0) {
+		tcptran_pipe *p;
+		nni_mtx_lock(&ep->mtx);
+		ep->txbatchtime = val;
+		NNI_LIST_FOREACH (&ep->waitpipes, p) {
+			p->txbatchtime = val;
+		}
+		NNI_LIST_FOREACH (&ep->negopipes, p) {
+			p->txbatchtime = val;
+		}
+		NNI_LIST_FOREACH (&ep->busypipes, p) {
+			nni_mtx_lock(&p->mtx);
+			p->txbatchtime = val;
+			nni_mtx_unlock(&p->mtx);
+		}
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
 static int
 tcptran_ep_bind(void *arg)
 {
@@ -1102,6 +1409,7 @@ static nni_tran_pipe_ops tcptran_pipe_ops = {
 	.p_close  = tcptran_pipe_close,
 	.p_peer   = tcptran_pipe_peer,
 	.p_getopt = tcptran_pipe_getopt,
+	.p_framed = true,
 };
 
 static const nni_option tcptran_ep_opts[] = {
@@ -1110,6 +1418,16 @@ static const nni_option tcptran_ep_opts[] = {
 	    .o_get  = tcptran_ep_get_recvmaxsz,
 	    .o_set  = tcptran_ep_set_recvmaxsz,
 	},
+	{
+	    .o_name = NNG_OPT_SENDBATCH,
+	    .o_get  = tcptran_ep_get_sendbatch,
+	    .o_set  = tcptran_ep_set_sendbatch,
+	},
+	{
+	    .o_name = NNG_OPT_SENDBATCHTIME,
+	    .o_get  = tcptran_ep_get_sendbatchtime,
+	    .o_set  = tcptran_ep_set_sendbatchtime,
+	},
 	{
 	    .o_name = NNG_OPT_URL,
 	    .o_get  = tcptran_ep_get_url,
@@ -1177,15 +1495,29 @@ tcptran_listener_setopt(
 }
 
 static int
-tcptran_check_recvmaxsz(const void *v, size_t sz, nni_type t)
+tcptran_check_size(const void *v, size_t sz, nni_type t)
 {
 	return (nni_copyin_size(NULL, v, sz, 0, NNI_MAXSZ, t));
 }
 
+static int
+tcptran_check_ms(const void *v, size_t sz, nni_type t)
+{
+	return (nni_copyin_ms(NULL, v, sz, t));
+}
+
 static nni_chkoption tcptran_checkopts[] = {
 	{
 	    .o_name  = NNG_OPT_RECVMAXSZ,
-	    .o_check = tcptran_check_recvmaxsz,
+	    .o_check = tcptran_check_size,
+	},
+	{
+	    .o_name  = NNG_OPT_SENDBATCH,
+	    .o_check = tcptran_check_size,
+	},
+	{
+	    .o_name  = NNG_OPT_SENDBATCHTIME,
+	    .o_check = tcptran_check_ms,
 	},
 	{
 	    .o_name = NULL,
@@ -444,12 +444,25 @@ tlstran_pipe_send_start(tlstran_pipe *p)
 	int      niov;
 	nni_iov  iov[3];
 	uint64_t len;
+	uint8_t *frame;
+	size_t   flen;
 
 	if ((aio = nni_list_first(&p->sendq)) == NULL) {
 		return;
 	}
 
 	msg = nni_aio_get_msg(aio);
+
+	// Use the pre-encoded frame if the message has one.  Like TCP, we
+	// leave off the first byte, which is the IPC message type.
+	if ((frame = nni_msg_frame(msg, &flen)) != NULL) {
+		iov[0].iov_buf = frame + 1;
+		iov[0].iov_len = flen - 1;
+		nni_aio_set_iov(p->txaio, 1, iov);
+		nng_stream_send(p->tls, p->txaio);
+		return;
+	}
+
 	len = nni_msg_len(msg) + nni_msg_header_len(msg);
 
 	NNI_PUT64(p->txlen, len);
@@ -1143,6 +1156,7 @@ static nni_tran_pipe_ops tlstran_pipe_ops = {
 	.p_close  = tlstran_pipe_close,
 	.p_peer   = tlstran_pipe_peer,
 	.p_getopt = tlstran_pipe_getopt,
+	.p_framed = true,
 };
 
 static nni_option tlstran_ep_options[] = {
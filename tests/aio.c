@@ -12,8 +12,12 @@
 
 #include <nng/nng.h>
 #include <nng/protocol/pair1/pair.h>
+#include <nng/protocol/reqrep0/rep.h>
+#include <nng/protocol/reqrep0/req.h>
 #include <nng/supplemental/util/platform.h>
 
+#include "core/nng_impl.h"
+
 #include "acutest.h"
 #include "testutil.h"
 
@@ -231,6 +235,311 @@ test_zero_timeout(void)
 	TEST_NNG_PASS(nng_close(s));
 }
 
+void
+test_sleep_many(void)
+{
+	// These cover every level of the expiration wheel, as well as
+	// some deadlines that share a slot.
+	static const nng_duration durs[] = { 1, 5, 5, 63, 64, 65, 130, 700,
+		4100, 300, 20, 1000 };
+	enum { NSLEEP = sizeof(durs) / sizeof(durs[0]) };
+	nng_aio *aios[NSLEEP];
+	nng_time ends[NSLEEP];
+	nng_time start;
+
+	for (int i = 0; i < NSLEEP; i++) {
+		ends[i] = 0;
+		TEST_NNG_PASS(nng_aio_alloc(&aios[i], sleepdone, &ends[i]));
+	}
+	start = nng_clock();
+	for (int i = 0; i < NSLEEP; i++) {
+		nng_sleep_aio(durs[i], aios[i]);
+	}
+	for (int i = 0; i < NSLEEP; i++) {
+		nng_aio_wait(aios[i]);
+		TEST_NNG_PASS(nng_aio_result(aios[i]));
+		TEST_CHECK(ends[i] >= start + durs[i]);
+		TEST_CHECK(ends[i] <= start + durs[i] + 500);
+		nng_aio_free(aios[i]);
+	}
+}
+
+void
+test_sleep_cancel_many(void)
+{
+	nng_aio *aios[1000];
+	int      done = 0;
+
+	for (int i = 0; i < 1000; i++) {
+		TEST_NNG_PASS(nng_aio_alloc(&aios[i], cbdone, &done));
+		nng_sleep_aio(1000 + (i * 7919) % 100000, aios[i]);
+	}
+	for (int i = 0; i < 1000; i++) {
+		nng_aio_cancel(aios[i]);
+		nng_aio_wait(aios[i]);
+		TEST_NNG_FAIL(nng_aio_result(aios[i]), NNG_ECANCELED);
+		nng_aio_free(aios[i]);
+	}
+	TEST_CHECK(done == 1000);
+}
+
+typedef struct {
+	nni_aio *      aio;
+	nni_atomic_int count;
+	int            target;
+	int            here; // callbacks run on the finishing thread
+} inline_chain;
+
+static nni_plat_tls inline_tls;
+
+static void
+inline_cb(void *arg)
+{
+	inline_chain *c = arg;
+
+	if (nni_plat_tls_get(&inline_tls) == c) {
+		c->here++;
+	}
+	// Each callback starts the next operation, which completes at once.
+	nni_atomic_inc(&c->count);
+	if ((nni_atomic_get(&c->count) < c->target) &&
+	    (nni_aio_begin(c->aio) == 0)) {
+		nni_aio_finish_inline(c->aio, 0, 0);
+	}
+}
+
+static void
+inline_run(inline_chain *c, int target, bool inl)
+{
+	memset(c, 0, sizeof(*c));
+	nni_atomic_init(&c->count);
+	c->target = target;
+	TEST_NNG_PASS(nni_aio_alloc(&c->aio, inline_cb, c));
+	nni_aio_set_inline(c->aio, inl);
+
+	nni_plat_tls_set(&inline_tls, c);
+	TEST_NNG_PASS(nni_aio_begin(c->aio));
+	nni_aio_finish_inline(c->aio, 0, 0);
+	nni_plat_tls_set(&inline_tls, NULL);
+
+	for (int i = 0; i < 500; i++) {
+		if (nni_atomic_get(&c->count) >= target) {
+			break;
+		}
+		nng_msleep(10);
+	}
+	nni_aio_wait(c->aio);
+	TEST_CHECK(nni_atomic_get(&c->count) == target);
+	nni_aio_free(c->aio);
+}
+
+void
+test_inline_completion(void)
+{
+	inline_chain c;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nni_plat_tls_init(&inline_tls, NULL));
+
+	// Not allowed by the consumer, so always dispatched.
+	inline_run(&c, 10, false);
+	TEST_CHECK(c.here == 0);
+
+	// Allowed, but only so deep; the rest of the chain carries on
+	// from the taskq.
+	inline_run(&c, 100, true);
+	TEST_CHECK(c.here == NNG_AIO_INLINE_DEPTH);
+	TEST_MSG("ran %d inline", c.here);
+
+	nni_plat_tls_fini(&inline_tls);
+}
+
+typedef struct {
+	nni_aio *outer;
+	nni_aio *inner;
+	bool     inner_here; // inner callback ran on the finishing thread
+	bool     inner_inline;
+} synch_chain;
+
+static void
+synch_inner_cb(void *arg)
+{
+	synch_chain *c = arg;
+
+	c->inner_here   = nni_plat_tls_get(&inline_tls) == c;
+	c->inner_inline = nni_aio_inline_active();
+}
+
+static void
+synch_outer_cb(void *arg)
+{
+	synch_chain *c = arg;
+
+	// A transport finishing its consumer's operation does this.
+	if (nni_aio_begin(c->inner) == 0) {
+		nni_aio_finish_synch(c->inner, 0, 0);
+	}
+}
+
+static void
+synch_run(synch_chain *c, bool inl)
+{
+	memset(c, 0, sizeof(*c));
+	TEST_NNG_PASS(nni_aio_alloc(&c->outer, synch_outer_cb, c));
+	TEST_NNG_PASS(nni_aio_alloc(&c->inner, synch_inner_cb, c));
+	nni_aio_set_inline(c->outer, true);
+	nni_aio_set_inline(c->inner, inl);
+
+	nni_plat_tls_set(&inline_tls, c);
+	TEST_NNG_PASS(nni_aio_begin(c->outer));
+	nni_aio_finish_inline(c->outer, 0, 0);
+	nni_plat_tls_set(&inline_tls, NULL);
+
+	nni_aio_wait(c->outer);
+	nni_aio_wait(c->inner);
+	nni_aio_free(c->outer);
+	nni_aio_free(c->inner);
+}
+
+void
+test_inline_synch(void)
+{
+	synch_chain c;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nni_plat_tls_init(&inline_tls, NULL));
+
+	// A synchronous completion within an inline one does not carry
+	// on to a consumer that has not allowed it.
+	synch_run(&c, false);
+	TEST_CHECK(!c.inner_here);
+	TEST_CHECK(!c.inner_inline);
+
+	synch_run(&c, true);
+	TEST_CHECK(c.inner_here);
+	TEST_CHECK(c.inner_inline);
+
+	nni_plat_tls_fini(&inline_tls);
+}
+
+#define NUSERMSGS 20
+#define NUSERSIZE (1024 * 1024)
+
+static nni_atomic_int user_inline; // user callbacks run inline
+
+static void
+user_cb(void *arg)
+{
+	NNI_ARG_UNUSED(arg);
+	if (nni_aio_inline_active()) {
+		nni_atomic_inc(&user_inline);
+	}
+}
+
+static void
+user_callback_check(const char *scheme)
+{
+	nng_socket req;
+	nng_socket rep;
+	nng_aio *  reqaio;
+	nng_aio *  repaio;
+	nng_msg *  msg;
+	char       addr[64];
+
+	testutil_scratch_addr(scheme, sizeof(addr), addr);
+	nni_atomic_init(&user_inline);
+	TEST_NNG_PASS(nng_req0_open(&req));
+	TEST_NNG_PASS(nng_rep0_open(&rep));
+	TEST_NNG_PASS(nng_aio_alloc(&reqaio, user_cb, NULL));
+	TEST_NNG_PASS(nng_aio_alloc(&repaio, user_cb, NULL));
+	nng_aio_set_timeout(reqaio, 5000);
+	nng_aio_set_timeout(repaio, 5000);
+
+	TEST_NNG_PASS(nng_listen(rep, addr, NULL, 0));
+	TEST_NNG_PASS(nng_dial(req, addr, NULL, 0));
+
+	// Both receives are posted before their message arrives, so the
+	// protocols finish them from the transport's read callback.  The
+	// messages are large, so that the poller finishes those reads.
+	for (int i = 0; i < NUSERMSGS; i++) {
+		nng_recv_aio(rep, repaio);
+		TEST_NNG_PASS(nng_msg_alloc(&msg, NUSERSIZE));
+		TEST_NNG_PASS(nng_sendmsg(req, msg, 0));
+		nng_recv_aio(req, reqaio);
+		nng_aio_wait(repaio);
+		TEST_NNG_PASS(nng_aio_result(repaio));
+		msg = nng_aio_get_msg(repaio);
+		TEST_NNG_PASS(nng_sendmsg(rep, msg, 0));
+		nng_aio_wait(reqaio);
+		TEST_NNG_PASS(nng_aio_result(reqaio));
+		nng_msg_free(nng_aio_get_msg(reqaio));
+	}
+	TEST_CHECK(nni_atomic_get(&user_inline) == 0);
+	TEST_MSG("%d user callbacks ran inline", nni_atomic_get(&user_inline));
+
+	TEST_NNG_PASS(nng_close(req));
+	TEST_NNG_PASS(nng_close(rep));
+	nng_aio_free(reqaio);
+	nng_aio_free(repaio);
+}
+
+void
+test_inline_user_callback(void)
+{
+	// Messages arrive on the poller thread, which completes the
+	// transport's reads inline; the user's callback must not be.
+	user_callback_check("tcp");
+	user_callback_check("ipc");
+}
+
+typedef struct {
+	nni_aio *aio;
+	int *    order;
+	int      id;
+} completion_rec;
+
+static void
+completion_cb(void *arg)
+{
+	completion_rec *r = arg;
+	int *           o = r->order;
+
+	while (*o != 0) {
+		o++;
+	}
+	*o = r->id;
+}
+
+void
+test_completions_in_order(void)
+{
+	completion_rec      recs[3];
+	int                 order[4] = { 0 };
+	nni_aio_completions done;
+
+	TEST_NNG_PASS(nni_init());
+	nni_aio_completions_init(&done);
+	for (int i = 0; i < 3; i++) {
+		recs[i].order = order;
+		recs[i].id    = i + 1;
+		TEST_NNG_PASS(
+		    nni_aio_alloc(&recs[i].aio, completion_cb, &recs[i]));
+		nni_aio_set_inline(recs[i].aio, true);
+		TEST_NNG_PASS(nni_aio_begin(recs[i].aio));
+		nni_aio_completions_add(&done, recs[i].aio, 0, i);
+	}
+	TEST_CHECK(order[0] == 0);
+	nni_aio_completions_run(&done);
+	TEST_CHECK(done == NULL);
+	for (int i = 0; i < 3; i++) {
+		// Inline, so they have all run by now, in order.
+		TEST_CHECK(order[i] == i + 1);
+		TEST_NNG_PASS(nni_aio_result(recs[i].aio));
+		TEST_CHECK(nni_aio_count(recs[i].aio) == (size_t) i);
+		nni_aio_free(recs[i].aio);
+	}
+}
+
 TEST_LIST = {
 	{ "sleep", test_sleep },
 	{ "sleep timeout", test_sleep_timeout },
@@ -241,5 +550,11 @@ TEST_LIST = {
 	{ "explicit timeout", test_explicit_timeout },
 	{ "inherited timeout", test_inherited_timeout },
 	{ "zero timeout", test_zero_timeout },
+	{ "sleep many", test_sleep_many },
+	{ "sleep cancel many", test_sleep_cancel_many },
+	{ "inline completion", test_inline_completion },
+	{ "inline synch", test_inline_synch },
+	{ "inline user callback", test_inline_user_callback },
+	{ "completions in order", test_completions_in_order },
 	{ NULL, NULL },
 };
\ No newline at end of file
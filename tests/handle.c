@@ -0,0 +1,245 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <nng/nng.h>
+
+#include "core/nng_impl.h"
+
+#include "acutest.h"
+#include "testutil.h"
+
+void
+test_handle_basic(void)
+{
+	nni_handles *t;
+	uint32_t     id;
+	int          val;
+	void *       obj;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nni_handles_init(&t, false));
+	TEST_NNG_PASS(nni_handle_alloc(t, &id, &val, 0));
+	TEST_CHECK(id > 0);
+	TEST_CHECK(id <= 0x7fffffffu);
+
+	// Not visible until published.
+	TEST_NNG_FAIL(nni_handle_hold(t, id, &obj), NNG_ENOENT);
+	nni_handle_publish(t, id);
+	TEST_NNG_PASS(nni_handle_hold(t, id, &obj));
+	TEST_CHECK(obj == &val);
+	TEST_NNG_PASS(nni_handle_hold(t, id, NULL));
+	TEST_CHECK(nni_handle_refs(t, id) == 2);
+	TEST_CHECK(nni_handle_rele_fast(t, id));
+	TEST_CHECK(nni_handle_refs(t, id) == 1);
+
+	// Once closed, holds fail and releases take the slow path.
+	TEST_CHECK(!nni_handle_closed(t, id));
+	TEST_CHECK(nni_handle_close(t, id) == 1);
+	TEST_CHECK(nni_handle_closed(t, id));
+	TEST_CHECK(nni_handle_close(t, id) == 1);
+	TEST_NNG_FAIL(nni_handle_hold(t, id, &obj), NNG_ENOENT);
+	TEST_CHECK(!nni_handle_rele_fast(t, id));
+	TEST_CHECK(nni_handle_rele(t, id) == 0);
+
+	nni_handle_free(t, id);
+	TEST_NNG_FAIL(nni_handle_hold(t, id, &obj), NNG_ENOENT);
+	nni_handles_fini(t);
+}
+
+void
+test_handle_bogus(void)
+{
+	nni_handles *t;
+	uint32_t     id;
+	int          val;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nni_handles_init(&t, false));
+	TEST_NNG_FAIL(nni_handle_hold(t, 1, NULL), NNG_ENOENT);
+	TEST_NNG_PASS(nni_handle_alloc(t, &id, &val, 0));
+	nni_handle_publish(t, id);
+	TEST_NNG_FAIL(nni_handle_hold(t, 0, NULL), NNG_ENOENT);
+	TEST_NNG_FAIL(nni_handle_hold(t, id + 1, NULL), NNG_ENOENT);
+	TEST_NNG_FAIL(nni_handle_hold(t, id | (1u << 30), NULL), NNG_ENOENT);
+	TEST_NNG_FAIL(nni_handle_hold(t, 0x7fffffffu, NULL), NNG_ENOENT);
+	TEST_NNG_FAIL(nni_handle_hold(t, 0xffffffffu, NULL), NNG_ENOENT);
+	nni_handle_close(t, id);
+	nni_handle_free(t, id);
+	nni_handles_fini(t);
+}
+
+#define NREUSE 5000
+
+void
+test_handle_reuse(void)
+{
+	nni_handles *t;
+	uint32_t *   ids;
+	int          val;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nni_handles_init(&t, true));
+	TEST_ASSERT((ids = nni_alloc(sizeof(uint32_t) * NREUSE)) != NULL);
+
+	// Open and close handles one at a time; no ID comes back.
+	for (int i = 0; i < NREUSE; i++) {
+		TEST_NNG_PASS(nni_handle_alloc(t, &ids[i], &val, 0));
+		nni_handle_publish(t, ids[i]);
+		nni_handle_close(t, ids[i]);
+		nni_handle_free(t, ids[i]);
+	}
+	for (int i = 0; i < NREUSE; i++) {
+		for (int j = i + 1; j < NREUSE; j++) {
+			if (ids[i] == ids[j]) {
+				TEST_CHECK(ids[i] != ids[j]);
+				TEST_MSG("id %u reused (%d %d)", ids[i], i, j);
+				i = j = NREUSE;
+			}
+		}
+	}
+
+	// Many at once spans several chunks.
+	for (int i = 0; i < NREUSE; i++) {
+		TEST_NNG_PASS(nni_handle_alloc(t, &ids[i], &ids[i], 0));
+		nni_handle_publish(t, ids[i]);
+	}
+	for (int i = 0; i < NREUSE; i++) {
+		void *obj;
+		TEST_NNG_PASS(nni_handle_hold(t, ids[i], &obj));
+		TEST_CHECK(obj == &ids[i]);
+		TEST_CHECK(nni_handle_rele_fast(t, ids[i]));
+		nni_handle_close(t, ids[i]);
+		nni_handle_free(t, ids[i]);
+	}
+
+	nni_free(ids, sizeof(uint32_t) * NREUSE);
+	nni_handles_fini(t);
+}
+
+// More than the slots in rotation times the generations, with the
+// reuse delay we used to have, so this would have wrapped.
+#define NCYCLE 300000
+
+static int
+id_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+void
+test_handle_reuse_delay(void)
+{
+	nni_handles *t;
+	uint32_t *   ids;
+	uint32_t     live[16];
+	int          val;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nni_handles_init(&t, false));
+	TEST_ASSERT((ids = nni_alloc(sizeof(uint32_t) * NCYCLE)) != NULL);
+
+	// Keep a few handles open, so the churn is not all one slot.
+	for (int i = 0; i < 16; i++) {
+		TEST_NNG_PASS(nni_handle_alloc(t, &live[i], &val, 0));
+		nni_handle_publish(t, live[i]);
+	}
+	for (int i = 0; i < NCYCLE; i++) {
+		TEST_NNG_PASS(nni_handle_alloc(t, &ids[i], &val, 0));
+		nni_handle_close(t, ids[i]);
+		nni_handle_free(t, ids[i]);
+	}
+	qsort(ids, NCYCLE, sizeof(uint32_t), id_cmp);
+	for (int i = 1; i < NCYCLE; i++) {
+		if (ids[i] == ids[i - 1]) {
+			TEST_CHECK(ids[i] != ids[i - 1]);
+			TEST_MSG("id %u reused", ids[i]);
+			break;
+		}
+	}
+	for (int i = 0; i < 16; i++) {
+		TEST_NNG_PASS(nni_handle_hold(t, live[i], NULL));
+		TEST_CHECK(nni_handle_rele_fast(t, live[i]));
+		nni_handle_close(t, live[i]);
+		nni_handle_free(t, live[i]);
+	}
+
+	nni_free(ids, sizeof(uint32_t) * NCYCLE);
+	nni_handles_fini(t);
+}
+
+#define NTHREADS 4
+#define NHOLDS 100000
+
+typedef struct {
+	nni_handles *t;
+	uint32_t     id;
+	int          fails;
+} holder;
+
+static void
+hold_loop(void *arg)
+{
+	holder *h = arg;
+
+	for (int i = 0; i < NHOLDS; i++) {
+		if (nni_handle_hold(h->t, h->id, NULL) != 0) {
+			h->fails++;
+			continue;
+		}
+		if (!nni_handle_rele_fast(h->t, h->id)) {
+			h->fails++;
+		}
+	}
+}
+
+void
+test_handle_concurrent(void)
+{
+	nni_handles *t;
+	nni_thr      thrs[NTHREADS];
+	holder       holders[NTHREADS];
+	uint32_t     id;
+	int          val;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nni_handles_init(&t, false));
+	TEST_NNG_PASS(nni_handle_alloc(t, &id, &val, 0));
+	nni_handle_publish(t, id);
+
+	for (int i = 0; i < NTHREADS; i++) {
+		holders[i].t     = t;
+		holders[i].id    = id;
+		holders[i].fails = 0;
+		TEST_NNG_PASS(nni_thr_init(&thrs[i], hold_loop, &holders[i]));
+	}
+	for (int i = 0; i < NTHREADS; i++) {
+		nni_thr_run(&thrs[i]);
+	}
+	for (int i = 0; i < NTHREADS; i++) {
+		nni_thr_fini(&thrs[i]);
+		TEST_CHECK(holders[i].fails == 0);
+	}
+	TEST_CHECK(nni_handle_refs(t, id) == 0);
+
+	nni_handle_close(t, id);
+	nni_handle_free(t, id);
+	nni_handles_fini(t);
+}
+
+TEST_LIST = {
+	{ "handle basic", test_handle_basic },
+	{ "handle bogus", test_handle_bogus },
+	{ "handle reuse", test_handle_reuse },
+	{ "handle reuse delay", test_handle_reuse_delay },
+	{ "handle concurrent", test_handle_concurrent },
+	{ NULL, NULL },
+};
@@ -161,6 +161,64 @@ fail:
 	return (rv);
 }
 
+// httphdr sends a GET, with the named header (if not NULL), and returns
+// the body, the status, and the value of the named response header.
+static int
+httphdr(const char *addr, const char *name, const char *val,
+    const char *rname, void **datap, size_t *sizep, uint16_t *statp,
+    char **rvalp)
+{
+	int           rv;
+	nng_http_req *req  = NULL;
+	nng_http_res *res  = NULL;
+	nng_url *     url  = NULL;
+	size_t        clen = 0;
+	void *        data = NULL;
+	char *        rval = NULL;
+	const char *  ptr;
+
+	if (((rv = nng_url_parse(&url, addr)) != 0) ||
+	    ((rv = nng_http_req_alloc(&req, url)) != 0) ||
+	    ((name != NULL) &&
+	        ((rv = nng_http_req_set_header(req, name, val)) != 0)) ||
+	    ((rv = nng_http_res_alloc(&res)) != 0)) {
+		goto fail;
+	}
+	if ((rv = httpdo(url, req, res, &data, &clen)) != 0) {
+		goto fail;
+	}
+
+	*statp = nng_http_res_get_status(res);
+	if ((ptr = nng_http_res_get_header(res, rname)) != NULL) {
+		rval = strdup(ptr);
+	}
+
+	*datap = data;
+	*sizep = clen;
+	*rvalp = rval;
+
+fail:
+	if (url != NULL) {
+		nni_url_free(url);
+	}
+	if (req != NULL) {
+		nng_http_req_free(req);
+	}
+	if (res != NULL) {
+		nng_http_res_free(res);
+	}
+
+	return (rv);
+}
+
+static int
+httprange(const char *addr, const char *range, void **datap, size_t *sizep,
+    uint16_t *statp, char **crangep)
+{
+	return (httphdr(addr, "Range", range, "Content-Range", datap, sizep,
+	    statp, crangep));
+}
+
 static void
 httpecho(nng_aio *aio)
 {
@@ -543,6 +601,273 @@ TestMain("HTTP Server", {
 		So(nng_http_server_start(s) == 0);
 		nng_msleep(100);
 
+		Convey("Range requests work", {
+			char     fullurl[256];
+			void *   data;
+			size_t   size;
+			uint16_t stat;
+			char *   crange;
+
+			snprintf(fullurl, sizeof(fullurl),
+			    "%s/docs/file.txt", urlstr);
+
+			So(httprange(fullurl, "bytes=5-6", &data, &size, &stat,
+			       &crange) == 0);
+			So(stat == NNG_HTTP_STATUS_PARTIAL_CONTENT);
+			So(size == 2);
+			So(memcmp(data, doc2 + 5, size) == 0);
+			So(crange != NULL);
+			So(strcmp(crange, "bytes 5-6/20") == 0);
+			free(crange);
+			nng_free(data, size);
+
+			So(httprange(fullurl, "bytes=15-", &data, &size, &stat,
+			       &crange) == 0);
+			So(stat == NNG_HTTP_STATUS_PARTIAL_CONTENT);
+			So(size == 5);
+			So(memcmp(data, "file.", size) == 0);
+			So(strcmp(crange, "bytes 15-19/20") == 0);
+			free(crange);
+			nng_free(data, size);
+
+			So(httprange(fullurl, "bytes=-5", &data, &size, &stat,
+			       &crange) == 0);
+			So(stat == NNG_HTTP_STATUS_PARTIAL_CONTENT);
+			So(size == 5);
+			So(memcmp(data, "file.", size) == 0);
+			free(crange);
+			nng_free(data, size);
+
+			// Past the end.
+			So(httprange(fullurl, "bytes=20-", &data, &size, &stat,
+			       &crange) == 0);
+			So(stat == NNG_HTTP_STATUS_RANGE_NOT_SATISFIABLE);
+			So(crange != NULL);
+			So(strcmp(crange, "bytes */20") == 0);
+			free(crange);
+			nng_free(data, size);
+
+			// Multiple ranges are not supported; we get it all.
+			So(httprange(fullurl, "bytes=0-1,4-5", &data, &size,
+			       &stat, &crange) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(size == strlen(doc2));
+			So(memcmp(data, doc2, size) == 0);
+			So(crange == NULL);
+			nng_free(data, size);
+		});
+
+		Convey("Conditional requests work", {
+			char     fullurl[256];
+			void *   data;
+			size_t   size;
+			uint16_t stat;
+			char *   etag;
+			char *   lastmod;
+			char *   val;
+			char *   val2;
+			char *   doc3;
+			char *   tmpfile;
+
+			So(nng_http_server_set_cache(s, 1024 * 1024) == 0);
+			snprintf(fullurl, sizeof(fullurl),
+			    "%s/docs/file.txt", urlstr);
+
+			So(httphdr(fullurl, NULL, NULL, "ETag", &data, &size,
+			       &stat, &etag) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(size == strlen(doc2));
+			So(etag != NULL);
+			nng_free(data, size);
+			So(httphdr(fullurl, NULL, NULL, "Last-Modified", &data,
+			       &size, &stat, &lastmod) == 0);
+			So(lastmod != NULL);
+			So(strstr(lastmod, " GMT") != NULL);
+			nng_free(data, size);
+
+			So(httphdr(fullurl, "If-None-Match", etag, "ETag",
+			       &data, &size, &stat, &val) == 0);
+			So(stat == NNG_HTTP_STATUS_NOT_MODIFIED);
+			So(size == 0);
+			So(val != NULL);
+			So(strcmp(val, etag) == 0);
+			free(val);
+
+			So(httphdr(fullurl, "If-None-Match", "\"x\", W/\"y\"",
+			       "ETag", &data, &size, &stat, &val) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(size == strlen(doc2));
+			free(val);
+			nng_free(data, size);
+
+			So(httphdr(fullurl, "If-Modified-Since", lastmod,
+			       "ETag", &data, &size, &stat, &val) == 0);
+			So(stat == NNG_HTTP_STATUS_NOT_MODIFIED);
+			free(val);
+
+			// An If-Range that does not match gets the whole file.
+			So(httphdr(fullurl, "If-Range", "\"x\"", "ETag",
+			       &data, &size, &stat, &val) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			free(val);
+			nng_free(data, size);
+
+#ifdef NNG_ENABLE_STATS
+			{
+				nng_stat *stats;
+				nng_stat *cache;
+				nng_stat *port;
+				nng_stat *hits;
+
+				So(nng_stats_get(&stats) == 0);
+				cache = nng_stat_child(stats);
+				while (cache != NULL) {
+					if ((strncmp(nng_stat_name(cache),
+					         "http-server", 11) == 0) &&
+					    ((port = nng_stat_find(
+					          cache, "port")) != NULL) &&
+					    (strcmp(nng_stat_string(port),
+					         url->u_port) == 0)) {
+						break;
+					}
+					cache = nng_stat_next(cache);
+				}
+				So(cache != NULL);
+				So((hits = nng_stat_find(cache, "hits")) !=
+				    NULL);
+				// Only the first request missed.
+				So(nng_stat_value(hits) == 5);
+				nng_stats_free(stats);
+			}
+#endif
+
+			// A changed file is seen at once.
+			So(nni_file_put(file2, doc1, strlen(doc1)) == 0);
+			So(httphdr(fullurl, "If-None-Match", etag, "ETag",
+			       &data, &size, &stat, &val) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(size == strlen(doc1));
+			So(memcmp(data, doc1, size) == 0);
+			So(strcmp(val, etag) != 0);
+			nng_free(data, size);
+
+			// So is one replaced by another of the same size, even
+			// if the clock has not moved on in between.
+			So((doc3 = nni_strdup(doc1)) != NULL);
+			doc3[0] = '[';
+			So((tmpfile = nni_file_join(workdir, "file.tmp")) !=
+			    NULL);
+			So(nni_file_put(tmpfile, doc3, strlen(doc3)) == 0);
+			So(nni_file_delete(file2) == 0);
+			So(rename(tmpfile, file2) == 0);
+			So(httphdr(fullurl, "If-None-Match", val, "ETag",
+			       &data, &size, &stat, &val2) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(size == strlen(doc3));
+			So(memcmp(data, doc3, size) == 0);
+			So(strcmp(val2, val) != 0);
+			nng_free(data, size);
+			nni_strfree(tmpfile);
+			nni_strfree(doc3);
+			free(val2);
+			free(val);
+
+			free(etag);
+			free(lastmod);
+		});
+
+		Convey("Large files are sent in pieces", {
+			char     fullurl[256];
+			void *   data;
+			size_t   size;
+			uint16_t stat;
+			char *   crange;
+			char *   bigfile;
+			uint8_t *big;
+			size_t   bigsz = 300001; // several chunks
+
+			So((big = nni_alloc(bigsz)) != NULL);
+			for (size_t i = 0; i < bigsz; i++) {
+				big[i] = (uint8_t)((i * 7) % 251);
+			}
+			So((bigfile = nni_file_join(workdir, "big.bin")) !=
+			    NULL);
+			So(nni_file_put(bigfile, big, bigsz) == 0);
+			Reset({
+				nni_file_delete(bigfile);
+				free(bigfile);
+				nni_free(big, bigsz);
+			});
+			snprintf(fullurl, sizeof(fullurl), "%s/docs/big.bin",
+			    urlstr);
+
+			So(httphdr(fullurl, NULL, NULL, "Content-Range", &data,
+			       &size, &stat, &crange) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(size == bigsz);
+			So(memcmp(data, big, size) == 0);
+			nng_free(data, size);
+
+			So(httprange(fullurl, "bytes=70000-200000", &data,
+			       &size, &stat, &crange) == 0);
+			So(stat == NNG_HTTP_STATUS_PARTIAL_CONTENT);
+			So(size == 130001);
+			So(memcmp(data, big + 70000, size) == 0);
+			So(crange != NULL);
+			So(strcmp(crange, "bytes 70000-200000/300001") == 0);
+			free(crange);
+			nng_free(data, size);
+		});
+
+		Convey("Precompressed files are used", {
+			char        fullurl[256];
+			void *      data;
+			size_t      size;
+			uint16_t    stat;
+			char *      cenc;
+			char *      gzfile;
+			const char *gz = "not really gzip";
+
+			So((gzfile = nni_file_join(workdir, "file.txt.gz")) !=
+			    NULL);
+			So(nni_file_put(gzfile, gz, strlen(gz)) == 0);
+			Reset({
+				nni_file_delete(gzfile);
+				free(gzfile);
+			});
+			snprintf(fullurl, sizeof(fullurl),
+			    "%s/docs/file.txt", urlstr);
+
+			So(httphdr(fullurl, "Accept-Encoding", "deflate, gzip",
+			       "Content-Encoding", &data, &size, &stat,
+			       &cenc) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(cenc != NULL);
+			So(strcmp(cenc, "gzip") == 0);
+			So(size == strlen(gz));
+			So(memcmp(data, gz, size) == 0);
+			free(cenc);
+			nng_free(data, size);
+
+			So(httphdr(fullurl, "Accept-Encoding", "gzip;q=0",
+			       "Content-Encoding", &data, &size, &stat,
+			       &cenc) == 0);
+			So(stat == NNG_HTTP_STATUS_OK);
+			So(cenc == NULL);
+			So(size == strlen(doc2));
+			So(memcmp(data, doc2, size) == 0);
+			nng_free(data, size);
+
+			// Caches are told the plain file is not the only one.
+			So(httphdr(fullurl, NULL, NULL, "Vary", &data, &size,
+			       &stat, &cenc) == 0);
+			So(cenc != NULL);
+			So(strcmp(cenc, "Accept-Encoding") == 0);
+			So(size == strlen(doc2));
+			free(cenc);
+			nng_free(data, size);
+		});
+
 		Convey("Index.html works", {
 			char     fullurl[256];
 			void *   data;
@@ -239,6 +239,61 @@ Main({
 		});
 	});
 
+	Test("Resizing", {
+		static int vals[4096];
+
+		Convey("Given an id hash", {
+			nni_idhash *h;
+			So(nni_idhash_init(&h) == 0);
+			Reset({ nni_idhash_fini(h); });
+
+			Convey("Keys stay visible while it grows", {
+				void *v;
+				int   bad = 0;
+
+				for (uint64_t i = 0; i < 4096; i++) {
+					So(nni_idhash_insert(
+					       h, i, &vals[i]) == 0);
+					// Check an older key, which may
+					// not have been moved yet.
+					if ((nni_idhash_find(h, i / 2, &v) !=
+					        0) ||
+					    (v != &vals[i / 2])) {
+						bad++;
+					}
+				}
+				So(bad == 0);
+				So(nni_idhash_count(h) == 4096);
+
+				Convey("And while it shrinks", {
+					for (uint64_t i = 0; i < 4096;
+					     i += 2) {
+						So(nni_idhash_remove(h, i) ==
+						    0);
+					}
+					So(nni_idhash_count(h) == 2048);
+					for (uint64_t i = 0; i < 4096; i++) {
+						int rv;
+						rv = nni_idhash_find(h, i, &v);
+						if ((i & 1) == 0) {
+							bad += (rv == 0);
+						} else if ((rv != 0) ||
+						    (v != &vals[i])) {
+							bad++;
+						}
+					}
+					So(bad == 0);
+					for (uint64_t i = 1; i < 4096;
+					     i += 2) {
+						So(nni_idhash_remove(h, i) ==
+						    0);
+					}
+					So(nni_idhash_count(h) == 0);
+				});
+			});
+		});
+	});
+
 	Test("Stress it", {
 		void *values[NVALUES];
 
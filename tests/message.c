@@ -164,6 +164,18 @@ TestMain("Message Tests", {
 			So(strcmp(nng_msg_body(msg), "++abc") == 0);
 		});
 
+		Convey("Inserting past a little headroom works", {
+			char chunk[30];
+			memset(chunk, '+', sizeof(chunk));
+			So(nng_msg_append(msg, chunk, sizeof(chunk)) == 0);
+			So(nng_msg_trim(msg, 2) == 0);
+			So(nng_msg_insert(msg, "abcd", 4) == 0);
+			So(nng_msg_len(msg) == sizeof(chunk) + 2);
+			So(memcmp(nng_msg_body(msg), "abcd", 4) == 0);
+			So(memcmp((char *) nng_msg_body(msg) + 4, chunk,
+			       sizeof(chunk) - 2) == 0);
+		});
+
 		Convey("Message dup works", {
 			nng_msg *m2;
 
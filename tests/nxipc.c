@@ -0,0 +1,410 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <pthread.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+#include "core/nng_impl.h"
+#include "nuttx/nxipc.h"
+
+#include "acutest.h"
+#include "testutil.h"
+
+#define OP_SLOW 1
+#define OP_FAST 2
+
+static int
+slow_cb(const void *cookie, const int code, const nxparcel *in,
+    nxparcel **out)
+{
+	(void) in;
+	(void) out;
+	nni_atomic_inc64((nni_atomic_u64 *) cookie);
+	if (code == OP_SLOW) {
+		nng_msleep(100);
+	}
+	return (0);
+}
+
+static void
+count_done(void *cookie, int ret, const nxparcel *out)
+{
+	(void) ret;
+	(void) out;
+	nni_atomic_inc64((nni_atomic_u64 *) cookie);
+}
+
+void
+test_server_release_busy_lane(void)
+{
+	void *         server;
+	void *         client;
+	nni_atomic_u64 ran;
+	nni_atomic_u64 done;
+
+	nni_atomic_init64(&ran);
+	nni_atomic_init64(&done);
+	server = nxipc_server_create_ex("nxipc-lane", 4);
+	TEST_ASSERT(server != NULL);
+	nxipc_server_set_transaction_cb(server, slow_cb, &ran);
+	TEST_CHECK(nxipc_server_set_affinity(server, OP_SLOW, 0) == 0);
+	TEST_ASSERT((client = nxipc_client_connect("nxipc-lane")) != NULL);
+
+	// One runs, and the rest wait on its lane.
+	for (int i = 0; i < 4; i++) {
+		TEST_CHECK(nxipc_client_transaction_async(
+		               client, OP_SLOW, NULL, -1, count_done, &done,
+		               NULL) == 0);
+	}
+	nng_msleep(50);
+	TEST_CHECK(nni_atomic_get64(&ran) == 1);
+
+	// Releasing the server now must neither run the parked ones, nor
+	// leak their requests.
+	TEST_CHECK(nxipc_server_release(server) == 0);
+	TEST_CHECK(nni_atomic_get64(&ran) == 1);
+
+	TEST_CHECK(nxipc_client_disconnect(client) == 0);
+	TEST_CHECK(nni_atomic_get64(&done) == 4);
+}
+
+void
+test_client_unwaited_handle(void)
+{
+	void *         server;
+	void *         client;
+	void *         h1;
+	void *         h2;
+	nni_atomic_u64 ran;
+	nni_atomic_u64 done;
+
+	nni_atomic_init64(&ran);
+	nni_atomic_init64(&done);
+	server = nxipc_server_create("nxipc-unwaited");
+	TEST_ASSERT(server != NULL);
+	nxipc_server_set_transaction_cb(server, slow_cb, &ran);
+	client = nxipc_client_connect("nxipc-unwaited");
+	TEST_ASSERT(client != NULL);
+
+	// One finishes, and one is still running, but neither is waited
+	// for; disconnecting releases both.
+	TEST_CHECK(nxipc_client_transaction_async(
+	               client, OP_FAST, NULL, -1, count_done, &done, &h1) ==
+	    0);
+	nng_msleep(20);
+	TEST_CHECK(nni_atomic_get64(&done) == 1);
+	TEST_CHECK(nxipc_client_transaction_async(
+	               client, OP_SLOW, NULL, -1, count_done, &done, &h2) ==
+	    0);
+	nng_msleep(20);
+	TEST_CHECK(nxipc_client_disconnect(client) == 0);
+	TEST_CHECK(nni_atomic_get64(&done) == 2);
+	TEST_CHECK(nxipc_server_release(server) == 0);
+}
+
+struct disconnect_state {
+	void *         client;
+	int            rv;
+	nni_atomic_u64 calls;
+};
+
+static void
+disconnect_done(void *cookie, int ret, const nxparcel *out)
+{
+	struct disconnect_state *st = cookie;
+
+	(void) ret;
+	(void) out;
+	st->rv = nxipc_client_disconnect(st->client);
+	nni_atomic_inc64(&st->calls);
+}
+
+void
+test_client_disconnect_in_callback(void)
+{
+	void *                  server;
+	nni_atomic_u64          ran;
+	struct disconnect_state st;
+
+	nni_atomic_init64(&ran);
+	nni_atomic_init64(&st.calls);
+	server = nxipc_server_create("nxipc-discb");
+	TEST_ASSERT(server != NULL);
+	nxipc_server_set_transaction_cb(server, slow_cb, &ran);
+	st.client = nxipc_client_connect("nxipc-discb");
+	TEST_ASSERT(st.client != NULL);
+
+	TEST_CHECK(nxipc_client_transaction_async(st.client, OP_FAST, NULL,
+	               -1, disconnect_done, &st, NULL) == 0);
+	for (int i = 0; i < 100 && nni_atomic_get64(&st.calls) == 0; i++) {
+		nng_msleep(10);
+	}
+	TEST_CHECK(nni_atomic_get64(&st.calls) == 1);
+	TEST_CHECK(st.rv == -EDEADLK);
+
+	// The client is still usable, and can be disconnected normally.
+	TEST_CHECK(nxipc_client_transaction(st.client, OP_FAST, NULL, NULL) ==
+	    0);
+	TEST_CHECK(nxipc_client_disconnect(st.client) == 0);
+	TEST_CHECK(nxipc_server_release(server) == 0);
+}
+
+struct topic_state {
+	nng_mtx * mtx;
+	pthread_t thread;
+	int       count;
+	char      last[16];
+};
+
+static int
+topic_listener(const void *cookie, const void *topic, const size_t topic_len,
+    const nxparcel *parcel)
+{
+	struct topic_state *st = (void *) cookie;
+	size_t              len;
+
+	(void) topic;
+	(void) topic_len;
+	len = nxparcel_size(parcel);
+	if (len >= sizeof(st->last)) {
+		len = sizeof(st->last) - 1;
+	}
+	nng_mtx_lock(st->mtx);
+	st->thread = pthread_self();
+	st->count++;
+	memcpy(st->last, nxparcel_data(parcel), len);
+	st->last[len] = '\0';
+	nng_mtx_unlock(st->mtx);
+	return (0);
+}
+
+static void
+publish(void *pub, const char *topic, const char *value)
+{
+	nxparcel *p;
+
+	TEST_ASSERT(nxparcel_alloc(&p) == 0);
+	TEST_CHECK(nxparcel_append(p, value, strlen(value)) == 0);
+	TEST_CHECK(nxipc_pub_topic_msg_zc(pub, topic, strlen(topic), p) == 0);
+}
+
+static int
+topic_count(struct topic_state *st)
+{
+	int count;
+
+	nng_mtx_lock(st->mtx);
+	count = st->count;
+	nng_mtx_unlock(st->mtx);
+	return (count);
+}
+
+static void
+wait_count(struct topic_state *st, int count)
+{
+	for (int i = 0; i < 100 && topic_count(st) < count; i++) {
+		nng_msleep(10);
+	}
+}
+
+void
+test_sub_cached_on_worker(void)
+{
+	void *             pub;
+	void *             sub;
+	struct topic_state st;
+
+	memset(&st, 0, sizeof(st));
+	TEST_ASSERT(nng_mtx_alloc(&st.mtx) == 0);
+	pub = nxipc_pub_create_ex("nxipc-cached", NXIPC_PUB_CACHE);
+	TEST_ASSERT(pub != NULL);
+	publish(pub, "t", "one");
+
+	sub = nxipc_sub_connect_ex(
+	    "nxipc-cached", NULL, NULL, NXIPC_SUB_CACHE);
+	TEST_ASSERT(sub != NULL);
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "t", 1, topic_listener, &st) == 0);
+	wait_count(&st, 1);
+
+	// It came from the subscriber's worker, not the registering thread.
+	nng_mtx_lock(st.mtx);
+	TEST_CHECK(st.count == 1);
+	TEST_CHECK(strcmp(st.last, "one") == 0);
+	TEST_CHECK(!pthread_equal(st.thread, pthread_self()));
+	nng_mtx_unlock(st.mtx);
+	nxipc_sub_disconnect(sub);
+
+	// Without NXIPC_SUB_CACHE, the cache is not asked.
+	sub = nxipc_sub_connect("nxipc-cached", NULL, NULL);
+	TEST_ASSERT(sub != NULL);
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "t", 1, topic_listener, &st) == 0);
+	nng_msleep(100);
+	TEST_CHECK(topic_count(&st) == 1);
+
+	nxipc_sub_disconnect(sub);
+	TEST_CHECK(nxipc_pub_release(pub) == 0);
+	nng_mtx_free(st.mtx);
+}
+
+// A cache server that is slow to answer, with content older than any
+// update published meanwhile.
+static int
+slow_cache_cb(const void *cookie, const int code, const nxparcel *in,
+    nxparcel **out)
+{
+	(void) cookie;
+	(void) code;
+	(void) in;
+	nng_msleep(100);
+	if (nxparcel_alloc(out) != 0) {
+		return (-ENOMEM);
+	}
+	return (nxparcel_append(*out, "old", 3));
+}
+
+void
+test_sub_cached_not_stale(void)
+{
+	void *             pub;
+	void *             cache;
+	void *             sub;
+	struct topic_state st;
+
+	memset(&st, 0, sizeof(st));
+	TEST_ASSERT(nng_mtx_alloc(&st.mtx) == 0);
+	pub = nxipc_pub_create("nxipc-stale");
+	TEST_ASSERT(pub != NULL);
+	cache = nxipc_server_create("nxipc-stale.cache");
+	TEST_ASSERT(cache != NULL);
+	nxipc_server_set_transaction_cb(cache, slow_cache_cb, NULL);
+	sub = nxipc_sub_connect_ex("nxipc-stale", NULL, NULL, NXIPC_SUB_CACHE);
+	TEST_ASSERT(sub != NULL);
+
+	// The update reaches the listener while the cached content is
+	// still being fetched, which then is too old to hand over.
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "t", 1, topic_listener, &st) == 0);
+	publish(pub, "t", "new");
+	nng_msleep(300);
+	nng_mtx_lock(st.mtx);
+	TEST_CHECK(st.count == 1);
+	TEST_CHECK(strcmp(st.last, "new") == 0);
+	nng_mtx_unlock(st.mtx);
+
+	// With no update, it is handed over.
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "u", 1, topic_listener, &st) == 0);
+	nng_msleep(300);
+	nng_mtx_lock(st.mtx);
+	TEST_CHECK(st.count == 2);
+	TEST_CHECK(strcmp(st.last, "old") == 0);
+	nng_mtx_unlock(st.mtx);
+
+	nxipc_sub_disconnect(sub);
+	TEST_CHECK(nxipc_server_release(cache) == 0);
+	TEST_CHECK(nxipc_pub_release(pub) == 0);
+	nng_mtx_free(st.mtx);
+}
+
+void
+test_sub_cache_connects_late(void)
+{
+	void *             pub;
+	void *             sub;
+	struct topic_state st;
+
+	memset(&st, 0, sizeof(st));
+	TEST_ASSERT(nng_mtx_alloc(&st.mtx) == 0);
+
+	// The subscriber starts with a publisher that has no cache...
+	pub = nxipc_pub_create("nxipc-late");
+	TEST_ASSERT(pub != NULL);
+	sub = nxipc_sub_connect_ex("nxipc-late", NULL, NULL, NXIPC_SUB_CACHE);
+	TEST_ASSERT(sub != NULL);
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "a", 1, topic_listener, &st) == 0);
+	TEST_CHECK(nxipc_pub_release(pub) == 0);
+
+	// ... which comes back with one.
+	pub = nxipc_pub_create_ex("nxipc-late", NXIPC_PUB_CACHE);
+	TEST_ASSERT(pub != NULL);
+	publish(pub, "b", "cached");
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "b", 1, topic_listener, &st) == 0);
+	wait_count(&st, 1);
+	nng_mtx_lock(st.mtx);
+	TEST_CHECK(st.count == 1);
+	TEST_CHECK(strcmp(st.last, "cached") == 0);
+	nng_mtx_unlock(st.mtx);
+
+	nxipc_sub_disconnect(sub);
+	TEST_CHECK(nxipc_pub_release(pub) == 0);
+	nng_mtx_free(st.mtx);
+}
+
+void
+test_pub_cache_bounded(void)
+{
+	void *             pub;
+	void *             sub;
+	struct topic_state st;
+	char               topic[16];
+	nxparcel *         big;
+
+	memset(&st, 0, sizeof(st));
+	TEST_ASSERT(nng_mtx_alloc(&st.mtx) == 0);
+	pub = nxipc_pub_create_ex("nxipc-bounded", NXIPC_PUB_CACHE);
+	TEST_ASSERT(pub != NULL);
+
+	// Many more topics than the cache keeps: the first ones go.
+	for (int i = 0; i < 1000; i++) {
+		snprintf(topic, sizeof(topic), "topic%d", i);
+		publish(pub, topic, "v");
+	}
+	// And content larger than the whole cache is not kept.
+	TEST_ASSERT(nng_msg_alloc(&big, 1024 * 1024) == 0);
+	TEST_CHECK(nxipc_pub_topic_msg_zc(pub, "big", 3, big) == 0);
+
+	sub = nxipc_sub_connect_ex(
+	    "nxipc-bounded", NULL, NULL, NXIPC_SUB_CACHE);
+	TEST_ASSERT(sub != NULL);
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "topic0", 6, topic_listener, &st) == 0);
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "big", 3, topic_listener, &st) == 0);
+	nng_msleep(100);
+	TEST_CHECK(topic_count(&st) == 0);
+
+	// The most recent ones are still there.
+	TEST_CHECK(nxipc_sub_register_topic_listener(
+	               sub, "topic999", 8, topic_listener, &st) == 0);
+	wait_count(&st, 1);
+	TEST_CHECK(topic_count(&st) == 1);
+
+	nxipc_sub_disconnect(sub);
+	TEST_CHECK(nxipc_pub_release(pub) == 0);
+	nng_mtx_free(st.mtx);
+}
+
+TEST_LIST = {
+	{ "server release busy lane", test_server_release_busy_lane },
+	{ "client unwaited handle", test_client_unwaited_handle },
+	{ "client disconnect in callback",
+	    test_client_disconnect_in_callback },
+	{ "sub cached on worker", test_sub_cached_on_worker },
+	{ "sub cached not stale", test_sub_cached_not_stale },
+	{ "sub cache connects late", test_sub_cache_connects_late },
+	{ "pub cache bounded", test_pub_cache_bounded },
+	{ NULL, NULL },
+};
@@ -0,0 +1,222 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include <nng/nng.h>
+
+#include "nuttx/nxparcel.h"
+
+#include "acutest.h"
+#include "testutil.h"
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define __SANITIZE_ADDRESS__ 1
+#endif
+#endif
+
+#ifdef __SANITIZE_ADDRESS__
+// The grow failure test asks for more memory than there can be, and
+// needs that to fail the way malloc does, not to stop the test.
+const char *
+__asan_default_options(void)
+{
+	return ("allocator_may_return_null=1");
+}
+#endif
+
+void
+test_parcel_round_trip(void)
+{
+	nxparcel *      p;
+	nxparcel *      inner;
+	nxparcel_writer w;
+	nxparcel_reader r;
+	nxparcel_reader nested;
+	uint32_t        vals[5] = { 0, 1, 0x12345678u, 0xfffffffeu, 7 };
+	uint32_t        got[5];
+	size_t          count;
+	const char *    str;
+	size_t          len;
+	uint16_t        v16;
+	uint32_t        v32;
+	uint64_t        v64;
+	char            raw[3];
+
+	TEST_CHECK(nxparcel_alloc(&p) == 0);
+	TEST_CHECK(nxparcel_alloc(&inner) == 0);
+	TEST_CHECK(nxparcel_append_u32(inner, 0xdeadbeefu) == 0);
+
+	nxparcel_writer_begin(&w, p);
+	nxparcel_write_u16(&w, 0xabcd);
+	nxparcel_write_u32(&w, 0x01020304u);
+	nxparcel_write_u64(&w, 0x1122334455667788ull);
+	nxparcel_write_string(&w, "hello");
+	nxparcel_write_string(&w, "");
+	nxparcel_write_u32_array(&w, vals, 5);
+	nxparcel_write_parcel(&w, inner);
+	nxparcel_write(&w, "xyz", 3);
+	TEST_CHECK(nxparcel_writer_commit(&w) == 0);
+	TEST_CHECK(nxparcel_size(p) == 2 + 4 + 8 + 9 + 4 + 24 + 8 + 3);
+
+	// Integers are big endian, as the append API writes them.
+	TEST_CHECK(memcmp(nxparcel_data(p), "\xab\xcd\x01\x02\x03\x04", 6) ==
+	    0);
+
+	nxparcel_reader_begin(&r, p);
+	TEST_CHECK(nxparcel_read_u16_at(&r, &v16) == 0);
+	TEST_CHECK(v16 == 0xabcd);
+	TEST_CHECK(nxparcel_read_u32_at(&r, &v32) == 0);
+	TEST_CHECK(v32 == 0x01020304u);
+	TEST_CHECK(nxparcel_read_u64_at(&r, &v64) == 0);
+	TEST_CHECK(v64 == 0x1122334455667788ull);
+	TEST_CHECK(nxparcel_read_string(&r, &str, &len) == 0);
+	TEST_CHECK(len == 5);
+	TEST_CHECK(memcmp(str, "hello", 5) == 0);
+	TEST_CHECK(nxparcel_read_string(&r, &str, &len) == 0);
+	TEST_CHECK(len == 0);
+	TEST_CHECK(nxparcel_read_u32_array(&r, got, 5, &count) == 0);
+	TEST_CHECK(count == 5);
+	TEST_CHECK(memcmp(got, vals, sizeof(vals)) == 0);
+	TEST_CHECK(nxparcel_read_parcel(&r, &nested) == 0);
+	TEST_CHECK(nxparcel_reader_remaining(&nested) == 4);
+	TEST_CHECK(nxparcel_read_u32_at(&nested, &v32) == 0);
+	TEST_CHECK(v32 == 0xdeadbeefu);
+	TEST_CHECK(nxparcel_read(&r, raw, 3) == 0);
+	TEST_CHECK(memcmp(raw, "xyz", 3) == 0);
+	TEST_CHECK(nxparcel_reader_remaining(&r) == 0);
+	TEST_CHECK(nxparcel_reader_error(&r) == 0);
+
+	// Readers do not consume, so the trimming API sees it all too.
+	TEST_CHECK(nxparcel_read_u16(p, &v16) == 0);
+	TEST_CHECK(v16 == 0xabcd);
+	TEST_CHECK(nxparcel_read_u32(p, &v32) == 0);
+	TEST_CHECK(v32 == 0x01020304u);
+	TEST_CHECK(nxparcel_read_u64(p, &v64) == 0);
+	TEST_CHECK(v64 == 0x1122334455667788ull);
+
+	nxparcel_free(inner);
+	nxparcel_free(p);
+}
+
+void
+test_parcel_append_then_write(void)
+{
+	nxparcel *      p;
+	nxparcel_writer w;
+	nxparcel_reader r;
+	uint32_t        v;
+
+	// Writers start at the end of what is already there, and grow
+	// as often as needed.
+	TEST_CHECK(nxparcel_alloc(&p) == 0);
+	TEST_CHECK(nxparcel_append_u32(p, 42) == 0);
+	nxparcel_writer_begin(&w, p);
+	for (uint32_t i = 0; i < 10000; i++) {
+		nxparcel_write_u32(&w, i);
+	}
+	TEST_CHECK(nxparcel_writer_commit(&w) == 0);
+	TEST_CHECK(nxparcel_size(p) == 4 * 10001);
+
+	nxparcel_reader_begin(&r, p);
+	TEST_CHECK(nxparcel_read_u32_at(&r, &v) == 0);
+	TEST_CHECK(v == 42);
+	for (uint32_t i = 0; i < 10000; i++) {
+		TEST_CHECK(nxparcel_read_u32_at(&r, &v) == 0);
+		TEST_CHECK(v == i);
+	}
+	TEST_CHECK(nxparcel_reader_remaining(&r) == 0);
+	nxparcel_free(p);
+}
+
+void
+test_parcel_grow_failure(void)
+{
+	nxparcel *      p;
+	nxparcel_writer w;
+	nxparcel_reader r;
+	uint32_t        v;
+
+	TEST_CHECK(nxparcel_alloc(&p) == 0);
+	TEST_CHECK(nxparcel_append(p, "abc", 3) == 0);
+
+	nxparcel_writer_begin(&w, p);
+	nxparcel_write_u32(&w, 1);
+	TEST_CHECK(nxparcel_reserve(&w, SIZE_MAX / 2) == -ENOMEM);
+
+	// The error sticks: nothing more is written, even what would fit
+	// in room reserved before the failure.
+	nxparcel_write_u32(&w, 2);
+	nxparcel_write_string(&w, "lost");
+	TEST_CHECK(nxparcel_reserve(&w, 1) == -ENOMEM);
+	TEST_CHECK(nxparcel_writer_commit(&w) == -ENOMEM);
+
+	// And nothing written by the failed writer stays in the parcel.
+	TEST_CHECK(nxparcel_size(p) == 3);
+	TEST_CHECK(memcmp(nxparcel_data(p), "abc", 3) == 0);
+
+	// A new writer starts afresh.
+	nxparcel_writer_begin(&w, p);
+	nxparcel_write_u32(&w, 3);
+	TEST_CHECK(nxparcel_writer_commit(&w) == 0);
+	TEST_CHECK(nxparcel_size(p) == 7);
+	nxparcel_reader_begin(&r, p);
+	TEST_CHECK(nxparcel_reader_take(&r, 3) != NULL);
+	TEST_CHECK(nxparcel_read_u32_at(&r, &v) == 0);
+	TEST_CHECK(v == 3);
+	nxparcel_free(p);
+}
+
+void
+test_parcel_short_read(void)
+{
+	nxparcel *      p;
+	nxparcel_reader r;
+	uint32_t        vals[2];
+	size_t          count;
+	uint32_t        v32;
+	uint64_t        v64 = 99;
+
+	TEST_CHECK(nxparcel_alloc(&p) == 0);
+	TEST_CHECK(nxparcel_append_u32(p, 3) == 0); // array of 3
+	TEST_CHECK(nxparcel_append_u32(p, 10) == 0);
+	TEST_CHECK(nxparcel_append_u32(p, 11) == 0);
+	TEST_CHECK(nxparcel_append_u32(p, 12) == 0);
+	TEST_CHECK(nxparcel_append_u32(p, 13) == 0);
+
+	// Too many elements is an error, but the array is skipped.
+	nxparcel_reader_begin(&r, p);
+	TEST_CHECK(nxparcel_read_u32_array(&r, vals, 2, &count) == -ENOSPC);
+	TEST_CHECK(nxparcel_read_u32_at(&r, &v32) == 0);
+	TEST_CHECK(v32 == 13);
+	TEST_CHECK(nxparcel_reader_error(&r) == 0);
+
+	// Reading past the end fails, leaves the value alone, and sticks.
+	TEST_CHECK(nxparcel_read_u64_at(&r, &v64) == -ENODATA);
+	TEST_CHECK(v64 == 99);
+	TEST_CHECK(nxparcel_reader_error(&r) == -ENODATA);
+	TEST_CHECK(nxparcel_reader_remaining(&r) == 0);
+
+	// A count larger than the data left is caught up front.
+	nxparcel_clear(p);
+	TEST_CHECK(nxparcel_append_u32(p, 0x40000000u) == 0);
+	nxparcel_reader_begin(&r, p);
+	TEST_CHECK(nxparcel_read_u32_array(&r, vals, 2, &count) == -ENODATA);
+	TEST_CHECK(nxparcel_reader_error(&r) == -ENODATA);
+	nxparcel_free(p);
+}
+
+TEST_LIST = {
+	{ "parcel round trip", test_parcel_round_trip },
+	{ "parcel append then write", test_parcel_append_then_write },
+	{ "parcel grow failure", test_parcel_grow_failure },
+	{ "parcel short read", test_parcel_short_read },
+	{ NULL, NULL },
+};
@@ -0,0 +1,295 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/protocol/pipeline0/pull.h>
+#include <nng/protocol/pipeline0/push.h>
+#include <nng/supplemental/util/platform.h>
+
+#include "acutest.h"
+#include "testutil.h"
+
+// Enough small messages that the sender will outrun the kernel socket
+// buffers while the receiver is not reading, so writes stay in progress
+// and the transport has to coalesce what queues up behind them.
+#define NMSGS 100000
+
+typedef struct {
+	nng_socket s;
+	int        count;
+	int        rv;
+} batch_sender;
+
+static void
+batch_send_thr(void *arg)
+{
+	batch_sender *bs = arg;
+	nng_msg *     msg;
+
+	for (int i = 0; i < bs->count; i++) {
+		if (((bs->rv = nng_msg_alloc(&msg, 0)) != 0) ||
+		    ((bs->rv = nng_msg_append_u32(msg, (uint32_t) i)) != 0) ||
+		    ((bs->rv = nng_msg_append(msg, "batch", 5)) != 0)) {
+			return;
+		}
+		// Vary the size a bit, so frames land at odd offsets.
+		if ((i % 7) == 0) {
+			if ((bs->rv = nng_msg_append(msg, "1234567", i % 5)) !=
+			    0) {
+				return;
+			}
+		}
+		if ((bs->rv = nng_sendmsg(bs->s, msg, 0)) != 0) {
+			nng_msg_free(msg);
+			return;
+		}
+	}
+}
+
+#ifdef NNG_ENABLE_STATS
+static uint64_t
+stat_sum(nng_stat *st, const char *name)
+{
+	uint64_t n = 0;
+
+	for (; st != NULL; st = nng_stat_next(st)) {
+		if (strcmp(nng_stat_name(st), name) == 0) {
+			n += nng_stat_value(st);
+		}
+		n += stat_sum(nng_stat_child(st), name);
+	}
+	return (n);
+}
+#endif
+
+// batch_count returns the number of writes, on all pipes, that carried
+// more than one message.
+static uint64_t
+batch_count(void)
+{
+	uint64_t n = 0;
+#ifdef NNG_ENABLE_STATS
+	nng_stat *stats;
+
+	TEST_NNG_PASS(nng_stats_get(&stats));
+	n = stat_sum(stats, "txbatches");
+	nng_stats_free(stats);
+#endif
+	return (n);
+}
+
+static void
+batch_check(const char *scheme, size_t batch, bool expect)
+{
+	nng_socket   push;
+	nng_socket   pull;
+	nng_thread * thr;
+	batch_sender bs;
+	char         addr[64];
+
+	testutil_scratch_addr(scheme, sizeof(addr), addr);
+	TEST_NNG_PASS(nng_push0_open(&push));
+	TEST_NNG_PASS(nng_pull0_open(&pull));
+	TEST_NNG_PASS(nng_setopt_size(push, NNG_OPT_SENDBATCH, batch));
+	TEST_NNG_PASS(nng_setopt_ms(pull, NNG_OPT_RECVTIMEO, 5000));
+	TEST_NNG_PASS(nng_setopt_ms(push, NNG_OPT_SENDTIMEO, 5000));
+	TEST_NNG_PASS(nng_listen(pull, addr, NULL, 0));
+	TEST_NNG_PASS(nng_dial(push, addr, NULL, 0));
+
+	bs.s     = push;
+	bs.count = NMSGS;
+	bs.rv    = 0;
+	TEST_NNG_PASS(nng_thread_create(&thr, batch_send_thr, &bs));
+
+	// Let the sender get well ahead of us.
+	nng_msleep(200);
+
+	for (int i = 0; i < NMSGS; i++) {
+		nng_msg *msg;
+		uint32_t v;
+		size_t   len = 9 + (((i % 7) == 0) ? (i % 5) : 0);
+
+		TEST_NNG_PASS(nng_recvmsg(pull, &msg, 0));
+		TEST_ASSERT(nng_msg_len(msg) == len);
+		TEST_NNG_PASS(nng_msg_trim_u32(msg, &v));
+		TEST_ASSERT(v == (uint32_t) i);
+		TEST_CHECK(memcmp(nng_msg_body(msg), "batch", 5) == 0);
+		nng_msg_free(msg);
+	}
+	nng_thread_destroy(thr);
+	TEST_NNG_PASS(bs.rv);
+#ifdef NNG_ENABLE_STATS
+	if (expect) {
+		TEST_CHECK(batch_count() > 0);
+	} else {
+		TEST_CHECK(batch_count() == 0);
+	}
+#else
+	(void) expect;
+#endif
+
+	TEST_NNG_PASS(nng_close(push));
+	TEST_NNG_PASS(nng_close(pull));
+}
+
+void
+test_sendbatch_option(void)
+{
+	nng_socket s;
+	nng_dialer d;
+	size_t     sz;
+	bool       b;
+
+	TEST_NNG_PASS(nng_push0_open(&s));
+	TEST_NNG_PASS(nng_dialer_create(&d, s, "tcp://127.0.0.1:80"));
+	// Off by default, as it completes sends before they are written.
+	TEST_NNG_PASS(nng_dialer_getopt_size(d, NNG_OPT_SENDBATCH, &sz));
+	TEST_CHECK(sz == 0);
+	TEST_NNG_PASS(nng_dialer_setopt_size(d, NNG_OPT_SENDBATCH, 8192));
+	TEST_NNG_PASS(nng_dialer_getopt_size(d, NNG_OPT_SENDBATCH, &sz));
+	TEST_CHECK(sz == 8192);
+	TEST_NNG_FAIL(nng_dialer_setopt_bool(d, NNG_OPT_SENDBATCH, true),
+	    NNG_EBADTYPE);
+	TEST_NNG_FAIL(nng_dialer_getopt_bool(d, NNG_OPT_SENDBATCH, &b),
+	    NNG_EBADTYPE);
+
+	// Setting it on the socket applies to endpoints made later.
+	TEST_NNG_PASS(nng_setopt_size(s, NNG_OPT_SENDBATCH, 1000));
+	TEST_NNG_PASS(nng_dialer_create(&d, s, "ipc:///tmp/sendbatch.ipc"));
+	TEST_NNG_PASS(nng_dialer_getopt_size(d, NNG_OPT_SENDBATCH, &sz));
+	TEST_CHECK(sz == 1000);
+	TEST_NNG_PASS(nng_close(s));
+}
+
+void
+test_sendbatchtime_option(void)
+{
+	nng_socket   s;
+	nng_dialer   d;
+	nng_duration t;
+
+	TEST_NNG_PASS(nng_push0_open(&s));
+	TEST_NNG_PASS(nng_dialer_create(&d, s, "tcp://127.0.0.1:80"));
+	TEST_NNG_PASS(nng_dialer_getopt_ms(d, NNG_OPT_SENDBATCHTIME, &t));
+	TEST_CHECK(t == 0);
+	TEST_NNG_PASS(nng_dialer_setopt_ms(d, NNG_OPT_SENDBATCHTIME, 10));
+	TEST_NNG_PASS(nng_dialer_getopt_ms(d, NNG_OPT_SENDBATCHTIME, &t));
+	TEST_CHECK(t == 10);
+	TEST_NNG_FAIL(nng_dialer_setopt_size(d, NNG_OPT_SENDBATCHTIME, 1),
+	    NNG_EBADTYPE);
+
+	TEST_NNG_PASS(nng_setopt_ms(s, NNG_OPT_SENDBATCHTIME, 5));
+	TEST_NNG_PASS(nng_dialer_create(&d, s, "ipc:///tmp/sendbatch.ipc"));
+	TEST_NNG_PASS(nng_dialer_getopt_ms(d, NNG_OPT_SENDBATCHTIME, &t));
+	TEST_CHECK(t == 5);
+	TEST_NNG_PASS(nng_close(s));
+}
+
+// batch_time_check sends a few messages at once on an idle connection
+// that waits to fill its batches, and checks that they went together in
+// one write, and that the first was not held much past the limit.
+static void
+batch_time_check(const char *scheme)
+{
+	nng_socket push;
+	nng_socket pull;
+	nng_msg *  msg;
+	nng_time   start;
+	nng_time   end;
+	uint64_t   before;
+	char       addr[64];
+
+	testutil_scratch_addr(scheme, sizeof(addr), addr);
+	TEST_NNG_PASS(nng_push0_open(&push));
+	TEST_NNG_PASS(nng_pull0_open(&pull));
+	TEST_NNG_PASS(nng_setopt_size(push, NNG_OPT_SENDBATCH, 8192));
+	TEST_NNG_PASS(nng_setopt_ms(push, NNG_OPT_SENDBATCHTIME, 200));
+	TEST_NNG_PASS(nng_setopt_ms(pull, NNG_OPT_RECVTIMEO, 5000));
+	TEST_NNG_PASS(nng_setopt_ms(push, NNG_OPT_SENDTIMEO, 5000));
+	TEST_NNG_PASS(nng_listen(pull, addr, NULL, 0));
+	TEST_NNG_PASS(nng_dial(push, addr, NULL, NNG_FLAG_NONBLOCK));
+	nng_msleep(100); // let the connection come up
+
+	before = batch_count();
+	start  = nng_clock();
+	for (uint32_t i = 0; i < 4; i++) {
+		TEST_NNG_PASS(nng_msg_alloc(&msg, 0));
+		TEST_NNG_PASS(nng_msg_append_u32(msg, i));
+		TEST_NNG_PASS(nng_sendmsg(push, msg, 0));
+	}
+	for (uint32_t i = 0; i < 4; i++) {
+		uint32_t v;
+		TEST_NNG_PASS(nng_recvmsg(pull, &msg, 0));
+		TEST_NNG_PASS(nng_msg_trim_u32(msg, &v));
+		TEST_CHECK(v == i);
+		nng_msg_free(msg);
+	}
+	end = nng_clock();
+	TEST_CHECK(end - start >= 150);
+	TEST_CHECK(end - start < 2000);
+#ifdef NNG_ENABLE_STATS
+	TEST_CHECK(batch_count() == before + 1);
+#else
+	(void) before;
+#endif
+
+	TEST_NNG_PASS(nng_close(push));
+	TEST_NNG_PASS(nng_close(pull));
+}
+
+void
+test_sendbatch_tcp(void)
+{
+	batch_check("tcp", 8192, true);
+}
+
+void
+test_sendbatch_ipc(void)
+{
+	batch_check("ipc", 8192, true);
+}
+
+void
+test_sendbatchtime_tcp(void)
+{
+	batch_time_check("tcp");
+}
+
+void
+test_sendbatchtime_ipc(void)
+{
+	batch_time_check("ipc");
+}
+
+void
+test_sendbatch_tiny(void)
+{
+	// Smaller than any of our frames, so nothing is batched.
+	batch_check("tcp", 16, false);
+}
+
+void
+test_sendbatch_disabled(void)
+{
+	batch_check("ipc", 0, false);
+}
+
+TEST_LIST = {
+	{ "send batch option", test_sendbatch_option },
+	{ "send batch time option", test_sendbatchtime_option },
+	{ "send batch tcp", test_sendbatch_tcp },
+	{ "send batch ipc", test_sendbatch_ipc },
+	{ "send batch time tcp", test_sendbatchtime_tcp },
+	{ "send batch time ipc", test_sendbatchtime_ipc },
+	{ "send batch tiny", test_sendbatch_tiny },
+	{ "send batch disabled", test_sendbatch_disabled },
+	{ NULL, NULL },
+};
@@ -0,0 +1,200 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <unistd.h>
+
+#include <nng/nng.h>
+#include <nng/protocol/pair1/pair.h>
+#include <nng/protocol/reqrep0/req.h>
+#include <nng/transport/shm/shm.h>
+
+#include "convey.h"
+#include "trantest.h"
+
+// Shared memory transport tests.  These are mostly the IPC ones, since
+// the connection and its properties come from there.
+
+#define BIGSZ (4 * 1024 * 1024) // larger than the rings
+#define NMSGS 2000
+#define WINDOW 100
+
+static int
+check_props(nng_msg *msg)
+{
+	nng_pipe     p;
+	nng_sockaddr la;
+	nng_sockaddr ra;
+	uint64_t     id;
+
+	p = nng_msg_get_pipe(msg);
+	So(nng_pipe_id(p) > 0);
+	So(nng_pipe_getopt_sockaddr(p, NNG_OPT_LOCADDR, &la) == 0);
+	So(la.s_family == NNG_AF_IPC);
+	So(nng_pipe_getopt_sockaddr(p, NNG_OPT_REMADDR, &ra) == 0);
+	So(ra.s_family == NNG_AF_IPC);
+
+	So(nng_pipe_getopt_uint64(p, NNG_OPT_IPC_PEER_UID, &id) == 0);
+	So(id == (uint64_t) getuid());
+	So(nng_pipe_getopt_uint64(p, NNG_OPT_IPC_PEER_PID, &id) == 0);
+	So(id == (uint64_t) getpid());
+	return (0);
+}
+
+static void
+fill(uint8_t *buf, size_t sz, unsigned seed)
+{
+	for (size_t i = 0; i < sz; i++) {
+		buf[i] = (uint8_t)((i * 31) + seed);
+	}
+}
+
+static int
+check(const uint8_t *buf, size_t sz, unsigned seed)
+{
+	for (size_t i = 0; i < sz; i++) {
+		if (buf[i] != (uint8_t)((i * 31) + seed)) {
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static void
+count_rem(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	(void) p;
+	(void) ev;
+	(*(int *) arg)++;
+}
+
+TestMain("SHM Transport", {
+	trantest_test_extended("shm:///tmp/nng_shm_test_%u", check_props);
+
+	Convey("SHM moves data larger than its rings", {
+		nng_socket s1;
+		nng_socket s2;
+		nng_msg *  msg;
+
+		So(nng_pair1_open(&s1) == 0);
+		So(nng_pair1_open(&s2) == 0);
+		Reset({
+			nng_close(s1);
+			nng_close(s2);
+		});
+		So(nng_setopt_size(s1, NNG_OPT_RECVMAXSZ, 0) == 0);
+		So(nng_setopt_size(s2, NNG_OPT_RECVMAXSZ, 0) == 0);
+		So(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 5000) == 0);
+		So(nng_setopt_ms(s2, NNG_OPT_RECVTIMEO, 5000) == 0);
+		So(nng_listen(s1, "shm:///tmp/nng_shm_big", NULL, 0) == 0);
+		So(nng_dial(s2, "shm:///tmp/nng_shm_big", NULL, 0) == 0);
+
+		for (unsigned i = 0; i < 3; i++) {
+			So(nng_msg_alloc(&msg, BIGSZ) == 0);
+			fill(nng_msg_body(msg), BIGSZ, i);
+			So(nng_sendmsg(i % 2 ? s1 : s2, msg, 0) == 0);
+			So(nng_recvmsg(i % 2 ? s2 : s1, &msg, 0) == 0);
+			So(nng_msg_len(msg) == BIGSZ);
+			So(check(nng_msg_body(msg), BIGSZ, i) == 0);
+			nng_msg_free(msg);
+		}
+	});
+
+	Convey("SHM keeps order with many messages in flight", {
+		nng_socket s1;
+		nng_socket s2;
+		nng_msg *  msg;
+		uint32_t   v;
+
+		So(nng_pair1_open(&s1) == 0);
+		So(nng_pair1_open(&s2) == 0);
+		Reset({
+			nng_close(s1);
+			nng_close(s2);
+		});
+		So(nng_setopt_int(s1, NNG_OPT_SENDBUF, 64) == 0);
+		So(nng_setopt_int(s2, NNG_OPT_RECVBUF, 64) == 0);
+		So(nng_setopt_ms(s1, NNG_OPT_SENDTIMEO, 5000) == 0);
+		So(nng_setopt_ms(s2, NNG_OPT_RECVTIMEO, 5000) == 0);
+		So(nng_listen(s1, "shm:///tmp/nng_shm_flood", NULL, 0) == 0);
+		So(nng_dial(s2, "shm:///tmp/nng_shm_flood", NULL, 0) == 0);
+		nng_msleep(50);
+
+		// Keep a window of messages outstanding, so that the ring
+		// wraps many times with data in it.
+		for (uint32_t i = 0; i < NMSGS + WINDOW; i++) {
+			if (i < NMSGS) {
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_msg_append_u32(msg, i) == 0);
+				So(nng_msg_realloc(msg, 4 + (i % 3000)) == 0);
+				So(nng_sendmsg(s1, msg, 0) == 0);
+			}
+			if (i >= WINDOW) {
+				uint32_t j = i - WINDOW;
+				So(nng_recvmsg(s2, &msg, 0) == 0);
+				So(nng_msg_len(msg) == 4 + (j % 3000));
+				So(nng_msg_trim_u32(msg, &v) == 0);
+				So(v == j);
+				nng_msg_free(msg);
+			}
+		}
+	});
+
+	Convey("SHM notices when the peer closes", {
+		nng_socket s1;
+		nng_socket s2;
+		nng_msg *  msg;
+		int        removed = 0;
+
+		So(nng_pair1_open(&s1) == 0);
+		So(nng_pair1_open(&s2) == 0);
+		Reset({ nng_close(s1); });
+		So(nng_pipe_notify(s1, NNG_PIPE_EV_REM_POST, count_rem,
+		       &removed) == 0);
+		So(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 5000) == 0);
+		So(nng_listen(s1, "shm:///tmp/nng_shm_close", NULL, 0) == 0);
+		So(nng_dial(s2, "shm:///tmp/nng_shm_close", NULL, 0) == 0);
+
+		So(nng_msg_alloc(&msg, 0) == 0);
+		So(nng_msg_append(msg, "bye", 4) == 0);
+		So(nng_sendmsg(s2, msg, 0) == 0);
+		So(nng_recvmsg(s1, &msg, 0) == 0);
+		So(strcmp(nng_msg_body(msg), "bye") == 0);
+		nng_msg_free(msg);
+		So(removed == 0);
+
+		nng_close(s2);
+		for (int i = 0; (i < 100) && (removed == 0); i++) {
+			nng_msleep(10);
+		}
+		So(removed == 1);
+	});
+
+	Convey("SHM listener properties", {
+		nng_socket   s;
+		nng_listener l;
+		nng_sockaddr sa;
+		size_t       z;
+
+		So(nng_req0_open(&s) == 0);
+		Reset({ nng_close(s); });
+		So(nng_listen(s, "shm:///tmp/nng_shm_addr_test", &l, 0) == 0);
+		So(nng_listener_getopt_sockaddr(l, NNG_OPT_LOCADDR, &sa) == 0);
+		So(sa.s_ipc.sa_family == NNG_AF_IPC);
+		So(strcmp(sa.s_ipc.sa_path, "/tmp/nng_shm_addr_test") == 0);
+		So(nng_listener_setopt(l, NNG_OPT_LOCADDR, &sa, sizeof(sa)) ==
+		    NNG_EREADONLY);
+		z = 8192;
+		So(nng_listener_setopt_size(l, NNG_OPT_RECVMAXSZ, z) == 0);
+		z = 0;
+		So(nng_listener_getopt_size(l, NNG_OPT_RECVMAXSZ, &z) == 0);
+		So(z == 8192);
+	});
+
+	nng_fini();
+})
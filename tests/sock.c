@@ -50,6 +50,48 @@ test_recv_nonblock(void)
 	TEST_CHECK(nng_close(s1) == 0);
 }
 
+void
+test_recv_busy_poll(void)
+{
+	nng_socket s1;
+	nng_socket s2;
+	int        v;
+	uint64_t   now;
+	nng_msg *  msg = NULL;
+	char *     a   = "inproc://recv-busy-poll";
+
+	TEST_NNG_PASS(nng_pair1_open(&s1));
+	TEST_NNG_PASS(nng_pair1_open(&s2));
+	TEST_NNG_PASS(nng_getopt_int(s1, NNG_OPT_RECVBUSYPOLL, &v));
+	TEST_CHECK(v == 0);
+	TEST_NNG_FAIL(
+	    nng_setopt_int(s1, NNG_OPT_RECVBUSYPOLL, -1), NNG_EINVAL);
+	TEST_NNG_PASS(nng_setopt_int(s1, NNG_OPT_RECVBUSYPOLL, 50));
+	TEST_NNG_PASS(nng_getopt_int(s1, NNG_OPT_RECVBUSYPOLL, &v));
+	TEST_CHECK(v == 50);
+	TEST_NNG_PASS(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 10));
+
+	// Spinning does not stretch, or cut short, the timeout.
+	now = testutil_clock();
+	TEST_NNG_FAIL(nng_recvmsg(s1, &msg, 0), NNG_ETIMEDOUT);
+	TEST_CHECK(msg == NULL);
+	TEST_CHECK(testutil_clock() >= (now + 9));
+	TEST_CHECK(testutil_clock() < (now + 500));
+
+	TEST_NNG_PASS(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 3000));
+	TEST_NNG_PASS(nng_listen(s1, a, NULL, 0));
+	TEST_NNG_PASS(nng_dial(s2, a, NULL, 0));
+	for (int i = 0; i < 100; i++) {
+		TEST_NNG_PASS(nng_send(s2, "ping", 5, 0));
+		TEST_NNG_PASS(nng_recvmsg(s1, &msg, 0));
+		TEST_CHECK(strcmp(nng_msg_body(msg), "ping") == 0);
+		nng_msg_free(msg);
+	}
+
+	TEST_NNG_PASS(nng_close(s1));
+	TEST_NNG_PASS(nng_close(s2));
+}
+
 void
 test_send_timeout(void)
 {
@@ -643,6 +685,7 @@ test_size_options(void)
 TEST_LIST = {
 	{ "recv timeout", test_recv_timeout },
 	{ "recv non-block", test_recv_nonblock },
+	{ "recv busy poll", test_recv_busy_poll },
 	{ "send timeout", test_send_timeout },
 	{ "send non-block", test_send_nonblock },
 	{ "read only options", test_readonly_options },
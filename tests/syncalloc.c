@@ -0,0 +1,147 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/protocol/pair1/pair.h>
+
+#include "acutest.h"
+#include "testutil.h"
+
+// The synchronous send and receive calls should not allocate anything
+// once a thread has used them.  We count allocations by wrapping the C
+// library's allocator, which we only know how to do with glibc, and not
+// underneath a sanitizer that wraps it itself.
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#define NO_ALLOC_COUNT
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define NO_ALLOC_COUNT
+#endif
+
+#if defined(__GLIBC__) && !defined(NO_ALLOC_COUNT)
+#define ALLOC_COUNT
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+// Only allocations made by the thread under test are counted.
+static __thread bool counting;
+static __thread int  nallocs;
+
+void *
+malloc(size_t sz)
+{
+	if (counting) {
+		nallocs++;
+	}
+	return (__libc_malloc(sz));
+}
+
+void *
+calloc(size_t n, size_t sz)
+{
+	if (counting) {
+		nallocs++;
+	}
+	return (__libc_calloc(n, sz));
+}
+
+void *
+realloc(void *ptr, size_t sz)
+{
+	if (counting) {
+		nallocs++;
+	}
+	return (__libc_realloc(ptr, sz));
+}
+#endif
+
+#define NROUNDS 1000
+
+static void
+ping_pong(nng_socket s1, nng_socket s2, nng_msg **msgp, int rounds)
+{
+	for (int i = 0; i < rounds; i++) {
+		TEST_NNG_PASS(nng_sendmsg(s1, *msgp, 0));
+		TEST_NNG_PASS(nng_recvmsg(s2, msgp, 0));
+		TEST_NNG_PASS(nng_sendmsg(s2, *msgp, 0));
+		TEST_NNG_PASS(nng_recvmsg(s1, msgp, 0));
+	}
+}
+
+void
+test_sendrecv_no_alloc(void)
+{
+#ifdef ALLOC_COUNT
+	nng_socket s1;
+	nng_socket s2;
+	nng_msg *  msg;
+
+	TEST_NNG_PASS(nng_pair1_open(&s1));
+	TEST_NNG_PASS(nng_pair1_open(&s2));
+	TEST_NNG_PASS(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 1000));
+	TEST_NNG_PASS(nng_setopt_ms(s2, NNG_OPT_RECVTIMEO, 1000));
+	TEST_NNG_PASS(testutil_marry(s1, s2));
+	TEST_NNG_PASS(nng_msg_alloc(&msg, 0));
+	TEST_NNG_PASS(nng_msg_append(msg, "ping", 5));
+
+	// The first calls on this thread are allowed to set things up.
+	ping_pong(s1, s2, &msg, 10);
+
+	nallocs  = 0;
+	counting = true;
+	ping_pong(s1, s2, &msg, NROUNDS);
+	counting = false;
+
+	TEST_CHECK(nallocs == 0);
+	TEST_MSG("%d allocations in %d round trips", nallocs, NROUNDS);
+	TEST_CHECK(strcmp(nng_msg_body(msg), "ping") == 0);
+
+	nng_msg_free(msg);
+	TEST_NNG_PASS(nng_close(s1));
+	TEST_NNG_PASS(nng_close(s2));
+#endif
+}
+
+void
+test_sendrecv_failures(void)
+{
+	nng_socket s;
+	nng_msg *  msg;
+
+	TEST_NNG_PASS(nng_pair1_open(&s));
+	TEST_NNG_PASS(nng_msg_alloc(&msg, 0));
+
+	// Failed sends leave the message with the caller, and failures do
+	// not spoil the cached aio for the calls that follow.
+	for (int i = 0; i < 3; i++) {
+		TEST_NNG_FAIL(
+		    nng_sendmsg(s, msg, NNG_FLAG_NONBLOCK), NNG_EAGAIN);
+		TEST_NNG_FAIL(
+		    nng_recvmsg(s, &msg, NNG_FLAG_NONBLOCK), NNG_EAGAIN);
+	}
+	TEST_NNG_FAIL(nng_sendmsg(s, NULL, 0), NNG_EINVAL);
+	TEST_NNG_PASS(nng_close(s));
+	TEST_NNG_FAIL(nng_sendmsg(s, msg, 0), NNG_ECLOSED);
+	TEST_NNG_FAIL(nng_recvmsg(s, &msg, 0), NNG_ECLOSED);
+	nng_msg_free(msg);
+}
+
+TEST_LIST = {
+	{ "sendrecv no alloc", test_sendrecv_no_alloc },
+	{ "sendrecv failures", test_sendrecv_failures },
+	{ NULL, NULL },
+};
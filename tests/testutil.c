@@ -458,9 +458,10 @@ stream_xfr_alloc(nng_stream *s, void (*submit)(nng_stream *, nng_aio *),
 {
 	stream_xfr_t *x;
 
-	if ((x = nng_alloc(size)) == NULL) {
+	if ((x = nng_alloc(sizeof(*x))) == NULL) {
 		return (NULL);
 	}
+	memset(x, 0, sizeof(*x));
 	if (nng_aio_alloc(&x->upper_aio, NULL, NULL) != 0) {
 		stream_xfr_free(x);
 		return (NULL);
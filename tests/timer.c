@@ -0,0 +1,251 @@
+//
+// Copyright 2020 Staysail Systems, Inc. <info@staysail.tech>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+
+#include "core/nng_impl.h"
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+#include "acutest.h"
+#include "testutil.h"
+
+#define NTIMERS 1000000
+
+typedef struct {
+	nni_timer_node node;
+	nng_mtx *      mtx;
+	nng_cv *       cv;
+	int *          fired;
+	int *          order;
+	int            index;
+	nng_time       when;
+	bool           late;
+	nng_duration   busy;
+} timer_arg;
+
+static void
+timer_cb(void *arg)
+{
+	timer_arg *ta = arg;
+	nng_time   now;
+
+	now = nng_clock();
+	if (ta->busy > 0) {
+		nng_msleep(ta->busy);
+	}
+	nng_mtx_lock(ta->mtx);
+	if (now < ta->when) {
+		ta->late = true; // actually early, which is worse
+	}
+	if (ta->order != NULL) {
+		ta->order[*ta->fired] = ta->index;
+	}
+	(*ta->fired)++;
+	nng_cv_wake(ta->cv);
+	nng_mtx_unlock(ta->mtx);
+}
+
+static void
+timer_wait_fired(timer_arg *ta, int count)
+{
+	nng_time deadline = nng_clock() + 5000;
+
+	nng_mtx_lock(ta->mtx);
+	while (*ta->fired < count) {
+		if (nng_cv_until(ta->cv, deadline) == NNG_ETIMEDOUT) {
+			break;
+		}
+	}
+	nng_mtx_unlock(ta->mtx);
+}
+
+void
+test_timer_fires(void)
+{
+	timer_arg ta;
+	int       fired = 0;
+
+	TEST_NNG_PASS(nni_init());
+	memset(&ta, 0, sizeof(ta));
+	TEST_NNG_PASS(nng_mtx_alloc(&ta.mtx));
+	TEST_NNG_PASS(nng_cv_alloc(&ta.cv, ta.mtx));
+	ta.fired = &fired;
+	nni_timer_init(&ta.node, timer_cb, &ta);
+
+	ta.when = nng_clock() + 20;
+	nni_timer_schedule(&ta.node, ta.when);
+	timer_wait_fired(&ta, 1);
+	TEST_CHECK(fired == 1);
+	TEST_CHECK(!ta.late);
+
+	// Rescheduling to never is the same as canceling.
+	nni_timer_schedule(&ta.node, nng_clock() + 10);
+	nni_timer_schedule(&ta.node, NNI_TIME_NEVER);
+	nng_msleep(50);
+	TEST_CHECK(fired == 1);
+
+	nni_timer_cancel(&ta.node);
+	nni_timer_fini(&ta.node);
+	nng_cv_free(ta.cv);
+	nng_mtx_free(ta.mtx);
+}
+
+void
+test_timer_order(void)
+{
+	timer_arg ta[100];
+	int       order[100];
+	int       fired = 0;
+	nng_mtx * mtx;
+	nng_cv *  cv;
+	nng_time  now;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nng_mtx_alloc(&mtx));
+	TEST_NNG_PASS(nng_cv_alloc(&cv, mtx));
+
+	now = nng_clock();
+	for (int i = 0; i < 100; i++) {
+		memset(&ta[i], 0, sizeof(ta[i]));
+		ta[i].mtx   = mtx;
+		ta[i].cv    = cv;
+		ta[i].fired = &fired;
+		ta[i].order = order;
+		ta[i].index = i;
+		ta[i].when  = now + 20 + (i * 37) % 200;
+		nni_timer_init(&ta[i].node, timer_cb, &ta[i]);
+	}
+	nng_mtx_lock(mtx);
+	for (int i = 0; i < 100; i++) {
+		nni_timer_schedule(&ta[i].node, ta[i].when);
+	}
+	nng_mtx_unlock(mtx);
+	timer_wait_fired(&ta[0], 100);
+
+	TEST_CHECK(fired == 100);
+	for (int i = 0; i < 100; i++) {
+		TEST_CHECK(!ta[i].late);
+		if (i > 0) {
+			TEST_CHECK(ta[order[i - 1]].when <= ta[order[i]].when);
+		}
+		nni_timer_fini(&ta[i].node);
+	}
+	nng_cv_free(cv);
+	nng_mtx_free(mtx);
+}
+
+void
+test_timer_cancel_active(void)
+{
+	timer_arg ta;
+	int       fired = 0;
+
+	TEST_NNG_PASS(nni_init());
+	memset(&ta, 0, sizeof(ta));
+	TEST_NNG_PASS(nng_mtx_alloc(&ta.mtx));
+	TEST_NNG_PASS(nng_cv_alloc(&ta.cv, ta.mtx));
+	ta.fired = &fired;
+	ta.busy  = 200;
+	nni_timer_init(&ta.node, timer_cb, &ta);
+
+	ta.when = nng_clock();
+	nni_timer_schedule(&ta.node, ta.when);
+	nng_msleep(50);
+
+	// Cancel must wait for the running callback to finish.
+	nni_timer_cancel(&ta.node);
+	nng_mtx_lock(ta.mtx);
+	TEST_CHECK(fired == 1);
+	nng_mtx_unlock(ta.mtx);
+
+	nni_timer_fini(&ta.node);
+	nng_cv_free(ta.cv);
+	nng_mtx_free(ta.mtx);
+}
+
+void
+test_timer_stress(void)
+{
+	timer_arg *ta;
+	int *      perm;
+	int        fired = 0;
+	nng_mtx *  mtx;
+	nng_cv *   cv;
+	nng_time   now;
+	nng_time   start;
+
+	TEST_NNG_PASS(nni_init());
+	TEST_NNG_PASS(nng_mtx_alloc(&mtx));
+	TEST_NNG_PASS(nng_cv_alloc(&cv, mtx));
+	TEST_ASSERT((ta = calloc(NTIMERS, sizeof(*ta))) != NULL);
+	TEST_ASSERT((perm = calloc(NTIMERS, sizeof(int))) != NULL);
+
+	srand(1);
+	now = nng_clock();
+	for (int i = 0; i < NTIMERS; i++) {
+		ta[i].mtx   = mtx;
+		ta[i].cv    = cv;
+		ta[i].fired = &fired;
+		ta[i].index = i;
+		// Far enough out that none of these should ever fire.
+		ta[i].when = now + 3600000 + (rand() % 3600000);
+		nni_timer_init(&ta[i].node, timer_cb, &ta[i]);
+		perm[i] = i;
+	}
+	for (int i = NTIMERS - 1; i > 0; i--) {
+		int j   = rand() % (i + 1);
+		int t   = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+
+	start = nng_clock();
+	for (int i = 0; i < NTIMERS; i++) {
+		nni_timer_schedule(&ta[i].node, ta[i].when);
+	}
+	// Reschedule a portion, some earlier and some later.
+	for (int i = 0; i < NTIMERS; i += 3) {
+		ta[perm[i]].when += (i & 1) ? 1000 : -1000;
+		nni_timer_schedule(&ta[perm[i]].node, ta[perm[i]].when);
+	}
+	for (int i = 0; i < NTIMERS; i++) {
+		nni_timer_cancel(&ta[perm[i]].node);
+	}
+	TEST_CHECK(nng_clock() - start < 60000);
+	TEST_MSG("took %d msec", (int) (nng_clock() - start));
+
+	nng_mtx_lock(mtx);
+	TEST_CHECK(fired == 0);
+	nng_mtx_unlock(mtx);
+
+	// Make sure the timer still works after all that.
+	ta[0].when = nng_clock() + 10;
+	nni_timer_schedule(&ta[0].node, ta[0].when);
+	timer_wait_fired(&ta[0], 1);
+	TEST_CHECK(fired == 1);
+	TEST_CHECK(!ta[0].late);
+
+	for (int i = 0; i < NTIMERS; i++) {
+		nni_timer_fini(&ta[i].node);
+	}
+	free(perm);
+	free(ta);
+	nng_cv_free(cv);
+	nng_mtx_free(mtx);
+}
+
+TEST_LIST = {
+	{ "timer fires", test_timer_fires },
+	{ "timer order", test_timer_order },
+	{ "timer cancel active", test_timer_cancel_active },
+	{ "timer stress", test_timer_stress },
+	{ NULL, NULL },
+};
@@ -279,7 +279,7 @@ trantest_send_recv(trantest *tt)
 		So(nng_recvmsg(tt->reqsock, &recv, 0) == 0);
 		So(recv != NULL);
 		So(nng_msg_len(recv) == strlen("acknowledge"));
-		So(strcmp(nng_msg_body(recv), "acknowledge") == 0);
+		So(memcmp(nng_msg_body(recv), "acknowledge", len) == 0);
 		p = nng_msg_get_pipe(recv);
 		So(nng_pipe_id(p) > 0);
 		So(nng_pipe_getopt_string(p, NNG_OPT_URL, &url) == 0);
@@ -372,7 +372,7 @@ trantest_check_properties(trantest *tt, trantest_proptest_t f)
 		So(nng_recvmsg(tt->repsock, &recv, 0) == 0);
 		So(recv != NULL);
 		So(nng_msg_len(recv) == 5);
-		So(strcmp(nng_msg_body(recv), "props") == 0);
+		So(memcmp(nng_msg_body(recv), "props", 5) == 0);
 		rv = f(recv);
 		nng_msg_free(recv);
 		So(rv == 0);
@@ -18,6 +18,11 @@
 #include "core/nng_impl.h"
 #include "trantest.h"
 
+// For the batch test: more than one batch, with a bad address in the
+// middle of the sends.
+#define NOPS 150
+#define BAD 70
+
 TestMain("UDP support", {
 	nni_init();
 	atexit(nng_fini);
@@ -191,6 +196,67 @@ TestMain("UDP support", {
 			nng_aio_free(aio4);
 		});
 
+		Convey("Many operations work in batches", {
+			nng_aio *    saio[NOPS];
+			nng_aio *    raio[NOPS];
+			nng_iov      iov;
+			uint32_t     sval[NOPS];
+			uint32_t     rval[NOPS];
+			nng_sockaddr to;
+			nng_sockaddr from[NOPS];
+
+			to = sa2;
+			for (int i = 0; i < NOPS; i++) {
+				So(nng_aio_alloc(&saio[i], NULL, NULL) == 0);
+				So(nng_aio_alloc(&raio[i], NULL, NULL) == 0);
+				sval[i]     = (uint32_t) i;
+				rval[i]     = 0xffffffffu;
+				iov.iov_buf = &sval[i];
+				iov.iov_len = sizeof(sval[i]);
+				So(nng_aio_set_iov(saio[i], 1, &iov) == 0);
+				if (i != BAD) {
+					nng_aio_set_input(saio[i], 0, &to);
+				}
+				iov.iov_buf = &rval[i];
+				iov.iov_len = sizeof(rval[i]);
+				So(nng_aio_set_iov(raio[i], 1, &iov) == 0);
+				nng_aio_set_input(raio[i], 0, &from[i]);
+				nng_aio_set_timeout(raio[i], 5000);
+			}
+			for (int i = 0; i < NOPS; i++) {
+				nni_plat_udp_recv(u2, raio[i]);
+			}
+			for (int i = 0; i < NOPS; i++) {
+				nni_plat_udp_send(u1, saio[i]);
+			}
+			for (int i = 0; i < NOPS; i++) {
+				nng_aio_wait(saio[i]);
+				if (i == BAD) {
+					So(nng_aio_result(saio[i]) ==
+					    NNG_EADDRINVAL);
+				} else {
+					So(nng_aio_result(saio[i]) == 0);
+					So(nng_aio_count(saio[i]) == 4);
+				}
+			}
+			for (int i = 0; i < NOPS - 1; i++) {
+				nng_aio_wait(raio[i]);
+				So(nng_aio_result(raio[i]) == 0);
+				So(nng_aio_count(raio[i]) == 4);
+				So(rval[i] == (uint32_t)(i < BAD ? i : i + 1));
+				So(from[i].s_in.sa_port == sa1.s_in.sa_port);
+			}
+			// The last one never gets anything.
+			nng_aio_cancel(raio[NOPS - 1]);
+			nng_aio_wait(raio[NOPS - 1]);
+			So(nng_aio_result(raio[NOPS - 1]) == NNG_ECANCELED);
+
+			for (int i = 0; i < NOPS; i++) {
+				nng_aio_free(saio[i]);
+				nng_aio_free(raio[i]);
+			}
+		});
+
 		Convey("Sending without an address fails", {
 			nng_aio *aio1;
 			char *   msg = "nope";